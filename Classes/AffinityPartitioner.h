@@ -0,0 +1,114 @@
+#ifndef AFFINITYPARTITIONER_H
+#define AFFINITYPARTITIONER_H
+
+#include "ThreadPool.h"
+
+#include <atomic>
+
+// parallelFor cuts [0,n) into the same ranges every frame, but which thread
+// runs which range is whoever gets to the WorkOrder first: a range that was
+// processed on core 2 last frame is as likely as not to land on core 0 this
+// frame, and its vertices, still sitting in core 2's cache, get fetched all
+// over again from memory.
+//
+// An AffinityPartitioner REMEMBERS who ran each range and sends it back to
+// the same thread next time:
+//
+//   static AffinityPartitioner transformAffinity( "vertex transforms" ) ;
+//   every frame:
+//     transformAffinity.parallelFor( (int)pcVertsA.size(), JOBSIZE, []( int startVert, int endVert ) {
+//       processVertices( &pcVertsA, &pcVertsA, startVert, endVert ) ;
+//     } ) ;
+//
+// Each range goes out TWICE: into the inbox of the thread that ran it last
+// time (ThreadPool::addJobForThread, which a worker checks before anything
+// else), and into a shared WorkOrder.  Whichever copy runs first CLAIMS the
+// range, the other finds it taken and does nothing.  So each thread works
+// through its own ranges first, and only a thread that's run out of its own
+// (it was given less, or the others are behind) takes from the shared
+// WorkOrder: it STEALS only when there's an imbalance.  Ranges run by the
+// main thread last time it runs itself, before it helps with the rest.
+//
+// The first call has nothing to go on, so it's an ordinary parallelFor that
+// notes who ran what.  Changing n or grain starts over.
+//
+// It's a sequence point, like parallelFor: it returns with every range done.
+// Call it on the main thread (anywhere else the ranges just run right there,
+// in order).  One partitioner per loop: it's the same ranges every time that
+// make it pay.
+
+struct AffinityPartitioner ;
+
+// One copy of one range.
+struct AffinityTicket : public Callback
+{
+  AffinityPartitioner* partitioner ;
+  int chunk ;
+
+  AffinityTicket( AffinityPartitioner* iPartitioner, int iChunk ) : partitioner( iPartitioner ), chunk( iChunk ) {}
+  void exec() ;
+} ;
+
+struct AffinityPartitioner
+{
+  string name ;
+
+private:
+  int n, grain, numChunks ;
+  vector<Thread*> owners ;   // who ran each range last, 0 for nobody yet
+  atomic<int>* claims ;      // the call each range was last claimed in
+  const function<void (int, int)>* body ;
+  atomic<int> call ;         // this call's number, from 1
+  atomic<int> chunksLeft ;   // of this call's
+  atomic<int> ticketsOut ;   // copies posted, not yet run (a lost claim stays in its inbox until then)
+
+  // This call's ranges: run by the thread that ran them last, run by another, run for the first time
+  atomic<int> ranByOwner, ranStolen, ranUnowned ;
+  int lastByOwner, lastStolen, lastUnowned ;
+  long long totalByOwner, totalChunks ;
+
+  // Copying forbidden (the tickets point at it)
+  AffinityPartitioner( const AffinityPartitioner& o ) {
+    puts( "ERROR: Copying AffinityPartitioner should not be done!" ) ;
+  }
+
+  void waitForTickets() ;
+
+public:
+  AffinityPartitioner( const string& iName ) : name( iName ), n( 0 ), grain( 0 ), numChunks( 0 ), claims( 0 ),
+    body( 0 ), call( 0 ), chunksLeft( 0 ), ticketsOut( 0 ), ranByOwner( 0 ), ranStolen( 0 ), ranUnowned( 0 ),
+    lastByOwner( 0 ), lastStolen( 0 ), lastUnowned( 0 ), totalByOwner( 0 ), totalChunks( 0 ) {}
+  ~AffinityPartitioner() ;
+
+  // body( start, end ) over [0,n) in ranges of `grain` (like parallelFor),
+  // each range to the thread that ran it last time.
+  void parallelFor( int iN, int iGrain, const function<void (int, int)>& iBody ) ;
+
+  // Forget who ran what (the next call is an ordinary parallelFor).
+  void reset() ;
+
+  // Internal: claims the range and runs it, false if it was already taken this call.
+  bool runChunk( int chunk ) ;
+  void ticketDone() { ticketsOut-- ; }
+
+  // Last call's ranges, by where they ran
+  int getLastByOwner() const { return lastByOwner ; }
+  int getLastStolen() const { return lastStolen ; }
+  int getLastUnowned() const { return lastUnowned ; }
+  // Of all the ranges run so far, the fraction that went back to the thread that ran them before
+  double affinityRate() const { return totalChunks ? (double)totalByOwner/totalChunks : 0.0 ; }
+  void print() const ;
+} ;
+
+// Many calls with a different body each time, and n and grain changed
+// partway: checks every index is run exactly once per call, and that a
+// change of ranges starts over.  Main thread, pool up.  Returns # failures.
+int testAffinityPartitioner() ;
+
+// Frames over working sets of 32KB per thread up to `maxKBPerThread`, plain
+// parallelFor against an AffinityPartitioner: the time per frame, and the
+// fraction of ranges that went back to the thread (so the cache) that had
+// them last frame.  Main thread, pool up.
+void benchmarkAffinityPartitioner( int maxKBPerThread ) ;
+
+#endif
@@ -0,0 +1,250 @@
+#import "AffinityPartitioner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sched.h>
+
+void AffinityTicket::exec()
+{
+  partitioner->runChunk( chunk ) ;
+  partitioner->ticketDone() ; // the last it touches the partitioner
+}
+
+AffinityPartitioner::~AffinityPartitioner()
+{
+  waitForTickets() ;
+  delete [] claims ;
+}
+
+// Copies that lost their claim can still be sitting in an inbox, and they
+// point at us and at `claims`.  Their threads were woken when they were
+// posted, so they'll be along.
+void AffinityPartitioner::waitForTickets()
+{
+  while( threadPool && ticketsOut )
+    sched_yield() ;
+}
+
+void AffinityPartitioner::reset()
+{
+  waitForTickets() ;
+  owners.assign( numChunks, 0 ) ;
+}
+
+bool AffinityPartitioner::runChunk( int chunk )
+{
+  // `call` only goes up, so a copy left over from an older call (it read the
+  // old number) never takes a range from this one.
+  int thisCall = call ;
+  int claimedIn = claims[ chunk ] ;
+  if( claimedIn >= thisCall || !claims[ chunk ].compare_exchange_strong( claimedIn, thisCall ) )
+    return false ;
+
+  Thread *me = threadPool->getMe() ;
+  if( !owners[ chunk ] )  ranUnowned++ ;
+  else if( owners[ chunk ] == me )  ranByOwner++ ;
+  else  ranStolen++ ;
+  owners[ chunk ] = me ;
+
+  int start = chunk*grain ;
+  (*body)( start, min( n, start + grain ) ) ;
+  chunksLeft-- ;
+  return true ;
+}
+
+void AffinityPartitioner::parallelFor( int iN, int iGrain, const function<void (int, int)>& iBody )
+{
+  if( iGrain < 1 )  iGrain = 1 ;
+
+  // Only the main thread can block on a sequence point.
+  if( !threadPool || ![NSThread isMainThread] ) {
+    for( int start = 0 ; start < iN ; start += iGrain )
+      iBody( start, min( iN, start + iGrain ) ) ;
+    return ;
+  }
+
+  Thread *mainThread = threadPool->getMainThread() ;
+  vector<int> mainChunks ; // what the main thread ran last time
+  {
+    PhaseTimer timer( PhaseSubmit ) ;
+    if( iN != n || iGrain != grain )
+    {
+      // Different ranges: who ran the old ones says nothing.
+      waitForTickets() ;
+      n = iN ;
+      grain = iGrain ;
+      numChunks = ( n + grain - 1 ) / grain ;
+      delete [] claims ;
+      claims = new atomic<int>[ numChunks ] ;
+      for( int c = 0 ; c < numChunks ; c++ )
+        claims[ c ] = 0 ;
+      owners.assign( numChunks, 0 ) ;
+    }
+    if( !numChunks )
+      return ;
+
+    // The shared WorkOrder has the ranges nobody's run before first, so a
+    // thread that's done its own takes those before it takes someone else's.
+    WorkOrder *wo = new WorkOrder( name ) ;
+    vector< pair<Thread*, AffinityTicket*> > mail ;
+    for( int c = 0 ; c < numChunks ; c++ )
+      if( !owners[ c ] )
+        wo->addJob( new AffinityTicket( this, c ) ) ;
+    for( int c = 0 ; c < numChunks ; c++ )
+    {
+      Thread *owner = owners[ c ] ;
+      if( !owner )  continue ;
+      wo->addJob( new AffinityTicket( this, c ) ) ;
+      if( owner == mainThread )
+        mainChunks.push_back( c ) ;
+      else
+        mail.push_back( make_pair( owner, new AffinityTicket( this, c ) ) ) ;
+    }
+
+    // Everything the copies read, and all the owners read, before `call`
+    // lets them claim: a copy left in an inbox from last time can run any moment.
+    body = &iBody ;
+    chunksLeft = numChunks ;
+    ranByOwner = ranStolen = ranUnowned = 0 ;
+    ticketsOut += numChunks + (int)mail.size() ;
+    call++ ;
+
+    // Each thread woken once for all its ranges, not once per range.
+    vector<Thread*> woken ;
+    for( pair<Thread*, AffinityTicket*>& m : mail ) {
+      m.first->post( m.second ) ;
+      if( find( woken.begin(), woken.end(), m.first ) == woken.end() )
+        woken.push_back( m.first ) ;
+    }
+    for( Thread* t : woken )
+      t->jobWaiting() ;
+    threadPool->startWorkOrder( wo ) ;
+  }
+
+  // The main thread's own first, then it helps with whatever's left.
+  for( int c : mainChunks )
+    runChunk( c ) ;
+  threadPool->sequencePoint( 0 ) ;
+  // The inbox copies aren't in the WorkOrder.  Asleep workers mean they've
+  // all been run, but a range a worker claimed is only done when it says so.
+  while( chunksLeft )
+    sched_yield() ;
+
+  lastByOwner = ranByOwner ;
+  lastStolen = ranStolen ;
+  lastUnowned = ranUnowned ;
+  totalByOwner += lastByOwner ;
+  totalChunks += numChunks ;
+}
+
+void AffinityPartitioner::print() const
+{
+  printf( "AffinityPartitioner `%s`: %d ranges, last call %d back to their thread, %d stolen, %d new.  %.1f%% back overall\n",
+    name.c_str(), numChunks, lastByOwner, lastStolen, lastUnowned, 100.0*affinityRate() ) ;
+}
+
+// TEST & BENCHMARK //
+
+int testAffinityPartitioner()
+{
+  int failures = 0 ;
+  puts( "testAffinityPartitioner" ) ;
+
+  AffinityPartitioner affinity( "affinity test" ) ;
+  const int numCalls = 200 ;
+  int n = 10000, grain = 300 ;
+  vector<int> runs( 20000, 0 ), stamps( 20000, 0 ) ;
+  int wrongRuns = 0, wrongStamps = 0, wrongTotals = 0, wrongStarts = 0 ;
+  for( int call = 1 ; call <= numCalls ; call++ )
+  {
+    // NEW RANGES halfway: more of them, smaller
+    bool changed = call == 1 || call == numCalls/2 ;
+    if( call == numCalls/2 ) {
+      n = 20000 ;
+      grain = 128 ;
+    }
+    int *r = &runs[0], *s = &stamps[0] ;
+    affinity.parallelFor( n, grain, [r, s, call]( int start, int end ) {
+      for( int i = start ; i < end ; i++ ) {
+        r[i]++ ; // a range run twice would race here too
+        s[i] = call ;
+      }
+    } ) ;
+    for( int i = 0 ; i < n ; i++ ) {
+      wrongRuns += runs[i] != 1 ;
+      wrongStamps += stamps[i] != call ;
+      runs[i] = 0 ;
+    }
+    int numChunks = ( n + grain - 1 ) / grain ;
+    wrongTotals += affinity.getLastByOwner() + affinity.getLastStolen() + affinity.getLastUnowned() != numChunks ;
+    wrongStarts += changed ? affinity.getLastUnowned() != numChunks : affinity.getLastUnowned() != 0 ;
+  }
+
+  bool ok = !wrongRuns && !wrongStamps ;
+  printf( "  %-52s %s\n", "every index once per call, with that call's body", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  ok = !wrongTotals && !wrongStarts ;
+  printf( "  %-52s %s\n", "every range counted, new ranges start over", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  affinity.print() ;
+
+  printf( "testAffinityPartitioner: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
+
+// iOS gives an app no cache counters, so the L2 hits aren't counted here:
+// what's printed is the fraction of ranges that went back to the thread that
+// had them last frame, the ones whose data can still be in that core's
+// cache.  The hits and misses themselves are in Instruments (Counters).
+void benchmarkAffinityPartitioner( int maxKBPerThread )
+{
+  int numThreads = threadPool->getNumWorkers() + 1 ;
+  printf( "benchmarkAffinityPartitioner: %d threads\n", numThreads ) ;
+  puts( "  KB/thread   frames   parallelFor ms/frame  same thread    affinity ms/frame  same thread   speedup" ) ;
+  for( int kb = 32 ; kb <= maxKBPerThread ; kb *= 2 )
+  {
+    // 4 ranges per thread.  One pass over each per frame, like processVertices.
+    int n = kb*1024/(int)sizeof( float ) * numThreads ;
+    int grain = max( 1, n / ( 4*numThreads ) ) ;
+    int numChunks = ( n + grain - 1 ) / grain ;
+    int frames = max( 20, (int)( 256LL*1024*1024 / ( (long long)n*sizeof( float ) ) ) ) ; // the same bytes for every size
+    vector<float> data( n, 1.f ) ;
+    float *d = &data[0] ;
+    auto transform = [d]( int start, int end ) {
+      for( int i = start ; i < end ; i++ )
+        d[i] = d[i]*0.999f + 0.001f ;
+    } ;
+
+    // Plain parallelFor, noting the thread each range lands on
+    vector<int> lastThread( numChunks, -1 ) ;
+    atomic<int> sameThread( 0 ) ;
+    int *last = &lastThread[0] ;
+    auto tracked = [&transform, &sameThread, last, grain]( int start, int end ) {
+      int me = threadIndex() ;
+      if( last[ start/grain ] == me )  sameThread++ ;
+      last[ start/grain ] = me ;
+      transform( start, end ) ;
+    } ;
+    threadPool->parallelFor( "affinity benchmark", n, grain, tracked ) ; // warm
+    sameThread = 0 ;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+    for( int f = 0 ; f < frames ; f++ )
+      threadPool->parallelFor( "affinity benchmark", n, grain, tracked ) ;
+    double plain = chrono::duration<double>( chrono::steady_clock::now() - start ).count() / frames ;
+    double plainSame = (double)sameThread / ( (double)frames*numChunks ) ;
+
+    AffinityPartitioner affinity( "affinity benchmark" ) ;
+    affinity.parallelFor( n, grain, transform ) ; // warm, and who runs what
+    long long byOwner = 0 ;
+    start = chrono::steady_clock::now() ;
+    for( int f = 0 ; f < frames ; f++ ) {
+      affinity.parallelFor( n, grain, transform ) ;
+      byOwner += affinity.getLastByOwner() ;
+    }
+    double affine = chrono::duration<double>( chrono::steady_clock::now() - start ).count() / frames ;
+    double affineSame = (double)byOwner / ( (double)frames*numChunks ) ;
+
+    printf( "  %9d %8d %21.3f %11.0f%% %20.3f %11.0f%% %8.2fx\n", kb, frames, plain*1e3, 100.0*plainSame,
+      affine*1e3, 100.0*affineSame, plain / affine ) ;
+  }
+}
@@ -24,9 +24,22 @@ using namespace std ;
 struct Callback
 {
   virtual void exec() = 0 ;
+  // Called instead of exec() when the job is thrown away without running
+  // (its WorkOrder was cancelled), right before it's deleted.
+  virtual void drop() {}
+  // Whoever runs a job deletes it afterwards (retire()), unless it's KEPT:
+  // its owner runs the same one again and again (a JobGraph's, see JobGraph.h).
+  virtual bool isKept() const { return false ; }
   virtual ~Callback() {}
 } ;
 
+// After exec(): gone, unless it's kept.
+inline void retire( Callback* job )
+{
+  if( !job->isKept() )
+    delete job ;
+}
+
 struct TimedCallback
 {
   Callback* callback ;
@@ -0,0 +1,255 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#import "ThreadPool.h"
+
+// Multi step async logic ("load this, then process it on the workers, then
+// upload it on the main thread") written straight down, instead of as
+// Callbacks daisy-chained through each other:
+//
+//   Task<int> loadLevel()
+//   {
+//     co_await threadPool->schedule() ;      // now on a worker
+//     Level* level = parse( file ) ;
+//
+//     WorkOrder wo( "build meshes" ) ;       // the jobs run on the pool...
+//     for( Mesh& m : level->meshes )
+//       wo.addJob( new Callback0( [&m](){ m.build() ; } ) ) ;
+//     co_await wo ;                          // ...and we carry on when they've ALL finished
+//
+//     co_await threadPool->toMainThread() ;  // GL calls, main thread only
+//     level->upload() ;
+//     co_return level->numMeshes() ;
+//   }
+//
+//   spawn( loadLevel() ) ;  // from anywhere, doesn't wait
+//
+// NOTHING BLOCKS while waiting: a coroutine that co_awaits is suspended,
+// its thread goes back to running jobs (or drawing), and whoever finishes
+// the thing it waited on resumes it.
+//
+//   co_await threadPool->schedule()      Resumes as a job in a new WorkOrder,
+//                                        so behind anything already queued.
+//   co_await threadPool->toMainThread()  Resumes in the next mainThreadRunJobs()
+//                                        (runFrame calls it every frame).
+//   co_await wo                          Takes the jobs out of `wo` (don't startWorkOrder
+//                                        it yourself), starts them as a WorkOrder of the
+//                                        same name, and resumes on the thread that finishes
+//                                        the last one (see WorkOrder::whenDone).  `wo` can
+//                                        be on the stack, it's empty afterward.
+//   co_await someTask                    Runs it, resumes with its result.
+//
+// Task<T> is LAZY: calling a Task function makes the frame and stops, it
+// starts when it's co_awaited (or spawn()ed).  Because of that:
+//   - co_await of a Task and a Task finishing both jump straight to the other
+//     coroutine (symmetric transfer), so a chain of a million co_awaits of
+//     tasks that finish right away doesn't grow the stack.  clang makes that
+//     jump a tail call at every -O level; gcc only when optimizing (-O2).
+//   - a Task that's created and co_awaited in the same expression lives entirely
+//     inside its caller's lifetime, which is what lets the compiler put its frame
+//     in the caller's frame and skip the allocation (HALO).  Whether it does is
+//     up to the compiler (clang at -O2 usually does for non-virtual, inlinable calls).
+//
+// Only built as C++20 (see THREADEN_COROUTINES).  Threaden.xcodeproj builds
+// C++0x for iOS 6.1, so in the app all of this is compiled out: it's for
+// builds with a C++20 toolchain (and a deployment target with <coroutine>).
+// Exceptions aren't used in this code base: one escaping a coroutine is
+// reported and terminates.
+
+#if THREADEN_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// ThreadPool::schedule()
+struct ScheduleAwaiter
+{
+  ThreadPool* pool ;
+  bool await_ready() const noexcept { return false ; }
+  void await_suspend( coroutine_handle<> h ) ;
+  void await_resume() const noexcept {}
+} ;
+
+// ThreadPool::toMainThread().  Already there?  Carries straight on.
+struct MainThreadAwaiter
+{
+  ThreadPool* pool ;
+  bool await_ready() const noexcept ;
+  void await_suspend( coroutine_handle<> h ) ;
+  void await_resume() const noexcept {}
+} ;
+
+inline ScheduleAwaiter ThreadPool::schedule() { return ScheduleAwaiter{ this } ; }
+inline MainThreadAwaiter ThreadPool::toMainThread() { return MainThreadAwaiter{ this } ; }
+
+// co_await wo
+struct WorkOrderAwaiter
+{
+  WorkOrder* wo ;
+  bool await_ready() const noexcept { return false ; }
+  void await_suspend( coroutine_handle<> h ) ;
+  void await_resume() const noexcept {}
+} ;
+
+WorkOrderAwaiter operator co_await( WorkOrder& wo ) ;
+
+// TASK //
+
+template <typename T> struct Task ;
+
+struct TaskPromiseBase
+{
+  coroutine_handle<> continuation ; // who co_awaited us, resumed when we finish
+
+  // Resumes the continuation directly (returning it = symmetric transfer).
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false ; }
+    template <typename Promise>
+    coroutine_handle<> await_suspend( coroutine_handle<Promise> h ) noexcept {
+      coroutine_handle<> c = h.promise().continuation ;
+      return c ? c : noop_coroutine() ;
+    }
+    void await_resume() const noexcept {}
+  } ;
+
+  suspend_always initial_suspend() const noexcept { return {} ; } // lazy
+  FinalAwaiter final_suspend() const noexcept { return {} ; }
+  void unhandled_exception() const noexcept {
+    puts( "ERROR: An exception escaped a Task. Terminating." ) ;
+    terminate() ;
+  }
+} ;
+
+template <typename T>
+struct TaskPromise : public TaskPromiseBase
+{
+  optional<T> result ;
+  Task<T> get_return_object() noexcept ;
+  template <typename U> void return_value( U&& value ) { result.emplace( std::forward<U>( value ) ) ; }
+  T take() { return std::move( *result ) ; }
+} ;
+
+template <>
+struct TaskPromise<void> : public TaskPromiseBase
+{
+  Task<void> get_return_object() noexcept ;
+  void return_void() const noexcept {}
+  void take() const noexcept {}
+} ;
+
+template <typename T = void>
+struct Task
+{
+  typedef TaskPromise<T> promise_type ;
+  coroutine_handle<promise_type> handle ;
+
+private:
+  // Copying forbidden: two Tasks would destroy the same frame.
+  Task( const Task& o ) {
+    puts( "ERROR: Copying Tasks should not be done!" ) ;
+  }
+
+public:
+  explicit Task( coroutine_handle<promise_type> h ) noexcept : handle( h ) {}
+  Task( Task&& o ) noexcept : handle( o.handle ) { o.handle = nullptr ; }
+  ~Task() {
+    if( handle )  handle.destroy() ;
+  }
+
+  bool isDone() const { return !handle || handle.done() ; }
+
+  struct Awaiter
+  {
+    coroutine_handle<promise_type> handle ;
+    bool await_ready() const noexcept { return !handle || handle.done() ; }
+    coroutine_handle<> await_suspend( coroutine_handle<> caller ) noexcept {
+      handle.promise().continuation = caller ;
+      return handle ; // start it, right here (symmetric transfer)
+    }
+    T await_resume() { return handle.promise().take() ; }
+  } ;
+  Awaiter operator co_await() && noexcept { return Awaiter{ handle } ; }
+  Awaiter operator co_await() & noexcept { return Awaiter{ handle } ; }
+} ;
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+  return Task<T>( coroutine_handle<TaskPromise<T>>::from_promise( *this ) ) ;
+}
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+  return Task<void>( coroutine_handle<TaskPromise<void>>::from_promise( *this ) ) ;
+}
+
+// SPAWN //
+
+// Fire and forget: a coroutine that starts right away and frees itself when it ends.
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object() const noexcept { return {} ; }
+    suspend_never initial_suspend() const noexcept { return {} ; }
+    suspend_never final_suspend() const noexcept { return {} ; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept {
+      puts( "ERROR: An exception escaped a spawned Task. Terminating." ) ;
+      terminate() ;
+    }
+  } ;
+} ;
+
+// Starts `task` on the calling thread (up to its first co_await) and
+// returns; it runs the rest of the way as whatever it awaited finishes.
+// Any result is dropped.
+template <typename T>
+Detached spawn( Task<T> task ) { co_await std::move( task ) ; }
+
+// For the main thread, when it really has nothing else to do (loading screens,
+// tests): starts `task` and keeps running the pool's jobs and the main thread
+// jobs until it's done.  The main thread works the whole time, it doesn't sleep.
+template <typename T>
+T mainThreadRun( Task<T> task )
+{
+  optional<T> result ;
+  LockCounter finished ;
+  auto wrapper = [&]() -> Task<void> {
+    result.emplace( co_await std::move( task ) ) ;
+    finished.write( 1 ) ;
+  } ;
+  spawn( wrapper() ) ;
+  while( !finished.read() ) {
+    threadPool->mainThreadRunJobs() ;
+    threadPool->runJobs() ;
+  }
+  return std::move( *result ) ;
+}
+
+template <>
+inline void mainThreadRun( Task<void> task )
+{
+  LockCounter finished ;
+  auto wrapper = [&]() -> Task<void> {
+    co_await std::move( task ) ;
+    finished.write( 1 ) ;
+  } ;
+  spawn( wrapper() ) ;
+  while( !finished.read() ) {
+    threadPool->mainThreadRunJobs() ;
+    threadPool->runJobs() ;
+  }
+}
+
+#endif // THREADEN_COROUTINES
+
+// Hops between the workers and the main thread, co_awaits WorkOrders and
+// nested Tasks (a long chain of them, for the stack), and checks which
+// thread each step ran on and that all the work got done.  Main thread,
+// with the pool up.  Prints it, returns # failures.  When not built as
+// C++20 there's nothing to test: it prints a SKIPPED line (so that doesn't
+// pass for a PASS) and returns 0.
+int testCoroutines() ;
+
+#endif
@@ -0,0 +1,180 @@
+#import "Coroutine.h"
+
+#if THREADEN_COROUTINES
+
+#include <atomic>
+#include <chrono>
+#include <sched.h>
+
+void ScheduleAwaiter::await_suspend( coroutine_handle<> h )
+{
+  WorkOrder *wo = new WorkOrder( "co_await schedule" ) ;
+  wo->addJob( new Callback0( [h](){ h.resume() ; } ) ) ;
+  pool->startWorkOrder( wo ) ;
+}
+
+bool MainThreadAwaiter::await_ready() const noexcept
+{
+  return [NSThread isMainThread] ;
+}
+
+void MainThreadAwaiter::await_suspend( coroutine_handle<> h )
+{
+  pool->addJobForMainThread( new Callback0( [h](){ h.resume() ; } ) ) ;
+}
+
+void WorkOrderAwaiter::await_suspend( coroutine_handle<> h )
+{
+  // Its jobs go into one the pool owns (it deletes them when they're taken),
+  // so `wo` itself can be anywhere.
+  WorkOrder *started = new WorkOrder( wo->name ) ;
+  pthread_mutex_lock( &wo->mutexJob ) ;
+  started->jobs.swap( wo->jobs ) ;
+  pthread_mutex_unlock( &wo->mutexJob ) ;
+  
+  // whenDone runs on whoever finishes the last job, and just resumes us there.
+  started->whenDone( new Callback0( [h](){ h.resume() ; } ) ) ;
+  threadPool->startWorkOrder( started ) ;
+}
+
+WorkOrderAwaiter operator co_await( WorkOrder& wo )
+{
+  return WorkOrderAwaiter{ &wo } ;
+}
+
+// TEST //
+
+static bool onWorker()
+{
+  return ![NSThread isMainThread] ;
+}
+
+static Task<int> ready( int i )
+{
+  co_return i ;
+}
+
+// A long chain of co_awaits that finish right away.  Without symmetric
+// transfer each one would be a nested resume() and this would blow the stack.
+static Task<long long> longChain( int n )
+{
+  long long sum = 0 ;
+  for( int i = 0 ; i < n ; i++ )
+    sum += co_await ready( i ) ;
+  co_return sum ;
+}
+
+static Task<int> fanOut( int numJobs, atomic<int>* jobsRun )
+{
+  WorkOrder wo( "coroutine fan out" ) ;
+  for( int i = 0 ; i < numJobs ; i++ )
+    wo.addJob( new Callback0( [jobsRun](){ ++*jobsRun ; } ) ) ;
+  co_await wo ;
+  // Resumed by whoever ran the last job, and every job has finished by now.
+  co_return jobsRun->load() ;
+}
+
+struct CoroutineTestResults
+{
+  bool scheduledOnWorker, backOnMain, mainAfterWorkOrder ;
+  int jobsSeen ;
+  long long chainSum ;
+} ;
+
+static Task<CoroutineTestResults> hops( int numJobs, int chainLength, atomic<int>* jobsRun )
+{
+  CoroutineTestResults r ;
+  co_await threadPool->schedule() ;
+  r.scheduledOnWorker = onWorker() ;
+  
+  r.jobsSeen = co_await fanOut( numJobs, jobsRun ) ;
+  r.chainSum = co_await longChain( chainLength ) ;
+  
+  co_await threadPool->toMainThread() ;
+  r.backOnMain = !onWorker() ;
+  
+  // co_await a WorkOrder from the main thread, then come back to it.
+  r.jobsSeen += co_await fanOut( numJobs, jobsRun ) ;
+  co_await threadPool->toMainThread() ;
+  r.mainAfterWorkOrder = !onWorker() ;
+  co_return r ;
+}
+
+static int check( const char* what, bool ok )
+{
+  printf( "  %-52s %s\n", what, ok ? "ok" : "FAIL" ) ;
+  return !ok ;
+}
+
+// The main thread ONLY runs its own jobs here, so anything that ran as a
+// pool job ran on a worker.
+static void mainThreadRunJobsUntil( atomic<int>* flag )
+{
+  while( !*flag ) {
+    threadPool->mainThreadRunJobs() ;
+    sched_yield() ;
+  }
+}
+
+static Task<void> runHops( int numJobs, int chainLength, atomic<int>* jobsRun, CoroutineTestResults* r, atomic<int>* done )
+{
+  *r = co_await hops( numJobs, chainLength, jobsRun ) ;
+  *done = 1 ;
+}
+
+int testCoroutines()
+{
+  if( !threadPool || ![NSThread isMainThread] ) {
+    puts( "ERROR: testCoroutines() needs the pool (with worker threads), and the main thread" ) ;
+    return 1 ;
+  }
+  const int numJobs = 1000, chainLength = 1000000 ;
+  printf( "testCoroutines: %d jobs per WorkOrder, chain of %d co_awaits\n", numJobs, chainLength ) ;
+  int failures = 0 ;
+  long long chainSum = (long long)chainLength*( chainLength - 1 )/2 ;
+  
+  atomic<int> jobsRun( 0 ), done( 0 ) ;
+  CoroutineTestResults r ;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  spawn( runHops( numJobs, chainLength, &jobsRun, &r, &done ) ) ;
+  mainThreadRunJobsUntil( &done ) ;
+  double time = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  
+  failures += check( "co_await schedule() resumed on a worker", r.scheduledOnWorker ) ;
+  failures += check( "co_await WorkOrder resumed after all its jobs", r.jobsSeen == numJobs + 2*numJobs ) ;
+  failures += check( "co_await Task chain (symmetric transfer) result", r.chainSum == chainSum ) ;
+  failures += check( "co_await toMainThread() resumed on main", r.backOnMain ) ;
+  failures += check( "main -> WorkOrder -> main", r.mainAfterWorkOrder ) ;
+  printf( "  all the hops: %.2f ms\n", time*1e3 ) ;
+  
+  // Just the chain, on the main thread.  mainThreadRun also helps with the pool's jobs.
+  start = chrono::steady_clock::now() ;
+  long long sum = mainThreadRun( longChain( chainLength ) ) ;
+  time = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  failures += check( "mainThreadRun( Task chain )", sum == chainSum ) ;
+  printf( "  %.1f ns per co_await of a Task that finishes right away\n", time*1e9/chainLength ) ;
+  
+  // Spawned and forgotten.  (The flag is a parameter, not a lambda capture:
+  // the lambda is gone by the time the coroutine finishes, its frame's copy isn't.)
+  atomic<int> spawnedDone( 0 ) ;
+  spawn( []( atomic<int>* flag ) -> Task<void> {
+    co_await threadPool->schedule() ;
+    co_await threadPool->toMainThread() ;
+    *flag = 1 ;
+  }( &spawnedDone ) ) ;
+  mainThreadRunJobsUntil( &spawnedDone ) ;
+  failures += check( "spawn()ed task ran to the end", spawnedDone == 1 ) ;
+  
+  printf( "testCoroutines: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
+
+#else
+
+int testCoroutines()
+{
+  puts( "testCoroutines: SKIPPED, not built as C++20, no coroutines" ) ;
+  return 0 ;
+}
+
+#endif
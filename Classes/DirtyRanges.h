@@ -0,0 +1,95 @@
+#ifndef DIRTYRANGES_H
+#define DIRTYRANGES_H
+
+#include "ThreadPool.h"
+
+#include <limits.h>
+#include <vector>
+using namespace std ;
+
+// The parallel techniques re-process every vertex of pcVertsA every frame,
+// whether or not the object it belongs to moved.
+//
+// A DirtyRanges sits next to a vertex buffer.  Whoever changes vertices in
+// the buffer (game code, a physics job, an animation) marks the range it
+// touched.  The processing pass then take()s the marked ranges and only
+// makes jobs over those.  So the frame costs what changed, not NUMVERTS.
+//
+// mark() can be called from any thread, even while the processing jobs of
+// the last take() are still running.
+
+// [start,end)
+struct VertexRange
+{
+  int start, end ;
+  VertexRange() : start(0), end(0) { }
+  VertexRange( int iStart, int iEnd ) : start(iStart), end(iEnd) { }
+  inline int size() const { return end - start ; }
+} ;
+
+struct DirtyRanges
+{
+  // Two dirty ranges with this many clean vertices or fewer between them
+  // get merged into one.  Re-processing a few clean vertices is cheaper
+  // than the bookkeeping + cache miss of starting a new range, BUT only if
+  // processing a clean vertex changes nothing: a pass that writes
+  // dst = f( src ) from untouched source data.  Passes that transform in
+  // place (processVertices( &pcVertsA, &pcVertsA, ... )) would move the
+  // clean vertices too, so it's 0 unless you set it: only overlapping and
+  // touching ranges merge.
+  int mergeGap ;
+
+private:
+  int numVerts ;
+  vector<VertexRange> marked ; // unsorted, may overlap, as marked
+  pthread_mutex_t mutexMarked ;
+
+  DirtyRanges( const DirtyRanges& o ) {
+    puts( "ERROR: Copying DirtyRanges should not be done!" ) ;
+  }
+
+public:
+  DirtyRanges( int iNumVerts=0 ) : mergeGap( 0 ), numVerts( iNumVerts ) {
+    pthread_mutex_init( &mutexMarked, 0 ) ;
+  }
+  ~DirtyRanges() {
+    pthread_mutex_destroy( &mutexMarked ) ;
+  }
+
+  // Size of the buffer being tracked.  Marks past the end get clipped.
+  void resize( int iNumVerts ) {
+    Lock lock( &mutexMarked ) ;
+    numVerts = iNumVerts ;
+  }
+
+  // Vertices [start,end) changed.
+  void mark( int start, int end ) ;
+
+  // Everything changed (a load, a reset).  mark() clips it to the buffer.
+  void markAll() { mark( 0, INT_MAX ) ; }
+
+  bool isDirty() {
+    Lock lock( &mutexMarked ) ;
+    return !marked.empty() ;
+  }
+
+  // Hands you everything marked since the last take(), sorted and merged
+  // (overlapping, adjacent and closer than mergeGap), and starts over clean.
+  vector<VertexRange> take() ;
+} ;
+
+// Total vertices in a set of ranges
+int countVertices( const vector<VertexRange>& ranges ) ;
+
+// Adds jobs to `wo` that together call process( start, end ) over exactly
+// `ranges`.  Small ranges are packed together and big ones are cut, so each
+// job gets about jobSize vertices: no jobs too small to be worth waking a
+// thread for, none so big that one worker ends up with all the work.
+// Returns the # of jobs added.
+int addDirtyRangeJobs( WorkOrder *wo, const vector<VertexRange>& ranges, int jobSize, const function<void (int, int)>& process ) ;
+
+// Processes (rotates) numVerts vertices, with 1%, 10% and 100% of the
+// objects in it dirty, and prints the time against a full pass.
+void benchmarkDirtyRanges( int numVerts, int reps ) ;
+
+#endif
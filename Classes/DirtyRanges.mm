@@ -0,0 +1,180 @@
+#import "DirtyRanges.h"
+#import "Vectorf.h"
+
+#include <algorithm>
+#include <chrono>
+
+void DirtyRanges::mark( int start, int end )
+{
+  Lock lock( &mutexMarked ) ;
+  if( start < 0 )  start = 0 ;
+  if( end > numVerts )  end = numVerts ;
+  if( start >= end )  return ;
+
+  // Marking the same range (or the next one along) over and over is the
+  // common case, so catch it here instead of growing the list.
+  if( marked.size() ) {
+    VertexRange& last = marked.back() ;
+    if( start <= last.end && end >= last.start ) {
+      last.start = min( last.start, start ) ;
+      last.end = max( last.end, end ) ;
+      return ;
+    }
+  }
+  marked.push_back( VertexRange( start, end ) ) ;
+}
+
+static bool startsBefore( const VertexRange& a, const VertexRange& b )
+{
+  return a.start < b.start ;
+}
+
+vector<VertexRange> DirtyRanges::take()
+{
+  vector<VertexRange> ranges ;
+  pthread_mutex_lock( &mutexMarked ) ;
+  ranges.swap( marked ) ; // marks from now on go in a fresh list
+  pthread_mutex_unlock( &mutexMarked ) ;
+
+  if( ranges.empty() )  return ranges ;
+
+  // COALESCE.  Sort by start, then sweep, merging into the range before.
+  sort( ranges.begin(), ranges.end(), startsBefore ) ;
+  int n = 0 ;
+  for( int i = 1 ; i < (int)ranges.size() ; i++ )
+  {
+    if( ranges[i].start <= ranges[n].end + mergeGap )
+      ranges[n].end = max( ranges[n].end, ranges[i].end ) ;
+    else
+      ranges[++n] = ranges[i] ;
+  }
+  ranges.resize( n+1 ) ;
+  return ranges ;
+}
+
+int countVertices( const vector<VertexRange>& ranges )
+{
+  int total = 0 ;
+  for( const VertexRange& r : ranges )
+    total += r.size() ;
+  return total ;
+}
+
+int addDirtyRangeJobs( WorkOrder *wo, const vector<VertexRange>& ranges, int jobSize, const function<void (int, int)>& process )
+{
+  if( jobSize < 1 )  jobSize = 1 ;
+  int numJobs = 0 ;
+  vector<VertexRange> pieces ; // what the job being packed will do
+  int piecesSize = 0 ;
+
+  for( const VertexRange& r : ranges )
+  {
+    int start = r.start ;
+    while( start < r.end )
+    {
+      int end = min( r.end, start + jobSize - piecesSize ) ;
+      pieces.push_back( VertexRange( start, end ) ) ;
+      piecesSize += end - start ;
+      start = end ;
+
+      if( piecesSize == jobSize )
+      {
+        // process is copied into the job, the caller's can go away.
+        wo->addJob( new Callback0( [pieces, process](){
+          for( const VertexRange& piece : pieces )
+            process( piece.start, piece.end ) ;
+        } ) ) ;
+        numJobs++ ;
+        pieces.clear() ;
+        piecesSize = 0 ;
+      }
+    }
+  }
+
+  if( piecesSize )
+  {
+    wo->addJob( new Callback0( [pieces, process](){
+      for( const VertexRange& piece : pieces )
+        process( piece.start, piece.end ) ;
+    } ) ) ;
+    numJobs++ ;
+  }
+  return numJobs ;
+}
+
+// BENCHMARK //
+
+static void rotateVertices( vector<VertexPC>* verts, const Matrix3f* m, int start, int end )
+{
+  for( int i = start ; i < end ; i++ )
+    (*verts)[i].pos = *m * (*verts)[i].pos ;
+}
+
+// Runs wo on the pool if there is one, else right here.
+static void finish( WorkOrder *wo )
+{
+  if( threadPool ) {
+    threadPool->startWorkOrder( wo ) ;
+    threadPool->sequencePoint( 0 ) ;
+  }
+  else {
+    wo->finishedSubmission() ;
+    wo->runAll() ;
+    delete wo ;
+  }
+}
+
+void benchmarkDirtyRanges( int numVerts, int reps )
+{
+  const int OBJECTSIZE = 64 ; // verts per object, objects move (get dirty) as a whole
+  const int JOBSIZE = 8192 ;
+  int numObjects = numVerts / OBJECTSIZE ;
+  numVerts = numObjects * OBJECTSIZE ;
+
+  vector<VertexPC> verts( numVerts ) ;
+  for( int i = 0 ; i < numVerts ; i++ )
+    verts[i] = VertexPC( Vector3f::random( -1.f, 1.f ), Vector4f::random() ) ;
+  Matrix3f m = Matrix3f::rotation( Vector3f( 0.f, 0.f, 1.f ), 0.01f ) ;
+  function<void (int, int)> process = [&verts, &m]( int start, int end ) { rotateVertices( &verts, &m, start, end ) ; } ;
+
+  // The full pass, what the renderer does every frame now.
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  for( int r = 0 ; r < reps ; r++ ) {
+    WorkOrder *wo = new WorkOrder( "full pass" ) ;
+    for( int i = 0 ; i < numVerts ; i += JOBSIZE )
+      wo->addJob( new Callback4<vector<VertexPC>*, const Matrix3f*, int, int>
+        ( rotateVertices, &verts, &m, i, min( numVerts, i + JOBSIZE ) ) ) ;
+    finish( wo ) ;
+  }
+  double fullTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() / reps ;
+  printf( "benchmarkDirtyRanges: %d verts in %d objects of %d\n", numVerts, numObjects, OBJECTSIZE ) ;
+  printf( "  100%% full pass          %8.3f ms\n", fullTime*1e3 ) ;
+
+  float fractions[] = { 0.01f, 0.1f, 1.f } ;
+  DirtyRanges dirty( numVerts ) ;
+  for( float fraction : fractions )
+  {
+    double time = 0 ;
+    int processed = 0, jobs = 0 ;
+    for( int r = 0 ; r < reps ; r++ )
+    {
+      // Mutators: a different random fraction of the objects moves each frame.
+      Rng rng = jobRng( r ) ;
+      for( int o = 0 ; o < numObjects ; o++ )
+        if( rng.nextFloat() < fraction )
+          dirty.mark( o*OBJECTSIZE, (o+1)*OBJECTSIZE ) ;
+
+      // The processing pass.  take() is in the timing, it's part of the cost.
+      start = chrono::steady_clock::now() ;
+      vector<VertexRange> ranges = dirty.take() ;
+      WorkOrder *wo = new WorkOrder( "dirty pass" ) ;
+      jobs += addDirtyRangeJobs( wo, ranges, JOBSIZE, process ) ;
+      finish( wo ) ;
+      time += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+      processed += countVertices( ranges ) ;
+    }
+    time /= reps ;
+    printf( "  %3d%% dirty  %8d verts %8.3f ms  %5.1f%% of full, %.1f jobs\n", (int)( fraction*100 + 0.5f ),
+      processed/reps, time*1e3, 100*time/fullTime, (float)jobs/reps ) ;
+  }
+}
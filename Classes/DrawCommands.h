@@ -0,0 +1,164 @@
+#ifndef DRAWCOMMANDS_H
+#define DRAWCOMMANDS_H
+
+#import <OpenGLES/ES1/gl.h>
+#import "Vectorf.h"
+#import "DirtyRanges.h" // VertexRange
+
+#include <vector>
+using namespace std ;
+
+// Worker threads can't draw (see parallelProcessAndDrawSameFrame: two
+// contexts can't render into the same framebuffer at once).  But they can
+// work out WHAT to draw.  A DrawCommandList lets jobs RECORD the GL calls
+// they'd make (client state, pointers, glDrawArrays) and the main thread
+// REPLAYS them later, in one go, into GL.
+//
+// ONE BUFFER PER THREAD.  Each thread only ever appends to its own buffer
+// (buffers[ Thread::num ]), so recording takes no lock at all.
+//
+// SUBMISSION ORDER.  Whichever thread a job happens to run on, what it
+// records is tagged with a sequence # the job was given when it was made
+// (its index, usually).  replay() merges the buffers by sequence #, so the
+// draws come out in the order the jobs were submitted, the same every frame,
+// same as if one thread had made all the calls.  Give every job its own #
+// (two jobs with one # replay in whatever order they happened to run in).
+//
+// The backend replay() sends the commands to is GLDrawBackend normally.
+// NullDrawBackend and RecordingDrawBackend make no GL calls at all, for
+// checking and timing the recording without a context.
+//
+// Recorded pointers are just pointers: the vertex data has to stay put until
+// the replay is done.
+//
+// Usage:
+//   list.reset() ;                        // main thread, before the jobs start
+//   ... job i:  DrawCommandBuffer& cb = list.record( i ) ;
+//               cb.drawPC( &verts[0], start, count, GL_LINES ) ;
+//   threadPool->sequencePoint( 0 ) ;
+//   list.replay( glBackend ) ;           // main thread
+
+enum DrawOp
+{
+  DrawOpEnableClientState,  // glEnableClientState( e )
+  DrawOpDisableClientState, // glDisableClientState( e )
+  DrawOpVertexPointer,      // glVertexPointer( size, e, stride, ptr )
+  DrawOpColorPointer,       // glColorPointer( size, e, stride, ptr )
+  DrawOpNormalPointer,      // glNormalPointer( e, stride, ptr )
+  DrawOpDrawArrays          // glDrawArrays( e, first, count )
+} ;
+
+struct DrawCommand
+{
+  int op ;      // DrawOp
+  GLenum e ;    // the array, the type, or the draw mode
+  int size, stride ;  // pointers
+  int first, count ;  // glDrawArrays
+  const void* ptr ;
+
+  DrawCommand() : op( DrawOpDrawArrays ), e( 0 ), size( 0 ), stride( 0 ), first( 0 ), count( 0 ), ptr( 0 ) { }
+
+  bool operator==( const DrawCommand& o ) const {
+    return op == o.op && e == o.e && size == o.size && stride == o.stride &&
+      first == o.first && count == o.count && ptr == o.ptr ;
+  }
+} ;
+
+// Where replay() sends the commands.
+struct DrawBackend
+{
+  virtual ~DrawBackend() { }
+  virtual void exec( const DrawCommand& cmd ) = 0 ;
+} ;
+
+// The real thing.  Main thread only (with the context current).
+struct GLDrawBackend : public DrawBackend
+{
+  void exec( const DrawCommand& cmd ) ;
+} ;
+
+// Throws the commands away, counting them.
+struct NullDrawBackend : public DrawBackend
+{
+  int commands, draws, vertices ;
+  NullDrawBackend() : commands( 0 ), draws( 0 ), vertices( 0 ) { }
+  void exec( const DrawCommand& cmd ) ;
+} ;
+
+// Keeps every command, in the order they were replayed.
+struct RecordingDrawBackend : public DrawBackend
+{
+  vector<DrawCommand> commands ;
+  void exec( const DrawCommand& cmd ) { commands.push_back( cmd ) ; }
+} ;
+
+// One thread's commands for the frame.
+struct DrawCommandBuffer
+{
+  // commands [first, first+count) were recorded by the job with this sequence #
+  struct Segment
+  {
+    int sequence, first, count ;
+    Segment( int iSequence, int iFirst ) : sequence( iSequence ), first( iFirst ), count( 0 ) { }
+  } ;
+
+  vector<DrawCommand> commands ;
+  vector<Segment> segments ;
+
+  void clear() {
+    commands.clear() ;
+    segments.clear() ;
+  }
+
+  // What's recorded from now on belongs to `sequence`.
+  void begin( int sequence ) {
+    if( !segments.size() || segments.back().sequence != sequence )
+      segments.push_back( Segment( sequence, (int)commands.size() ) ) ;
+  }
+
+  void enableClientState( GLenum array ) ;
+  void disableClientState( GLenum array ) ;
+  void vertexPointer( int size, GLenum type, int stride, const void* ptr ) ;
+  void colorPointer( int size, GLenum type, int stride, const void* ptr ) ;
+  void normalPointer( GLenum type, int stride, const void* ptr ) ;
+  void drawArrays( GLenum mode, int first, int count ) ;
+
+  // The same calls drawPC makes
+  void drawPC( const VertexPC* verts, int first, int count, GLenum drawMode ) ;
+  void drawPC( const VertexPC* verts, const vector<VertexRange>& ranges, GLenum drawMode ) ;
+
+private:
+  inline void push( const DrawCommand& cmd ) {
+    if( !segments.size() )  begin( 0 ) ; // record() wasn't used, it's all sequence 0
+    commands.push_back( cmd ) ;
+    segments.back().count++ ;
+  }
+} ;
+
+// The whole frame's commands, one buffer per thread.
+struct DrawCommandList
+{
+  vector<DrawCommandBuffer> buffers ; // [ Thread::num ]
+
+  // Clears every buffer and makes sure there's one for every thread there
+  // is.  Main thread, while no job is recording (the vector can't
+  // grow while jobs are writing into it).
+  void reset() ;
+
+  // The calling thread's buffer, with what's recorded next belonging to
+  // `sequence`.  No locking.
+  DrawCommandBuffer& record( int sequence ) ;
+
+  // Sends every command to the backend, in sequence order.  Main thread,
+  // after the recording jobs are done.  Returns the # of commands.
+  int replay( DrawBackend& backend ) const ;
+
+  int numCommands() const ;
+} ;
+
+// Records the same frame of jobs serially and in parallel, checks the
+// replays match command for command, and times recording and replaying
+// into the null backend.  Returns # failures.
+int testDrawCommands( int numVerts, int numJobs ) ;
+
+#endif
@@ -0,0 +1,256 @@
+#import "DrawCommands.h"
+#import "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+void GLDrawBackend::exec( const DrawCommand& cmd )
+{
+  switch( cmd.op )
+  {
+  case DrawOpEnableClientState:  glEnableClientState( cmd.e ) ;  break ;
+  case DrawOpDisableClientState:  glDisableClientState( cmd.e ) ;  break ;
+  case DrawOpVertexPointer:  glVertexPointer( cmd.size, cmd.e, cmd.stride, cmd.ptr ) ;  break ;
+  case DrawOpColorPointer:  glColorPointer( cmd.size, cmd.e, cmd.stride, cmd.ptr ) ;  break ;
+  case DrawOpNormalPointer:  glNormalPointer( cmd.e, cmd.stride, cmd.ptr ) ;  break ;
+  case DrawOpDrawArrays:  glDrawArrays( cmd.e, cmd.first, cmd.count ) ;  break ;
+  default:
+    printf( "ERROR: GLDrawBackend: unknown DrawOp %d\n", cmd.op ) ;
+    break ;
+  }
+}
+
+void NullDrawBackend::exec( const DrawCommand& cmd )
+{
+  commands++ ;
+  if( cmd.op == DrawOpDrawArrays ) {
+    draws++ ;
+    vertices += cmd.count ;
+  }
+}
+
+// RECORDING //
+
+void DrawCommandBuffer::enableClientState( GLenum array )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpEnableClientState, cmd.e = array ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::disableClientState( GLenum array )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpDisableClientState, cmd.e = array ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::vertexPointer( int size, GLenum type, int stride, const void* ptr )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpVertexPointer, cmd.size = size, cmd.e = type, cmd.stride = stride, cmd.ptr = ptr ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::colorPointer( int size, GLenum type, int stride, const void* ptr )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpColorPointer, cmd.size = size, cmd.e = type, cmd.stride = stride, cmd.ptr = ptr ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::normalPointer( GLenum type, int stride, const void* ptr )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpNormalPointer, cmd.e = type, cmd.stride = stride, cmd.ptr = ptr ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::drawArrays( GLenum mode, int first, int count )
+{
+  DrawCommand cmd ;
+  cmd.op = DrawOpDrawArrays, cmd.e = mode, cmd.first = first, cmd.count = count ;
+  push( cmd ) ;
+}
+
+void DrawCommandBuffer::drawPC( const VertexPC* verts, int first, int count, GLenum drawMode )
+{
+  if( !count ) return ;
+  enableClientState( GL_VERTEX_ARRAY ) ;
+  enableClientState( GL_COLOR_ARRAY ) ;
+
+  vertexPointer( 3, GL_FLOAT, sizeof( VertexPC ), &verts[0].pos ) ;
+  colorPointer( 4, GL_FLOAT, sizeof( VertexPC ), &verts[0].color ) ;
+  drawArrays( drawMode, first, count ) ;
+
+  disableClientState( GL_VERTEX_ARRAY ) ;
+  disableClientState( GL_COLOR_ARRAY ) ;
+}
+
+void DrawCommandBuffer::drawPC( const VertexPC* verts, const vector<VertexRange>& ranges, GLenum drawMode )
+{
+  if( !ranges.size() ) return ;
+  enableClientState( GL_VERTEX_ARRAY ) ;
+  enableClientState( GL_COLOR_ARRAY ) ;
+
+  vertexPointer( 3, GL_FLOAT, sizeof( VertexPC ), &verts[0].pos ) ;
+  colorPointer( 4, GL_FLOAT, sizeof( VertexPC ), &verts[0].color ) ;
+  for( const VertexRange& range : ranges )
+    drawArrays( drawMode, range.start, range.size() ) ;
+
+  disableClientState( GL_VERTEX_ARRAY ) ;
+  disableClientState( GL_COLOR_ARRAY ) ;
+}
+
+// MERGE & REPLAY //
+
+void DrawCommandList::reset()
+{
+  // Thread nums are handed out from 1 up, [0] is for when there's no pool.
+  if( (int)buffers.size() < Thread::NextThreadId )
+    buffers.resize( Thread::NextThreadId ) ;
+  for( DrawCommandBuffer& buffer : buffers )
+    buffer.clear() ;
+}
+
+DrawCommandBuffer& DrawCommandList::record( int sequence )
+{
+  int num = 0 ;
+  if( threadPool )
+    if( Thread* me = threadPool->getMe() )
+      num = me->num ;
+
+  if( num >= (int)buffers.size() ) {
+    // Resizing here would pull the buffers out from under the other threads.
+    printf( "ERROR: DrawCommandList: thread %d has no buffer, call reset() after the threads are made. "
+            "Recording into buffer 0\n", num ) ;
+    num = 0 ;
+  }
+
+  DrawCommandBuffer& buffer = buffers[ num ] ;
+  buffer.begin( sequence ) ;
+  return buffer ;
+}
+
+// A segment, found by which buffer it's in.
+struct SegmentRef
+{
+  int sequence, buffer, segment ;
+  bool operator<( const SegmentRef& o ) const {
+    if( sequence != o.sequence )  return sequence < o.sequence ;
+    if( buffer != o.buffer )  return buffer < o.buffer ;
+    return segment < o.segment ;
+  }
+} ;
+
+int DrawCommandList::replay( DrawBackend& backend ) const
+{
+  PhaseTimer timer( PhaseDraw ) ;
+  // Sorting the segments (one per job), not the commands, is all the merge there is.
+  vector<SegmentRef> order ;
+  for( int b = 0 ; b < (int)buffers.size() ; b++ )
+    for( int s = 0 ; s < (int)buffers[b].segments.size() ; s++ ) {
+      SegmentRef ref = { buffers[b].segments[s].sequence, b, s } ;
+      order.push_back( ref ) ;
+    }
+  sort( order.begin(), order.end() ) ;
+
+  int replayed = 0 ;
+  for( const SegmentRef& ref : order )
+  {
+    const DrawCommandBuffer& buffer = buffers[ ref.buffer ] ;
+    const DrawCommandBuffer::Segment& segment = buffer.segments[ ref.segment ] ;
+    for( int i = segment.first ; i < segment.first + segment.count ; i++ )
+      backend.exec( buffer.commands[i] ) ;
+    replayed += segment.count ;
+  }
+  return replayed ;
+}
+
+int DrawCommandList::numCommands() const
+{
+  int total = 0 ;
+  for( const DrawCommandBuffer& buffer : buffers )
+    total += (int)buffer.commands.size() ;
+  return total ;
+}
+
+// TEST & BENCHMARK //
+
+// What one job does in the test: its range as a few uneven pieces, so the
+// jobs record different amounts.
+static void recordJob( DrawCommandBuffer& cb, const vector<VertexPC>& verts, int job, int numJobs )
+{
+  int n = (int)verts.size() ;
+  int start = (int)( (int64_t)n * job / numJobs ), end = (int)( (int64_t)n * ( job+1 ) / numJobs ) ;
+  vector<VertexRange> ranges ;
+  for( int piece = start, i = 0 ; piece < end ; i++ ) {
+    int pieceEnd = min( end, piece + 2*( 16 + ( job*7 + i*13 ) % 64 ) ) ;
+    ranges.push_back( VertexRange( piece, pieceEnd ) ) ;
+    piece = pieceEnd + 2 ; // leave a line out between pieces
+  }
+  cb.drawPC( &verts[0], ranges, GL_LINES ) ;
+}
+
+int testDrawCommands( int numVerts, int numJobs )
+{
+  vector<VertexPC> verts( numVerts ) ;
+  DrawCommandList list ;
+  int failures = 0 ;
+
+  // SERIAL, what the main thread would have done itself.
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  list.reset() ;
+  for( int job = 0 ; job < numJobs ; job++ )
+    recordJob( list.record( job ), verts, job, numJobs ) ;
+  double serialRecordTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  RecordingDrawBackend expected ;
+  list.replay( expected ) ;
+
+  // PARALLEL, the jobs are added in order but run wherever.  Done a few times,
+  // the threads take different jobs each time.
+  double recordTime = 0, replayTime = 0 ;
+  const int reps = 10 ;
+  for( int r = 0 ; r < reps ; r++ )
+  {
+    start = chrono::steady_clock::now() ;
+    list.reset() ;
+    WorkOrder *wo = new WorkOrder( "record draws" ) ;
+    for( int job = 0 ; job < numJobs ; job++ )
+      wo->addJob( new Callback0( [&list, &verts, job, numJobs](){
+        recordJob( list.record( job ), verts, job, numJobs ) ;
+      } ) ) ;
+    if( threadPool ) {
+      threadPool->startWorkOrder( wo ) ;
+      threadPool->sequencePoint( 0 ) ;
+    }
+    else {
+      wo->finishedSubmission() ;
+      wo->runAll() ;
+      delete wo ;
+    }
+    recordTime += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+
+    RecordingDrawBackend got ;
+    list.replay( got ) ;
+    if( got.commands != expected.commands ) {
+      printf( "  FAIL rep %d: the replay doesn't match the serial recording (%d vs %d commands)\n", r,
+        (int)got.commands.size(), (int)expected.commands.size() ) ;
+      failures++ ;
+    }
+
+    start = chrono::steady_clock::now() ;
+    NullDrawBackend null ;
+    list.replay( null ) ;
+    replayTime += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  }
+
+  int buffersUsed = 0 ;
+  for( const DrawCommandBuffer& buffer : list.buffers )
+    buffersUsed += buffer.commands.size() > 0 ;
+  printf( "testDrawCommands: %d jobs, %d commands in %d thread buffers\n", numJobs, list.numCommands(), buffersUsed ) ;
+  printf( "  record serial %.3f ms, parallel %.3f ms, merge+replay (null) %.3f ms\n",
+    serialRecordTime*1e3, recordTime/reps*1e3, replayTime/reps*1e3 ) ;
+  printf( "testDrawCommands: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
@@ -2,6 +2,77 @@
 
 #import "ES1Renderer.h"
 #import "ThreadPool.h"
+#import "FrameScheduler.h"
+#import "IoExecutor.h"
+#import "FrameTelemetry.h"
+
+#import "Vectorf.h"
+#import "Random.h"
+#import "ThreadSpecific.h"
+#import "Executor.h"
+#import "ParallelAlgorithms.h"
+#import "Coroutine.h"
+#import "JobGraph.h"
+#import "Pipeline.h"
+#import "AffinityPartitioner.h"
+#import "DirtyRanges.h"
+#import "DrawCommands.h"
+#import "GeometryBuilder.h"
+#import "LineBVH.h"
+#import "LineGrid.h"
+#import "RadixSort.h"
+#import "QuantizedVertex.h"
+#import "SceneFile.h"
+#import "StreamingVBO.h"
+#import "VertexStreams.h"
+
+// 1 runs every module's test at startup, once the pool is up, and prints the
+// total failures.  1 for the benchmarks too (they take a while).  Debugging
+// only: the first frame waits for them.
+#define THREADEN_RUN_TESTS 0
+#define THREADEN_RUN_BENCHMARKS 0
+
+// Main thread, GL context current, pool (and frameScheduler, ioExecutor) up.
+static void runTestsAndBenchmarks()
+{
+#if THREADEN_RUN_TESTS
+  int failures = 0 ;
+  failures += testBatchKernels() ;
+  failures += testRandom() ;
+  failures += testThreadSpecific( 1000000 ) ;
+  failures += testCancellation() ;
+  failures += testThreadAffinity() ;
+  failures += testTaskArenas() ;
+  failures += testFrameScheduler() ;
+  failures += testFrameTelemetry( 600 ) ;
+  failures += testIoExecutor( 2, 60 ) ;
+  failures += testSenders() ;
+  failures += testParallelAlgorithms( 100000 ) ;
+  failures += testCoroutines() ;
+  failures += testJobGraph( 1024 ) ;
+  failures += testPipeline( 256, 1024, 8 ) ;
+  failures += testAffinityPartitioner() ;
+  failures += testDrawCommands( 40000, 16 ) ;
+  failures += testLineBVH( 10000 ) ;
+  failures += testLineGrid( 10000 ) ;
+  failures += testQuantizedVertices( 100000 ) ;
+  failures += testSceneFile( 100000 ) ;
+  failures += testStreamingVBO( 40000, 60 ) ;
+  printf( "THREADEN TESTS: %d failures\n", failures ) ;
+#endif
+  
+#if THREADEN_RUN_BENCHMARKS
+  benchmarkBatchKernels( 100000, 50 ) ;
+  benchmarkRandom( 1000000, 10 ) ;
+  benchmarkVertexLayouts( 40000, 100 ) ;
+  benchmarkDirtyRanges( 40000, 100 ) ;
+  benchmarkGeometryBuilders( 100000 ) ;
+  benchmarkRadixSort( 100000 ) ;
+  benchmarkLineGrid( 100000 ) ;
+  benchmarkParallelAlgorithms( 1000000 ) ;
+  benchmarkAffinityPartitioner( 1024 ) ;
+#endif
+}
 
 @implementation EAGLView
 
@@ -78,11 +149,27 @@
     //threadPool->createWorkerThreads( 1, renderer->context, renderer->defaultFramebuffer, renderer->colorRenderbuffer ) ;
     threadPool->createWorkerThreads( 1 ) ; // Not accessing the glcontext from the worker threads
 
+    // The frame scheduler needs to know the frame budget, which is set by the display link interval.
+    frameScheduler = new FrameScheduler( threadPool ) ;
+    frameScheduler->setFrameInterval( (int)animationFrameInterval ) ;
+    
+    // Blocking work (file loads) goes here, not on the compute workers.
+    // The I/O threads mostly sleep, so 2 of them cost next to no CPU.
+    ioExecutor = new IoExecutor( 2 ) ;
+    
+    // Where each frame's time goes, over the last 600 frames (10 s at 60 fps).
+    // A tool on the Mac can read the block while the app runs (simulator: it's
+    // a plain file in the app's tmp directory).
+    frameTelemetry = new FrameTelemetry( 600 ) ;
+    frameTelemetry->publish( string( [NSTemporaryDirectory() UTF8String] ) + "threaden_telemetry.block" ) ;
+
     // A threadpool can be used for background work that
     // runs independently of rendering.  Here we can test that.
     //testBackgroundWork() ; // launches a bunch of jobs that take forever to do,
     // but they get run on a background thread and the renderer is allowed to continue drawing independently.
 
+    runTestsAndBenchmarks() ; // nothing unless THREADEN_RUN_TESTS / THREADEN_RUN_BENCHMARKS
+
     first=0;
   }
   [self drawView:nil];
@@ -104,6 +191,7 @@
 	if (frameInterval >= 1)
 	{
 		animationFrameInterval = frameInterval;
+		if( frameScheduler )  frameScheduler->setFrameInterval( (int)frameInterval ) ;
 		
 		if (animating)
 		{
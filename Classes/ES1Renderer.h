@@ -10,6 +10,10 @@
 using namespace std ;
 
 #import "Vectorf.h"
+#import "VertexStreams.h"
+#import "DirtyRanges.h"
+#import "LineBVH.h"
+#import "QuantizedVertex.h"
 
 inline void addLine( vector<VertexPC>& verts, const Vector3f& a, const Vector3f& b, const Vector4f& color )
 {
@@ -29,8 +33,26 @@ void drawPC( const vector<VertexPC>& verts, int start, int count, GLenum drawMod
 void drawPC( const vector<VertexPC>& verts, GLenum drawMode ) ;
 void drawPNC( const vector<VertexPNC>& verts, GLenum drawMode ) ;
 
+// Strided pointer versions. These work on AoS and SoA data alike, GL reads straight from the pointers.
+void drawPC( const VertexAttribView& pos, const VertexAttribView& color, int start, int count, GLenum drawMode ) ;
+void drawPC( const VertexStreamsPC& verts, GLenum drawMode ) ;
+// Just the given vertex ranges (what LineBVH::cull hands back). One glDrawArrays per range.
+void drawPC( const vector<VertexPC>& verts, const vector<VertexRange>& ranges, GLenum drawMode ) ;
+// From a buffer object full of VertexPCs (a StreamingVBO's), not client memory.
+void drawPC( GLuint vbo, int start, int count, GLenum drawMode ) ;
+
+// The compact formats (QuantizedVertex.h), drawn as they are: GL takes the
+// shorts/bytes and the RGBA8 color directly.  The snorm16 ones need the `scale`
+// they were quantized with, it goes on the modelview matrix for the draw.
+void drawPC8( const vector<VertexPC8>& verts, GLenum drawMode ) ;
+void drawQPC( const vector<VertexQPC>& verts, float scale, GLenum drawMode ) ;
+void drawQPNC( const vector<VertexQPNC>& verts, float scale, GLenum drawMode ) ;
+
 extern vector<VertexPC> pcVertsA, pcVertsB ;
 extern vector<VertexPNC> pncVerts ;
+extern VertexStreamsPC pcStreams ; // same lines as pcVertsA, stored as separate pos/color streams
+extern LineBVH linesBVH ; // over pcVertsA (and the copies of it, they're all in its order)
+extern DirtyRanges pcVertsDirty ; // which of pcVertsA changed since the last IncrementalProcessThenSerialDraw pass
 
 
 @interface ES1Renderer : NSObject
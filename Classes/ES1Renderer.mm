@@ -1,12 +1,27 @@
 #import "ES1Renderer.h"
 #import "ThreadPool.h"
+#import "FrameScheduler.h"
+#import "FrameTelemetry.h"
+#import "Transform.h"
+#import "GeometryBuilder.h"
+#import "DrawCommands.h"
+#import "StreamingVBO.h"
+#import "SceneFile.h"
+#import "JobGraph.h"
+#import "AffinityPartitioner.h"
+
+#include <unistd.h>
 
 vector<VertexPC> pcVertsA,pcVertsB ;
 vector<VertexPNC> pncVerts ;
+VertexStreamsPC pcStreams ;
+LineBVH linesBVH ;
+DirtyRanges pcVertsDirty ;
 
 void drawPC( const vector<VertexPC>& verts, int start, int count, GLenum drawMode )
 {
   if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
   glEnableClientState( GL_VERTEX_ARRAY ) ;
   glEnableClientState( GL_COLOR_ARRAY ) ;
   
@@ -21,6 +36,7 @@ void drawPC( const vector<VertexPC>& verts, int start, int count, GLenum drawMod
 void drawPC( const vector<VertexPC>& verts, GLenum drawMode )
 {
   if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
   glEnableClientState( GL_VERTEX_ARRAY ) ;
   glEnableClientState( GL_COLOR_ARRAY ) ;
   
@@ -35,6 +51,7 @@ void drawPC( const vector<VertexPC>& verts, GLenum drawMode )
 void drawPNC( const vector<VertexPNC>& verts, GLenum drawMode )
 {
   if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
   glEnableClientState( GL_VERTEX_ARRAY ) ;
   glEnableClientState( GL_NORMAL_ARRAY ) ;
   glEnableClientState( GL_COLOR_ARRAY ) ;
@@ -51,9 +68,134 @@ void drawPNC( const vector<VertexPNC>& verts, GLenum drawMode )
   
 }
 
+void drawPC( const VertexAttribView& pos, const VertexAttribView& color, int start, int count, GLenum drawMode )
+{
+  if( !count ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  glVertexPointer( 3, GL_FLOAT, pos.stride, pos.ptr ) ;
+  glColorPointer( 4, GL_FLOAT, color.stride, color.ptr ) ;
+  glDrawArrays( drawMode, start, count ) ;
+
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+}
+
+// No interleaving pass: GL gets the two streams as two arrays.
+void drawPC( const VertexStreamsPC& verts, GLenum drawMode )
+{
+  drawPC( verts.posView(), verts.colorView(), 0, verts.size(), drawMode ) ;
+}
+
+void drawPC( const vector<VertexPC>& verts, const vector<VertexRange>& ranges, GLenum drawMode )
+{
+  if( !verts.size() || !ranges.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  // The pointers are set once, only the draws are per range.
+  glVertexPointer( 3, GL_FLOAT, sizeof( VertexPC ), &verts[0].pos ) ;
+  glColorPointer( 4, GL_FLOAT, sizeof( VertexPC ), &verts[0].color ) ;
+  for( const VertexRange& range : ranges )
+    glDrawArrays( drawMode, range.start, range.size() ) ;
+
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+}
+
+void drawPC( GLuint vbo, int start, int count, GLenum drawMode )
+{
+  if( !vbo || !count ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  VertexPC v ;
+  int colorOffset = (int)( (char*)&v.color - (char*)&v ) ;
+  
+  glBindBuffer( GL_ARRAY_BUFFER, vbo ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  // With a buffer bound, the "pointers" are byte offsets into it.
+  glVertexPointer( 3, GL_FLOAT, sizeof( VertexPC ), (const GLvoid*)0 ) ;
+  glColorPointer( 4, GL_FLOAT, sizeof( VertexPC ), (const GLvoid*)(size_t)colorOffset ) ;
+  glDrawArrays( drawMode, start, count ) ;
+
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+  glBindBuffer( GL_ARRAY_BUFFER, 0 ) ; // the other drawPCs need client arrays back
+}
+
+void drawPC8( const vector<VertexPC8>& verts, GLenum drawMode )
+{
+  if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  glVertexPointer( 3, GL_FLOAT, sizeof( VertexPC8 ), &verts[0].pos ) ;
+  glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof( VertexPC8 ), verts[0].color ) ; // GL maps 0..255 to 0..1
+  glDrawArrays( drawMode, 0, (int)verts.size() ) ;
+
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+}
+
+void drawQPC( const vector<VertexQPC>& verts, float scale, GLenum drawMode )
+{
+  if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  // ES1 takes GL_SHORT positions as plain integers (-32767..32767), so scale them back here.
+  float s = scale / SNORM16_MAX ;
+  glMatrixMode( GL_MODELVIEW ) ;
+  glPushMatrix() ;
+  glScalef( s, s, s ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  glVertexPointer( 3, GL_SHORT, sizeof( VertexQPC ), verts[0].pos ) ;
+  glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof( VertexQPC ), verts[0].color ) ;
+  glDrawArrays( drawMode, 0, (int)verts.size() ) ;
+
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+  glPopMatrix() ;
+}
+
+void drawQPNC( const vector<VertexQPNC>& verts, float scale, GLenum drawMode )
+{
+  if( !verts.size() ) return ;
+  PhaseTimer timer( PhaseDraw ) ;
+  float s = scale / SNORM16_MAX ;
+  glMatrixMode( GL_MODELVIEW ) ;
+  glPushMatrix() ;
+  glScalef( s, s, s ) ;
+  // GL_BYTE normals come in normalized, but the glScalef would shrink them for lighting.
+  glEnable( GL_RESCALE_NORMAL ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_NORMAL_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  
+  glVertexPointer( 3, GL_SHORT, sizeof( VertexQPNC ), verts[0].pos ) ;
+  glNormalPointer( GL_BYTE, sizeof( VertexQPNC ), verts[0].normal ) ;
+  glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof( VertexQPNC ), verts[0].color ) ;
+  glDrawArrays( drawMode, 0, (int)verts.size() ) ;
+  
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_NORMAL_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+  glDisable( GL_RESCALE_NORMAL ) ;
+  glPopMatrix() ;
+}
+
 
 // #verts to process
 #define NUMVERTS 40000
+
+// 1 prints the frame telemetry every 600 frames.  Debugging only: the
+// published block (EAGLView) is the way to watch it without the console.
+#define PRINT_FRAME_TELEMETRY 0
 enum ParallelTechnique
 {
   // Serial processing is the default (not multithreaded)
@@ -65,15 +207,79 @@ enum ParallelTechnique
   // Good, but no need to use since `parallelProcessSerialDraw` seems to perform equally well.
   // Since you always draw the LAST FRAME computed, it means input will lag one additional frame
   // (effectively giving you 30fps response rates for a 60 fps display rate). Not recommended.
-  ParallelProcessAndDrawTogether
+  ParallelProcessAndDrawTogether,
+  
+  // Same as ParallelProcessThenSerialDraw, but the vertices live in pcStreams (SoA),
+  // so the transform only moves 12 bytes/vertex through cache instead of 28.
+  ParallelProcessStreamsThenSerialDraw,
+  
+  // The vertices are never rewritten.  The frame's rotation is composed into one
+  // matrix, and the reference positions are transformed by it (once, in parallel) only when drawn.
+  LazyComposedTransformsSerialDraw,
+  
+  // Only the objects that moved this frame get processed (in parallel), see DirtyRanges.h.
+  IncrementalProcessThenSerialDraw,
+  
+  // ParallelProcessThenSerialDraw, then the BVH is refit and culled against the
+  // view (both in parallel), and only the visible ranges are drawn.
+  ParallelProcessCullThenSerialDraw,
+  
+  // What parallelProcessAndDrawSameFrame wanted.  Each job processes its vertices
+  // and RECORDS the draw for them (see DrawCommands.h), the main thread replays it all.
+  ParallelProcessAndRecordThenReplay,
+  
+  // The jobs write the processed vertices straight into a mapped buffer object
+  // (see StreamingVBO.h), so glDrawArrays doesn't copy them all again.
+  ParallelProcessIntoStreamingVBO,
+  
+  // The lines are kept as VertexQPC (12 bytes, not 28, see QuantizedVertex.h),
+  // transformed in place by frameRotation in parallel, and drawn as shorts + bytes.
+  ParallelProcessQuantizedThenSerialDraw
 } ;
 
 int parallelTechnique = ParallelProcessThenSerialDraw ;
 
+// For IncrementalProcessThenSerialDraw.  Every LINESPEROBJECT consecutive lines
+// are one object, and this fraction of the objects moves each frame.
+#define LINESPEROBJECT 64
+#define DIRTY_JOBSIZE 8192
+float movingObjectFraction = 0.1f ;
+
+// The view volume setupTransformations sets up.  Culling uses the same numbers.
+static const float viewLeft = -2.f, viewRight = 2.f, viewBottom = -2.f, viewTop = 2.f, viewNear = -10.f, viewFar = 10.f ;
+static Frustum viewFrustum = Frustum::ortho( viewLeft, viewRight, viewBottom, viewTop, viewNear, viewFar ) ;
+
 static Matrix3f rot = Matrix3f::rotation( Vector3f::random(), 0.01f ) ;
 static Matrix3f rot2 = Matrix3f::rotation( Vector3f::random(), 0.01f ) ;
 static Matrix3f rot3 = Matrix3f::rotation( Vector3f::random(), 0.01f ) ;
 
+// For LazyComposedTransformsSerialDraw.  processVertices applies rot, then rot2, then rot3
+// to every vertex, which is the same as applying this product once.
+static Matrix3f frameRotation = rot3 * rot2 * rot ;
+static TransformNode linesNode ;
+static TransformedStreamsPC lazyLines( &linesNode ) ;
+
+// For ParallelProcessAndRecordThenReplay
+static DrawCommandList frameDraws ;
+static GLDrawBackend glBackend ;
+
+// For ParallelProcessIntoStreamingVBO.  Made the first time it's used (needs the context).
+#define STREAMVBO_RING 3
+static StreamingVBO pcVBO ;
+
+// What's in Caches/lines.scene, besides the seed and size.  BUMP IT whenever
+// the line generator, the BVH order or the packed format changes, or the
+// next launch loads the old lines from the cache.
+#define LINES_SCENE_VERSION 1
+
+// For ParallelProcessQuantizedThenSerialDraw.  qpcVerts is quantized from pcVertsA
+// at init and never changes; qpcNode holds the rotation so far, and each frame
+// writes qpcVerts rotated by it into qpcDrawn.
+static vector<VertexQPC> qpcVerts ;
+static vector<VertexQPC> qpcDrawn ;
+static float qpcScale = 1.f ;
+static TransformNode qpcNode ;
+
 // Often src and dst are the same, except for parallelProcessAndDraw.
 void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVertex, int endVertex )
 {
@@ -86,6 +292,33 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
   }
 }
 
+// processVertices in place, and each finished vertex also goes to `out`
+// (mapped GL memory, write only: never read it back).
+void processVerticesInto( vector<VertexPC>* verts, VertexPC* out, int startVertex, int endVertex )
+{
+  for( int i = startVertex ; i < endVertex ; i++ )
+  {
+    VertexPC& v = (*verts)[i] ;
+    v.pos = rot * v.pos ;
+    v.pos = rot2 * v.pos ;
+    v.pos = rot3 * v.pos ;
+    out[i] = v ;
+  }
+}
+
+// processVertices for the SoA layout.  Only the pos stream is touched.
+// Runs as 3 SIMD batch passes over the range, which gives the same result
+// as processVertices' 3 products per vertex (in place or not).
+void processVertexStreams( VertexStreamsPC* dst, VertexStreamsPC* src, int startVertex, int endVertex )
+{
+  Vector3f *dstPos = dst->pos + startVertex ;
+  const Vector3f *srcPos = src->pos + startVertex ;
+  int n = endVertex - startVertex ;
+  transformBatch( rot, srcPos, dstPos, n ) ;
+  transformBatch( rot2, srcPos, dstPos, n ) ;
+  transformBatch( rot3, srcPos, dstPos, n ) ;
+}
+
 @implementation ES1Renderer
 
 // Create an ES 1.1 context
@@ -109,15 +342,51 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
 		glFramebufferRenderbufferOES(GL_FRAMEBUFFER_OES, GL_COLOR_ATTACHMENT0_OES, GL_RENDERBUFFER_OES, colorRenderbuffer);
 	}
   
-  // Gen data, #verts
-  for( int i = 0 ; i < NUMVERTS ; i++ )
+  // The lines come out of the scene file cached by the last launch with the
+  // same seed, size and LINES_SCENE_VERSION.  Otherwise they're generated, and cached for next time.
+  NSString *caches = [NSSearchPathForDirectoriesInDomains( NSCachesDirectory, NSUserDomainMask, YES ) objectAtIndex:0] ;
+  string scenePath = string( [caches UTF8String] ) + "/lines.scene" ;
+  uint64_t sceneTag = randomSeed ^ ( (uint64_t)NUMVERTS * 0x9E3779B97F4A7C15ULL ) ^ ( (uint64_t)LINES_SCENE_VERSION * 0xC2B2AE3D27D4EB4FULL ) ;
+  SceneFile scene ;
+  int sceneLines = -1, scenePacked = -1 ;
+  if( !access( scenePath.c_str(), R_OK ) && scene.open( scenePath ) && scene.header->userTag == sceneTag &&
+      ( sceneLines = scene.findStream( "lines" ) ) >= 0 && ( scenePacked = scene.findStream( "lines packed" ) ) >= 0 &&
+      !scene.validate() )
+  {
+    // Already sorted when it was written.  Copied out because the lines move every frame.
+    scene.decode( sceneLines, pcVertsA ) ;
+    linesBVH.build( pcVertsA ) ;
+    qpcScale = scene.info( scenePacked ).scale ;
+    qpcVerts.assign( scene.vertexQPC( scenePacked ), scene.vertexQPC( scenePacked ) + scene.info( scenePacked ).count ) ;
+  }
+  else
   {
-    Vector3f p = Vector3f::random(-1.f,1.f) ;
-    Vector3f dir = Vector3f::random(-1.f,1.f).normalize() ;
+    // Gen data, #verts.  Each line gets its own Rng, so this comes out the same
+    // whether the pool is up yet or not (see GeometryBuilder.h)
+    buildGeometry( pcVertsA, NUMVERTS, 2, randomSeed, []( int item, Rng& rng, VertexPC* out ) {
+      Vector3f p = Vector3f::random( rng, -1.f, 1.f ) ;
+      Vector3f dir = Vector3f::random( rng, -1.f, 1.f ).normalize() ;
+      
+      writeLine( out, p, p+dir*0.05f, Vector4f::random( rng ) ) ;
+    } ) ;
+    // Sorts the lines spatially (reorders pcVertsA), so do it before anything copies them.
+    linesBVH.build( pcVertsA ) ;
+    qpcScale = positionScale( &pcVertsA[0], (int)pcVertsA.size() ) ;
+    qpcVerts.resize( pcVertsA.size() ) ;
+    quantize( &pcVertsA[0], &qpcVerts[0], (int)pcVertsA.size(), qpcScale ) ;
     
-    addLine( pcVertsA, p, p+dir*0.05f, Vector4f::random() ) ;
+    SceneWriter writer ;
+    writer.userTag = sceneTag ;
+    writer.add( "lines", &pcVertsA[0], (int)pcVertsA.size() ) ;
+    writer.add( "lines packed", &qpcVerts[0], (int)qpcVerts.size(), qpcScale ) ;
+    writer.write( scenePath ) ;
   }
+  scene.close() ;
+  
   pcVertsB=pcVertsA;//copy it
+  pcStreams.fromInterleaved( pcVertsA ) ;
+  pcVertsDirty.resize( (int)pcVertsA.size() ) ;
+  lazyLines.load( pcVertsA ) ;
   
   draw=&pcVertsA, process = &pcVertsB ;
   
@@ -128,13 +397,14 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
 {
   glMatrixMode( GL_PROJECTION ) ;
   glLoadIdentity() ;
-  glOrthof( -2.f, 2.f, -2.f, 2.f, -10.0f, 10.0f ) ;
+  glOrthof( viewLeft, viewRight, viewBottom, viewTop, viewNear, viewFar ) ;
   glMatrixMode( GL_MODELVIEW ) ;
 }
 
 // Stuff you must do prior to rendering (call on main thread)
 - (void) prerender:(EAGLContext*)glContext
 {
+  PhaseTimer timer( PhasePrerender ) ;
   //[EAGLContext setCurrentContext:glContext]; // you don't have to do this every frame.
   ///glBindFramebufferOES(GL_FRAMEBUFFER_OES, defaultFramebuffer); // SHARED.// you don't have to do this every frame.
   glViewport( 0, 0, backingWidth, backingHeight ) ;
@@ -147,6 +417,7 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
 // stuff you do after all rendering is complete (call on main thread)
 - (void) flipBuffers
 {
+  PhaseTimer timer( PhaseFlip ) ;
   glBindRenderbufferOES(GL_RENDERBUFFER_OES, colorRenderbuffer);// you don't have to do this every frame.
   [context presentRenderbuffer:GL_RENDERBUFFER_OES];
 }
@@ -177,23 +448,34 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
   // before even creating any workorders.
   [self prerender:context] ;
     
-  // Add a few workorders.
-  WorkOrder *wo = new WorkOrder( "vertex transforms" ) ;
-  
-  // Cut into jobs of size.  Every vertex must be processed.
-  int JOBSIZE = (int)pcVertsA.size() / 4 ;
-  
-  for( int i = 0 ; i < pcVertsA.size() ; i+=JOBSIZE )
+  // The jobs are the same every frame (same vector, same chunks), so they're
+  // recorded into a JobGraph once and replayed: no WorkOrder, no Callback4s
+  // to allocate every frame (see JobGraph.h).  Recorded again if the
+  // vertex count changes.
+  static JobGraph *transforms = 0 ;
+  static int recordedVerts = -1 ;
+  if( !transforms || recordedVerts != (int)pcVertsA.size() )
   {
-    int startVert=i, endVert=i+JOBSIZE ;
-    if( endVert > (int)pcVertsA.size() )  endVert=(int)pcVertsA.size() ;  // If the end ends up OOB, clamp it.
+    delete transforms ;
+    transforms = new JobGraph( "vertex transforms" ) ;
+    int node = transforms->addNode( "processVertices" ) ;
+    recordedVerts = (int)pcVertsA.size() ;
     
-    // Add a callback object to run processVertices from startVert to endVert.
-    wo->addJob( new Callback4<vector<VertexPC>*, vector<VertexPC>*, int, int>
-      ( processVertices, &pcVertsA, &pcVertsA, startVert, endVert ) ) ;
+    // Cut into jobs of size.  Every vertex must be processed.
+    int JOBSIZE = max( 1, (int)pcVertsA.size() / 4 ) ;
+    
+    for( int i = 0 ; i < pcVertsA.size() ; i+=JOBSIZE )
+    {
+      int startVert=i, endVert=i+JOBSIZE ;
+      if( endVert > (int)pcVertsA.size() )  endVert=(int)pcVertsA.size() ;  // If the end ends up OOB, clamp it.
+      
+      // Add a callback object to run processVertices from startVert to endVert.
+      transforms->addJob( node, new Callback4<vector<VertexPC>*, vector<VertexPC>*, int, int>
+        ( processVertices, &pcVertsA, &pcVertsA, startVert, endVert ) ) ;
+    }
   }
   
-  threadPool->startWorkOrder( wo ) ; // worker threads start crunching away
+  transforms->start() ; // worker threads start crunching away
   
   // The main thread should be made to run worker jobs too.
   threadPool->runJobs() ;
@@ -222,6 +504,192 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
   [self flipBuffers] ;
 }
 
+// Exactly parallelProcessSerialDraw, over the SoA copy of the data.
+- (void) parallelProcessStreamsSerialDraw
+{
+  [self prerender:context] ;
+  
+  WorkOrder *wo = new WorkOrder( "vertex stream transforms" ) ;
+  
+  int JOBSIZE = max( 1, pcStreams.size() / 4 ) ;
+  
+  for( int i = 0 ; i < pcStreams.size() ; i+=JOBSIZE )
+  {
+    int startVert=i, endVert=i+JOBSIZE ;
+    if( endVert > pcStreams.size() )  endVert=pcStreams.size() ;
+    
+    wo->addJob( new Callback4<VertexStreamsPC*, VertexStreamsPC*, int, int>
+      ( processVertexStreams, &pcStreams, &pcStreams, startVert, endVert ) ) ;
+  }
+  
+  threadPool->startWorkOrder( wo ) ;
+  threadPool->runJobs() ;
+  threadPool->mainThreadBlockUntilAllJobsFinished( 0 ) ;
+  
+  // SEQUENCE POINT: ALL VERTEX PROCESSING COMPLETE
+  drawPC( pcStreams, GL_LINES ) ;
+  [self flipBuffers] ;
+}
+
+// One Matrix3f*Matrix3f per frame instead of 3 matrix-vector products per vertex.
+// The reference positions stay pristine, so nothing drifts.
+- (void) lazyTransformSerialDraw
+{
+  [self prerender:context] ;
+  
+  linesNode.compose( frameRotation ) ;
+  
+  // If the lines didn't move, addTransformJobs adds nothing and there's no pass at all.
+  WorkOrder *wo = new WorkOrder( "lazy vertex transforms" ) ;
+  if( lazyLines.addTransformJobs( wo, lazyLines.size() / 4 ) )
+  {
+    threadPool->startWorkOrder( wo ) ;
+    threadPool->sequencePoint( 0 ) ;
+    lazyLines.jobsFinished() ;
+  }
+  else  delete wo ;
+  
+  // SEQUENCE POINT: positions are current
+  drawPC( lazyLines.posView(), lazyLines.colorView(), 0, lazyLines.size(), GL_LINES ) ;
+  [self flipBuffers] ;
+}
+
+// parallelProcessSerialDraw, but only over what changed.  With 10% of the
+// objects moving, that's ~10% of the vertex work.
+- (void) incrementalProcessSerialDraw
+{
+  [self prerender:context] ;
+  
+  // Stands in for the game code.  Whatever moves vertices marks them dirty.
+  Rng& rng = threadRng() ;
+  int vertsPerObject = 2*LINESPEROBJECT ;
+  for( int start = 0 ; start < (int)pcVertsA.size() ; start += vertsPerObject )
+    if( rng.nextFloat() < movingObjectFraction )
+      pcVertsDirty.mark( start, start + vertsPerObject ) ;
+  
+  // Jobs only over the dirty ranges.  If nothing moved there's no pass at all.
+  vector<VertexRange> ranges = pcVertsDirty.take() ;
+  if( ranges.size() )
+  {
+    WorkOrder *wo = new WorkOrder( "dirty vertex transforms" ) ;
+    addDirtyRangeJobs( wo, ranges, DIRTY_JOBSIZE, []( int startVert, int endVert ) {
+      processVertices( &pcVertsA, &pcVertsA, startVert, endVert ) ;
+    } ) ;
+    threadPool->startWorkOrder( wo ) ;
+    threadPool->sequencePoint( 0 ) ;
+  }
+  
+  // SEQUENCE POINT: ALL DIRTY VERTICES PROCESSED
+  drawPC( pcVertsA, GL_LINES ) ;
+  [self flipBuffers] ;
+}
+
+// parallelProcessSerialDraw, but only what's on screen gets drawn.
+- (void) parallelProcessCullSerialDraw
+{
+  [self prerender:context] ;
+  
+  // The same ranges every frame, so each goes back to the thread that did it
+  // last frame, whose cache still has its vertices (see AffinityPartitioner.h).
+  static AffinityPartitioner transformAffinity( "vertex transforms" ) ;
+  int JOBSIZE = max( 1, (int)pcVertsA.size() / 4 ) ;
+  transformAffinity.parallelFor( (int)pcVertsA.size(), JOBSIZE, []( int startVert, int endVert ) {
+    processVertices( &pcVertsA, &pcVertsA, startVert, endVert ) ;
+  } ) ;
+  
+  // SEQUENCE POINT: ALL VERTEX PROCESSING COMPLETE
+  // The lines moved, so the bounds have to follow them before culling.
+  linesBVH.refit( pcVertsA ) ;
+  vector<VertexRange> visible = linesBVH.cull( viewFrustum ) ;
+  
+  drawPC( pcVertsA, visible, GL_LINES ) ;
+  [self flipBuffers] ;
+}
+
+// parallelProcessSerialDraw, but the jobs also record their part of the draw.
+// Only the replay is on the main thread: GL calls, no work out what to call.
+- (void) parallelProcessRecordReplay
+{
+  [self prerender:context] ;
+  
+  frameDraws.reset() ; // before any job records
+  
+  WorkOrder *wo = new WorkOrder( "vertex transforms + record draws" ) ;
+  int JOBSIZE = max( 1, (int)pcVertsA.size() / 4 ) ;
+  for( int i = 0, job = 0 ; i < pcVertsA.size() ; i+=JOBSIZE, job++ )
+  {
+    int startVert=i, endVert=i+JOBSIZE ;
+    if( endVert > (int)pcVertsA.size() )  endVert=(int)pcVertsA.size() ;
+    
+    // job # is the sequence #, so the replay draws the jobs in this order.
+    wo->addJob( new Callback0( [startVert,endVert,job](){
+      processVertices( &pcVertsA, &pcVertsA, startVert, endVert ) ;
+      frameDraws.record( job ).drawPC( &pcVertsA[0], startVert, endVert-startVert, GL_LINES ) ;
+    } ) ) ;
+  }
+  
+  threadPool->startWorkOrder( wo ) ;
+  threadPool->sequencePoint( 0 ) ;
+  
+  // SEQUENCE POINT: ALL VERTEX PROCESSING AND RECORDING COMPLETE
+  frameDraws.replay( glBackend ) ;
+  [self flipBuffers] ;
+}
+
+// parallelProcessSerialDraw, but the vertices go to GL from the jobs, not from the draw call.
+- (void) parallelProcessStreamVBOSerialDraw
+{
+  [self prerender:context] ;
+  
+  int numVerts = (int)pcVertsA.size() ;
+  if( !pcVBO.isCreated() )
+    pcVBO.create( numVerts*sizeof(VertexPC), STREAMVBO_RING, StreamUnsynchronized ) ;
+  
+  VertexPC *out = (VertexPC*)pcVBO.begin( numVerts*sizeof(VertexPC) ) ;
+  if( !out )
+  {
+    // Couldn't map.  Do this frame the old way.
+    [self parallelProcessSerialDraw] ;
+    return ;
+  }
+  
+  int JOBSIZE = max( 1, numVerts / 4 ) ;
+  threadPool->parallelFor( "vertex transforms into vbo", numVerts, JOBSIZE, [out]( int startVert, int endVert ) {
+    processVerticesInto( &pcVertsA, out, startVert, endVert ) ;
+  } ) ;
+  
+  // SEQUENCE POINT: ALL VERTICES PROCESSED AND IN THE BUFFER
+  GLuint vbo = pcVBO.end() ;
+  drawPC( vbo, 0, numVerts, GL_LINES ) ;
+  pcVBO.fence() ;
+  [self flipBuffers] ;
+}
+
+// parallelProcessSerialDraw over VertexQPCs.  The rotation adds up in float
+// (qpcNode composes frameRotation, the same as processVertices' 3) and the
+// reference is transformed out of place, so the rounding never accumulates.
+- (void) parallelProcessQuantizedSerialDraw
+{
+  [self prerender:context] ;
+  
+  qpcNode.compose( frameRotation ) ;
+  static Matrix3f world ;
+  world = qpcNode.getWorld() ;
+  int numVerts = (int)qpcVerts.size() ;
+  qpcDrawn.resize( numVerts ) ;
+  if( numVerts )
+  {
+    int JOBSIZE = max( 1, numVerts / 4 ) ;
+    threadPool->parallelFor( "quantized vertex transforms", numVerts, JOBSIZE, []( int startVert, int endVert ) {
+      transformQuantized( world, &qpcVerts[0], &qpcDrawn[0], startVert, endVert ) ;
+    } ) ;
+  }
+  
+  // SEQUENCE POINT: ALL VERTICES PROCESSED
+  drawQPC( qpcDrawn, qpcScale, GL_LINES ) ;
+  [self flipBuffers] ;
+}
+
 // in this mode, we process IN PARALLEL with draw.
 // If your app is about 50-50 on the process/draw,
 // use this mode.
@@ -285,7 +753,8 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
 // THIS DOESN'T ACTUALLY WORK AS EXPECTED.  THE REASON IS
 // YOU CAN'T RENDER FROM TWO SEPARATE CONTEXTS TO THE SAME
 // FRAMEBUFFER SIMULTANEOUSLY.  This is only here to remember
-// that this way is invalid.
+// that this way is invalid.  parallelProcessRecordReplay is the way
+// to get the draw work onto the workers.
 - (void) parallelProcessAndDrawSameFrame // WRONG
 {
   [self prerender:context] ;
@@ -349,6 +818,20 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
 // Consider this 1 step of the game loop.
 - (void) runFrame
 {
+  // Times the frame's phases (see FrameTelemetry.h): prerender, submit, runJobs, wait, draw, flip.
+  if( frameTelemetry )
+    frameTelemetry->beginFrame() ;
+  
+  // Starts the frame budget clock, and sends any jobs that are due this frame to the workers.
+  if( frameScheduler ) {
+    frameScheduler->beginFrame() ;
+    frameScheduler->dispatch() ;
+  }
+  
+  // Jobs queued for the main thread since last frame (like coroutines that
+  // co_await threadPool->toMainThread(), see Coroutine.h)
+  threadPool->mainThreadRunJobs() ;
+  
   switch( parallelTechnique )
   {
   case SerialProcessThenDraw:
@@ -365,6 +848,34 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
     // Good, but no need to use since `parallelProcessSerialDraw` seems to perform equally well
     [self parallelProcessAndDrawLagged1Frame];  // OK. process IN PARALLEL with draw.
     break;
+    
+  case ParallelProcessStreamsThenSerialDraw:
+    [self parallelProcessStreamsSerialDraw];  // ParallelProcessThenSerialDraw with less memory traffic
+    break;
+    
+  case LazyComposedTransformsSerialDraw:
+    [self lazyTransformSerialDraw];  // 1 transform per vertex, only when the lines moved
+    break;
+    
+  case IncrementalProcessThenSerialDraw:
+    [self incrementalProcessSerialDraw];  // cost scales with what moved, not NUMVERTS
+    break;
+    
+  case ParallelProcessCullThenSerialDraw:
+    [self parallelProcessCullSerialDraw];  // off screen lines never go to GL
+    break;
+    
+  case ParallelProcessAndRecordThenReplay:
+    [self parallelProcessRecordReplay];  // workers record the draws, main thread replays them
+    break;
+    
+  case ParallelProcessIntoStreamingVBO:
+    [self parallelProcessStreamVBOSerialDraw];  // no copy in glDrawArrays
+    break;
+    
+  case ParallelProcessQuantizedThenSerialDraw:
+    [self parallelProcessQuantizedSerialDraw];  // 12 bytes/vertex through cache and to GL, not 28
+    break;
 
   default:
     puts( "ERROR: INVALID PARALLELTECHNIQUE" ) ;
@@ -379,6 +890,18 @@ void processVertices( vector<VertexPC>* dst, vector<VertexPC>* src, int startVer
   // if it runs _faster_ than the worker thread.
   // In my experiments, I kind of find that it works ok, but `parallelProcessSerialDraw`
   // is pretty much equivalent for heavy CPU processing and large buffer flushing.
+  
+  // Main thread uses whatever is left of the frame on deferrable jobs.
+  if( frameScheduler )
+    frameScheduler->endFrame() ;
+  
+  if( frameTelemetry ) {
+    frameTelemetry->endFrame() ;
+    #if PRINT_FRAME_TELEMETRY
+    if( frameTelemetry->frames % 600 == 0 )
+      frameTelemetry->print() ;
+    #endif
+  }
 }
 
 
@@ -0,0 +1,232 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "ThreadPool.h"
+
+#include <memory>
+#include <utility>
+#include <sched.h>
+
+// Running anything on the pool means building Callbacks and WorkOrders by
+// hand, and a second runtime (TBB, OpenMP) for the standard algorithms
+// would bring its own threads to fight Threaden's workers for the cores.
+//
+// An EXECUTOR is the pool as something generic code can be handed.  There
+// are no concepts in C++11, so it's by convention: an executor is anything with
+//
+//   ex.execute( f )             f() some time soon, on some thread.  Returns right away.
+//   ex.bulk( n, grain, body )   body( start, end ) over [0,n) in ranges of grain.
+//                               Returns when they're all done.
+//   ex.concurrency()            how many threads bulk() can have going at once
+//
+// ThreadPoolExecutor is the pool (bulk is a parallelFor: on the main thread
+// the workers help, anywhere else it runs right there, in order).
+// InlineExecutor does everything on the calling thread, to compare against
+// or to turn the parallelism off.  The algorithms that take one are in
+// ParallelAlgorithms.h.
+//
+// SENDERS (after P2300, cut down).  A Sender<T> is work that hasn't started,
+// that will send a T to whoever it's started with (its Receiver).  They're
+// built up out of each other, then started once:
+//
+//   Sender<int> s = then( schedule( ThreadPoolExecutor() ), []( Nothing ) { return loadLevel() ; } ) ;
+//   Sender<int> c = bulk( s, 64, []( int i, int& level ) { buildChunk( level, i ) ; } ) ;
+//   int level = syncWait( c ) ;
+//
+//   schedule( ex )          sends Nothing, from a job on `ex`
+//   then( s, f )            sends f( what s sent ), on the thread s finished on
+//                           (Nothing if f returns void)
+//   bulk( s, n, f )         f( i, value ) for i in [0,n) as jobs on the pool,
+//                           then sends the value on, from the last one to finish
+//   syncWait( s )           starts s and waits for its value.  On the main
+//                           thread it runs pool jobs while it waits.
+//
+// Nothing blocks in between: each step starts the next from whichever thread
+// finished it, so a chain off the main thread still runs in parallel (bulk
+// posts its own WorkOrder, it doesn't need a sequence point).  Senders are
+// copied by value and can be started more than once.  There's no error or
+// stopped channel: the repo doesn't throw, and cancelling is CancelToken's.
+
+// One job on the pool, or on the calling thread if there's no pool.
+struct ThreadPoolExecutor
+{
+  void execute( const function<void ()>& f ) const ;
+  void bulk( int n, int grain, const function<void (int, int)>& body ) const {
+    forEachChunk( "executor bulk", n, grain, body ) ;
+  }
+  int concurrency() const { return threadPool ? threadPool->getNumWorkers() + 1 : 1 ; }
+} ;
+
+struct InlineExecutor
+{
+  void execute( const function<void ()>& f ) const { f() ; }
+  void bulk( int n, int grain, const function<void (int, int)>& body ) const {
+    if( grain < 1 )  grain = 1 ;
+    for( int start = 0 ; start < n ; start += grain )
+      body( start, min( n, start + grain ) ) ;
+  }
+  int concurrency() const { return 1 ; }
+} ;
+
+// SENDERS //
+
+// What a sender of no value sends
+struct Nothing {} ;
+
+template<typename T>
+struct Receiver
+{
+  function<void (T)> setValue ;
+} ;
+
+template<typename T>
+struct Sender
+{
+  typedef T ValueType ;
+  // Starts the work.  `receiver` gets the value on whichever thread finished it.
+  function<void (const Receiver<T>&)> start ;
+} ;
+
+template<class Executor>
+Sender<Nothing> schedule( const Executor& ex )
+{
+  Sender<Nothing> s ;
+  s.start = [ex]( const Receiver<Nothing>& r ) {
+    ex.execute( [r](){ r.setValue( Nothing() ) ; } ) ;
+  } ;
+  return s ;
+}
+
+// What then( s, f ) sends: what f returns, Nothing for void.
+template<typename R>
+struct ThenValue
+{
+  typedef R type ;
+  template<class F, class T>
+  static void send( F& f, T& value, const Receiver<R>& r ) { r.setValue( f( value ) ) ; }
+} ;
+template<>
+struct ThenValue<void>
+{
+  typedef Nothing type ;
+  template<class F, class T>
+  static void send( F& f, T& value, const Receiver<Nothing>& r ) {
+    f( value ) ;
+    r.setValue( Nothing() ) ;
+  }
+} ;
+
+template<typename T, class F>
+Sender< typename ThenValue< decltype( declval<F&>()( declval<T&>() ) ) >::type > then( const Sender<T>& s, F f )
+{
+  typedef decltype( declval<F&>()( declval<T&>() ) ) R ;
+  typedef typename ThenValue<R>::type U ;
+  Sender<U> out ;
+  out.start = [s, f]( const Receiver<U>& r ) {
+    Receiver<T> next ;
+    next.setValue = [f, r]( T value ) mutable { ThenValue<R>::send( f, value, r ) ; } ;
+    s.start( next ) ;
+  } ;
+  return out ;
+}
+
+// The value, shared by bulk's jobs until the last one sends it on.
+template<typename T>
+struct BulkState
+{
+  T value ;
+  Receiver<T> receiver ;
+  BulkState( const T& iValue, const Receiver<T>& iReceiver ) : value( iValue ), receiver( iReceiver ) {}
+} ;
+
+template<typename T, class F>
+Sender<T> bulk( const Sender<T>& s, int n, F f, int grain=0 )
+{
+  Sender<T> out ;
+  out.start = [s, n, f, grain]( const Receiver<T>& r ) {
+    Receiver<T> next ;
+    next.setValue = [n, f, grain, r]( T value ) {
+      int g = grain > 0 ? grain : max( 1, n / ( 4*ThreadPoolExecutor().concurrency() ) ) ;
+      shared_ptr< BulkState<T> > state( new BulkState<T>( value, r ) ) ;
+      if( !threadPool || n <= g ) {
+        for( int i = 0 ; i < n ; i++ )
+          f( i, state->value ) ;
+        r.setValue( state->value ) ;
+        return ;
+      }
+      // Its own WorkOrder, not a parallelFor: this can be any thread, and it mustn't block.
+      WorkOrder *wo = new WorkOrder( "bulk" ) ;
+      for( int start = 0 ; start < n ; start += g ) {
+        int end = min( n, start + g ) ;
+        wo->addJob( new Callback0( [state, f, start, end](){
+          for( int i = start ; i < end ; i++ )
+            f( i, state->value ) ;
+        } ) ) ;
+      }
+      wo->whenDone( new Callback0( [state](){ state->receiver.setValue( state->value ) ; } ) ) ;
+      threadPool->startWorkOrder( wo ) ;
+    } ;
+    s.start( next ) ;
+  } ;
+  return out ;
+}
+
+// syncWait's end of it: where the value lands, and the flag it waits on.
+template<typename T>
+struct SyncWaitState
+{
+  pthread_mutex_t mutex ;
+  pthread_cond_t arrived ;
+  bool done ;
+  unique_ptr<T> value ;
+
+  SyncWaitState() : done( 0 ) {
+    pthread_mutex_init( &mutex, 0 ) ;
+    pthread_cond_init( &arrived, 0 ) ;
+  }
+  ~SyncWaitState() {
+    pthread_cond_destroy( &arrived ) ;
+    pthread_mutex_destroy( &mutex ) ;
+  }
+  bool isDone() {
+    Lock lock( &mutex ) ;
+    return done ;
+  }
+} ;
+
+template<typename T>
+T syncWait( const Sender<T>& s )
+{
+  // Shared: the receiver can still be unlocking after we've woken and gone.
+  shared_ptr< SyncWaitState<T> > state( new SyncWaitState<T>() ) ;
+  Receiver<T> r ;
+  r.setValue = [state]( T value ) {
+    Lock lock( &state->mutex ) ;
+    state->value.reset( new T( value ) ) ;
+    state->done = 1 ;
+    pthread_cond_signal( &state->arrived ) ;
+  } ;
+  s.start( r ) ;
+
+  if( threadPool && [NSThread isMainThread] ) {
+    // The main thread is a worker too: it helps with the jobs it's waiting on.
+    while( !state->isDone() ) {
+      threadPool->runJobs() ;
+      if( !state->isDone() )
+        sched_yield() ;
+    }
+  }
+  else {
+    Lock lock( &state->mutex ) ;
+    while( !state->done )
+      pthread_cond_wait( &state->arrived, &state->mutex ) ;
+  }
+  return *state->value ;
+}
+
+// schedule / then / bulk / syncWait: values, threads, and a chain started
+// from a worker (so nothing can lean on a sequence point).  Main thread, pool
+// up.  Returns # failures.
+int testSenders() ;
+
+#endif
@@ -0,0 +1,70 @@
+#import "Executor.h"
+
+void ThreadPoolExecutor::execute( const function<void ()>& f ) const
+{
+  if( !threadPool ) {
+    f() ;
+    return ;
+  }
+  threadPool->startWorkOrder( ( new WorkOrder( "execute" ) )->addJob( new Callback0( f ) ) ) ;
+}
+
+// TEST //
+
+static int checkSender( const char* what, bool ok )
+{
+  printf( "  %-52s %s\n", what, ok ? "ok" : "FAIL" ) ;
+  return !ok ;
+}
+
+int testSenders()
+{
+  int failures = 0 ;
+  puts( "testSenders" ) ;
+  ThreadPoolExecutor pool ;
+
+  // A VALUE through a chain: schedule -> then -> then
+  Sender<int> answer = then( then( schedule( pool ), []( Nothing ) { return 6 ; } ), []( int x ) { return x*7 ; } ) ;
+  failures += checkSender( "schedule, then, then, syncWait", syncWait( answer ) == 42 ) ;
+  failures += checkSender( "a sender can be started again", syncWait( answer ) == 42 ) ;
+
+  // then( f returning void ) sends Nothing; schedule runs the rest off the calling thread
+  // (with workers; with none, the main thread runs it in syncWait).
+  atomic<int> ranOnMain( -1 ) ;
+  Sender<Nothing> side = then( schedule( pool ), [&ranOnMain]( Nothing ) { ranOnMain = [NSThread isMainThread] ; } ) ;
+  syncWait( side ) ;
+  failures += checkSender( "then of a void function", ranOnMain != -1 && ( threadPool->getNumWorkers() || ranOnMain == 1 ) ) ;
+
+  // BULK: every index once, then the value carries on
+  const int n = 100000 ;
+  vector<int> hits( n, 0 ) ;
+  int* h = &hits[0] ;
+  Sender<int> counted = then( bulk( then( schedule( pool ), []( Nothing ) { return 3 ; } ), n,
+    [h]( int i, int& add ) { h[i] += add ; } ), []( int add ) { return add + 1 ; } ) ;
+  bool once = syncWait( counted ) == 4 ;
+  for( int i = 0 ; i < n ; i++ )
+    once &= hits[i] == 3 ;
+  failures += checkSender( "bulk: every index once, the value passed on", once ) ;
+
+  // OFF THE MAIN THREAD: a worker starts a chain with a bulk in it and waits
+  // on it.  No sequence point there: bulk's jobs must still run (and finish).
+  if( threadPool->getNumWorkers() >= 2 )
+  {
+    atomic<long long> total( 0 ) ;
+    atomic<int> finished( 0 ) ;
+    ThreadPoolExecutor().execute( [&total, &finished](){
+      Sender<long long> sum = bulk( then( schedule( ThreadPoolExecutor() ), []( Nothing ) { return 0LL ; } ), 1000,
+        [&total]( int i, long long& ) { total += i ; } ) ;
+      syncWait( sum ) ;
+      finished = 1 ;
+    } ) ;
+    while( !finished ) {
+      threadPool->runJobs() ;
+      sched_yield() ;
+    }
+    failures += checkSender( "a chain started and waited on by a worker", total == 999LL*1000/2 ) ;
+  }
+
+  printf( "testSenders: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
@@ -0,0 +1,211 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include "ThreadPool.h"
+
+#include <chrono>
+
+// The display link fires every `animationFrameInterval` vsyncs, so a frame
+// has a fixed BUDGET of time before the next one is due.  The ThreadPool
+// itself doesn't know that.  The FrameScheduler sits next to it and does:
+//   1. Tags jobs with a deadline (absolute time, FrameClock seconds).
+//   2. REQUIRED jobs go to the pool this frame no matter what.
+//   3. DEFERRABLE jobs are held back and the MAIN THREAD picks them up
+//      at the end of the frame, in whatever slack is left.  When the budget
+//      is running low they get pushed to a later frame instead.
+//   4. Counts missed deadlines (jobs that finished late, frames that overran).
+
+// Where the scheduler gets the time from.  Seconds, arbitrary epoch.
+struct FrameClock
+{
+  virtual double now() = 0 ;
+  virtual ~FrameClock(){}
+} ;
+
+// The real clock.  Used when the display link is driving the frames.
+struct SystemFrameClock : public FrameClock
+{
+  double now()
+  {
+    return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count() ;
+  }
+} ;
+
+// Time only moves when you say so.  This lets you run frames headless
+// (no display link, no GL) and get the exact same budget numbers every run.
+struct ManualFrameClock : public FrameClock
+{
+  double t ;
+  pthread_mutex_t mutexT ;
+
+  ManualFrameClock() : t(0.0) {
+    pthread_mutex_init( &mutexT, 0 ) ;
+  }
+  ~ManualFrameClock() {
+    pthread_mutex_destroy( &mutexT ) ;
+  }
+
+  double now() {
+    Lock tLock( &mutexT ) ;
+    return t ;
+  }
+  // A "job" can call this to pretend it took `seconds` to run.
+  void advance( double seconds ) {
+    Lock tLock( &mutexT ) ;
+    t += seconds ;
+  }
+  void set( double seconds ) {
+    Lock tLock( &mutexT ) ;
+    t = seconds ;
+  }
+} ;
+
+struct FrameScheduler ;
+
+// Wraps the user's Callback so we know WHEN it finished relative to its deadline.
+struct DeadlineJob : public Callback
+{
+  FrameScheduler *scheduler ;
+  Callback *callback ;
+  double deadline ;  // absolute, FrameClock time
+  bool deferrable ;
+  int framesDeferred ; // how many times this job got pushed to a later frame
+
+  DeadlineJob( FrameScheduler *iScheduler, Callback *iCallback, double iDeadline, bool iDeferrable ) :
+    scheduler( iScheduler ), callback( iCallback ), deadline( iDeadline ),
+    deferrable( iDeferrable ), framesDeferred( 0 )
+  {
+  }
+
+  ~DeadlineJob() {
+    delete callback ;
+  }
+
+  void exec() ;
+} ;
+
+// Counters for the frames run so far.  Read them any time on the main thread.
+struct FrameStats
+{
+  int frames ;
+  int overrunFrames ;     // frames that went past their vsync deadline
+  int missedDeadlines ;   // jobs that completed after their own deadline
+  int deferredJobs ;      // # of times a deferrable job got pushed to the next frame
+  int slackJobsRun ;      // deferrable jobs the main thread picked up at end of frame
+  double lastFrameTime ;  // seconds, beginFrame() to endFrame()
+
+  FrameStats() { reset() ; }
+  void reset() {
+    frames=overrunFrames=missedDeadlines=deferredJobs=slackJobsRun=0 ;
+    lastFrameTime=0.0 ;
+  }
+  void print() const {
+    printf( "FrameStats: %d frames, %d overran, %d missed deadlines, %d deferrals, %d slack jobs, last frame %.3f ms\n",
+      frames, overrunFrames, missedDeadlines, deferredJobs, slackJobsRun, lastFrameTime*1e3 ) ;
+  }
+} ;
+
+struct FrameScheduler
+{
+  ThreadPool *pool ;
+  FrameClock *clock ;
+
+  double refreshRate ;   // vsyncs per second of the display (60 on every iOS device so far)
+  int frameInterval ;    // same meaning as EAGLView::animationFrameInterval
+  double frameBudget ;   // seconds per frame = frameInterval / refreshRate
+
+  // Don't start a slack job if it would finish closer than this to the vsync.
+  double safetyMargin ;
+
+  int frameNumber ;
+  double frameStart, frameDeadline ;
+
+  FrameStats stats ;
+
+  // Running estimate of how long a deferrable job takes.  Used to decide
+  // whether the main thread can fit one more in before the deadline.
+  double avgSlackJobCost ;
+
+private:
+  bool ownsClock ;
+  WorkOrder *frameWorkOrder ; // REQUIRED jobs for this frame, not yet started
+  bool dispatched ; // dispatch() has been called this frame
+  deque<DeadlineJob*> deferred ; // DEFERRABLE jobs, waiting for slack
+  LockCounter missedDeadlines ; // bumped from worker threads
+  pthread_mutex_t mutexDeferred ;
+
+  // Copying FrameSchedulers forbidden
+  FrameScheduler( const FrameScheduler& o ) {
+    puts( "ERROR: Copying FrameSchedulers should not be done!" ) ;
+  }
+
+public:
+  // Doesn't own the pool.  Pass 0 for the clock to get a SystemFrameClock
+  // (the scheduler owns that one).  A clock you pass in stays yours.
+  FrameScheduler( ThreadPool *iPool, FrameClock *iClock=0, double iRefreshRate=60.0 ) ;
+  ~FrameScheduler() ;
+
+  // Same semantics as the display link's frameInterval.  < 1 is ignored.
+  void setFrameInterval( int iFrameInterval ) ;
+
+  // Marks the start of the frame.  Call on the main thread, first thing in runFrame.
+  void beginFrame() ;
+
+  // Time left before this frame's vsync.  Negative when you've blown it.
+  double remaining() { return frameDeadline - clock->now() ; }
+
+  // Schedules `job` to complete by `deadline` (absolute FrameClock seconds,
+  // use frameDeadline for "this frame").  REQUIRED jobs are sent to the pool on dispatch().
+  // Ones added after this frame's dispatch() go to the pool right away, so
+  // this frame's sequence point still waits for them.
+  // DEFERRABLE jobs wait for slack at endFrame().  The scheduler owns `job`.
+  // Main thread only.
+  void addJob( Callback *job, double deadline, bool isDeferrable ) ;
+  // Due at the end of this frame
+  void addJob( Callback *job ) { addJob( job, frameDeadline, false ) ; }
+  // Whenever there's room, but no later than `framesFromNow` frames out.
+  void addDeferrableJob( Callback *job, int framesFromNow ) {
+    addJob( job, frameDeadline + framesFromNow*frameBudget, true ) ;
+  }
+
+  // Sends this frame's required jobs to the pool.  Workers start crunching.
+  // Deferrable jobs whose deadline is THIS frame get promoted and sent too.
+  void dispatch() ;
+
+  // Main thread picks up slack: runs deferrable jobs while they fit in the
+  // remaining budget, and pushes the rest to the next frame.  Then does the
+  // per-frame accounting.  Call on the main thread, after flipBuffers.
+  void endFrame() ;
+
+  int numDeferred() {
+    Lock dLock( &mutexDeferred ) ;
+    return (int)deferred.size() ;
+  }
+
+  // DeadlineJob reports in here when it finishes.  Any thread.
+  void jobFinished( DeadlineJob *job, double finishTime ) ;
+} ;
+
+// A stand-in for the CADisplayLink.  Drives `frame` at the display rate
+// off a FrameClock so the scheduler can be run without a view or GL context.
+// With a ManualFrameClock it never sleeps: it jumps the clock to each vsync.
+struct HeadlessFrameLoop
+{
+  FrameScheduler *scheduler ;
+
+  HeadlessFrameLoop( FrameScheduler *iScheduler ) : scheduler( iScheduler ) { }
+
+  // Runs `numFrames` frames.  `frame` is your runFrame: it should add jobs,
+  // dispatch(), and reach a sequence point.  beginFrame/endFrame are done for you.
+  void run( int numFrames, function<void ()> frame ) ;
+} ;
+
+extern FrameScheduler *frameScheduler ;
+
+// Headless frames on a ManualFrameClock: vsync pacing, skipped vsyncs after
+// an overrun, missed deadlines, deferrable jobs run in slack or pushed to
+// later frames (or promoted when due), and required jobs added mid-frame.
+// Main thread, pool up.  Returns # failures.
+int testFrameScheduler() ;
+
+#endif
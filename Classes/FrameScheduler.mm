@@ -0,0 +1,323 @@
+#import "FrameScheduler.h"
+
+#include <algorithm>
+#include <unistd.h>
+
+FrameScheduler *frameScheduler = 0 ;
+
+void DeadlineJob::exec()
+{
+  callback->exec() ;
+  scheduler->jobFinished( this, scheduler->clock->now() ) ;
+}
+
+FrameScheduler::FrameScheduler( ThreadPool *iPool, FrameClock *iClock, double iRefreshRate )
+{
+  pool = iPool ;
+  ownsClock = !iClock ;
+  clock = iClock ? iClock : new SystemFrameClock() ;
+  refreshRate = iRefreshRate ;
+  safetyMargin = 0.001 ; // 1ms, presentRenderbuffer needs a little room
+  avgSlackJobCost = 0.0 ;
+  frameNumber = 0 ;
+  frameWorkOrder = 0 ;
+  dispatched = false ;
+  pthread_mutex_init( &mutexDeferred, 0 ) ;
+
+  setFrameInterval( 1 ) ;
+  frameStart = clock->now() ;
+  frameDeadline = frameStart + frameBudget ;
+}
+
+FrameScheduler::~FrameScheduler()
+{
+  // Never started, so nobody else has it.
+  delete frameWorkOrder ;
+
+  pthread_mutex_lock( &mutexDeferred ) ;
+  if( deferred.size() )
+    printf( "WARNING: FrameScheduler being destroyed with %d deferred jobs never run\n", (int)deferred.size() ) ;
+  for( DeadlineJob* job : deferred )
+    delete job ;
+  deferred.clear() ;
+  pthread_mutex_unlock( &mutexDeferred ) ;
+  pthread_mutex_destroy( &mutexDeferred ) ;
+
+  if( ownsClock )
+    delete clock ;
+}
+
+void FrameScheduler::setFrameInterval( int iFrameInterval )
+{
+  // Same rule as the display link: less than one is undefined, so ignore it.
+  if( iFrameInterval < 1 ) {
+    printf( "ERROR: FrameScheduler frame interval %d < 1, ignored\n", iFrameInterval ) ;
+    return ;
+  }
+  frameInterval = iFrameInterval ;
+  frameBudget = frameInterval / refreshRate ;
+}
+
+void FrameScheduler::beginFrame()
+{
+  frameNumber++ ;
+  frameStart = clock->now() ;
+  frameDeadline = frameStart + frameBudget ;
+  dispatched = false ;
+}
+
+void FrameScheduler::addJob( Callback *job, double deadline, bool isDeferrable )
+{
+  DeadlineJob *dj = new DeadlineJob( this, job, deadline, isDeferrable ) ;
+
+  if( !isDeferrable )
+  {
+    if( !frameWorkOrder ) {
+      char b[64];  sprintf( b, "frame %d", frameNumber ) ;
+      frameWorkOrder = new WorkOrder( b ) ;
+    }
+    frameWorkOrder->addJob( dj ) ;
+    // Too late for this frame's dispatch, so it goes on its own.
+    if( dispatched )
+      dispatch() ;
+    return ;
+  }
+
+  // Earliest deadline first.  Equal deadlines stay in the order they were added.
+  Lock dLock( &mutexDeferred ) ;
+  deque<DeadlineJob*>::iterator iter = deferred.begin() ;
+  while( iter != deferred.end() && (*iter)->deadline <= deadline )
+    ++iter ;
+  deferred.insert( iter, dj ) ;
+}
+
+void FrameScheduler::dispatch()
+{
+  // Deferrable jobs that are due by this vsync can't wait for slack any
+  // longer, they get promoted to required and go to the workers now.
+  pthread_mutex_lock( &mutexDeferred ) ;
+  while( deferred.size() && deferred.front()->deadline <= frameDeadline )
+  {
+    if( !frameWorkOrder ) {
+      char b[64];  sprintf( b, "frame %d", frameNumber ) ;
+      frameWorkOrder = new WorkOrder( b ) ;
+    }
+    frameWorkOrder->addJob( deferred.front() ) ;
+    deferred.pop_front() ;
+  }
+  pthread_mutex_unlock( &mutexDeferred ) ;
+
+  dispatched = true ;
+  if( !frameWorkOrder )  return ; // nothing required this frame
+
+  if( pool )  pool->startWorkOrder( frameWorkOrder ) ; // the pool deletes it when it's done
+  else
+  {
+    // No pool (yet).  Required means required, so run them here.
+    frameWorkOrder->finishedSubmission() ;
+    frameWorkOrder->runAll() ;
+    delete frameWorkOrder ;
+  }
+  frameWorkOrder = 0 ;
+}
+
+void FrameScheduler::endFrame()
+{
+  double now = clock->now() ;
+
+  // SLACK.  Whatever time is left before the vsync, the main thread spends
+  // on deferrable jobs, earliest deadline first.  We only start a job we
+  // expect to finish in time, using the running average of what they've cost.
+  while( 1 )
+  {
+    if( now + avgSlackJobCost + safetyMargin > frameDeadline )
+      break ; // budget is low. the rest wait.
+
+    pthread_mutex_lock( &mutexDeferred ) ;
+    if( !deferred.size() ) {
+      pthread_mutex_unlock( &mutexDeferred ) ;
+      break ;
+    }
+    DeadlineJob *job = deferred.front() ;
+    deferred.pop_front() ;
+    pthread_mutex_unlock( &mutexDeferred ) ;
+
+    job->exec() ;
+    delete job ;
+
+    double after = clock->now() ;
+    double cost = after - now ;
+    // first sample sets it, after that it's a slow moving average
+    avgSlackJobCost = stats.slackJobsRun ? 0.875*avgSlackJobCost + 0.125*cost : cost ;
+    stats.slackJobsRun++ ;
+    now = after ;
+  }
+
+  // Everything still waiting got pushed to a later frame.
+  pthread_mutex_lock( &mutexDeferred ) ;
+  for( DeadlineJob* job : deferred )
+    job->framesDeferred++ ;
+  stats.deferredJobs += (int)deferred.size() ;
+  pthread_mutex_unlock( &mutexDeferred ) ;
+
+  stats.frames++ ;
+  stats.lastFrameTime = now - frameStart ;
+  if( now > frameDeadline )
+    stats.overrunFrames++ ;
+  stats.missedDeadlines = missedDeadlines.read() ;
+}
+
+void FrameScheduler::jobFinished( DeadlineJob *job, double finishTime )
+{
+  if( finishTime > job->deadline )
+    ++missedDeadlines ;
+}
+
+void HeadlessFrameLoop::run( int numFrames, function<void ()> frame )
+{
+  FrameClock *clock = scheduler->clock ;
+  ManualFrameClock *manual = dynamic_cast<ManualFrameClock*>( clock ) ;
+
+  double vsync = clock->now() ;
+  for( int i = 0 ; i < numFrames ; i++ )
+  {
+    // If the last frame overran, the display link would just fire on the
+    // next vsync after that, so we skip the vsyncs we missed.
+    double now = clock->now() ;
+    while( vsync < now )
+      vsync += scheduler->frameBudget ;
+
+    if( manual )  manual->set( vsync ) ;
+    else  usleep( (useconds_t)( (vsync - now)*1e6 ) ) ;
+
+    scheduler->beginFrame() ;
+    frame() ;
+    scheduler->endFrame() ;
+
+    vsync += scheduler->frameBudget ;
+  }
+}
+
+
+
+// TEST //
+
+static int checkFrames( const char* what, bool ok )
+{
+  printf( "  %-52s %s\n", what, ok ? "ok" : "FAIL" ) ;
+  return !ok ;
+}
+
+int testFrameScheduler()
+{
+  int failures = 0 ;
+  puts( "testFrameScheduler" ) ;
+  ManualFrameClock clock ;
+
+  // PACING: light frames start exactly one budget apart, and none overrun.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    vector<double> starts ;
+    loop.run( 10, [&](){
+      starts.push_back( fs.frameStart ) ;
+      clock.advance( 0.25*fs.frameBudget ) ;
+    } ) ;
+    bool paced = starts.size() == 10 ;
+    for( int i = 1 ; i < (int)starts.size() ; i++ )
+      paced &= fabs( starts[i] - starts[i-1] - fs.frameBudget ) < 1e-9 ;
+    failures += checkFrames( "light frames start one budget apart", paced && fs.stats.frames == 10 && !fs.stats.overrunFrames ) ;
+  }
+
+  // OVERRUN: a frame of 1.5 budgets counts as overrun, and the next one
+  // starts on the vsync after the one it missed.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    vector<double> starts ;
+    loop.run( 4, [&](){
+      starts.push_back( fs.frameStart ) ;
+      if( starts.size() == 2 )  clock.advance( 1.5*fs.frameBudget ) ;
+    } ) ;
+    bool skipped = fabs( starts[2] - starts[1] - 2*fs.frameBudget ) < 1e-9 &&
+                   fabs( starts[3] - starts[2] - fs.frameBudget ) < 1e-9 ;
+    failures += checkFrames( "an overrun frame skips the vsync it missed", skipped && fs.stats.overrunFrames == 1 ) ;
+  }
+
+  // DEADLINES: required jobs that finish in time don't count, one that
+  // finishes past its frame's deadline does.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    int frame = 0 ;
+    loop.run( 2, [&](){
+      if( ++frame == 1 )
+        for( int i = 0 ; i < 3 ; i++ )
+          fs.addJob( new Callback0( [&clock](){ clock.advance( 0.001 ) ; } ) ) ;
+      else
+        fs.addJob( new Callback0( [&clock, &fs](){ clock.advance( 1.2*fs.frameBudget ) ; } ) ) ;
+      fs.dispatch() ;
+      threadPool->sequencePoint( 0 ) ;
+    } ) ;
+    failures += checkFrames( "a late required job is a missed deadline", fs.stats.missedDeadlines == 1 && fs.stats.overrunFrames == 1 ) ;
+  }
+
+  // DEFERRAL: 5 deferrable jobs of 6ms in a 16.7ms frame.  The main thread
+  // fits 2 in the slack (the 3rd would pass the vsync), pushes 3 to the
+  // next frame, fits 2 of those, and the last one the frame after.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    int frame = 0, ran = 0 ;
+    bool afterFirst = false ;
+    loop.run( 3, [&](){
+      if( ++frame == 1 )
+        for( int i = 0 ; i < 5 ; i++ )
+          fs.addDeferrableJob( new Callback0( [&clock, &ran](){ clock.advance( 0.006 ) ; ran++ ; } ), 10 ) ;
+      else if( frame == 2 )
+        afterFirst = ran == 2 && fs.numDeferred() == 3 ;
+      fs.dispatch() ;
+    } ) ;
+    failures += checkFrames( "deferrable jobs run in slack, 2 a frame", afterFirst && ran == 5 && fs.stats.slackJobsRun == 5 ) ;
+    failures += checkFrames( "the rest pushed to later frames", fs.stats.deferredJobs == 3 + 1 && !fs.numDeferred() && !fs.stats.overrunFrames ) ;
+  }
+
+  // PROMOTED: in a frame with no slack left, a deferrable job due this
+  // frame goes to the workers at dispatch(), one due later waits.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    LockCounter dueNow, dueLater ;
+    bool promoted = false ;
+    loop.run( 1, [&](){
+      clock.advance( fs.frameBudget - 0.0005 ) ;
+      fs.addDeferrableJob( new Callback0( [&dueNow](){ ++dueNow ; } ), 0 ) ;
+      fs.addDeferrableJob( new Callback0( [&dueLater](){ ++dueLater ; } ), 2 ) ;
+      fs.dispatch() ;
+      threadPool->sequencePoint( 0 ) ;
+      promoted = dueNow.read() == 1 ;
+    } ) ;
+    failures += checkFrames( "a deferrable job due this frame is promoted", promoted && !dueLater.read() && fs.numDeferred() == 1 ) ;
+    loop.run( 1, [&](){ fs.dispatch() ; } ) ; // runs the other one, in the slack
+  }
+
+  // MID-FRAME: a required job added after dispatch() still makes this
+  // frame's sequence point.
+  {
+    FrameScheduler fs( threadPool, &clock ) ;
+    HeadlessFrameLoop loop( &fs ) ;
+    LockCounter early, late ;
+    bool inTime = false ;
+    loop.run( 1, [&](){
+      fs.addJob( new Callback0( [&early](){ ++early ; } ) ) ;
+      fs.dispatch() ;
+      fs.addJob( new Callback0( [&late](){ ++late ; } ) ) ;
+      threadPool->sequencePoint( 0 ) ;
+      inTime = early.read() == 1 && late.read() == 1 ;
+    } ) ;
+    failures += checkFrames( "a required job added after dispatch runs this frame", inTime ) ;
+  }
+
+  printf( "testFrameScheduler: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
@@ -0,0 +1,167 @@
+#ifndef FRAMETELEMETRY_H
+#define FRAMETELEMETRY_H
+
+#include "PhaseTimer.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std ;
+
+// Where the MAIN THREAD's frame time goes, phase by phase:
+//
+//   prerender   [self prerender:]                      clear, viewport, matrices
+//   submit      building WorkOrders and startWorkOrder  (parallelFor's too)
+//   runJobs     the main thread running pool jobs       (runJobs, sequencePoint)
+//   wait        blocked in mainThreadBlockUntilAllJobsFinished
+//   draw        drawPC and friends, DrawCommandList::replay
+//   flip        [self flipBuffers]
+//   other       everything else (work done right on the main thread, the
+//               FrameScheduler's slack jobs)
+//
+// The phases tile the frame: every microsecond between beginFrame() and
+// endFrame() goes to exactly one of them.  A PhaseTimer inside another
+// (a job run by runJobs that calls startWorkOrder) takes over until it ends,
+// then the outer one carries on.  So the phases add up to the frame time.
+//
+// Each phase keeps the last `windowFrames` frames in a ROLLING HISTOGRAM
+// (quarter octave buckets from 1us), for p50/p95/p99 that follow what the
+// app is doing now, not since launch.  Read them with percentile(), print(),
+// writeCSV()/writeJSON(), or publish() a shared memory block that a tool
+// outside the app can mmap and read while the app runs (readFrameTelemetryBlock).
+//
+// Only the main thread is timed: PhaseTimers on any other thread do nothing.
+// With no `frameTelemetry`, or outside a frame, they do nothing either.
+// FramePhase and PhaseTimer are in PhaseTimer.h.
+
+// The whole frame, where a phase number is expected (percentile( FramePhaseTotal, .. ))
+#define FramePhaseTotal NumFramePhases
+
+const char* framePhaseName( int phase ) ; // "total" for FramePhaseTotal
+
+// Bucket 0 is < 1us, bucket b >= 1 is [ 2^((b-1)/4), 2^(b/4) ) us.  95 covers 13 s.
+#define PHASE_BUCKETS 96
+
+struct PhaseHistogram
+{
+  int count ;
+  int buckets[ PHASE_BUCKETS ] ;
+
+  PhaseHistogram() { reset() ; }
+  void reset() {
+    count = 0 ;
+    for( int b = 0 ; b < PHASE_BUCKETS ; b++ )  buckets[b] = 0 ;
+  }
+  static int bucketOf( double seconds ) ;
+  static double bucketLow( int b ) ;   // seconds
+  static double bucketHigh( int b ) ;
+  void add( double seconds ) { buckets[ bucketOf( seconds ) ]++ ;  count++ ; }
+  void remove( double seconds ) { buckets[ bucketOf( seconds ) ]-- ;  count-- ; }
+  // Interpolated inside the bucket the `p` (0..1) percentile falls in, seconds
+  double percentile( double p ) const ;
+} ;
+
+// What publish() writes, every frame.  Plain old data, so a reader built
+// from this header can map it.  Little endian, same as the app.
+#define FRAME_TELEMETRY_MAGIC   0x4D454C45544D5246ULL // "FRMTELEM"
+#define FRAME_TELEMETRY_VERSION 1
+
+struct FramePhaseStats
+{
+  char name[16] ;
+  float lastMs, avgMs, p50Ms, p95Ms, p99Ms, maxMs ; // over the window
+} ;
+
+struct FrameTelemetryBlock
+{
+  uint64_t magic ;
+  uint32_t version ;
+  uint32_t blockBytes ;           // sizeof( FrameTelemetryBlock )
+  // SEQLOCK: odd while the app is writing.  A reader copies the block, and
+  // keeps it only if this was even and unchanged before and after.
+  volatile uint32_t sequence ;
+  uint32_t numPhases ;            // NumFramePhases + 1, the total is last
+  uint32_t windowFrames ;         // frames in the window now
+  uint32_t reserved ;
+  uint64_t frames ;               // since the FrameTelemetry was made
+  FramePhaseStats phases[ NumFramePhases + 1 ] ;
+  int32_t histograms[ NumFramePhases + 1 ][ PHASE_BUCKETS ] ;
+} ;
+
+struct FrameTelemetry
+{
+  pthread_t mainThread ;
+  bool inFrame ;
+  int frames ;
+
+private:
+  // THIS FRAME
+  double frameStart, since ;      // since: when the current phase last took over
+  int stack[ 16 ], depth ;        // stack[depth] is the current phase
+  int overflow ;                  // timers entered past the top of stack: they credit stack[depth]
+  double phaseTime[ NumFramePhases ] ;
+
+  // THE WINDOW: the last windowFrames frames, [frame][phase], the total last
+  int windowFrames, windowNext, windowFilled ;
+  vector<float> window ;
+  PhaseHistogram histograms[ NumFramePhases + 1 ] ;
+
+  // publish()
+  int blockFd ;
+  FrameTelemetryBlock *block ;
+
+  // Copying FrameTelemetrys forbidden
+  FrameTelemetry( const FrameTelemetry& o ) {
+    puts( "ERROR: Copying FrameTelemetry should not be done!" ) ;
+  }
+
+  void credit( double now ) ;
+  void updateBlock() ;
+
+public:
+  // Make it on the main thread: that's the thread it times.
+  FrameTelemetry( int iWindowFrames=600 ) ;
+  ~FrameTelemetry() ;
+
+  inline bool onMainThread() const { return pthread_equal( pthread_self(), mainThread ) ; }
+
+  // First and last thing in runFrame.
+  void beginFrame() ;
+  void endFrame() ;
+
+  // PhaseTimer's side.  Main thread, in a frame.
+  void enter( FramePhase phase ) ;
+  void leave() ;
+
+  // Over the window.  `phase` is a FramePhase or FramePhaseTotal.  Seconds.
+  double last( int phase ) const ;
+  double average( int phase ) const ;
+  double maximum( int phase ) const ;
+  double percentile( int phase, double p ) const { return histograms[ phase ].percentile( p ) ; }
+  int framesInWindow() const { return windowFilled ; }
+
+  void print() const ;
+  // false (and why, printed) if the file couldn't be written
+  bool writeCSV( const string& path ) const ;
+  bool writeJSON( const string& path ) const ;
+
+  // Creates (or reuses) `path` as a FrameTelemetryBlock, mapped shared, and
+  // rewrites it at every endFrame().  false if it couldn't.
+  bool publish( const string& path ) ;
+
+  FramePhaseStats stats( int phase ) const ;
+} ;
+
+// The tool's side: copies a consistent snapshot of the block at `path`.
+// false if there's no block there (or it's from another version).
+bool readFrameTelemetryBlock( const string& path, FrameTelemetryBlock& out ) ;
+
+// Runs frames whose phases take known times (with every 10th frame's draw
+// 3x as long), checks the phases add up to the frame, the percentiles land
+// where they should, nesting credits the inner phase, and the CSV, JSON and
+// shared block come out matching.  Uses $TMPDIR.  Main thread, pool up (or
+// not).  Returns # failures.
+int testFrameTelemetry( int numFrames ) ;
+
+#endif
@@ -0,0 +1,420 @@
+#import "FrameTelemetry.h"
+#import "ThreadPool.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+FrameTelemetry *frameTelemetry = 0 ;
+
+static double telemetryNow()
+{
+  return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count() ;
+}
+
+const char* framePhaseName( int phase )
+{
+  static const char* names[] = { "other", "prerender", "submit", "runJobs", "wait", "draw", "flip", "total" } ;
+  return phase >= 0 && phase <= FramePhaseTotal ? names[ phase ] : "?" ;
+}
+
+// HISTOGRAM //
+
+int PhaseHistogram::bucketOf( double seconds )
+{
+  double us = seconds * 1e6 ;
+  if( us < 1.0 )  return 0 ;
+  int b = 1 + (int)( 4.0 * log2( us ) ) ;
+  return b < PHASE_BUCKETS ? b : PHASE_BUCKETS - 1 ;
+}
+
+double PhaseHistogram::bucketLow( int b ) { return b ? exp2( ( b - 1 ) / 4.0 ) * 1e-6 : 0.0 ; }
+double PhaseHistogram::bucketHigh( int b ) { return exp2( b / 4.0 ) * 1e-6 ; }
+
+double PhaseHistogram::percentile( double p ) const
+{
+  if( !count )  return 0.0 ;
+  double rank = p * count ; // how many samples are at or below the answer
+  int below = 0 ;
+  for( int b = 0 ; b < PHASE_BUCKETS ; b++ )
+  {
+    if( below + buckets[b] >= rank && buckets[b] ) {
+      // Linearly between the bucket's edges, by how far into it the rank is.
+      double t = ( rank - below ) / buckets[b] ;
+      return bucketLow( b ) + t * ( bucketHigh( b ) - bucketLow( b ) ) ;
+    }
+    below += buckets[b] ;
+  }
+  return bucketHigh( PHASE_BUCKETS - 1 ) ;
+}
+
+// FRAMETELEMETRY //
+
+FrameTelemetry::FrameTelemetry( int iWindowFrames ) :
+  mainThread( pthread_self() ), inFrame( 0 ), frames( 0 ), frameStart( 0 ), since( 0 ), depth( 0 ), overflow( 0 ),
+  windowFrames( iWindowFrames < 1 ? 1 : iWindowFrames ), windowNext( 0 ), windowFilled( 0 ),
+  blockFd( -1 ), block( 0 )
+{
+  window.resize( windowFrames * ( NumFramePhases + 1 ) ) ;
+  for( int p = 0 ; p < NumFramePhases ; p++ )  phaseTime[p] = 0.0 ;
+}
+
+FrameTelemetry::~FrameTelemetry()
+{
+  if( block )  munmap( block, sizeof( FrameTelemetryBlock ) ) ;
+  if( blockFd >= 0 )  close( blockFd ) ;
+}
+
+// The current phase gets the time since it last took over.
+void FrameTelemetry::credit( double now )
+{
+  phaseTime[ stack[ depth ] ] += now - since ;
+  since = now ;
+}
+
+void FrameTelemetry::beginFrame()
+{
+  if( inFrame )
+    puts( "ERROR: FrameTelemetry::beginFrame twice without an endFrame" ) ;
+  for( int p = 0 ; p < NumFramePhases ; p++ )  phaseTime[p] = 0.0 ;
+  depth = overflow = 0 ;
+  stack[0] = PhaseOther ;
+  frameStart = since = telemetryNow() ;
+  inFrame = 1 ;
+}
+
+void FrameTelemetry::enter( FramePhase phase )
+{
+  credit( telemetryNow() ) ;
+  if( overflow || depth + 1 >= (int)( sizeof( stack ) / sizeof( stack[0] ) ) ) {
+    if( !overflow )
+      puts( "ERROR: FrameTelemetry: PhaseTimers nested too deep, crediting the outer phase" ) ;
+    overflow++ ; // the matching leave()s come off this first
+    return ;
+  }
+  stack[ ++depth ] = phase ;
+}
+
+void FrameTelemetry::leave()
+{
+  credit( telemetryNow() ) ;
+  if( overflow )  overflow-- ;
+  else if( depth > 0 )  depth-- ;
+}
+
+FrameTelemetry* phaseTimerEnter( FramePhase phase )
+{
+  FrameTelemetry *telemetry = frameTelemetry ;
+  if( !telemetry || !telemetry->inFrame || !telemetry->onMainThread() )  return 0 ;
+  telemetry->enter( phase ) ;
+  return telemetry ;
+}
+
+void phaseTimerLeave( FrameTelemetry *telemetry )
+{
+  telemetry->leave() ;
+}
+
+void FrameTelemetry::endFrame()
+{
+  if( !inFrame )  return ;
+  double now = telemetryNow() ;
+  credit( now ) ;
+  if( depth + overflow )
+    printf( "ERROR: FrameTelemetry::endFrame with %d PhaseTimers still running\n", depth + overflow ) ;
+  inFrame = 0 ;
+  frames++ ;
+
+  // Into the window, pushing the oldest frame out of the histograms if it's full.
+  float *row = &window[ windowNext * ( NumFramePhases + 1 ) ] ;
+  if( windowFilled == windowFrames )
+    for( int p = 0 ; p <= NumFramePhases ; p++ )
+      histograms[p].remove( row[p] ) ;
+  else
+    windowFilled++ ;
+  for( int p = 0 ; p < NumFramePhases ; p++ )
+    row[p] = (float)phaseTime[p] ;
+  row[ NumFramePhases ] = (float)( now - frameStart ) ;
+  for( int p = 0 ; p <= NumFramePhases ; p++ )
+    histograms[p].add( row[p] ) ;
+  windowNext = ( windowNext + 1 ) % windowFrames ;
+
+  if( block )  updateBlock() ;
+}
+
+double FrameTelemetry::last( int phase ) const
+{
+  if( !windowFilled )  return 0.0 ;
+  int lastFrame = ( windowNext + windowFrames - 1 ) % windowFrames ;
+  return window[ lastFrame * ( NumFramePhases + 1 ) + phase ] ;
+}
+
+double FrameTelemetry::average( int phase ) const
+{
+  double sum = 0.0 ;
+  for( int f = 0 ; f < windowFilled ; f++ )
+    sum += window[ f * ( NumFramePhases + 1 ) + phase ] ;
+  return windowFilled ? sum / windowFilled : 0.0 ;
+}
+
+double FrameTelemetry::maximum( int phase ) const
+{
+  double m = 0.0 ;
+  for( int f = 0 ; f < windowFilled ; f++ )
+    m = max( m, (double)window[ f * ( NumFramePhases + 1 ) + phase ] ) ;
+  return m ;
+}
+
+FramePhaseStats FrameTelemetry::stats( int phase ) const
+{
+  FramePhaseStats s ;
+  memset( &s, 0, sizeof( s ) ) ;
+  strncpy( s.name, framePhaseName( phase ), sizeof( s.name ) - 1 ) ;
+  s.lastMs = (float)( last( phase ) * 1e3 ) ;
+  s.avgMs = (float)( average( phase ) * 1e3 ) ;
+  s.p50Ms = (float)( percentile( phase, 0.50 ) * 1e3 ) ;
+  s.p95Ms = (float)( percentile( phase, 0.95 ) * 1e3 ) ;
+  s.p99Ms = (float)( percentile( phase, 0.99 ) * 1e3 ) ;
+  s.maxMs = (float)( maximum( phase ) * 1e3 ) ;
+  return s ;
+}
+
+void FrameTelemetry::print() const
+{
+  printf( "FrameTelemetry: last %d frames (of %d), ms\n", windowFilled, frames ) ;
+  printf( "  %-10s %8s %8s %8s %8s %8s\n", "phase", "avg", "p50", "p95", "p99", "max" ) ;
+  for( int p = 0 ; p <= NumFramePhases ; p++ ) {
+    FramePhaseStats s = stats( p ) ;
+    printf( "  %-10s %8.3f %8.3f %8.3f %8.3f %8.3f\n", s.name, s.avgMs, s.p50Ms, s.p95Ms, s.p99Ms, s.maxMs ) ;
+  }
+}
+
+// EXPORT //
+
+bool FrameTelemetry::writeCSV( const string& path ) const
+{
+  FILE *f = fopen( path.c_str(), "w" ) ;
+  if( !f ) {
+    printf( "ERROR: FrameTelemetry couldn't write %s\n", path.c_str() ) ;
+    return false ;
+  }
+  fprintf( f, "phase,frames,last_ms,avg_ms,p50_ms,p95_ms,p99_ms,max_ms\n" ) ;
+  for( int p = 0 ; p <= NumFramePhases ; p++ ) {
+    FramePhaseStats s = stats( p ) ;
+    fprintf( f, "%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", s.name, windowFilled,
+      s.lastMs, s.avgMs, s.p50Ms, s.p95Ms, s.p99Ms, s.maxMs ) ;
+  }
+  return fclose( f ) == 0 ;
+}
+
+bool FrameTelemetry::writeJSON( const string& path ) const
+{
+  FILE *f = fopen( path.c_str(), "w" ) ;
+  if( !f ) {
+    printf( "ERROR: FrameTelemetry couldn't write %s\n", path.c_str() ) ;
+    return false ;
+  }
+  fprintf( f, "{\n  \"frames\": %d,\n  \"windowFrames\": %d,\n", frames, windowFilled ) ;
+  fprintf( f, "  \"bucketsUs\": \"bucket 0 is < 1us, bucket b is [2^((b-1)/4), 2^(b/4)) us\",\n" ) ;
+  fprintf( f, "  \"phases\": {\n" ) ;
+  for( int p = 0 ; p <= NumFramePhases ; p++ )
+  {
+    FramePhaseStats s = stats( p ) ;
+    fprintf( f, "    \"%s\": { \"lastMs\": %.4f, \"avgMs\": %.4f, \"p50Ms\": %.4f, \"p95Ms\": %.4f, \"p99Ms\": %.4f, \"maxMs\": %.4f,\n",
+      s.name, s.lastMs, s.avgMs, s.p50Ms, s.p95Ms, s.p99Ms, s.maxMs ) ;
+    // Up to the last non empty bucket
+    int used = PHASE_BUCKETS ;
+    while( used && !histograms[p].buckets[ used - 1 ] )  used-- ;
+    fprintf( f, "      \"buckets\": [" ) ;
+    for( int b = 0 ; b < used ; b++ )
+      fprintf( f, b ? ",%d" : "%d", histograms[p].buckets[b] ) ;
+    fprintf( f, "] }%s\n", p < NumFramePhases ? "," : "" ) ;
+  }
+  fprintf( f, "  }\n}\n" ) ;
+  return fclose( f ) == 0 ;
+}
+
+bool FrameTelemetry::publish( const string& path )
+{
+  int fd = open( path.c_str(), O_RDWR | O_CREAT, 0644 ) ;
+  if( fd < 0 || ftruncate( fd, sizeof( FrameTelemetryBlock ) ) ) {
+    printf( "ERROR: FrameTelemetry couldn't make the shared block %s\n", path.c_str() ) ;
+    if( fd >= 0 )  close( fd ) ;
+    return false ;
+  }
+  void *mem = mmap( 0, sizeof( FrameTelemetryBlock ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+  if( mem == MAP_FAILED ) {
+    printf( "ERROR: FrameTelemetry couldn't map the shared block %s\n", path.c_str() ) ;
+    close( fd ) ;
+    return false ;
+  }
+  if( block )  munmap( block, sizeof( FrameTelemetryBlock ) ) ;
+  if( blockFd >= 0 )  close( blockFd ) ;
+  block = (FrameTelemetryBlock*)mem ;
+  blockFd = fd ;
+
+  memset( block, 0, sizeof( FrameTelemetryBlock ) ) ;
+  block->version = FRAME_TELEMETRY_VERSION ;
+  block->blockBytes = sizeof( FrameTelemetryBlock ) ;
+  block->numPhases = NumFramePhases + 1 ;
+  updateBlock() ;
+  __sync_synchronize() ;
+  block->magic = FRAME_TELEMETRY_MAGIC ; // last: a reader that sees it sees the rest
+  return true ;
+}
+
+void FrameTelemetry::updateBlock()
+{
+  block->sequence++ ; // odd: writing
+  __sync_synchronize() ;
+  block->windowFrames = windowFilled ;
+  block->frames = frames ;
+  for( int p = 0 ; p <= NumFramePhases ; p++ ) {
+    block->phases[p] = stats( p ) ;
+    memcpy( block->histograms[p], histograms[p].buckets, sizeof( block->histograms[p] ) ) ;
+  }
+  __sync_synchronize() ;
+  block->sequence++ ; // even: done
+}
+
+bool readFrameTelemetryBlock( const string& path, FrameTelemetryBlock& out )
+{
+  int fd = open( path.c_str(), O_RDONLY ) ;
+  if( fd < 0 )  return false ;
+  void *mem = mmap( 0, sizeof( FrameTelemetryBlock ), PROT_READ, MAP_SHARED, fd, 0 ) ;
+  close( fd ) ;
+  if( mem == MAP_FAILED )  return false ;
+  const FrameTelemetryBlock *block = (const FrameTelemetryBlock*)mem ;
+
+  bool ok = 0 ;
+  if( block->magic == FRAME_TELEMETRY_MAGIC && block->version == FRAME_TELEMETRY_VERSION &&
+      block->blockBytes == sizeof( FrameTelemetryBlock ) )
+    for( int tries = 0 ; tries < 1000 && !ok ; tries++ )
+    {
+      uint32_t before = block->sequence ;
+      __sync_synchronize() ;
+      memcpy( &out, block, sizeof( out ) ) ;
+      __sync_synchronize() ;
+      ok = !( before & 1 ) && before == block->sequence ;
+      if( !ok )  usleep( 100 ) ; // the app's writing it this moment
+    }
+  munmap( mem, sizeof( FrameTelemetryBlock ) ) ;
+  return ok ;
+}
+
+// TEST //
+
+static void spinFor( double seconds )
+{
+  double start = telemetryNow() ;
+  while( telemetryNow() - start < seconds ) ;
+}
+
+// `levels` PhaseTimers, each inside the last
+static void nestTimers( int levels )
+{
+  if( !levels )  return ;
+  PhaseTimer t( PhaseSubmit ) ;
+  nestTimers( levels - 1 ) ;
+}
+
+int testFrameTelemetry( int numFrames )
+{
+  int failures = 0 ;
+  printf( "testFrameTelemetry: %d frames\n", numFrames ) ;
+  const char *tmp = getenv( "TMPDIR" ) ;
+  string dir = tmp ? tmp : "/tmp" ;
+
+  FrameTelemetry *saved = frameTelemetry ;
+  FrameTelemetry telemetry( numFrames ) ;
+  frameTelemetry = &telemetry ;
+  if( !telemetry.publish( dir + "/threaden_telemetry.block" ) )
+    failures++ ;
+
+  PhaseTimer offFrame( PhaseDraw ) ; // outside a frame: does nothing
+  double phaseSum = 0, frameSum = 0 ;
+  for( int f = 0 ; f < numFrames ; f++ )
+  {
+    telemetry.beginFrame() ;
+    { PhaseTimer t( PhasePrerender ) ;  spinFor( 0.0002 ) ; }
+    forEachChunk( "telemetry test", 64, 8, []( int start, int end ) { spinFor( 0.00005 ) ; } ) ;
+    spinFor( 0.0003 ) ; // other
+    {
+      PhaseTimer t( PhaseDraw ) ;
+      spinFor( f % 10 == 9 ? 0.003 : 0.001 ) ;
+      { PhaseTimer inner( PhaseSubmit ) ;  spinFor( 0.0001 ) ; } // nested: submit's, not draw's
+    }
+    { PhaseTimer t( PhaseFlip ) ;  spinFor( 0.0001 ) ; }
+    telemetry.endFrame() ;
+
+    double sum = 0 ;
+    for( int p = 0 ; p < NumFramePhases ; p++ )  sum += telemetry.last( p ) ;
+    phaseSum += sum ;
+    frameSum += telemetry.last( FramePhaseTotal ) ;
+  }
+  telemetry.print() ;
+
+  // Phases tile the frame (floats in the window: a little rounding).
+  bool tiles = fabs( phaseSum - frameSum ) < 1e-4 * numFrames ;
+  // 9 frames in 10 draw 1ms, 1 in 10 3ms: p50 ~1ms, p95 and p99 ~3ms.  The
+  // buckets are 19% wide, interpolated; spins on a busy machine run long.
+  double p50 = telemetry.percentile( PhaseDraw, 0.50 ), p95 = telemetry.percentile( PhaseDraw, 0.95 ) ;
+  double p99 = telemetry.percentile( PhaseDraw, 0.99 ) ;
+  bool percentiles = p50 > 0.0008 && p50 < 0.0015 && p95 > 0.0025 && p95 < 0.0045 && p99 > 0.0025 && p99 < 0.0045 ;
+  bool nested = telemetry.average( PhaseSubmit ) >= 0.0001 && telemetry.average( PhaseDraw ) < 0.0013 * 1.5 ;
+  // The parallelFor's 3.2ms of jobs goes to submit/runJobs/wait (which, depends on
+  // who ran them), none of it to "other", which only spins 0.3ms.
+  bool workCounted = telemetry.average( PhaseOther ) < 0.0003 * 1.5 &&
+    telemetry.average( PhaseSubmit ) + telemetry.average( PhaseRunJobs ) + telemetry.average( PhaseWait ) > 0.0001 ;
+  printf( "  draw p50 %.3f p95 %.3f p99 %.3f ms\n", p50*1e3, p95*1e3, p99*1e3 ) ;
+  printf( "  %-44s %s\n", "phases add up to the frame", tiles ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "percentiles where they should be", percentiles ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "nested timer credits the inner phase", nested ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "parallelFor isn't counted as other", workCounted ? "ok" : "FAIL" ) ;
+  failures += !tiles + !percentiles + !nested + !workCounted ;
+
+  // EXPORTS
+  string csvPath = dir + "/threaden_telemetry.csv", jsonPath = dir + "/threaden_telemetry.json" ;
+  bool wrote = telemetry.writeCSV( csvPath ) && telemetry.writeJSON( jsonPath ) ;
+  int csvLines = 0 ;
+  if( FILE *f = fopen( csvPath.c_str(), "r" ) ) {
+    char line[256] ;
+    while( fgets( line, sizeof( line ), f ) )  csvLines++ ;
+    fclose( f ) ;
+  }
+  bool csvOk = wrote && csvLines == NumFramePhases + 2 ; // header, phases, total
+
+  FrameTelemetryBlock read ;
+  bool blockOk = readFrameTelemetryBlock( dir + "/threaden_telemetry.block", read ) &&
+    read.frames == (uint64_t)numFrames && read.numPhases == NumFramePhases + 1 &&
+    !strcmp( read.phases[ PhaseDraw ].name, "draw" ) &&
+    read.phases[ PhaseDraw ].p50Ms == telemetry.stats( PhaseDraw ).p50Ms ;
+  int histogramTotal = 0 ;
+  for( int b = 0 ; b < PHASE_BUCKETS ; b++ )  histogramTotal += read.histograms[ PhaseDraw ][b] ;
+  blockOk = blockOk && histogramTotal == numFrames ;
+  printf( "  %-44s %s\n", "CSV and JSON written", csvOk ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "shared block reads back the same", blockOk ? "ok" : "FAIL" ) ;
+  failures += !csvOk + !blockOk ;
+  unlink( csvPath.c_str() ) ;
+  unlink( jsonPath.c_str() ) ;
+  unlink( ( dir + "/threaden_telemetry.block" ).c_str() ) ;
+
+  // TOO DEEP: 40 timers inside draw's.  Coming back out, draw is current again.
+  telemetry.beginFrame() ;
+  {
+    PhaseTimer t( PhaseDraw ) ;
+    nestTimers( 40 ) ;
+    spinFor( 0.001 ) ;
+  }
+  telemetry.endFrame() ;
+  bool deep = telemetry.last( PhaseDraw ) >= 0.001 ;
+  printf( "  %-44s %s\n", "timers nested too deep unwind to the outer", deep ? "ok" : "FAIL" ) ;
+  failures += !deep ;
+
+  frameTelemetry = saved ;
+  printf( "testFrameTelemetry: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
@@ -0,0 +1,145 @@
+#ifndef GEOMETRYBUILDER_H
+#define GEOMETRYBUILDER_H
+
+#include "ThreadPool.h"
+#include "Vectorf.h"
+#include "Random.h"
+
+#include <string.h>
+#include <vector>
+using namespace std ;
+
+// addLine/addTri push_back onto one vector, so building a scene is serial,
+// and the vector keeps reallocating + copying as it grows.
+//
+// These build it in parallel, in 3 passes over the ITEMS (an item is one
+// primitive, or one procedural "thing" that makes several):
+//   1. COUNT  (parallel) how many vertices each item makes
+//   2. SCAN   (serial, over chunks only) where each chunk's vertices start
+//   3. FILL   (parallel) each item writes straight into its own slot of the
+//             pre-sized output.  No locks, no push_back, no reallocation.
+//
+// DETERMINISM.  Every item gets its own Rng, jobRng( seed, item ), in both
+// the count and the fill pass, so it draws the same numbers in both, and
+// item i always lands at the same place in the output.  The result is
+// identical whatever the number of threads, the grain, or whether there's
+// a pool at all (before EAGLView makes one, the passes just run serially).
+
+#define GEOMETRY_GRAIN 1024
+
+// count( int item, Rng& rng ) returns how many vertices item makes.
+// fill( int item, Rng& rng, Vertex* out ) writes exactly that many at out.
+// `out` is resized to the total (anything in it before is replaced).
+template <typename Vertex, typename CountFn, typename FillFn>
+void buildCountedGeometry( vector<Vertex>& out, int numItems, uint64_t seed, CountFn count, FillFn fill, int grain=GEOMETRY_GRAIN )
+{
+  if( grain < 1 )  grain = 1 ;
+  int numChunks = ( numItems + grain - 1 ) / grain ;
+  vector<int> counts( numItems ) ;
+  vector<int> chunkStart( numChunks + 1 ) ;
+
+  // 1. COUNT.  Each chunk also totals itself, so the scan only has to walk the chunks.
+  forEachChunk( "geometry count", numItems, grain, [&]( int start, int end ) {
+    int total = 0 ;
+    for( int i = start ; i < end ; i++ ) {
+      Rng rng = jobRng( seed, i ) ;
+      total += counts[i] = count( i, rng ) ;
+    }
+    chunkStart[ start / grain + 1 ] = total ;
+  } ) ;
+
+  // 2. SCAN.  Exclusive prefix sum of the chunk totals.
+  chunkStart[0] = 0 ;
+  for( int c = 0 ; c < numChunks ; c++ )
+    chunkStart[c+1] += chunkStart[c] ;
+  out.resize( chunkStart[ numChunks ] ) ;
+  if( out.empty() )  return ;
+
+  // 3. FILL.  Each chunk picks up its running offset where the scan left it.
+  Vertex *base = &out[0] ;
+  forEachChunk( "geometry fill", numItems, grain, [&]( int start, int end ) {
+    int offset = chunkStart[ start / grain ] ;
+    for( int i = start ; i < end ; i++ ) {
+      Rng rng = jobRng( seed, i ) ;
+      fill( i, rng, base + offset ) ;
+      offset += counts[i] ;
+    }
+  } ) ;
+}
+
+// Every item makes the same number of vertices (a line is 2, a triangle 3),
+// so there's nothing to count: item i starts at i*vertsPerItem.
+// fill is the same as buildCountedGeometry's.
+template <typename Vertex, typename FillFn>
+void buildGeometry( vector<Vertex>& out, int numItems, int vertsPerItem, uint64_t seed, FillFn fill, int grain=GEOMETRY_GRAIN )
+{
+  out.resize( (size_t)numItems * vertsPerItem ) ;
+  if( out.empty() )  return ;
+  Vertex *base = &out[0] ;
+  forEachChunk( "geometry fill", numItems, grain, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      Rng rng = jobRng( seed, i ) ;
+      fill( i, rng, base + (size_t)i*vertsPerItem ) ;
+    }
+  } ) ;
+}
+
+// For generators that can't know their count without doing all the work
+// (rejection sampling, clipping, marching cubes..): emit( int item, Rng& rng,
+// vector<Vertex>& buffer ) push_backs whatever it makes.
+// The append buffers are per CHUNK, not per thread.  Per thread, the output
+// order would depend on which thread happened to get which chunk.  Per chunk,
+// concatenating them in chunk order is item order, so it's still deterministic.
+// The buffers are merged into `out` (replacing what's there) with a parallel copy.
+template <typename Vertex, typename EmitFn>
+void appendGeometry( vector<Vertex>& out, int numItems, uint64_t seed, EmitFn emit, int grain=GEOMETRY_GRAIN )
+{
+  if( grain < 1 )  grain = 1 ;
+  int numChunks = ( numItems + grain - 1 ) / grain ;
+  vector< vector<Vertex> > buffers( numChunks ) ;
+
+  forEachChunk( "geometry emit", numItems, grain, [&]( int start, int end ) {
+    vector<Vertex>& buffer = buffers[ start / grain ] ;
+    for( int i = start ; i < end ; i++ ) {
+      Rng rng = jobRng( seed, i ) ;
+      emit( i, rng, buffer ) ;
+    }
+  } ) ;
+
+  vector<size_t> chunkStart( numChunks + 1, 0 ) ;
+  for( int c = 0 ; c < numChunks ; c++ )
+    chunkStart[c+1] = chunkStart[c] + buffers[c].size() ;
+  out.resize( chunkStart[ numChunks ] ) ;
+  if( out.empty() )  return ;
+
+  // MERGE.  1 chunk per job, each copies its buffer into place and frees it.
+  Vertex *base = &out[0] ;
+  forEachChunk( "geometry merge", numChunks, 1, [&]( int c, int cEnd ) {
+    if( buffers[c].size() )
+      memcpy( base + chunkStart[c], &buffers[c][0], sizeof(Vertex)*buffers[c].size() ) ;
+    vector<Vertex>().swap( buffers[c] ) ;
+  } ) ;
+}
+
+// addLine/addTri, but writing into a slot instead of push_back.  Return the next slot.
+inline VertexPC* writeLine( VertexPC* out, const Vector3f& a, const Vector3f& b, const Vector4f& color )
+{
+  out[0] = VertexPC( a, color ) ;
+  out[1] = VertexPC( b, color ) ;
+  return out + 2 ;
+}
+
+inline VertexPNC* writeTri( VertexPNC* out, const Vector3f& a, const Vector3f& b, const Vector3f& c, const Vector4f& color )
+{
+  Vector3f N = Triangle::triNormal( a, b, c ) ;
+  out[0] = VertexPNC( a, N, color ) ;
+  out[1] = VertexPNC( b, N, color ) ;
+  out[2] = VertexPNC( c, N, color ) ;
+  return out + 3 ;
+}
+
+// Builds numLines random lines serially with addLine, then with each builder,
+// prints the times and checks the builders all made the same thing.
+void benchmarkGeometryBuilders( int numLines ) ;
+
+#endif
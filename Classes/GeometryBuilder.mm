@@ -0,0 +1,69 @@
+#import "GeometryBuilder.h"
+#import "ES1Renderer.h"
+
+#include <chrono>
+
+static double secondsSince( const chrono::steady_clock::time_point& start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+// The same short random lines ES1Renderer's init makes.
+static void randomLine( int item, Rng& rng, VertexPC* out )
+{
+  Vector3f p = Vector3f::random( rng, -1.f, 1.f ) ;
+  Vector3f dir = Vector3f::random( rng, -1.f, 1.f ).normalize() ;
+  writeLine( out, p, p+dir*0.05f, Vector4f::random( rng ) ) ;
+}
+
+static bool same( const vector<VertexPC>& a, const vector<VertexPC>& b )
+{
+  return a.size() == b.size() && ( !a.size() || !memcmp( &a[0], &b[0], sizeof(VertexPC)*a.size() ) ) ;
+}
+
+void benchmarkGeometryBuilders( int numLines )
+{
+  uint64_t seed = 77 ;
+  vector<VertexPC> serial, fixed, counted, appended, noPool ;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  for( int i = 0 ; i < numLines ; i++ )
+  {
+    Vector3f p = Vector3f::random(-1.f,1.f) ;
+    Vector3f dir = Vector3f::random(-1.f,1.f).normalize() ;
+    addLine( serial, p, p+dir*0.05f, Vector4f::random() ) ;
+  }
+  double serialTime = secondsSince( start ) ;
+
+  start = chrono::steady_clock::now() ;
+  buildGeometry( fixed, numLines, 2, seed, randomLine ) ;
+  double fixedTime = secondsSince( start ) ;
+
+  start = chrono::steady_clock::now() ;
+  buildCountedGeometry( counted, numLines, seed,
+    []( int item, Rng& rng ) { return 2 ; },
+    randomLine ) ;
+  double countedTime = secondsSince( start ) ;
+
+  start = chrono::steady_clock::now() ;
+  appendGeometry( appended, numLines, seed, []( int item, Rng& rng, vector<VertexPC>& buffer ) {
+    VertexPC line[2] ;
+    randomLine( item, rng, line ) ;
+    buffer.push_back( line[0] ) ;
+    buffer.push_back( line[1] ) ;
+  } ) ;
+  double appendedTime = secondsSince( start ) ;
+
+  // Without the pool, and a different grain: must still come out the same.
+  ThreadPool *pool = threadPool ;
+  threadPool = 0 ;
+  buildGeometry( noPool, numLines, 2, seed, randomLine, 100 ) ;
+  threadPool = pool ;
+
+  printf( "benchmarkGeometryBuilders: %d lines on %d threads\n", numLines, pool ? pool->getNumCores() : 1 ) ;
+  printf( "  addLine loop          %8.3f ms\n", serialTime*1e3 ) ;
+  printf( "  buildGeometry         %8.3f ms  %.2fx\n", fixedTime*1e3, serialTime/fixedTime ) ;
+  printf( "  buildCountedGeometry  %8.3f ms  %.2fx\n", countedTime*1e3, serialTime/countedTime ) ;
+  printf( "  appendGeometry        %8.3f ms  %.2fx\n", appendedTime*1e3, serialTime/appendedTime ) ;
+  printf( "  deterministic: %s\n", same( fixed, counted ) && same( fixed, appended ) && same( fixed, noPool ) ? "yes" : "NO" ) ;
+}
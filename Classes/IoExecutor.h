@@ -0,0 +1,142 @@
+#ifndef IOEXECUTOR_H
+#define IOEXECUTOR_H
+
+#include "ThreadPool.h"
+
+// Every Thread in the ThreadPool is a COMPUTE worker, one per core.  A job
+// that blocks (reads a file, waits on the network) holds its core the whole
+// time it's blocked, and every frame job queued behind it waits too.
+//
+// The IoExecutor is a separate set of threads just for BLOCKING work.  They
+// spend nearly all their time asleep in the kernel, so having more of them than
+// cores is fine and doesn't take CPU away from the compute workers.
+//
+//   ioExecutor->submit( "load level", [=](){ readWholeFile( path, &bytes ) ; },   // on an I/O thread
+//     new Callback0( [=](){ parse( bytes ) ; } ), IoCompleteOnPool ) ;           // then, as a compute job
+//
+// The completion goes back where it belongs:
+//   IoCompleteOnPool        a job in its own WorkOrder on the ThreadPool
+//   IoCompleteOnMainThread  a main thread job (runFrame runs those every frame)
+//   IoCompleteOnIoThread    right there on the I/O thread (for small stuff only)
+//
+// It keeps its own numbers (IoStats): how deep the queue got, how long requests
+// waited for an I/O thread, how long they blocked, and how long until their
+// completion started running.  When those grow, loading is I/O bound; when
+// the frame time grows instead, I/O is leaking onto the compute workers.
+//
+// (On Linux io_uring would let one thread keep many reads in flight.  iOS
+// doesn't have it, and blocking reads on a few threads is what the rest of
+// the app can use for any blocking call, not just reads.)
+
+enum IoCompletion
+{
+  IoCompleteOnPool,
+  IoCompleteOnMainThread,
+  IoCompleteOnIoThread
+} ;
+
+// Latencies, bucketed by powers of 2 microseconds, so percentiles are cheap
+// and only ever overestimated by up to 2x.
+#define IOLATENCY_BUCKETS 32
+struct IoLatency
+{
+  int count ;
+  double total, max ; // seconds
+  int buckets[ IOLATENCY_BUCKETS ] ; // bucket b holds [2^(b-1), 2^b) us; bucket 0 is < 1us
+
+  IoLatency() { reset() ; }
+  void reset() {
+    count = 0 ;
+    total = max = 0.0 ;
+    for( int b = 0 ; b < IOLATENCY_BUCKETS ; b++ )  buckets[b] = 0 ;
+  }
+  void add( double seconds ) ;
+  double average() const { return count ? total / count : 0.0 ; }
+  // Upper edge of the bucket the `p` (0..1) percentile falls in, seconds
+  double percentile( double p ) const ;
+  void print( const char* name ) const ;
+} ;
+
+struct IoStats
+{
+  int submitted, completed ;
+  int queueDepth, maxQueueDepth ; // requests waiting for an I/O thread (not counting running ones)
+  int running, maxRunning ;       // requests on I/O threads right now
+  int completing ;                // work done, completion posted but not run (or dropped) yet
+  IoLatency queueWait ;  // submit -> an I/O thread picked it up
+  IoLatency service ;    // the blocking work itself
+  IoLatency completion ; // work done -> its completion started running (pool/main thread queueing)
+
+  IoStats() { reset() ; }
+  void reset() {
+    submitted = completed = 0 ;
+    queueDepth = maxQueueDepth = running = maxRunning = completing = 0 ;
+    queueWait.reset() ;  service.reset() ;  completion.reset() ;
+  }
+  void print() const ;
+} ;
+
+struct IoRequest ;
+
+struct IoExecutor
+{
+private:
+  vector<pthread_t> threads ;
+  deque<IoRequest*> queue ;
+  pthread_mutex_t mutexQueue ;   // the queue, `exiting`, and the stats
+  pthread_cond_t requestAdded ;
+  pthread_cond_t completionDone ; // stats.completing went down
+  bool exiting ;
+  IoStats stats ;
+
+  // Copying IoExecutors forbidden
+  IoExecutor( const IoExecutor& o ) {
+    puts( "ERROR: Copying IoExecutors should not be done!" ) ;
+  }
+
+  static void* ioThread( void* executor ) ;
+  void runRequests() ;
+
+public:
+  // Starts `numThreads` I/O threads.  They post completions to `threadPool`.
+  IoExecutor( int numThreads ) ;
+  // Waits for the queued requests to finish, joins the threads, then waits
+  // for their completions to have run (on the main thread it runs them), so
+  // none is left pointing at a deleted executor.
+  ~IoExecutor() ;
+
+  inline int getNumThreads() const { return (int)threads.size() ; }
+
+  // Runs `work` on an I/O thread, then `completion` (if any, the executor owns it) on `where`.
+  // Any thread can submit.
+  void submit( const string& name, function<void ()> work, Callback* completion, IoCompletion where ) ;
+
+  // Requests queued, running, or with a completion that hasn't run yet.
+  // 0 means everything submitted is all the way done.
+  int numPending() ;
+
+  // Is the caller one of the I/O threads (of any IoExecutor)?
+  static bool onIoThread() ;
+
+  // A copy, so it can be read while the I/O threads carry on.
+  IoStats getStats() ;
+  void resetStats() ;
+
+  // Internal: the completion reports in here when it starts running, and
+  // when it's done with (run or dropped).
+  void completionStarted( double secondsWaited ) ;
+  void completionFinished() ;
+} ;
+
+extern IoExecutor *ioExecutor ;
+
+// Frames of compute work (a parallelFor over a buffer) on the pool, with no
+// loading, then with the same blocking reads as ordinary pool jobs, then with
+// them on the IoExecutor.  Prints the frame times and the IoStats, and checks
+// every read ran, every completion ran once on the thread it asked for.
+// Main thread, pool up.  The "blocking read" is a real pread of a temp file
+// plus a sleep standing in for the storage latency (the file's in the page
+// cache, so the read alone wouldn't block).  Returns # failures.
+int testIoExecutor( int numIoThreads, int numFrames ) ;
+
+#endif
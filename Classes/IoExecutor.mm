@@ -0,0 +1,427 @@
+#import "IoExecutor.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+
+IoExecutor *ioExecutor = 0 ;
+
+static double ioNow()
+{
+  return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count() ;
+}
+
+// IoLatency //
+
+void IoLatency::add( double seconds )
+{
+  count++ ;
+  total += seconds ;
+  if( seconds > max )  max = seconds ;
+  int b = 0 ;
+  for( double us = seconds*1e6 ; us >= 1.0 && b < IOLATENCY_BUCKETS-1 ; us *= 0.5 )
+    b++ ;
+  buckets[b]++ ;
+}
+
+double IoLatency::percentile( double p ) const
+{
+  if( !count )  return 0.0 ;
+  int want = (int)ceil( p*count ), seen = 0 ;
+  for( int b = 0 ; b < IOLATENCY_BUCKETS ; b++ ) {
+    seen += buckets[b] ;
+    if( seen >= want )
+      return min( ldexp( 1.0, b ) * 1e-6, max ) ; // 2^b us, but never past the real max
+  }
+  return max ;
+}
+
+void IoLatency::print( const char* name ) const
+{
+  printf( "    %-11s avg %8.3f ms  p50 <%8.3f  p95 <%8.3f  p99 <%8.3f  max %8.3f ms\n", name,
+    average()*1e3, percentile( 0.5 )*1e3, percentile( 0.95 )*1e3, percentile( 0.99 )*1e3, max*1e3 ) ;
+}
+
+void IoStats::print() const
+{
+  printf( "  IoStats: %d submitted, %d done, queue depth %d (max %d), running %d (max %d), %d completions to run\n",
+    submitted, completed, queueDepth, maxQueueDepth, running, maxRunning, completing ) ;
+  queueWait.print( "queue wait" ) ;
+  service.print( "blocked" ) ;
+  completion.print( "completion" ) ;
+}
+
+// REQUESTS //
+
+struct IoRequest
+{
+  string name ;
+  function<void ()> work ;
+  Callback *completion ;
+  IoCompletion where ;
+  double submitTime ;
+} ;
+
+// Wraps the completion so we know how long it sat in the pool's (or the main thread's) queue.
+struct IoCompletionJob : public Callback
+{
+  IoExecutor *executor ;
+  Callback *callback ;
+  double workDoneTime ;
+
+  IoCompletionJob( IoExecutor *iExecutor, Callback *iCallback, double iWorkDoneTime ) :
+    executor( iExecutor ), callback( iCallback ), workDoneTime( iWorkDoneTime ) {}
+  // Run or dropped, this is the last the executor hears of it.  (It waits
+  // for this in its destructor, so it's still there.)
+  ~IoCompletionJob() {
+    delete callback ;
+    executor->completionFinished() ;
+  }
+
+  void exec() {
+    executor->completionStarted( ioNow() - workDoneTime ) ;
+    callback->exec() ;
+  }
+} ;
+
+// IoExecutor //
+
+IoExecutor::IoExecutor( int numThreads ) : exiting( 0 )
+{
+  pthread_mutex_init( &mutexQueue, 0 ) ;
+  pthread_cond_init( &requestAdded, 0 ) ;
+  pthread_cond_init( &completionDone, 0 ) ;
+  printf( "IoExecutor: Creating %d I/O threads\n", numThreads ) ;
+  threads.resize( numThreads ) ;
+  for( int i = 0 ; i < numThreads ; i++ )
+    pthread_create( &threads[i], NULL, ioThread, this ) ;
+}
+
+IoExecutor::~IoExecutor()
+{
+  pthread_mutex_lock( &mutexQueue ) ;
+  exiting = 1 ;
+  pthread_cond_broadcast( &requestAdded ) ;
+  pthread_mutex_unlock( &mutexQueue ) ;
+
+  for( pthread_t t : threads )
+    pthread_join( t, 0 ) ; // they finish what's queued first
+
+  // The completions they posted call back in here.  Main thread completions
+  // only run on the main thread, so there, run them (and help with the pool's).
+  pthread_mutex_lock( &mutexQueue ) ;
+  while( stats.completing )
+  {
+    if( threadPool && [NSThread isMainThread] ) {
+      pthread_mutex_unlock( &mutexQueue ) ;
+      threadPool->mainThreadRunJobs() ;
+      threadPool->runJobs() ;
+      sched_yield() ;
+      pthread_mutex_lock( &mutexQueue ) ;
+    }
+    else
+      pthread_cond_wait( &completionDone, &mutexQueue ) ;
+  }
+  pthread_mutex_unlock( &mutexQueue ) ;
+
+  pthread_cond_destroy( &completionDone ) ;
+  pthread_cond_destroy( &requestAdded ) ;
+  pthread_mutex_destroy( &mutexQueue ) ;
+}
+
+// Marks the I/O threads, for onIoThread()
+static pthread_key_t ioThreadKey ;
+static pthread_once_t ioThreadKeyOnce = PTHREAD_ONCE_INIT ;
+static void makeIoThreadKey() { pthread_key_create( &ioThreadKey, 0 ) ; }
+
+bool IoExecutor::onIoThread()
+{
+  pthread_once( &ioThreadKeyOnce, makeIoThreadKey ) ;
+  return pthread_getspecific( ioThreadKey ) != 0 ;
+}
+
+void* IoExecutor::ioThread( void* executor )
+{
+  pthread_once( &ioThreadKeyOnce, makeIoThreadKey ) ;
+  pthread_setspecific( ioThreadKey, executor ) ;
+  ((IoExecutor*)executor)->runRequests() ;
+  return 0 ;
+}
+
+void IoExecutor::runRequests()
+{
+  pthread_mutex_lock( &mutexQueue ) ;
+  while( 1 )
+  {
+    // Same loose chain as Thread::sleep(): cond_wait can wake up for nothing.
+    while( !queue.size() && !exiting )
+      pthread_cond_wait( &requestAdded, &mutexQueue ) ;
+    if( !queue.size() )
+      break ; // exiting, and nothing left to do
+
+    IoRequest *req = queue.front() ;
+    queue.pop_front() ;
+    double start = ioNow() ;
+    stats.queueDepth-- ;
+    stats.running++ ;
+    stats.maxRunning = max( stats.maxRunning, stats.running ) ;
+    stats.queueWait.add( start - req->submitTime ) ;
+    pthread_mutex_unlock( &mutexQueue ) ;
+
+    req->work() ; // BLOCKS, that's what we're here for
+    double done = ioNow() ;
+
+    // Still pending until its completion has run: it moves from running
+    // to completing in one go.
+    pthread_mutex_lock( &mutexQueue ) ;
+    stats.running-- ;
+    if( req->completion )
+      stats.completing++ ;
+    stats.completed++ ;
+    stats.service.add( done - start ) ;
+    pthread_mutex_unlock( &mutexQueue ) ;
+
+    if( req->completion )
+    {
+      Callback *job = new IoCompletionJob( this, req->completion, done ) ;
+      switch( req->where )
+      {
+      case IoCompleteOnPool: {
+          WorkOrder *wo = new WorkOrder( req->name ) ;
+          wo->addJob( job ) ;
+          threadPool->startWorkOrder( wo ) ;
+        }
+        break ;
+      case IoCompleteOnMainThread:
+        threadPool->addJobForMainThread( job ) ;
+        break ;
+      default:
+        job->exec() ;
+        delete job ;
+        break ;
+      }
+    }
+    delete req ;
+
+    pthread_mutex_lock( &mutexQueue ) ;
+  }
+  pthread_mutex_unlock( &mutexQueue ) ;
+}
+
+void IoExecutor::submit( const string& name, function<void ()> work, Callback* completion, IoCompletion where )
+{
+  IoRequest *req = new IoRequest ;
+  req->name = name ;
+  req->work = work ;
+  req->completion = completion ;
+  req->where = where ;
+  req->submitTime = ioNow() ;
+
+  Lock qLock( &mutexQueue ) ;
+  if( exiting ) {
+    puts( "ERROR: IoExecutor is shutting down, not taking new requests." ) ;
+    delete completion ;
+    delete req ;
+    return ;
+  }
+  queue.push_back( req ) ;
+  stats.submitted++ ;
+  stats.queueDepth++ ;
+  stats.maxQueueDepth = max( stats.maxQueueDepth, stats.queueDepth ) ;
+  pthread_cond_signal( &requestAdded ) ; // one request, one thread
+}
+
+int IoExecutor::numPending()
+{
+  Lock qLock( &mutexQueue ) ;
+  return stats.queueDepth + stats.running + stats.completing ;
+}
+
+IoStats IoExecutor::getStats()
+{
+  Lock qLock( &mutexQueue ) ;
+  return stats ;
+}
+
+void IoExecutor::resetStats()
+{
+  Lock qLock( &mutexQueue ) ;
+  // Whatever's in flight now is still in flight.
+  int queueDepth = stats.queueDepth, running = stats.running, completing = stats.completing ;
+  stats.reset() ;
+  stats.queueDepth = stats.maxQueueDepth = queueDepth ;
+  stats.running = stats.maxRunning = running ;
+  stats.completing = completing ;
+}
+
+void IoExecutor::completionStarted( double secondsWaited )
+{
+  Lock qLock( &mutexQueue ) ;
+  stats.completion.add( secondsWaited ) ;
+}
+
+void IoExecutor::completionFinished()
+{
+  Lock qLock( &mutexQueue ) ;
+  stats.completing-- ;
+  pthread_cond_broadcast( &completionDone ) ;
+}
+
+// TEST & BENCHMARK //
+
+static pthread_t testMainThread ;
+
+// What a loader does: a read that blocks.  See testIoExecutor in the header for the sleep.
+static long long blockingRead( int fd, int offset, int bytes, int latencyUs )
+{
+  vector<unsigned char> buf( bytes ) ;
+  int got = (int)pread( fd, &buf[0], bytes, offset ) ;
+  usleep( latencyUs ) ;
+  long long sum = 0 ;
+  for( int i = 0 ; i < got ; i++ )
+    sum += buf[i] ;
+  return sum ;
+}
+
+struct FrameTimes
+{
+  double total, max ;
+  int frames ;
+  FrameTimes() : total( 0 ), max( 0 ), frames( 0 ) {}
+  void add( double t ) { total += t, max = std::max( max, t ), frames++ ; }
+  void print( const char* name ) const {
+    printf( "  %-36s frame avg %7.3f ms, max %7.3f ms\n", name, frames ? total/frames*1e3 : 0.0, max*1e3 ) ;
+  }
+} ;
+
+int testIoExecutor( int numIoThreads, int numFrames )
+{
+  if( !threadPool || ![NSThread isMainThread] ) {
+    puts( "ERROR: testIoExecutor() needs the pool, and the main thread" ) ;
+    return 1 ;
+  }
+  testMainThread = pthread_self() ;
+  const int readsPerFrame = 4, readBytes = 64*1024, latencyUs = 4000 ;
+  const int computeN = 1<<20 ;
+  printf( "testIoExecutor: %d I/O threads, %d frames, %d reads of %d KB (+%.1f ms latency) a frame\n",
+    numIoThreads, numFrames, readsPerFrame, readBytes/1024, latencyUs*1e-3 ) ;
+  int failures = 0 ;
+
+  // The "asset file"
+  const char *tmp = getenv( "TMPDIR" ) ;
+  string path = string( tmp ? tmp : "/tmp" ) + "/threaden_io_test.bin" ;
+  int fileBytes = 4*1024*1024 ;
+  {
+    vector<unsigned char> data( fileBytes ) ;
+    for( int i = 0 ; i < fileBytes ; i++ )  data[i] = (unsigned char)( i*2654435761u >> 24 ) ;
+    FILE *f = fopen( path.c_str(), "wb" ) ;
+    if( !f ) {
+      printf( "ERROR: testIoExecutor couldn't write %s\n", path.c_str() ) ;
+      return 1 ;
+    }
+    fwrite( &data[0], 1, fileBytes, f ) ;
+    fclose( f ) ;
+  }
+  int fd = open( path.c_str(), O_RDONLY ) ;
+
+  // The frame: a parallelFor of plain arithmetic, like the vertex processing.
+  vector<float> work( computeN, 1.f ) ;
+  float *w = &work[0] ;
+  auto computeFrame = [w, computeN]() {
+    threadPool->parallelFor( "io test compute", computeN, computeN/16, [w]( int start, int end ) {
+      for( int i = start ; i < end ; i++ )
+        w[i] = sqrtf( w[i]*w[i] + 1.f ) * 0.5f ;
+    } ) ;
+  } ;
+
+  // A. Compute alone
+  FrameTimes alone, onPool, onIo ;
+  for( int f = 0 ; f < numFrames ; f++ ) {
+    double start = ioNow() ;
+    computeFrame() ;
+    alone.add( ioNow() - start ) ;
+  }
+
+  // B. The reads as ordinary pool jobs, started at the top of each frame
+  atomic<long long> poolSum( 0 ) ;
+  for( int f = 0 ; f < numFrames ; f++ ) {
+    double start = ioNow() ;
+    WorkOrder *loads = new WorkOrder( "loads on the pool" ) ;
+    for( int r = 0 ; r < readsPerFrame ; r++ ) {
+      int offset = ( ( f*readsPerFrame + r ) * readBytes ) % ( fileBytes - readBytes ) ;
+      loads->addJob( new Callback0( [&poolSum, fd, offset, readBytes, latencyUs](){
+        poolSum += blockingRead( fd, offset, readBytes, latencyUs ) ;
+      } ) ) ;
+    }
+    threadPool->startWorkOrder( loads ) ;
+    computeFrame() ; // queued behind the loads, and its sequence point waits for them
+    onPool.add( ioNow() - start ) ;
+  }
+
+  // C. The same reads on the IoExecutor.  Half complete on the pool, half on the main thread.
+  IoExecutor *previous = ioExecutor ;
+  ioExecutor = new IoExecutor( numIoThreads ) ;
+  int numRequests = numFrames*readsPerFrame ;
+  vector<atomic<int>> completionsRun( numRequests ) ;
+  for( atomic<int>& c : completionsRun )  c = 0 ;
+  atomic<long long> ioSum( 0 ) ;
+  atomic<int> workNotOnIoThread( 0 ), wrongCompletionThread( 0 ) ;
+  for( int f = 0 ; f < numFrames ; f++ ) {
+    double start = ioNow() ;
+    threadPool->mainThreadRunJobs() ; // what runFrame does
+    for( int r = 0 ; r < readsPerFrame ; r++ ) {
+      int req = f*readsPerFrame + r ;
+      int offset = ( req * readBytes ) % ( fileBytes - readBytes ) ;
+      IoCompletion where = ( r & 1 ) ? IoCompleteOnMainThread : IoCompleteOnPool ;
+      long long *result = new long long( 0 ) ;
+      ioExecutor->submit( "load", [&, fd, offset, result](){
+        if( !IoExecutor::onIoThread() )
+          workNotOnIoThread++ ;
+        *result = blockingRead( fd, offset, readBytes, latencyUs ) ;
+      }, new Callback0( [&, req, where, result](){
+        bool onMain = pthread_equal( pthread_self(), testMainThread ) ;
+        if( ( where == IoCompleteOnMainThread && !onMain ) || IoExecutor::onIoThread() )
+          wrongCompletionThread++ ;
+        ioSum += *result ;
+        delete result ;
+        completionsRun[req]++ ;
+      } ), where ) ;
+    }
+    computeFrame() ;
+    onIo.add( ioNow() - start ) ;
+  }
+  // Drain: the reads and their completions.  Half of those are main thread
+  // jobs, and with no workers the pool's are ours too.
+  while( ioExecutor->numPending() ) {
+    threadPool->mainThreadRunJobs() ;
+    threadPool->runJobs() ;
+    usleep( 1000 ) ;
+  }
+  threadPool->sequencePoint( 0 ) ;
+  IoStats stats = ioExecutor->getStats() ;
+  delete ioExecutor ;
+  ioExecutor = previous ;
+  close( fd ) ;
+  unlink( path.c_str() ) ;
+
+  alone.print( "compute alone" ) ;
+  onPool.print( "compute + reads as pool jobs" ) ;
+  onIo.print( "compute + reads on the IoExecutor" ) ;
+  stats.print() ;
+
+  int wrongCount = 0 ;
+  for( atomic<int>& c : completionsRun )
+    wrongCount += c != 1 ;
+  printf( "  %-52s %s\n", "every request's completion ran exactly once", wrongCount ? "FAIL" : "ok" ) ;
+  printf( "  %-52s %s\n", "same bytes read both ways", ioSum == poolSum ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "reads ran on I/O threads", workNotOnIoThread ? "FAIL" : "ok" ) ;
+  printf( "  %-52s %s\n", "completions ran off the I/O threads, where asked", wrongCompletionThread ? "FAIL" : "ok" ) ;
+  printf( "  %-52s %s\n", "IoStats counted them all", stats.submitted == numRequests && stats.completed == numRequests &&
+    stats.completion.count == numRequests ? "ok" : "FAIL" ) ;
+  failures += ( wrongCount != 0 ) + ( ioSum != poolSum ) + ( workNotOnIoThread != 0 ) + ( wrongCompletionThread != 0 ) +
+    !( stats.submitted == numRequests && stats.completed == numRequests && stats.completion.count == numRequests ) ;
+
+  printf( "testIoExecutor: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
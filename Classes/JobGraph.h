@@ -0,0 +1,140 @@
+#ifndef JOBGRAPH_H
+#define JOBGRAPH_H
+
+#include "ThreadPool.h"
+
+#include <atomic>
+
+// Every frame parallelProcessSerialDraw builds the same WorkOrder: a new
+// WorkOrder (a name string, a mutex, a deque), a new Callback4 per chunk,
+// startWorkOrder, and the pool deletes it all again when it's done.  The
+// chunking never changes.  Only the frame does.
+//
+// A JobGraph is RECORDED ONCE and REPLAYED every frame:
+//
+//   JobGraph graph( "frame" ) ;
+//   int transform = graph.addNode( "transform" ) ;
+//   for( ... )
+//     graph.addJob( transform, new Callback4<...>( processVertices, &a, &a, start, end ) ) ;
+//   int cull = graph.addNode( "cull" ) ;
+//   graph.addChunks( cull, n, 4096, [&]( int start, int end ){ ... } ) ;
+//   graph.precede( transform, cull ) ;  // cull's jobs start once transform's have all finished
+//
+//   every frame:
+//     graph.replay() ;   // a sequence point: returns with every job done
+//
+// The nodes are a DAG: each node is a set of jobs that can run in parallel
+// (what a WorkOrder is), and a node's jobs are released when every node
+// that precedes it has finished.  The thread that finishes a node's last job
+// releases the nodes after it, so there's no waiting in between.
+//
+// A replay ALLOCATES NOTHING, copies no strings, rebuilds nothing: it resets
+// a few counters per node and hands each node's jobs to the pool as one
+// pre-linked chain (LinkedJob, ThreadPool::addLinkedJobs), which is O(1)
+// however many jobs the node has.  So the submit costs the same for 4 jobs
+// as for 4000.  The jobs are kept, not deleted, after they run.
+//
+// PATCHING: the graph owns the jobs it's given, but addJob() hands the
+// pointer back.  Change a Callback4's arguments between replays (never
+// while it's running) and the next replay uses them.  Jobs that read the
+// frame's state through pointers (&rot, &pcVertsA) need no patching at all.
+//
+// Record on one thread, replay on the main thread (anywhere else the nodes
+// just run right there, in order).  Don't change it while it's running.
+
+struct JobGraph ;
+struct GraphNode ;
+
+// One of a node's jobs, as the pool sees it.
+struct GraphJob : public LinkedJob
+{
+  Callback* job ;   // the graph's
+  GraphNode* node ;
+
+  GraphJob( Callback* iJob, GraphNode* iNode ) : job( iJob ), node( iNode ) {}
+  ~GraphJob() { delete job ; }
+  void exec() ;
+} ;
+
+struct GraphNode
+{
+  string name ;
+  JobGraph* graph ;
+  vector<GraphJob*> jobs ;        // linked first to last
+  vector<GraphNode*> successors ;
+  int numPredecessors ;
+
+  // This replay's countdowns
+  atomic<int> jobsLeft, predecessorsLeft ;
+
+  GraphNode( const string& iName, JobGraph* iGraph ) :
+    name( iName ), graph( iGraph ), numPredecessors( 0 ), jobsLeft( 0 ), predecessorsLeft( 0 ) {}
+  ~GraphNode() {
+    for( GraphJob* job : jobs )
+      delete job ;
+  }
+} ;
+
+struct JobGraph
+{
+  string name ;
+  vector<GraphNode*> nodes ;
+
+private:
+  vector<GraphNode*> order ; // topological (0 until it's worked out), for running without the pool
+  vector<GraphNode*> roots ; // the nodes with nothing before them
+  bool ordered ;
+  atomic<bool> running ;
+  atomic<int> nodesLeft ;
+  int replays ;
+  double lastSubmit ;
+
+  // Copying JobGraphs forbidden
+  JobGraph( const JobGraph& o ) {
+    puts( "ERROR: Copying JobGraphs should not be done!" ) ;
+  }
+
+  bool sortNodes() ;
+  bool changeable( const char* what ) ;
+  void release( GraphNode* node ) ;
+
+public:
+  JobGraph( const string& iName ) : name( iName ), ordered( 0 ), running( 0 ), nodesLeft( 0 ),
+    replays( 0 ), lastSubmit( 0.0 ) {}
+  ~JobGraph() ;
+
+  // RECORDING.  Nodes are numbered from 0 in the order they're added.
+  int addNode( const string& nodeName ) ;
+  // The graph owns `job`.  Returns it, to patch between replays.
+  Callback* addJob( int node, Callback* job ) ;
+  // body( start, end ) over [0,n) in ranges of `grain`, one job each (like parallelFor)
+  void addChunks( int node, int n, int grain, const function<void (int, int)>& body ) ;
+  // `after`'s jobs only start once all of `before`'s have finished.
+  void precede( int before, int after ) ;
+
+  // REPLAYING.  start() releases the first nodes and returns (the rest follow
+  // as those finish).  false if it's still running, or has a cycle.
+  bool start() ;
+  // start(), then a sequence point: every job has run when it returns.
+  // Off the main thread, or with no pool, the jobs just run here, node by node.
+  void replay() ;
+  bool isRunning() const { return running ; }
+
+  int numJobs() const ;
+  int getReplays() const { return replays ; }
+  double getLastSubmit() const { return lastSubmit ; } // seconds start() took last time
+
+  // Internal: a node's last job calls it.
+  void nodeFinished( GraphNode* node ) ;
+} ;
+
+// A diamond (a -> b, c -> d) with an empty node and patched Callback4
+// arguments, replayed many times, checking each node only ever ran after the
+// ones before it and saw this frame's arguments; a cycle is refused; a
+// replay waits behind a WorkOrder started before it.  Then
+// the submit and frame time of rebuilding a WorkOrder every frame against
+// replaying a JobGraph, for 16 to `maxJobs` jobs.  Main thread, pool up.
+// Returns # failures.
+int testJobGraph( int maxJobs ) ;
+
+#endif
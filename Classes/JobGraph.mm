@@ -0,0 +1,317 @@
+#import "JobGraph.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <map>
+
+void GraphJob::exec()
+{
+  job->exec() ;
+  if( !--node->jobsLeft )
+    node->graph->nodeFinished( node ) ;
+}
+
+JobGraph::~JobGraph()
+{
+  if( running )
+    printf( "ERROR: JobGraph `%s` destroyed while it's running\n", name.c_str() ) ;
+  for( GraphNode* node : nodes )
+    delete node ;
+}
+
+bool JobGraph::changeable( const char* what )
+{
+  if( running ) {
+    printf( "ERROR: JobGraph `%s`: %s while it's running. Not doing it.\n", name.c_str(), what ) ;
+    return false ;
+  }
+  ordered = 0 ;
+  return true ;
+}
+
+int JobGraph::addNode( const string& nodeName )
+{
+  if( !changeable( "addNode" ) )  return -1 ;
+  nodes.push_back( new GraphNode( nodeName, this ) ) ;
+  return (int)nodes.size() - 1 ;
+}
+
+Callback* JobGraph::addJob( int node, Callback* job )
+{
+  if( node < 0 || node >= (int)nodes.size() ) {
+    printf( "ERROR: JobGraph `%s` has no node %d. Not adding the job.\n", name.c_str(), node ) ;
+    delete job ;
+    return 0 ;
+  }
+  if( !changeable( "addJob" ) ) {
+    delete job ;
+    return 0 ;
+  }
+  // Linked on the end of the node's chain, where it stays.
+  vector<GraphJob*>& jobs = nodes[ node ]->jobs ;
+  GraphJob *graphJob = new GraphJob( job, nodes[ node ] ) ;
+  if( jobs.size() )
+    jobs.back()->nextLinked = graphJob ;
+  jobs.push_back( graphJob ) ;
+  return job ;
+}
+
+void JobGraph::addChunks( int node, int n, int grain, const function<void (int, int)>& body )
+{
+  if( grain < 1 )  grain = 1 ;
+  for( int start = 0 ; start < n ; start += grain )
+  {
+    int end = min( n, start + grain ) ;
+    addJob( node, new Callback0( [body, start, end](){ body( start, end ) ; } ) ) ;
+  }
+}
+
+void JobGraph::precede( int before, int after )
+{
+  if( before < 0 || after < 0 || before >= (int)nodes.size() || after >= (int)nodes.size() || before == after ) {
+    printf( "ERROR: JobGraph `%s`: can't make node %d precede node %d\n", name.c_str(), before, after ) ;
+    return ;
+  }
+  if( !changeable( "precede" ) )  return ;
+  nodes[ before ]->successors.push_back( nodes[ after ] ) ;
+  nodes[ after ]->numPredecessors++ ;
+}
+
+int JobGraph::numJobs() const
+{
+  int n = 0 ;
+  for( GraphNode* node : nodes )
+    n += (int)node->jobs.size() ;
+  return n ;
+}
+
+// Kahn's: a node goes once everything before it has.  Whatever's left over is in a cycle.
+bool JobGraph::sortNodes()
+{
+  order.clear() ;
+  roots.clear() ;
+  map<GraphNode*, int> waiting ;
+  for( GraphNode* node : nodes ) {
+    waiting[ node ] = node->numPredecessors ;
+    if( !node->numPredecessors ) {
+      roots.push_back( node ) ;
+      order.push_back( node ) ;
+    }
+  }
+  for( int i = 0 ; i < (int)order.size() ; i++ )
+    for( GraphNode* next : order[i]->successors )
+      if( !--waiting[ next ] )
+        order.push_back( next ) ;
+  if( order.size() != nodes.size() ) {
+    printf( "ERROR: JobGraph `%s` has a cycle (%d of its %d nodes are in or after it). Not running it.\n",
+      name.c_str(), (int)( nodes.size() - order.size() ), (int)nodes.size() ) ;
+    return false ;
+  }
+  ordered = 1 ;
+  return true ;
+}
+
+void JobGraph::release( GraphNode* node )
+{
+  if( node->jobs.empty() )
+    nodeFinished( node ) ; // nothing to wait for
+  else
+    threadPool->addLinkedJobs( node->jobs.front(), node->jobs.back() ) ;
+}
+
+void JobGraph::nodeFinished( GraphNode* node )
+{
+  // The next nodes first: `running` can only go false once they're out too.
+  for( GraphNode* next : node->successors )
+    if( !--next->predecessorsLeft )
+      release( next ) ;
+  if( !--nodesLeft )
+    running = 0 ;
+}
+
+bool JobGraph::start()
+{
+  PhaseTimer timer( PhaseSubmit ) ;
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now() ;
+  if( running ) {
+    printf( "ERROR: JobGraph `%s` started while it's still running. Not starting it.\n", name.c_str() ) ;
+    return false ;
+  }
+  if( !ordered && !sortNodes() )
+    return false ;
+  if( nodes.empty() )
+    return true ;
+
+  // All the counters before any job's out: a fast job could finish its node
+  // and go looking at the next one's.
+  running = 1 ;
+  nodesLeft = (int)nodes.size() ;
+  for( GraphNode* node : nodes ) {
+    node->jobsLeft = (int)node->jobs.size() ;
+    node->predecessorsLeft = node->numPredecessors ;
+  }
+  for( GraphNode* root : roots )
+    release( root ) ;
+
+  replays++ ;
+  lastSubmit = chrono::duration<double>( chrono::steady_clock::now() - startTime ).count() ;
+  return true ;
+}
+
+void JobGraph::replay()
+{
+  // Only the main thread can block on a sequence point.
+  if( !threadPool || ![NSThread isMainThread] )
+  {
+    if( running ) {
+      printf( "ERROR: JobGraph `%s` replayed while it's still running. Not running it.\n", name.c_str() ) ;
+      return ;
+    }
+    if( !ordered && !sortNodes() )
+      return ;
+    for( GraphNode* node : order )
+      for( GraphJob* job : node->jobs )
+        job->job->exec() ;
+    replays++ ;
+    return ;
+  }
+
+  if( !start() )
+    return ;
+  threadPool->sequencePoint( 0 ) ;
+  if( running )
+    printf( "ERROR: JobGraph `%s`: the sequence point returned with %d nodes still to go\n", name.c_str(), (int)nodesLeft ) ;
+}
+
+// TEST & BENCHMARK //
+
+// A Callback4 function, so its arguments can be patched.
+static void stampFrame( int* out, int frame, int start, int end )
+{
+  for( int i = start ; i < end ; i++ )
+    out[i] = frame ;
+}
+
+static void emptyJob( int* out, int frame, int start, int end )
+{
+}
+
+int testJobGraph( int maxJobs )
+{
+  int failures = 0 ;
+  printf( "testJobGraph: up to %d jobs\n", maxJobs ) ;
+
+  // THE DIAMOND: a (8 jobs) -> b, c (8 each) -> empty -> d (1)
+  const int numFrames = 200, jobsPer = 8, n = 8*1024 ;
+  vector<int> stamps( n, -1 ) ;
+  atomic<int> aDone( 0 ), bcDone( 0 ), outOfOrder( 0 ), staleStamps( 0 ) ;
+  int frame = 0 ;
+
+  JobGraph graph( "diamond" ) ;
+  int a = graph.addNode( "a" ), b = graph.addNode( "b" ), c = graph.addNode( "c" ) ;
+  int empty = graph.addNode( "empty" ), d = graph.addNode( "d" ) ;
+  vector< Callback4<int*, int, int, int>* > aJobs ;
+  for( int j = 0 ; j < jobsPer ; j++ )
+  {
+    int start = j*n/jobsPer, end = (j+1)*n/jobsPer ;
+    aJobs.push_back( (Callback4<int*, int, int, int>*)graph.addJob( a,
+      new Callback4<int*, int, int, int>( stampFrame, &stamps[0], 0, start, end ) ) ) ;
+  }
+  graph.addJob( a, new Callback0( [&](){ aDone++ ; } ) ) ;
+  auto bc = [&]( int start, int end ) {
+    if( aDone != 1 )  outOfOrder++ ;
+    // a stamped this frame everywhere before b or c could start
+    for( int i = start ; i < end ; i++ )
+      if( stamps[i] != frame )  staleStamps++ ;
+    bcDone++ ;
+  } ;
+  graph.addChunks( b, n, n/jobsPer, bc ) ;
+  graph.addChunks( c, n, n/jobsPer, bc ) ;
+  graph.addJob( d, new Callback0( [&](){ if( bcDone != 2*jobsPer )  outOfOrder++ ; } ) ) ;
+  graph.precede( a, b ) ;
+  graph.precede( a, c ) ;
+  graph.precede( b, empty ) ;
+  graph.precede( c, empty ) ;
+  graph.precede( empty, d ) ;
+
+  for( frame = 1 ; frame <= numFrames ; frame++ )
+  {
+    aDone = 0 ;
+    bcDone = 0 ;
+    for( Callback4<int*, int, int, int>* job : aJobs )
+      job->argument2 = frame ; // PATCH this frame in
+    graph.replay() ;
+  }
+  bool ok = !outOfOrder && !staleStamps && !graph.isRunning() && graph.getReplays() == numFrames ;
+  printf( "  %-52s %s\n", "every node after the ones before it, patched args", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+
+  JobGraph cycle( "cycle" ) ;
+  int x = cycle.addNode( "x" ), y = cycle.addNode( "y" ), z = cycle.addNode( "z" ) ;
+  cycle.addJob( x, new Callback0( [](){} ) ) ;
+  cycle.precede( x, y ) ;
+  cycle.precede( y, z ) ;
+  cycle.precede( z, y ) ;
+  ok = !cycle.start() && !cycle.isRunning() ;
+  printf( "  %-52s %s\n", "a cycle is refused", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+
+  // ORDER OF ADDITION: a replay started after a WorkOrder waits for it.  Every
+  // one of its jobs is handed out first, so at most one a thread hasn't started.
+  const int numQueued = 40 ;
+  atomic<int> started( 0 ), firstReplayed( numQueued ) ;
+  WorkOrder *queued = new WorkOrder( "queued first" ) ;
+  for( int j = 0 ; j < numQueued ; j++ )
+    queued->addJob( new Callback0( [&started](){ started++ ; usleep( 200 ) ; } ) ) ;
+  JobGraph after( "queued after" ) ;
+  int afterNode = after.addNode( "after" ) ;
+  for( int j = 0 ; j < 4 ; j++ )
+    after.addJob( afterNode, new Callback0( [&started, &firstReplayed](){
+      int s = started, f = firstReplayed ;
+      while( s < f && !firstReplayed.compare_exchange_weak( f, s ) ) ;
+    } ) ) ;
+  threadPool->startWorkOrder( queued ) ;
+  after.start() ;
+  threadPool->sequencePoint( 0 ) ;
+  ok = started == numQueued && firstReplayed >= numQueued - ( threadPool->getNumWorkers() + 1 ) ;
+  printf( "  %-52s %s\n", "a replay runs behind the WorkOrders queued before it", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+
+  // SUBMIT COST: a WorkOrder rebuilt every frame vs the graph replayed.  The
+  // jobs do nothing, so what's timed is all overhead.
+  puts( "  us per frame        rebuild: submit    frame   replay: submit    frame" ) ;
+  for( int numJobs = 16 ; numJobs <= maxJobs ; numJobs *= 4 )
+  {
+    const int reps = 50 ;
+    double rebuildSubmit = 0, rebuildFrame = 0, replaySubmit = 0, replayFrame = 0 ;
+    for( int rep = 0 ; rep < reps ; rep++ )
+    {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+      WorkOrder *wo = new WorkOrder( "vertex transforms" ) ;
+      for( int j = 0 ; j < numJobs ; j++ )
+        wo->addJob( new Callback4<int*, int, int, int>( emptyJob, &stamps[0], rep, j, j+1 ) ) ;
+      threadPool->startWorkOrder( wo ) ;
+      rebuildSubmit += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+      threadPool->sequencePoint( 0 ) ;
+      rebuildFrame += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+    }
+
+    JobGraph same( "vertex transforms" ) ;
+    int node = same.addNode( "transform" ) ;
+    for( int j = 0 ; j < numJobs ; j++ )
+      same.addJob( node, new Callback4<int*, int, int, int>( emptyJob, &stamps[0], 0, j, j+1 ) ) ;
+    for( int rep = 0 ; rep < reps ; rep++ )
+    {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+      same.start() ;
+      replaySubmit += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+      threadPool->sequencePoint( 0 ) ;
+      replayFrame += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+    }
+    printf( "  %6d jobs %22.1f %8.1f %17.1f %8.1f\n", numJobs, rebuildSubmit/reps*1e6, rebuildFrame/reps*1e6,
+      replaySubmit/reps*1e6, replayFrame/reps*1e6 ) ;
+  }
+
+  printf( "testJobGraph: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
@@ -0,0 +1,150 @@
+#ifndef LINEBVH_H
+#define LINEBVH_H
+
+#include "ThreadPool.h"
+#include "Vectorf.h"
+#include "DirtyRanges.h" // VertexRange
+
+#include <float.h>
+#include <vector>
+using namespace std ;
+
+// drawPC sends every line to GL every frame, on screen or not.
+//
+// LineBVH is a bounding volume hierarchy over the lines (vertex pairs) of a
+// vector<VertexPC>.  Cull it against the view frustum and you get back the
+// vertex ranges that might be visible, ready for drawPC( verts, ranges ).
+//
+// HOW.  build() sorts the lines along a Morton (Z-order) curve through
+// their centers, so lines near each other in space are near each other in
+// the array.  *** IT REORDERS THE VERTEX BUFFER ***  That's the point: then
+// every node of the tree is a CONTIGUOUS run of vertices, and a visible
+// subtree is one glDrawArrays.  Do it right after you generate the lines,
+// before you copy them anywhere.
+//
+// The tree is implicit, like a heap: node 1 is the root, node i's children
+// are 2i and 2i+1, and the leaves (BVH_LEAF_LINES lines each, padded to a
+// power of 2 with empty ones) are the bottom level.  Every pass is parallel:
+//   build:  centers/bounds, Morton codes, radix sort, gather into the new order
+//   refit:  leaf bounds, then each level up from the bottom
+//   cull:   one job per subtree, a few levels down from the root
+// Moving the vertices (processVertices) only needs a refit(), the order
+// stays.  The tree gets looser as lines drift far from where they were sorted.
+
+#define BVH_LEAF_LINES 32
+
+struct AABB
+{
+  Vector3f min, max ;
+
+  AABB() : min( FLT_MAX ), max( -FLT_MAX ) { } // empty
+  AABB( const Vector3f& a, const Vector3f& b ) : min( a ), max( a ) {
+    add( b ) ;
+  }
+
+  inline bool isEmpty() const { return min.x > max.x ; }
+  inline Vector3f center() const { return ( min + max ) * 0.5f ; }
+
+  inline void add( const Vector3f& p ) {
+    if( p.x < min.x )  min.x = p.x ;
+    if( p.y < min.y )  min.y = p.y ;
+    if( p.z < min.z )  min.z = p.z ;
+    if( p.x > max.x )  max.x = p.x ;
+    if( p.y > max.y )  max.y = p.y ;
+    if( p.z > max.z )  max.z = p.z ;
+  }
+  inline void add( const AABB& o ) {
+    if( o.isEmpty() )  return ;
+    add( o.min ) ;
+    add( o.max ) ;
+  }
+} ;
+
+// 6 planes, normals pointing IN.  p is inside plane i if normal[i].dot( p ) + d[i] >= 0.
+struct Frustum
+{
+  Vector3f normal[6] ;
+  float d[6] ;
+
+  enum Result { Outside, Intersects, Inside } ;
+
+  // The volume glOrthof( left, right, bottom, top, zNear, zFar ) sees, with an identity modelview.
+  // (eye space looks down -z, so the z range is -zFar .. -zNear)
+  static Frustum ortho( float left, float right, float bottom, float top, float zNear, float zFar )
+  {
+    Frustum f ;
+    f.normal[0] = Vector3f(  1.f, 0.f, 0.f ) ;  f.d[0] = -left ;
+    f.normal[1] = Vector3f( -1.f, 0.f, 0.f ) ;  f.d[1] = right ;
+    f.normal[2] = Vector3f( 0.f,  1.f, 0.f ) ;  f.d[2] = -bottom ;
+    f.normal[3] = Vector3f( 0.f, -1.f, 0.f ) ;  f.d[3] = top ;
+    f.normal[4] = Vector3f( 0.f, 0.f,  1.f ) ;  f.d[4] = zFar ;
+    f.normal[5] = Vector3f( 0.f, 0.f, -1.f ) ;  f.d[5] = -zNear ;
+    return f ;
+  }
+
+  inline bool contains( const Vector3f& p ) const {
+    for( int i = 0 ; i < 6 ; i++ )
+      if( normal[i].dot( p ) + d[i] < 0.f )
+        return false ;
+    return true ;
+  }
+
+  // For each plane, test the box corner furthest along the normal (if even
+  // that's behind the plane, the whole box is) and the nearest one (if
+  // that's in front, the whole box is).
+  Result classify( const AABB& box ) const
+  {
+    if( box.isEmpty() )  return Outside ;
+    Result result = Inside ;
+    for( int i = 0 ; i < 6 ; i++ )
+    {
+      const Vector3f& n = normal[i] ;
+      Vector3f far( n.x >= 0.f ? box.max.x : box.min.x, n.y >= 0.f ? box.max.y : box.min.y, n.z >= 0.f ? box.max.z : box.min.z ) ;
+      if( n.dot( far ) + d[i] < 0.f )
+        return Outside ;
+      Vector3f near( n.x >= 0.f ? box.min.x : box.max.x, n.y >= 0.f ? box.min.y : box.max.y, n.z >= 0.f ? box.min.z : box.max.z ) ;
+      if( n.dot( near ) + d[i] < 0.f )
+        result = Intersects ;
+    }
+    return result ;
+  }
+} ;
+
+struct LineBVH
+{
+  int numLines ;
+  int firstLeaf ;  // node index of leaf 0. a power of 2, so # of leaves incl. padding
+  vector<AABB> nodes ; // [0] unused, [1] root, [firstLeaf, 2*firstLeaf) the leaves
+
+  // How many subtrees the cull is split into (rounded down to a power of 2)
+  int cullJobs ;
+
+  LineBVH() : numLines( 0 ), firstLeaf( 1 ), cullJobs( 32 ) { }
+
+  // Sorts the lines of `verts` into Morton order (REORDERS verts) and builds the tree.
+  void build( vector<VertexPC>& verts ) ;
+
+  // Recomputes every node's bounds after the vertices moved.  The order isn't touched.
+  void refit( const vector<VertexPC>& verts ) ;
+
+  // The vertex ranges of every node that isn't entirely outside the frustum,
+  // sorted, with touching ranges merged.  Visible lines are never missed, but
+  // a leaf that's partly visible comes back whole.
+  vector<VertexRange> cull( const Frustum& frustum ) const ;
+
+  // Lines [first,last) of node i
+  inline void lineRange( int i, int& first, int& last ) const {
+    int lo = i, hi = i+1 ;
+    while( lo < firstLeaf )  lo *= 2, hi *= 2 ;
+    first = min( numLines, ( lo - firstLeaf )*BVH_LEAF_LINES ) ;
+    last = min( numLines, ( hi - firstLeaf )*BVH_LEAF_LINES ) ;
+  }
+} ;
+
+// Checks cull() against testing every line, before and after moving the
+// lines and refitting, for a few frusta, and that it really culls: none drawn
+// looking away, fewer than all for a partial view.  Prints the culled counts
+// and returns # failures.
+int testLineBVH( int numLines ) ;
+
+#endif
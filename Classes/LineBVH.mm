@@ -0,0 +1,264 @@
+#import "LineBVH.h"
+#import "RadixSort.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+
+#define BVH_GRAIN 4096 // lines (or nodes) per job
+
+// 10 bits -> every 3rd bit of 30
+static inline uint32_t spreadBits( uint32_t v )
+{
+  v = ( v * 0x00010001u ) & 0xFF0000FFu ;
+  v = ( v * 0x00000101u ) & 0x0F00F00Fu ;
+  v = ( v * 0x00000011u ) & 0xC30C30C3u ;
+  v = ( v * 0x00000005u ) & 0x49249249u ;
+  return v ;
+}
+
+static inline uint32_t morton3( float x, float y, float z )
+{
+  // x,y,z in [0,1]
+  uint32_t ix = (uint32_t)min( max( x*1024.f, 0.f ), 1023.f ) ;
+  uint32_t iy = (uint32_t)min( max( y*1024.f, 0.f ), 1023.f ) ;
+  uint32_t iz = (uint32_t)min( max( z*1024.f, 0.f ), 1023.f ) ;
+  return ( spreadBits( ix ) << 2 ) | ( spreadBits( iy ) << 1 ) | spreadBits( iz ) ;
+}
+
+void LineBVH::build( vector<VertexPC>& verts )
+{
+  numLines = (int)verts.size() / 2 ;
+  int numLeaves = ( numLines + BVH_LEAF_LINES - 1 ) / BVH_LEAF_LINES ;
+  firstLeaf = 1 ;
+  while( firstLeaf < numLeaves )  firstLeaf *= 2 ;
+  nodes.assign( 2*firstLeaf, AABB() ) ;
+  if( !numLines )  return ;
+
+  // 1. Bounds of the line centers, each chunk does its own then they're combined.
+  int numChunks = ( numLines + BVH_GRAIN - 1 ) / BVH_GRAIN ;
+  vector<AABB> chunkBounds( numChunks ) ;
+  vector<Vector3f> centers( numLines ) ;
+  forEachChunk( "bvh centers", numLines, BVH_GRAIN, [&]( int start, int end ) {
+    AABB& bounds = chunkBounds[ start / BVH_GRAIN ] ;
+    for( int i = start ; i < end ; i++ ) {
+      centers[i] = ( verts[2*i].pos + verts[2*i+1].pos ) * 0.5f ;
+      bounds.add( centers[i] ) ;
+    }
+  } ) ;
+  AABB bounds ;
+  for( const AABB& b : chunkBounds )
+    bounds.add( b ) ;
+  Vector3f extent = bounds.max - bounds.min ;
+  Vector3f scale( extent.x > 0.f ? 1.f/extent.x : 0.f, extent.y > 0.f ? 1.f/extent.y : 0.f, extent.z > 0.f ? 1.f/extent.z : 0.f ) ;
+
+  // 2. Morton codes, sorted along with the line indices.  The radix sort is
+  // stable, so equal codes keep their original order.
+  vector<uint32_t> codes( numLines ), order( numLines ) ;
+  forEachChunk( "bvh morton codes", numLines, BVH_GRAIN, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      Vector3f unit = ( centers[i] - bounds.min ) * scale ;
+      codes[i] = morton3( unit.x, unit.y, unit.z ) ;
+      order[i] = i ;
+    }
+  } ) ;
+
+  // 3. Sort.
+  radixSort( &codes[0], &order[0], numLines ) ;
+
+  // 4. Gather the lines into Morton order.
+  vector<VertexPC> sorted( verts.size() ) ;
+  forEachChunk( "bvh reorder", numLines, BVH_GRAIN, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      int from = order[i] ;
+      sorted[2*i] = verts[2*from] ;
+      sorted[2*i+1] = verts[2*from+1] ;
+    }
+  } ) ;
+  if( verts.size() & 1 )  sorted.back() = verts.back() ; // a stray vertex that isn't a line stays at the end
+  verts.swap( sorted ) ;
+
+  // 5. Bounds.
+  refit( verts ) ;
+}
+
+void LineBVH::refit( const vector<VertexPC>& verts )
+{
+  if( !numLines )  return ;
+
+  // Leaves.  The padding leaves past numLines stay empty.
+  int numLeaves = ( numLines + BVH_LEAF_LINES - 1 ) / BVH_LEAF_LINES ;
+  forEachChunk( "bvh refit leaves", numLeaves, BVH_GRAIN / BVH_LEAF_LINES, [&]( int start, int end ) {
+    for( int leaf = start ; leaf < end ; leaf++ )
+    {
+      AABB box ;
+      int last = min( numLines, ( leaf+1 )*BVH_LEAF_LINES ) ;
+      for( int line = leaf*BVH_LEAF_LINES ; line < last ; line++ ) {
+        box.add( verts[2*line].pos ) ;
+        box.add( verts[2*line+1].pos ) ;
+      }
+      nodes[ firstLeaf + leaf ] = box ;
+    }
+  } ) ;
+
+  // Then each level from the bottom up: nodes [levelStart, 2*levelStart).
+  // A level has to be done before the one above it starts, so a level is a
+  // parallelFor.  The levels near the root are small, not worth the jobs.
+  for( int levelStart = firstLeaf/2 ; levelStart >= 1 ; levelStart /= 2 )
+  {
+    function<void (int, int)> unite = [this, levelStart]( int start, int end ) {
+      for( int i = levelStart + start ; i < levelStart + end ; i++ ) {
+        AABB box = nodes[ 2*i ] ;
+        box.add( nodes[ 2*i+1 ] ) ;
+        nodes[i] = box ;
+      }
+    } ;
+    if( levelStart >= BVH_GRAIN )  forEachChunk( "bvh refit level", levelStart, BVH_GRAIN, unite ) ;
+    else  unite( 0, levelStart ) ;
+  }
+}
+
+vector<VertexRange> LineBVH::cull( const Frustum& frustum ) const
+{
+  vector<VertexRange> visible ;
+  if( !numLines )  return visible ;
+
+  // The subtree roots are one level of the tree, left to right, so their
+  // results concatenated are already in vertex order.
+  int roots = 1 ;
+  while( roots*2 <= cullJobs && roots*2 <= firstLeaf )  roots *= 2 ;
+
+  // Any level above the roots that's outside would be caught by all of
+  // its roots being outside, so nothing is missed by starting down there.
+  vector< vector<VertexRange> > found( roots ) ;
+  forEachChunk( "bvh cull", roots, 1, [&]( int start, int end ) {
+    for( int r = start ; r < end ; r++ )
+    {
+      vector<VertexRange>& out = found[r] ;
+      int stack[64], top = 0 ;
+      stack[ top++ ] = roots + r ;
+      while( top )
+      {
+        int i = stack[ --top ] ;
+        Frustum::Result result = frustum.classify( nodes[i] ) ;
+        if( result == Frustum::Outside )  continue ;
+        if( result == Frustum::Inside || i >= firstLeaf )
+        {
+          // The whole node goes.  No need to look inside it.
+          int first, last ;
+          lineRange( i, first, last ) ;
+          if( out.size() && out.back().end == 2*first )  out.back().end = 2*last ;
+          else if( first < last )  out.push_back( VertexRange( 2*first, 2*last ) ) ;
+          continue ;
+        }
+        // right first, so left comes off the stack first and the output stays sorted
+        stack[ top++ ] = 2*i+1 ;
+        stack[ top++ ] = 2*i ;
+      }
+    }
+  } ) ;
+
+  for( const vector<VertexRange>& ranges : found )
+    for( const VertexRange& range : ranges )
+    {
+      if( visible.size() && visible.back().end == range.start )  visible.back().end = range.end ;
+      else  visible.push_back( range ) ;
+    }
+  return visible ;
+}
+
+// TEST //
+
+// How much of the lines a frustum should leave drawn.  Drawing every line
+// never culls anything visible, so "nothing visible culled" alone can't
+// tell a working cull from one that returns everything.  (DrawsAny is for
+// a few lines in a few leaves, where a partial view can touch every leaf.)
+enum CullExpect { DrawsNone, DrawsSome, DrawsAll, DrawsAny } ;
+
+static int checkCull( const char* what, const LineBVH& bvh, const vector<VertexPC>& verts, const Frustum& frustum, CullExpect expect )
+{
+  int numLines = (int)verts.size() / 2 ;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  vector<VertexRange> ranges = bvh.cull( frustum ) ;
+  double cullTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+
+  // Ranges sorted, not touching (else they'd have been merged), line aligned.
+  vector<bool> drawn( numLines, false ) ;
+  for( int i = 0 ; i < (int)ranges.size() ; i++ )
+  {
+    const VertexRange& r = ranges[i] ;
+    if( r.start >= r.end || ( r.start & 1 ) || ( r.end & 1 ) || r.end > 2*numLines || ( i && r.start <= ranges[i-1].end ) ) {
+      printf( "  FAIL %s: bad range %d [%d,%d)\n", what, i, r.start, r.end ) ;
+      return 1 ;
+    }
+    for( int v = r.start ; v < r.end ; v += 2 )
+      drawn[ v/2 ] = true ;
+  }
+
+  // Every line that's even partly inside has to be drawn.
+  int reallyVisible = 0 ;
+  for( int line = 0 ; line < numLines ; line++ )
+  {
+    bool visible = frustum.classify( AABB( verts[2*line].pos, verts[2*line+1].pos ) ) != Frustum::Outside ;
+    reallyVisible += visible ;
+    if( visible && !drawn[line] ) {
+      printf( "  FAIL %s: line %d is visible but was culled\n", what, line ) ;
+      return 1 ;
+    }
+  }
+
+  int numDrawn = countVertices( ranges ) / 2 ;
+  bool expected = expect == DrawsNone ? numDrawn == 0 :
+                  expect == DrawsSome ? numDrawn > 0 && numDrawn < numLines :
+                  expect == DrawsAll ? numDrawn == numLines : true ;
+  if( !expected ) {
+    printf( "  FAIL %s: %d of %d lines drawn, expected %s\n", what, numDrawn, numLines,
+      expect == DrawsNone ? "none" : expect == DrawsSome ? "some but not all" : "all" ) ;
+    return 1 ;
+  }
+  printf( "  %-28s %6d of %d lines drawn (%d really visible), %d culled, %d ranges, %.3f ms\n",
+    what, numDrawn, numLines, reallyVisible, numLines - numDrawn, (int)ranges.size(), cullTime*1e3 ) ;
+  return 0 ;
+}
+
+int testLineBVH( int numLines )
+{
+  vector<VertexPC> verts( 2*numLines ) ;
+  for( int i = 0 ; i < numLines ; i++ )
+  {
+    Rng rng = jobRng( i ) ;
+    Vector3f p = Vector3f::random( rng, -1.f, 1.f ) ;
+    Vector3f dir = Vector3f::random( rng, -1.f, 1.f ) ;
+    verts[2*i] = VertexPC( p, Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ;
+    verts[2*i+1] = VertexPC( p + dir*0.05f, Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ;
+  }
+
+  LineBVH bvh ;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  bvh.build( verts ) ;
+  double buildTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  printf( "testLineBVH: %d lines, %d leaves, build %.3f ms\n", numLines, bvh.firstLeaf, buildTime*1e3 ) ;
+
+  // Lines are spread over [-1,1]^3, these views see a few % of it.  Below
+  // 64 leaves' worth, they can easily take a bit of every leaf.
+  CullExpect partial = numLines >= 64*BVH_LEAF_LINES ? DrawsSome : DrawsAny ;
+  int failures = 0 ;
+  failures += checkCull( "whole view (ES1Renderer's)", bvh, verts, Frustum::ortho( -2.f, 2.f, -2.f, 2.f, -10.f, 10.f ), DrawsAll ) ;
+  failures += checkCull( "zoomed in", bvh, verts, Frustum::ortho( -0.25f, 0.25f, -0.25f, 0.25f, -10.f, 10.f ), partial ) ;
+  failures += checkCull( "right half, thin slab", bvh, verts, Frustum::ortho( 0.f, 2.f, -2.f, 2.f, -0.1f, 0.1f ), partial ) ;
+  failures += checkCull( "looking away", bvh, verts, Frustum::ortho( 5.f, 6.f, 5.f, 6.f, -10.f, 10.f ), DrawsNone ) ;
+
+  // Move everything, like processVertices does, and refit.
+  Matrix3f m = Matrix3f::rotationYawPitchRoll( 0.4f, 0.2f, 0.1f ) ;
+  for( VertexPC& v : verts )
+    v.pos = m * v.pos ;
+  start = chrono::steady_clock::now() ;
+  bvh.refit( verts ) ;
+  double refitTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  printf( "  refit after rotating %.3f ms\n", refitTime*1e3 ) ;
+  failures += checkCull( "zoomed in, rotated", bvh, verts, Frustum::ortho( -0.25f, 0.25f, -0.25f, 0.25f, -10.f, 10.f ), partial ) ;
+  failures += checkCull( "right half, rotated", bvh, verts, Frustum::ortho( 0.f, 2.f, -2.f, 2.f, -0.1f, 0.1f ), partial ) ;
+
+  printf( "testLineBVH: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
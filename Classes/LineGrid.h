@@ -0,0 +1,108 @@
+#ifndef LINEGRID_H
+#define LINEGRID_H
+
+#include "ThreadPool.h"
+#include "ThreadSpecific.h"
+#include "LineBVH.h" // AABB
+
+#include <stdint.h>
+
+// Which lines are near which?  Testing every line against every other is
+// n(n-1)/2 tests: 800M for the 40k lines, 500G for 1M.
+//
+// LineGrid is a BROADPHASE: a uniform grid over the lines (vertex pairs) of
+// a vector<VertexPC>, rebuilt from scratch every frame on the pool.  Only
+// lines that share a cell get tested, and what comes out are CANDIDATE
+// pairs: their boxes (grown by radius/2 each) overlap, so the lines might be
+// within `radius` of each other.  The exact test (the narrowphase) is the
+// caller's, on far fewer pairs.
+//
+// build(), all parallel:
+//   1. every line's box, and the bounds of them all
+//   2. how many cells each line's box covers, scanned to where its entries go
+//   3. the (cell, line) entries, then a radix sort by cell (RadixSort.h, a
+//      counting sort 8 bits at a time), so each cell's lines end up together
+//   4. where each occupied cell's run of lines starts
+// findPairs(), parallel over the occupied cells: each job tests the lines of
+// its cells pairwise into ITS THREAD'S buffer (EnumerableThreadSpecific, no
+// locks, kept from frame to frame), then the buffers are joined.
+//
+// A line whose box covers several cells is in each of them, so two lines can
+// meet in more than one cell.  The pair is only reported by the cell that
+// holds the low corner of where their boxes overlap, so it comes out ONCE.
+//
+// The cell size defaults to the average line box, so a line covers a few
+// cells, and is grown if that would make more than ~4 cells per line.  Lines
+// bunched up in a few places (a clustered scene) put many lines in a cell,
+// and that cell costs (lines in it)^2: the grid is only as good as the
+// distribution is even.
+
+struct SegmentPair
+{
+  uint32_t a, b ; // line indices (vertices 2a, 2a+1), a < b
+} ;
+
+inline bool operator<( const SegmentPair& p, const SegmentPair& q ) {
+  return p.a < q.a || ( p.a == q.a && p.b < q.b ) ;
+}
+inline bool operator==( const SegmentPair& p, const SegmentPair& q ) {
+  return p.a == q.a && p.b == q.b ;
+}
+
+struct LineGrid
+{
+  int numLines ;
+  float radius, cellSize ;
+  Vector3f origin ;       // the low corner of cell (0,0,0)
+  int dims[3] ;
+  vector<AABB> boxes ;    // each line's, grown by radius/2
+
+  // (cell, line) for every cell each line's box covers, sorted by cell, then line
+  vector<uint32_t> cellKeys, cellLines ;
+  // Where each occupied cell's lines start in cellLines, then cellLines.size()
+  vector<uint32_t> runs ;
+  int maxCellLines ;
+
+private:
+  EnumerableThreadSpecific< vector<SegmentPair> > threadPairs ;
+
+  // Copying forbidden (the per thread buffers)
+  LineGrid( const LineGrid& o ) {
+    puts( "ERROR: Copying LineGrid should not be done!" ) ;
+  }
+
+public:
+  LineGrid() : numLines( 0 ), radius( 0.f ), cellSize( 0.f ), maxCellLines( 0 ) {
+    dims[0] = dims[1] = dims[2] = 0 ;
+  }
+
+  // `radius`: how close lines have to be to be a pair.  `cellSize` 0 picks one.
+  void build( const vector<VertexPC>& verts, float iRadius, float iCellSize=0.f ) ;
+
+  // Every pair of lines whose boxes overlap, each once, a < b, in no
+  // particular order.  Parallel.  Replaces what's in `pairs`.
+  void findPairs( vector<SegmentPair>& pairs ) ;
+
+  inline int numCells() const { return dims[0]*dims[1]*dims[2] ; }
+  inline int numOccupiedCells() const { return runs.empty() ? 0 : (int)runs.size() - 1 ; }
+
+  inline int cellCoord( float p, float o, int axis ) const {
+    int c = (int)( ( p - o ) / cellSize ) ;
+    return c < 0 ? 0 : c >= dims[ axis ] ? dims[ axis ] - 1 : c ;
+  }
+  inline uint32_t cellKey( int x, int y, int z ) const {
+    return ( (uint32_t)z*dims[1] + y )*dims[0] + x ;
+  }
+} ;
+
+// Grids over a uniform scene and a clustered scene, plus one with cells much
+// smaller than the lines (so pairs meet in many cells).  Checks findPairs
+// against testing every pair, for each.  Returns # failures.
+int testLineGrid( int numLines ) ;
+
+// Build and findPairs times for 10k, 100k and 1M lines (sizes over maxLines
+// are skipped), uniform and clustered, with the cells, pairs and the most
+// lines in one cell.  Up to 10k, also against testing every pair.
+void benchmarkLineGrid( int maxLines ) ;
+
+#endif
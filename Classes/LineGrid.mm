@@ -0,0 +1,319 @@
+#import "LineGrid.h"
+#import "RadixSort.h"
+
+#include <chrono>
+
+#define LINEGRID_GRAIN 4096
+
+void LineGrid::build( const vector<VertexPC>& verts, float iRadius, float iCellSize )
+{
+  numLines = (int)verts.size() / 2 ;
+  radius = iRadius ;
+  boxes.resize( numLines ) ;
+  maxCellLines = 0 ;
+  if( !numLines ) {
+    cellKeys.clear() ;  cellLines.clear() ;  runs.clear() ;
+    dims[0] = dims[1] = dims[2] = 0 ;
+    return ;
+  }
+
+  // 1. BOXES, and the bounds and average size of them all
+  struct Extent
+  {
+    AABB bounds ;
+    double size ;
+    Extent() : size( 0.0 ) {}
+  } ;
+  Combinable<Extent> extents ;
+  float grow = radius * 0.5f ;
+  forEachChunk( "line boxes", numLines, LINEGRID_GRAIN, [&]( int start, int end ) {
+    Extent& e = extents.local() ;
+    for( int i = start ; i < end ; i++ )
+    {
+      AABB& box = boxes[i] ;
+      box = AABB( verts[ 2*i ].pos, verts[ 2*i+1 ].pos ) ;
+      box.min = box.min - Vector3f( grow ) ;
+      box.max = box.max + Vector3f( grow ) ;
+      e.bounds.add( box ) ;
+      Vector3f d = box.max - box.min ;
+      e.size += max( d.x, max( d.y, d.z ) ) ;
+    }
+  } ) ;
+  Extent all = extents.combine( []( const Extent& a, const Extent& b ) {
+    Extent sum = a ;
+    sum.bounds.add( b.bounds ) ;
+    sum.size += b.size ;
+    return sum ;
+  } ) ;
+
+  // The CELL SIZE: the average box, grown until there are no more than ~4
+  // cells per line (and no more than 1024 a side, so keys fit 32 bits).
+  origin = all.bounds.min ;
+  Vector3f span = all.bounds.max - all.bounds.min ;
+  cellSize = iCellSize > 0.f ? iCellSize : (float)( all.size / numLines ) ;
+  cellSize = max( cellSize, max( span.x, max( span.y, span.z ) ) / 1024.f ) ;
+  if( cellSize <= 0.f )  cellSize = 1.f ; // every line's a point, at the same point
+  for( ;; )
+  {
+    dims[0] = 1 + (int)( span.x / cellSize ) ;
+    dims[1] = 1 + (int)( span.y / cellSize ) ;
+    dims[2] = 1 + (int)( span.z / cellSize ) ;
+    if( iCellSize > 0.f || (double)dims[0]*dims[1]*dims[2] <= max( 4096.0, 4.0*numLines ) )
+      break ;
+    cellSize *= 1.26f ; // doubles the volume of a cell
+  }
+
+  // 2. COUNT the cells each box covers, and SCAN the counts to where each
+  // line's entries go: per chunk totals, a serial pass over the chunks, then
+  // each chunk scans its own lines from its start.
+  vector<uint32_t> firstEntry( numLines + 1 ) ;
+  int numChunks = ( numLines + LINEGRID_GRAIN - 1 ) / LINEGRID_GRAIN ;
+  vector<uint32_t> chunkEntries( numChunks + 1, 0 ) ;
+  auto cellRange = [this]( const AABB& box, int* lo, int* hi ) {
+    lo[0] = cellCoord( box.min.x, origin.x, 0 ) ;  hi[0] = cellCoord( box.max.x, origin.x, 0 ) ;
+    lo[1] = cellCoord( box.min.y, origin.y, 1 ) ;  hi[1] = cellCoord( box.max.y, origin.y, 1 ) ;
+    lo[2] = cellCoord( box.min.z, origin.z, 2 ) ;  hi[2] = cellCoord( box.max.z, origin.z, 2 ) ;
+  } ;
+  forEachChunk( "line cells count", numLines, LINEGRID_GRAIN, [&]( int start, int end ) {
+    uint32_t total = 0 ;
+    for( int i = start ; i < end ; i++ )
+    {
+      int lo[3], hi[3] ;
+      cellRange( boxes[i], lo, hi ) ;
+      firstEntry[i] = ( hi[0]-lo[0]+1 )*( hi[1]-lo[1]+1 )*( hi[2]-lo[2]+1 ) ;
+      total += firstEntry[i] ;
+    }
+    chunkEntries[ start / LINEGRID_GRAIN + 1 ] = total ;
+  } ) ;
+  for( int c = 0 ; c < numChunks ; c++ )
+    chunkEntries[ c+1 ] += chunkEntries[c] ;
+  int numEntries = (int)chunkEntries[ numChunks ] ;
+
+  // 3. The (cell, line) ENTRIES, in line order, then sorted by cell.  The
+  // sort is stable, so each cell's lines stay in line order (a < b for free).
+  cellKeys.resize( numEntries ) ;
+  cellLines.resize( numEntries ) ;
+  forEachChunk( "line cells", numLines, LINEGRID_GRAIN, [&]( int start, int end ) {
+    uint32_t entry = chunkEntries[ start / LINEGRID_GRAIN ] ;
+    for( int i = start ; i < end ; i++ )
+    {
+      int lo[3], hi[3] ;
+      cellRange( boxes[i], lo, hi ) ;
+      for( int z = lo[2] ; z <= hi[2] ; z++ )
+        for( int y = lo[1] ; y <= hi[1] ; y++ )
+          for( int x = lo[0] ; x <= hi[0] ; x++ ) {
+            cellKeys[ entry ] = cellKey( x, y, z ) ;
+            cellLines[ entry++ ] = i ;
+          }
+    }
+  } ) ;
+  radixSort( &cellKeys[0], &cellLines[0], numEntries ) ;
+
+  // 4. RUNS: where the key changes is where a cell starts.  Each chunk finds
+  // its own, and they're joined in chunk order.
+  int numEntryChunks = ( numEntries + LINEGRID_GRAIN - 1 ) / LINEGRID_GRAIN ;
+  vector< vector<uint32_t> > chunkRuns( numEntryChunks ) ;
+  vector<int> chunkMax( numEntryChunks, 0 ) ;
+  forEachChunk( "line cell runs", numEntries, LINEGRID_GRAIN, [&]( int start, int end ) {
+    vector<uint32_t>& starts = chunkRuns[ start / LINEGRID_GRAIN ] ;
+    for( int e = start ; e < end ; e++ )
+      if( !e || cellKeys[e] != cellKeys[e-1] )
+        starts.push_back( e ) ;
+  } ) ;
+  runs.clear() ;
+  for( const vector<uint32_t>& starts : chunkRuns )
+    runs.insert( runs.end(), starts.begin(), starts.end() ) ;
+  runs.push_back( numEntries ) ;
+  for( int r = 0 ; r + 1 < (int)runs.size() ; r++ )
+    maxCellLines = max( maxCellLines, (int)( runs[r+1] - runs[r] ) ) ;
+}
+
+void LineGrid::findPairs( vector<SegmentPair>& pairs )
+{
+  threadPairs.forEach( []( vector<SegmentPair>& found ) { found.clear() ; } ) ;
+
+  // Cells cost (lines in them)^2, so a few per job.
+  forEachChunk( "line pairs", numOccupiedCells(), 64, [&]( int start, int end ) {
+    vector<SegmentPair>& found = threadPairs.local() ;
+    for( int r = start ; r < end ; r++ )
+    {
+      uint32_t key = cellKeys[ runs[r] ] ;
+      int cx = key % dims[0], cy = ( key / dims[0] ) % dims[1], cz = key / ( dims[0]*dims[1] ) ;
+      for( uint32_t i = runs[r] ; i < runs[r+1] ; i++ )
+      {
+        uint32_t a = cellLines[i] ;
+        const AABB& boxA = boxes[a] ;
+        for( uint32_t j = i + 1 ; j < runs[r+1] ; j++ )
+        {
+          uint32_t b = cellLines[j] ;
+          const AABB& boxB = boxes[b] ;
+          if( boxA.max.x < boxB.min.x || boxB.max.x < boxA.min.x ||
+              boxA.max.y < boxB.min.y || boxB.max.y < boxA.min.y ||
+              boxA.max.z < boxB.min.z || boxB.max.z < boxA.min.z )
+            continue ;
+          // Only the cell with the low corner of the overlap reports it.
+          if( cellCoord( max( boxA.min.x, boxB.min.x ), origin.x, 0 ) != cx ||
+              cellCoord( max( boxA.min.y, boxB.min.y ), origin.y, 1 ) != cy ||
+              cellCoord( max( boxA.min.z, boxB.min.z ), origin.z, 2 ) != cz )
+            continue ;
+          SegmentPair pair = { a, b } ;
+          found.push_back( pair ) ;
+        }
+      }
+    }
+  } ) ;
+
+  // JOIN the threads' buffers, each copied in parallel to its own place.
+  vector< vector<SegmentPair>* > buffers ;
+  vector<size_t> offsets( 1, 0 ) ;
+  threadPairs.forEach( [&]( vector<SegmentPair>& found ) {
+    buffers.push_back( &found ) ;
+    offsets.push_back( offsets.back() + found.size() ) ;
+  } ) ;
+  pairs.resize( offsets.back() ) ;
+  forEachChunk( "line pairs join", (int)buffers.size(), 1, [&]( int start, int end ) {
+    for( int t = start ; t < end ; t++ )
+      if( buffers[t]->size() )
+        memcpy( &pairs[ offsets[t] ], &(*buffers[t])[0], buffers[t]->size() * sizeof( SegmentPair ) ) ;
+  } ) ;
+}
+
+// TEST & BENCHMARK //
+
+static double secondsSince( const chrono::steady_clock::time_point& start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+// Lines of length up to `length` in the unit cube.  Clustered: 80% of them
+// in 16 balls of radius 0.1, the rest spread out.
+static void makeLines( vector<VertexPC>& verts, int numLines, float length, bool clustered )
+{
+  verts.resize( 2*numLines ) ;
+  Vector3f centers[16] ;
+  Rng clusterRng( 0xC1057E4 ) ;
+  for( int c = 0 ; c < 16 ; c++ )
+    centers[c] = Vector3f::random( clusterRng, 0.1f, 0.9f ) ;
+  forEachChunk( "make lines", numLines, LINEGRID_GRAIN, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+    {
+      Rng rng = jobRng( i ) ;
+      Vector3f p ;
+      if( clustered && rng.nextInt( 5 ) ) {
+        Vector3f d ;
+        do  d = Vector3f::random( rng, -1.f, 1.f ) ;  while( d.dot( d ) > 1.f ) ;
+        p = centers[ rng.nextInt( 16 ) ] + d*0.1f ;
+      }
+      else
+        p = Vector3f::random( rng, 0.f, 1.f ) ;
+      Vector3f dir = Vector3f::random( rng, -1.f, 1.f ) ;
+      verts[ 2*i ] = VertexPC( p, Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ;
+      verts[ 2*i+1 ] = VertexPC( p + dir*length, Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ;
+    }
+  } ) ;
+}
+
+// Testing every pair (parallel over a), sorted.
+static void allPairs( const LineGrid& grid, vector<SegmentPair>& pairs )
+{
+  int n = grid.numLines ;
+  vector< vector<SegmentPair> > rows( n ) ;
+  forEachChunk( "all pairs", n, 64, [&]( int start, int end ) {
+    for( int a = start ; a < end ; a++ )
+    {
+      const AABB& boxA = grid.boxes[a] ;
+      for( int b = a + 1 ; b < n ; b++ )
+      {
+        const AABB& boxB = grid.boxes[b] ;
+        if( boxA.max.x < boxB.min.x || boxB.max.x < boxA.min.x ||
+            boxA.max.y < boxB.min.y || boxB.max.y < boxA.min.y ||
+            boxA.max.z < boxB.min.z || boxB.max.z < boxA.min.z )
+          continue ;
+        SegmentPair pair = { (uint32_t)a, (uint32_t)b } ;
+        rows[a].push_back( pair ) ;
+      }
+    }
+  } ) ;
+  pairs.clear() ;
+  for( const vector<SegmentPair>& row : rows )
+    pairs.insert( pairs.end(), row.begin(), row.end() ) ;
+}
+
+static int checkGrid( const char* what, const vector<VertexPC>& verts, float radius, float cellSize )
+{
+  LineGrid grid ;
+  grid.build( verts, radius, cellSize ) ;
+  vector<SegmentPair> pairs, expected ;
+  grid.findPairs( pairs ) ;
+  allPairs( grid, expected ) ;
+  sort( pairs.begin(), pairs.end() ) ;
+  bool ordered = 1 ;
+  for( const SegmentPair& p : pairs )
+    ordered = ordered && p.a < p.b ;
+  bool ok = ordered && pairs == expected ;
+  printf( "  %-30s %3dx%3dx%3d cells, %6d occupied, up to %4d lines in one, %7d pairs (expected %7d) %s\n",
+    what, grid.dims[0], grid.dims[1], grid.dims[2], grid.numOccupiedCells(), grid.maxCellLines,
+    (int)pairs.size(), (int)expected.size(), ok ? "ok" : "FAIL" ) ;
+  return !ok ;
+}
+
+int testLineGrid( int numLines )
+{
+  printf( "testLineGrid: %d lines\n", numLines ) ;
+  int failures = 0 ;
+  float length = 0.5f / cbrtf( (float)numLines ) ;
+  vector<VertexPC> verts ;
+
+  makeLines( verts, numLines, length, 0 ) ;
+  failures += checkGrid( "uniform", verts, length*0.5f, 0.f ) ;
+  failures += checkGrid( "uniform, tiny cells", verts, length*0.5f, length*0.2f ) ;
+  failures += checkGrid( "uniform, no radius", verts, 0.f, 0.f ) ;
+  makeLines( verts, numLines, length, 1 ) ;
+  failures += checkGrid( "clustered", verts, length*0.5f, 0.f ) ;
+
+  // No lines, one line, and every line the same point.
+  verts.clear() ;
+  failures += checkGrid( "no lines", verts, 0.1f, 0.f ) ;
+  verts.assign( 2, VertexPC( Vector3f( 0.5f ), Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ) ;
+  failures += checkGrid( "one line", verts, 0.1f, 0.f ) ;
+  verts.assign( 200, VertexPC( Vector3f( 0.5f ), Vector4f( 1.f, 1.f, 1.f, 1.f ) ) ) ;
+  failures += checkGrid( "100 lines on one point", verts, 0.f, 0.f ) ;
+
+  printf( "testLineGrid: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
+
+void benchmarkLineGrid( int maxLines )
+{
+  puts( "benchmarkLineGrid: ms, lines of length 0.5/cbrt(n) in the unit cube, radius half that" ) ;
+  printf( "  %-10s %8s %9s %9s %10s %11s %8s %10s\n", "", "lines", "build", "pairs", "# pairs", "cells used", "max/cell", "all pairs" ) ;
+  vector<VertexPC> verts ;
+  vector<SegmentPair> pairs, expected ;
+  for( int n = 10000 ; n <= maxLines ; n *= 10 )
+    for( int clustered = 0 ; clustered < 2 ; clustered++ )
+    {
+      float length = 0.5f / cbrtf( (float)n ) ;
+      makeLines( verts, n, length, clustered ) ;
+
+      // Best of a few: the first build pays for growing the buffers.
+      LineGrid grid ;
+      double buildTime = 1e9, pairsTime = 1e9 ;
+      for( int rep = 0 ; rep < 5 ; rep++ )
+      {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+        grid.build( verts, length*0.5f ) ;
+        buildTime = min( buildTime, secondsSince( start ) ) ;
+        start = chrono::steady_clock::now() ;
+        grid.findPairs( pairs ) ;
+        pairsTime = min( pairsTime, secondsSince( start ) ) ;
+      }
+      printf( "  %-10s %8d %9.2f %9.2f %10d %11d %8d", clustered ? "clustered" : "uniform", n,
+        buildTime*1e3, pairsTime*1e3, (int)pairs.size(), grid.numOccupiedCells(), grid.maxCellLines ) ;
+      if( n <= 10000 ) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+        allPairs( grid, expected ) ;
+        printf( " %10.2f", secondsSince( start )*1e3 ) ;
+      }
+      puts( "" ) ;
+    }
+}
@@ -0,0 +1,243 @@
+#ifndef PARALLELALGORITHMS_H
+#define PARALLELALGORITHMS_H
+
+#include "Executor.h"
+
+#include <iterator>
+#include <functional>
+
+// The standard algorithms, parallel, on an executor (Executor.h) instead of
+// an execution policy, so they run on Threaden's workers and not on a second
+// set of threads:
+//
+//   parallelForEach( ThreadPoolExecutor(), verts.begin(), verts.end(), []( VertexPC& v ) { ... } ) ;
+//   float total = parallelReduce( ThreadPoolExecutor(), w.begin(), w.end(), 0.f ) ;
+//   parallelSort( ThreadPoolExecutor(), draws.begin(), draws.end(), byDepth ) ;
+//
+// Same arguments and results as std::for_each, transform, reduce, sort and
+// inclusive_scan, with the executor where the policy would go.  RANDOM ACCESS
+// iterators only (vector, array, pointers), and fewer than 2^31 elements.
+//
+// Each cuts its range into ranges of parallelGrain() (4 per thread, at
+// least PARALLEL_MIN_GRAIN elements) and runs them with ex.bulk(), so on the
+// pool they're a parallelFor: a sequence point on the main thread, in order
+// on any other (and InlineExecutor is always in order).  As with the
+// parallel policies, f and op get called from many threads at once, and
+// reduce and inclusive_scan's op has to be associative: the ranges are
+// summed separately, then the sums combined (in order, so it needn't commute).
+//
+// sort: every range std::sort'ed, then merged in pairs, twice the length
+// each round, between the data and a buffer the size of it.  Each pair is
+// cut into pieces at matching values in both halves, so even the last
+// round (one pair, the whole lot) merges in parallel.  Not stable.
+//
+// inclusive_scan: each range's total, then the totals scanned (serial, one
+// per range), then each range scanned again from what came before it.
+// That's twice the ops of the serial scan, so it needs 3 or more threads to win.
+// out may be first (in place).
+
+// Ranges below this many elements aren't worth a job.
+#define PARALLEL_MIN_GRAIN 4096
+
+template<class Executor>
+int parallelGrain( const Executor& ex, int n )
+{
+  return max( PARALLEL_MIN_GRAIN, n / ( 4*ex.concurrency() ) ) ;
+}
+
+template<class Executor, class RandomIt, class F>
+void parallelForEach( const Executor& ex, RandomIt first, RandomIt last, F f )
+{
+  int n = (int)( last - first ) ;
+  ex.bulk( n, parallelGrain( ex, n ), [&]( int start, int end ) {
+    for( RandomIt it = first + start, e = first + end ; it != e ; ++it )
+      f( *it ) ;
+  } ) ;
+}
+
+template<class Executor, class InIt, class OutIt, class F>
+OutIt parallelTransform( const Executor& ex, InIt first, InIt last, OutIt out, F f )
+{
+  int n = (int)( last - first ) ;
+  ex.bulk( n, parallelGrain( ex, n ), [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      out[i] = f( first[i] ) ;
+  } ) ;
+  return out + n ;
+}
+
+template<class Executor, class InIt1, class InIt2, class OutIt, class F>
+OutIt parallelTransform( const Executor& ex, InIt1 first1, InIt1 last1, InIt2 first2, OutIt out, F f )
+{
+  int n = (int)( last1 - first1 ) ;
+  ex.bulk( n, parallelGrain( ex, n ), [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      out[i] = f( first1[i], first2[i] ) ;
+  } ) ;
+  return out + n ;
+}
+
+template<class Executor, class RandomIt, class T, class Op>
+T parallelReduce( const Executor& ex, RandomIt first, RandomIt last, T init, Op op )
+{
+  int n = (int)( last - first ) ;
+  if( !n )  return init ;
+  int grain = parallelGrain( ex, n ) ;
+  vector<T> sums( ( n + grain - 1 ) / grain, init ) ;
+  ex.bulk( n, grain, [&]( int start, int end ) {
+    T sum = first[ start ] ;
+    for( int i = start + 1 ; i < end ; i++ )
+      sum = op( sum, first[i] ) ;
+    sums[ start / grain ] = sum ; // ranges start on multiples of the grain
+  } ) ;
+  for( const T& sum : sums )
+    init = op( init, sum ) ;
+  return init ;
+}
+
+template<class Executor, class RandomIt, class T>
+T parallelReduce( const Executor& ex, RandomIt first, RandomIt last, T init )
+{
+  return parallelReduce( ex, first, last, init, plus<T>() ) ;
+}
+
+template<class Executor, class InIt, class OutIt, class Op>
+OutIt parallelInclusiveScan( const Executor& ex, InIt first, InIt last, OutIt out, Op op )
+{
+  typedef typename iterator_traits<InIt>::value_type T ;
+  int n = (int)( last - first ) ;
+  if( !n )  return out ;
+  int grain = parallelGrain( ex, n ) ;
+  int numRanges = ( n + grain - 1 ) / grain ;
+
+  // 1. Every range's total
+  vector<T> totals( numRanges, first[0] ) ;
+  ex.bulk( n, grain, [&]( int start, int end ) {
+    T sum = first[ start ] ;
+    for( int i = start + 1 ; i < end ; i++ )
+      sum = op( sum, first[i] ) ;
+    totals[ start / grain ] = sum ;
+  } ) ;
+  // 2. Scanned: totals[r] is now everything up to the end of range r
+  for( int r = 1 ; r < numRanges ; r++ )
+    totals[r] = op( totals[r-1], totals[r] ) ;
+  // 3. Every range again, carrying in what's before it.  Each element is read
+  // before it's written, so out can be first.
+  ex.bulk( n, grain, [&]( int start, int end ) {
+    int r = start / grain ;
+    T sum = r ? op( totals[r-1], first[ start ] ) : first[ start ] ;
+    out[ start ] = sum ;
+    for( int i = start + 1 ; i < end ; i++ ) {
+      sum = op( sum, first[i] ) ;
+      out[i] = sum ;
+    }
+  } ) ;
+  return out + n ;
+}
+
+template<class Executor, class InIt, class OutIt>
+OutIt parallelInclusiveScan( const Executor& ex, InIt first, InIt last, OutIt out )
+{
+  return parallelInclusiveScan( ex, first, last, out, plus< typename iterator_traits<InIt>::value_type >() ) ;
+}
+
+// A piece of one pair of runs that merges on its own: [a0,a1) of the first
+// run and [b0,b1) of the second, to `out` onward.
+struct MergePiece
+{
+  int a0, a1, b0, b1, out ;
+} ;
+
+// One round of parallelSort's merging: the runs of `width` in src, merged in
+// pairs into dst.  The longer run of a pair is cut evenly, the other where
+// those values fall in it, so the pieces are about `grain` each.
+template<class Executor, class SrcIt, class DstIt, class Compare>
+void mergeRuns( const Executor& ex, SrcIt src, DstIt dst, int n, int width, int grain, Compare comp )
+{
+  vector<MergePiece> pieces ;
+  for( int lo = 0 ; lo < n ; lo += 2*width )
+  {
+    int mid = min( n, lo + width ), hi = min( n, lo + 2*width ) ;
+    int numPieces = max( 1, ( hi - lo ) / grain ) ;
+    bool cutFirst = mid - lo >= hi - mid ;
+    int a = lo, b = mid ;
+    for( int p = 1 ; p <= numPieces ; p++ )
+    {
+      int a1, b1 ;
+      if( p == numPieces ) {
+        a1 = mid ;
+        b1 = hi ;
+      }
+      else if( cutFirst ) {
+        // the second run's values equal to the cut go after it, like std::merge puts them
+        a1 = lo + (int)( (long long)( mid - lo )*p/numPieces ) ;
+        b1 = (int)( lower_bound( src + mid, src + hi, src[ a1 ], comp ) - src ) ;
+      }
+      else {
+        b1 = mid + (int)( (long long)( hi - mid )*p/numPieces ) ;
+        a1 = (int)( upper_bound( src + lo, src + mid, src[ b1 ], comp ) - src ) ;
+      }
+      MergePiece piece = { a, a1, b, b1, a + b - mid } ;
+      pieces.push_back( piece ) ;
+      a = a1 ;
+      b = b1 ;
+    }
+  }
+  ex.bulk( (int)pieces.size(), 1, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      const MergePiece& m = pieces[i] ;
+      merge( make_move_iterator( src + m.a0 ), make_move_iterator( src + m.a1 ),
+             make_move_iterator( src + m.b0 ), make_move_iterator( src + m.b1 ), dst + m.out, comp ) ;
+    }
+  } ) ;
+}
+
+template<class Executor, class RandomIt, class Compare>
+void parallelSort( const Executor& ex, RandomIt first, RandomIt last, Compare comp )
+{
+  typedef typename iterator_traits<RandomIt>::value_type T ;
+  int n = (int)( last - first ) ;
+  int grain = parallelGrain( ex, n ) ;
+  if( n <= grain ) {
+    sort( first, last, comp ) ;
+    return ;
+  }
+
+  // 1. Every range sorted on its own
+  ex.bulk( n, grain, [&]( int start, int end ) {
+    sort( first + start, first + end, comp ) ;
+  } ) ;
+
+  // 2. Merged in pairs, back and forth between the data and the buffer
+  vector<T> buffer( first, last ) ;
+  bool inBuffer = false ;
+  for( int width = grain ; width < n ; width *= 2 )
+  {
+    if( inBuffer )  mergeRuns( ex, buffer.begin(), first, n, width, grain, comp ) ;
+    else  mergeRuns( ex, first, buffer.begin(), n, width, grain, comp ) ;
+    inBuffer = !inBuffer ;
+  }
+  if( inBuffer )
+    ex.bulk( n, grain, [&]( int start, int end ) {
+      move( buffer.begin() + start, buffer.begin() + end, first + start ) ;
+    } ) ;
+}
+
+template<class Executor, class RandomIt>
+void parallelSort( const Executor& ex, RandomIt first, RandomIt last )
+{
+  parallelSort( ex, first, last, less< typename iterator_traits<RandomIt>::value_type >() ) ;
+}
+
+// Each algorithm on the pool and inline, against the std one, on `n`
+// elements (ints, so reduce and scan are exact; sort with repeats and a
+// custom compare; scan in place).  Main thread, pool up.  Returns # failures.
+int testParallelAlgorithms( int n ) ;
+
+// for_each, transform, reduce, sort and inclusive_scan on 1M and 10M
+// elements (sizes over maxN skipped): std serial, the parallel algorithms on
+// the pool, and, where the standard library has them (libstdc++ with TBB,
+// built as C++17), std::execution::par.  Main thread, pool up.
+void benchmarkParallelAlgorithms( int maxN ) ;
+
+#endif
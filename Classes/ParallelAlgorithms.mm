@@ -0,0 +1,182 @@
+#import "ParallelAlgorithms.h"
+#import "Random.h"
+
+#include <chrono>
+#include <math.h>
+#include <numeric>
+
+// libstdc++ has the parallel policies from C++17 (backed by TBB); libc++ doesn't.
+#if __cplusplus >= 201703L && defined( __has_include )
+#if __has_include( <execution> )
+#include <execution>
+#endif
+#endif
+#ifdef __cpp_lib_parallel_algorithm
+#define THREADEN_STD_PARALLEL 1
+#else
+#define THREADEN_STD_PARALLEL 0
+#endif
+
+// TEST & BENCHMARK //
+
+// Quietly, only the failures are printed.
+template<class Executor>
+static int testOn( const Executor& ex, const char* exName, const vector<int>& data, bool quietly )
+{
+  int failures = 0, n = (int)data.size() ;
+  auto check = [&]( const char* what, bool ok ) {
+    if( !quietly || !ok )
+      printf( "  %-8s %-43s %s\n", exName, what, ok ? "ok" : "FAIL" ) ;
+    failures += !ok ;
+  } ;
+
+  vector<int> a( data ), b( data ) ;
+  parallelForEach( ex, a.begin(), a.end(), []( int& x ) { x = x*3 + 1 ; } ) ;
+  for_each( b.begin(), b.end(), []( int& x ) { x = x*3 + 1 ; } ) ;
+  check( "for_each", a == b ) ;
+
+  vector<long long> out( n ), expected( n ) ;
+  parallelTransform( ex, data.begin(), data.end(), out.begin(), []( int x ) { return (long long)x*x ; } ) ;
+  transform( data.begin(), data.end(), expected.begin(), []( int x ) { return (long long)x*x ; } ) ;
+  check( "transform", out == expected ) ;
+  parallelTransform( ex, data.begin(), data.end(), a.begin(), out.begin(), []( int x, int y ) { return (long long)x - y ; } ) ;
+  transform( data.begin(), data.end(), a.begin(), expected.begin(), []( int x, int y ) { return (long long)x - y ; } ) ;
+  check( "transform (binary)", out == expected ) ;
+
+  long long sum = parallelReduce( ex, data.begin(), data.end(), 5LL ) ;
+  check( "reduce", sum == accumulate( data.begin(), data.end(), 5LL ) ) ;
+  int biggest = parallelReduce( ex, data.begin(), data.end(), INT_MIN, []( int x, int y ) { return max( x, y ) ; } ) ;
+  check( "reduce (max)", biggest == *max_element( data.begin(), data.end() ) ) ;
+  check( "reduce (nothing)", parallelReduce( ex, data.begin(), data.begin(), 7 ) == 7 ) ;
+
+  a = data ;
+  b = data ;
+  parallelSort( ex, a.begin(), a.end() ) ;
+  sort( b.begin(), b.end() ) ;
+  check( "sort", a == b ) ;
+  a = data ;
+  parallelSort( ex, a.begin(), a.end(), greater<int>() ) ;
+  reverse( b.begin(), b.end() ) ;
+  check( "sort (descending)", a == b ) ;
+  // Keys with the index riding along: lots of repeats, so cuts land inside runs of equal keys
+  vector< pair<int, int> > keyed( n ), keyedExpected ;
+  for( int i = 0 ; i < n ; i++ )
+    keyed[i] = make_pair( data[i] % 16, i ) ;
+  keyedExpected = keyed ;
+  auto byKey = []( const pair<int, int>& p, const pair<int, int>& q ) { return p.first < q.first ; } ;
+  parallelSort( ex, keyed.begin(), keyed.end(), byKey ) ;
+  stable_sort( keyedExpected.begin(), keyedExpected.end(), byKey ) ;
+  bool sameKeys = 1 ;
+  for( int i = 0 ; i < n ; i++ )
+    sameKeys &= keyed[i].first == keyedExpected[i].first ;
+  sort( keyed.begin(), keyed.end() ) ; // every (key, index) still there once
+  sort( keyedExpected.begin(), keyedExpected.end() ) ;
+  check( "sort (repeated keys, nothing lost)", sameKeys && keyed == keyedExpected ) ;
+
+  vector<long long> scanned( n ) ;
+  vector<long long> wide( data.begin(), data.end() ) ;
+  parallelInclusiveScan( ex, wide.begin(), wide.end(), scanned.begin() ) ;
+  partial_sum( wide.begin(), wide.end(), expected.begin() ) ;
+  check( "inclusive_scan", scanned == expected ) ;
+  parallelInclusiveScan( ex, wide.begin(), wide.end(), wide.begin() ) ; // in place
+  check( "inclusive_scan (in place)", wide == expected ) ;
+  return failures ;
+}
+
+int testParallelAlgorithms( int n )
+{
+  printf( "testParallelAlgorithms: %d elements\n", n ) ;
+  Rng rng = jobRng( n ) ;
+  vector<int> data( n ) ;
+  for( int i = 0 ; i < n ; i++ )
+    data[i] = (int)( rng.next() % 2000001 ) - 1000000 ;
+
+  int failures = testOn( ThreadPoolExecutor(), "pool", data, false ) ;
+  failures += testOn( InlineExecutor(), "inline", data, false ) ;
+  // Sizes around the grain: 1 range, 1 range and a bit, an odd number of runs
+  int sizes[] = { 1, PARALLEL_MIN_GRAIN, PARALLEL_MIN_GRAIN + 1, 5*PARALLEL_MIN_GRAIN + 3 } ;
+  for( int size : sizes )
+    if( size < n ) {
+      vector<int> small( data.begin(), data.begin() + size ) ;
+      int smallFailures = testOn( ThreadPoolExecutor(), "pool", small, true ) ;
+      printf( "  %-8s %-43s %s\n", "pool", ( "all of them, " + to_string( size ) + " elements" ).c_str(), smallFailures ? "FAIL" : "ok" ) ;
+      failures += smallFailures ;
+    }
+
+  printf( "testParallelAlgorithms: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
+
+// Best of `reps` runs of f(), each after reset() (untimed), in ms
+static double bestOf( int reps, const function<void ()>& reset, const function<void ()>& f )
+{
+  double best = 1e30 ;
+  for( int r = 0 ; r < reps ; r++ ) {
+    reset() ;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+    f() ;
+    best = min( best, chrono::duration<double>( chrono::steady_clock::now() - start ).count() ) ;
+  }
+  return best*1e3 ;
+}
+
+void benchmarkParallelAlgorithms( int maxN )
+{
+  ThreadPoolExecutor pool ;
+  printf( "benchmarkParallelAlgorithms: %d threads in the pool, %s\n", pool.concurrency(),
+    THREADEN_STD_PARALLEL ? "std::execution::par has its own" : "no std::execution::par in this build" ) ;
+  puts( "  ms, best of 5                  std serial  std par   pool    pool speedup" ) ;
+  int sizes[] = { 1000000, 10000000 } ;
+  for( int n : sizes )
+  {
+    if( n > maxN )  continue ;
+    Rng rng = jobRng( n ) ;
+    vector<float> x( n ), y( n ), work( n ) ;
+    vector<uint32_t> keys( n ), sorting( n ) ;
+    vector<double> values( n ), scanned( n ) ;
+    randomFill( rng, &x[0], n, 0.f, 1000.f ) ;
+    for( int i = 0 ; i < n ; i++ ) {
+      keys[i] = rng.next() ;
+      values[i] = x[i] ;
+    }
+    const int reps = 5 ;
+    auto noReset = [](){} ;
+    auto resetWork = [&](){ work = x ; } ;
+    auto resetSort = [&](){ sorting = keys ; } ;
+    auto heavy = []( float& v ) { v = sqrtf( v )*1.0001f + sinf( v ) ; } ;
+    auto axpy = []( float v ) { return v*2.5f + 1.f ; } ;
+    volatile double sink = 0 ;
+
+    double serial[5], par[5], ours[5] ;
+    const char* names[] = { "for_each (sqrt, sin)", "transform (a*x + b)", "reduce (double sum)", "sort (uint32)", "inclusive_scan (double)" } ;
+    serial[0] = bestOf( reps, resetWork, [&](){ for_each( work.begin(), work.end(), heavy ) ; } ) ;
+    ours[0] = bestOf( reps, resetWork, [&](){ parallelForEach( pool, work.begin(), work.end(), heavy ) ; } ) ;
+    serial[1] = bestOf( reps, noReset, [&](){ transform( x.begin(), x.end(), y.begin(), axpy ) ; } ) ;
+    ours[1] = bestOf( reps, noReset, [&](){ parallelTransform( pool, x.begin(), x.end(), y.begin(), axpy ) ; } ) ;
+    serial[2] = bestOf( reps, noReset, [&](){ sink = accumulate( values.begin(), values.end(), 0.0 ) ; } ) ;
+    ours[2] = bestOf( reps, noReset, [&](){ sink = parallelReduce( pool, values.begin(), values.end(), 0.0 ) ; } ) ;
+    serial[3] = bestOf( reps, resetSort, [&](){ sort( sorting.begin(), sorting.end() ) ; } ) ;
+    ours[3] = bestOf( reps, resetSort, [&](){ parallelSort( pool, sorting.begin(), sorting.end() ) ; } ) ;
+    serial[4] = bestOf( reps, noReset, [&](){ partial_sum( values.begin(), values.end(), scanned.begin() ) ; } ) ;
+    ours[4] = bestOf( reps, noReset, [&](){ parallelInclusiveScan( pool, values.begin(), values.end(), scanned.begin() ) ; } ) ;
+#if THREADEN_STD_PARALLEL
+    par[0] = bestOf( reps, resetWork, [&](){ for_each( execution::par, work.begin(), work.end(), heavy ) ; } ) ;
+    par[1] = bestOf( reps, noReset, [&](){ transform( execution::par, x.begin(), x.end(), y.begin(), axpy ) ; } ) ;
+    par[2] = bestOf( reps, noReset, [&](){ sink = reduce( execution::par, values.begin(), values.end(), 0.0 ) ; } ) ;
+    par[3] = bestOf( reps, resetSort, [&](){ sort( execution::par, sorting.begin(), sorting.end() ) ; } ) ;
+    par[4] = bestOf( reps, noReset, [&](){ inclusive_scan( execution::par, values.begin(), values.end(), scanned.begin() ) ; } ) ;
+#else
+    for( int a = 0 ; a < 5 ; a++ )
+      par[a] = 0 ;
+#endif
+
+    printf( "  %d elements\n", n ) ;
+    for( int a = 0 ; a < 5 ; a++ )
+    {
+      char parMs[32] = "-" ;
+      if( THREADEN_STD_PARALLEL )
+        sprintf( parMs, "%.2f", par[a] ) ;
+      printf( "    %-26s %9.2f %8s %8.2f %8.2fx\n", names[a], serial[a], parMs, ours[a], serial[a]/ours[a] ) ;
+    }
+  }
+}
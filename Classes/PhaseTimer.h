@@ -0,0 +1,42 @@
+#ifndef PHASETIMER_H
+#define PHASETIMER_H
+
+// The hook the pool (and anything else) times main thread phases with, on
+// its own so timing a scope doesn't pull in the telemetry module.  The
+// phases and what they cover: FrameTelemetry.h.
+
+enum FramePhase
+{
+  PhaseOther,
+  PhasePrerender,
+  PhaseSubmit,
+  PhaseRunJobs,
+  PhaseWait,
+  PhaseDraw,
+  PhaseFlip,
+  NumFramePhases
+} ;
+
+struct FrameTelemetry ;
+extern FrameTelemetry *frameTelemetry ;
+
+// FrameTelemetry.mm.  Enters `phase` and returns frameTelemetry if this is
+// the main thread in a frame, else 0.
+FrameTelemetry* phaseTimerEnter( FramePhase phase ) ;
+void phaseTimerLeave( FrameTelemetry *telemetry ) ;
+
+// Times its scope as `phase`, if this is the main thread in a frame.
+// With no `frameTelemetry` it's a null check.
+struct PhaseTimer
+{
+  FrameTelemetry *telemetry ;
+
+  PhaseTimer( FramePhase phase ) : telemetry( 0 ) {
+    if( frameTelemetry )  telemetry = phaseTimerEnter( phase ) ;
+  }
+  ~PhaseTimer() {
+    if( telemetry )  phaseTimerLeave( telemetry ) ;
+  }
+} ;
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "ThreadPool.h"
+
+#include <map>
+#include <atomic>
+
+// A chain of FILTERS that CHUNKS flow through, on the ThreadPool:
+//
+//   Pipeline pipe( "lines", 8 ) ;                                  // at most 8 chunks in flight
+//   pipe.addFilter( "input", FilterSerialInOrder, [&]( void* ){ return nextChunk() ; } ) ;   // 0 when there are no more
+//   pipe.addFilter( "transform", FilterParallel, [&]( void* c ){ transform( (Chunk*)c ) ; return c ; } ) ;
+//   pipe.addFilter( "cull", FilterParallel, ... ) ;
+//   pipe.addFilter( "pack", FilterSerialInOrder, [&]( void* c ){ append( (Chunk*)c ) ; return c ; } ) ;
+//   pipe.run() ;
+//
+// Instead of a sequence point per stage (every core transforms ALL the
+// vertices, everybody waits, every core culls ALL of them, ...), a thread
+// takes ONE chunk through as many stages as it can in a row, so the chunk is
+// still in that core's cache for the next stage, and no core sits idle
+// waiting for the slowest one to finish a stage.
+//
+// TOKENS: no more than `maxTokens` chunks are between the input and the end
+// of the last filter at once.  The input isn't called again until one comes out
+// the end.  So the working set is maxTokens chunks, not the whole data set,
+// and a slow serial stage can't make the input run away from it.
+//
+// Filter kinds:
+//   FilterParallel          any number of chunks at once, on any thread
+//   FilterSerialInOrder     one chunk at a time, in the order the input made them
+//   FilterSerialOutOfOrder  one chunk at a time, in whatever order they show up
+//
+// The FIRST filter is the input: it's always serial, gets 0, and returns the
+// next chunk, or 0 when there are no more.  Any other filter returns the
+// chunk for the next filter (the same one or another), or 0 to drop it
+// (whatever it is, the filter's responsible for it then).  A dropped chunk
+// still holds its place in order: the serial in order filters after it skip
+// over it rather than wait for it.
+//
+// No filter ever blocks a thread: a chunk that reaches a serial filter that's
+// busy (or, in order, isn't up to it yet) is parked there, and the thread that
+// finishes the filter hands it on.  So it runs fine with no workers too.
+
+enum FilterMode
+{
+  FilterParallel,
+  FilterSerialInOrder,
+  FilterSerialOutOfOrder
+} ;
+
+struct PipelineFilter
+{
+  string name ;
+  FilterMode mode ;
+  function<void* (void*)> body ;
+
+  // SERIAL filters: who's in it, and who's waiting for it
+  pthread_mutex_t mutex ;
+  bool busy ;
+  long long nextSeq ;            // in order: the chunk it takes next
+  map<long long, void*> parked ; // by sequence number
+
+  // STATS
+  atomic<long long> items, nanoseconds ;
+  int maxParked ;
+
+  PipelineFilter( const string& iName, FilterMode iMode, const function<void* (void*)>& iBody ) :
+    name( iName ), mode( iMode ), body( iBody ), busy( 0 ), nextSeq( 0 ),
+    items( 0 ), nanoseconds( 0 ), maxParked( 0 )
+  {
+    pthread_mutex_init( &mutex, 0 ) ;
+  }
+  ~PipelineFilter() {
+    pthread_mutex_destroy( &mutex ) ;
+  }
+
+private:
+  // Copying forbidden (the mutex)
+  PipelineFilter( const PipelineFilter& o ) : items( 0 ), nanoseconds( 0 ) {
+    puts( "ERROR: Copying PipelineFilter should not be done!" ) ;
+  }
+} ;
+
+struct Pipeline ;
+
+// One chunk on its way through (or the input's turn, stage 0), as a job.
+// Queued as a LinkedJob and kept, so a chunk moving on allocates nothing:
+// the Pipeline takes them from its free list and they go back on it as they
+// start.
+struct PipelineJob : public LinkedJob
+{
+  Pipeline* pipeline ;
+  long long seq ;
+  void* item ;
+  int stage ;
+  bool ownsStage ;
+
+  PipelineJob( Pipeline* iPipeline ) : pipeline( iPipeline ), seq( 0 ), item( 0 ), stage( 0 ), ownsStage( 0 ) {}
+  void exec() ;
+} ;
+
+struct Pipeline
+{
+  string name ;
+  int maxTokens ;
+  vector<PipelineFilter*> filters ;
+
+private:
+  // THE TOKENS
+  pthread_mutex_t mutexTokens ;
+  int live ;             // chunks out of the input and not yet out the end
+  int maxLive ;
+  bool producing ;       // a thread has (or a job is queued to take) the input
+  bool inputDone ;
+  bool finished ;
+  long long inputSeq ;   // only the producer touches it
+
+  // Every PipelineJob made, and the ones not queued or running, under
+  // mutexTokens.  No more than maxTokens + 1 are queued at once (each chunk
+  // in flight, and the input), so that many are made up front.
+  vector<PipelineJob*> jobs, freeJobs ;
+
+  // Copying Pipelines forbidden
+  Pipeline( const Pipeline& o ) {
+    puts( "ERROR: Copying Pipeline should not be done!" ) ;
+  }
+
+  friend struct PipelineJob ;
+  void spawn( long long seq, void* item, int stage, bool ownsStage ) ;
+  void freeJob( PipelineJob* job ) ;
+  void runJob( long long seq, void* item, int stage, bool ownsStage ) ;
+  bool produce( long long& seq, void*& item ) ;
+  bool carry( long long seq, void* item, int stage, bool ownsStage ) ;
+  void* runFilter( PipelineFilter* filter, void* item ) ;
+  void runSerially() ;
+
+public:
+  Pipeline( const string& iName, int iMaxTokens ) ;
+  ~Pipeline() ;
+
+  // In order, input first.  Before run().
+  void addFilter( const string& filterName, FilterMode mode, const function<void* (void*)>& body ) ;
+
+  // Runs until the input says there are no more chunks, and every chunk is
+  // out the end.  On the main thread it's a sequence point (the main thread
+  // carries chunks too).  Anywhere else, or with no pool, the chunks just run
+  // here, one at a time, through every filter.  Returns the # chunks the input made.
+  // A Pipeline can run() again (the filters' stats keep adding up).
+  long long run() ;
+
+  // The most chunks that were in flight at once (<= maxTokens)
+  int getMaxInFlight() const { return maxLive ; }
+  // Per filter: chunks, time in it, the most that ever waited for it (serial only)
+  void print() const ;
+} ;
+
+// A generate -> transform -> cull -> pack chain over `numChunks` chunks of
+// `chunkVerts` line vertices, run 2 ways: as 4 parallelFors with a sequence
+// point after each (the way the frame does it now), and as a Pipeline with
+// `maxTokens` chunks in flight.  Checks they pack the exact same vertices in
+// the same order, the serial filters never overlapped, the out of order one
+// saw every chunk, dropped chunks didn't stall anything, and there were never
+// more than maxTokens chunks in flight.  Prints both times.  Main thread.
+// Returns # failures.
+int testPipeline( int numChunks, int chunkVerts, int maxTokens ) ;
+
+#endif
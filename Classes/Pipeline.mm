@@ -0,0 +1,420 @@
+#import "Pipeline.h"
+#import "Vectorf.h"
+
+#include <chrono>
+
+Pipeline::Pipeline( const string& iName, int iMaxTokens ) :
+  name( iName ), maxTokens( iMaxTokens < 1 ? 1 : iMaxTokens ),
+  live( 0 ), maxLive( 0 ), producing( 0 ), inputDone( 0 ), finished( 0 ), inputSeq( 0 )
+{
+  pthread_mutex_init( &mutexTokens, 0 ) ;
+  for( int i = 0 ; i < maxTokens + 1 ; i++ )
+    jobs.push_back( new PipelineJob( this ) ) ;
+  freeJobs = jobs ;
+}
+
+Pipeline::~Pipeline()
+{
+  for( PipelineFilter* filter : filters )
+    delete filter ;
+  for( PipelineJob* job : jobs )
+    delete job ;
+  pthread_mutex_destroy( &mutexTokens ) ;
+}
+
+void Pipeline::addFilter( const string& filterName, FilterMode mode, const function<void* (void*)>& body )
+{
+  if( filters.empty() && mode == FilterParallel ) {
+    printf( "WARNING: Pipeline `%s`: the input filter `%s` can't be parallel, it'll run serial in order\n",
+      name.c_str(), filterName.c_str() ) ;
+    mode = FilterSerialInOrder ;
+  }
+  filters.push_back( new PipelineFilter( filterName, mode, body ) ) ;
+}
+
+void* Pipeline::runFilter( PipelineFilter* filter, void* item )
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  item = filter->body( item ) ;
+  filter->nanoseconds += chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - start ).count() ;
+  filter->items++ ;
+  return item ;
+}
+
+// Each job is one chunk on its way through (or the input, stage 0).
+void Pipeline::spawn( long long seq, void* item, int stage, bool ownsStage )
+{
+  PipelineJob *job ;
+  {
+    Lock lock( &mutexTokens ) ;
+    if( freeJobs.empty() ) {
+      printf( "WARNING: Pipeline `%s`: more than %d jobs queued, making another\n", name.c_str(), (int)jobs.size() ) ;
+      jobs.push_back( new PipelineJob( this ) ) ;
+      freeJobs.push_back( jobs.back() ) ;
+    }
+    job = freeJobs.back() ;
+    freeJobs.pop_back() ;
+  }
+  job->seq = seq, job->item = item, job->stage = stage, job->ownsStage = ownsStage ;
+  threadPool->addLinkedJobs( job, job ) ;
+}
+
+void Pipeline::freeJob( PipelineJob* job )
+{
+  Lock lock( &mutexTokens ) ;
+  freeJobs.push_back( job ) ;
+}
+
+// Back on the free list before it runs: what it carries is copied out, and
+// the chunk may well spawn the next job.
+void PipelineJob::exec()
+{
+  long long s = seq ;
+  void *i = item ;
+  int st = stage ;
+  bool owns = ownsStage ;
+  pipeline->freeJob( this ) ;
+  pipeline->runJob( s, i, st, owns ) ;
+}
+
+void Pipeline::runJob( long long seq, void* item, int stage, bool ownsStage )
+{
+  // A thread whose chunk just came out the end, with the input free, makes the
+  // next chunk itself (a loop, not a new job: nothing else is waiting for this thread).
+  for( ;; )
+  {
+    if( stage == 0 ) {
+      if( !produce( seq, item ) )
+        return ;
+      stage = 1 ;
+    }
+    if( !carry( seq, item, stage, ownsStage ) )
+      return ;
+    stage = 0 ;
+    ownsStage = 0 ;
+  }
+}
+
+// The caller is the producer.  false when the input's done (or out of tokens).
+bool Pipeline::produce( long long& seq, void*& item )
+{
+  item = runFilter( filters[0], 0 ) ;
+  if( item )  seq = inputSeq++ ;
+
+  bool another ;
+  {
+    Lock lock( &mutexTokens ) ;
+    if( !item ) {
+      inputDone = 1 ;
+      producing = 0 ;
+      finished = !live ;
+      return false ;
+    }
+    live++ ;
+    maxLive = max( maxLive, live ) ;
+    // A free token: somebody else can make the next chunk while this thread
+    // carries this one on (it's the one in cache).  If not, the input waits
+    // for a chunk to come out the end.
+    another = live < maxTokens ;
+    if( !another )  producing = 0 ;
+  }
+  if( another )
+    spawn( 0, 0, 0, 0 ) ;
+  return true ;
+}
+
+// Takes the chunk through stages from `stage` on, as far as it can go.
+// true if it came out the end and this thread should make the next one.
+bool Pipeline::carry( long long seq, void* item, int stage, bool ownsStage )
+{
+  for( ; stage < (int)filters.size() ; stage++ )
+  {
+    PipelineFilter *filter = filters[ stage ] ;
+    if( filter->mode == FilterParallel ) {
+      if( item )  item = runFilter( filter, item ) ;
+      continue ;
+    }
+
+    // SERIAL: get in, or park the chunk and let whoever's in there hand it on.
+    if( !ownsStage )
+    {
+      Lock lock( &filter->mutex ) ;
+      if( filter->busy || ( filter->mode == FilterSerialInOrder && seq != filter->nextSeq ) ) {
+        filter->parked[ seq ] = item ;
+        filter->maxParked = max( filter->maxParked, (int)filter->parked.size() ) ;
+        return false ;
+      }
+      filter->busy = 1 ;
+    }
+    ownsStage = 0 ;
+
+    if( item )  item = runFilter( filter, item ) ; // a dropped chunk only takes its turn
+
+    // Out: hand the filter straight to the next chunk that can have it, so
+    // it doesn't have to race anybody for it.  (That chunk goes on as a new
+    // job; this thread keeps the one in its cache.)
+    bool handOff = 0 ;
+    long long nextSeq = 0 ;
+    void *nextItem = 0 ;
+    {
+      Lock lock( &filter->mutex ) ;
+      filter->nextSeq++ ;
+      map<long long, void*>::iterator next = filter->parked.begin() ;
+      if( next != filter->parked.end() &&
+          ( filter->mode == FilterSerialOutOfOrder || next->first == filter->nextSeq ) ) {
+        handOff = 1 ;
+        nextSeq = next->first ;
+        nextItem = next->second ;
+        filter->parked.erase( next ) ;
+      }
+      else
+        filter->busy = 0 ;
+    }
+    if( handOff )
+      spawn( nextSeq, nextItem, stage, 1 ) ;
+  }
+
+  // Out the end: the token comes back.
+  Lock lock( &mutexTokens ) ;
+  live-- ;
+  if( !inputDone && !producing ) {
+    producing = 1 ;
+    return true ;
+  }
+  if( inputDone && !live )
+    finished = 1 ;
+  return false ;
+}
+
+void Pipeline::runSerially()
+{
+  for( ;; )
+  {
+    void *item = runFilter( filters[0], 0 ) ;
+    if( !item )  break ;
+    inputSeq++ ;
+    maxLive = max( maxLive, 1 ) ;
+    for( int stage = 1 ; stage < (int)filters.size() && item ; stage++ )
+      item = runFilter( filters[ stage ], item ) ;
+  }
+}
+
+long long Pipeline::run()
+{
+  if( filters.empty() ) {
+    printf( "ERROR: Pipeline `%s` has no filters\n", name.c_str() ) ;
+    return 0 ;
+  }
+
+  long long startSeq = inputSeq ;
+  for( PipelineFilter* filter : filters )
+    filter->nextSeq = inputSeq ;
+  live = 0 ;
+  inputDone = finished = 0 ;
+
+  // Only the main thread can block on a sequence point.
+  if( !threadPool || ![NSThread isMainThread] ) {
+    runSerially() ;
+    return inputSeq - startSeq ;
+  }
+
+  producing = 1 ;
+  spawn( 0, 0, 0, 0 ) ;
+  threadPool->sequencePoint( 0 ) ;
+
+  Lock lock( &mutexTokens ) ;
+  if( !finished )
+    printf( "ERROR: Pipeline `%s`: the sequence point returned with %d chunks still in flight\n", name.c_str(), live ) ;
+  return inputSeq - startSeq ;
+}
+
+void Pipeline::print() const
+{
+  printf( "Pipeline `%s`: %lld chunks, up to %d of %d tokens in flight\n", name.c_str(), inputSeq, maxLive, maxTokens ) ;
+  static const char* modes[] = { "parallel", "serial in order", "serial any order" } ;
+  for( PipelineFilter* filter : filters )
+  {
+    long long items = filter->items ;
+    double ms = filter->nanoseconds * 1e-6 ;
+    printf( "  %-12s %-16s %7lld chunks %9.3f ms (%.1f us each)", filter->name.c_str(), modes[ filter->mode ],
+      items, ms, items ? ms * 1e3 / items : 0.0 ) ;
+    if( filter->mode != FilterParallel )
+      printf( ", up to %d parked", filter->maxParked ) ;
+    puts( "" ) ;
+  }
+}
+
+// TEST & BENCHMARK //
+
+struct LineChunk
+{
+  int index ;
+  int kept ;     // after the cull
+  vector<VertexPC> verts ;
+} ;
+
+// Every chunk's vertices come from its own stream, so any thread can make any chunk.
+static void generateChunk( VertexPC* verts, int chunk, int chunkVerts )
+{
+  Rng rng( 0x5EED, chunk ) ;
+  for( int v = 0 ; v < chunkVerts ; v++ )
+  {
+    Vector3f pos( rng.nextFloat( -1.f, 1.f ), rng.nextFloat( -1.f, 1.f ), rng.nextFloat( -1.f, 1.f ) ) ;
+    verts[v] = VertexPC( pos, Vector4f( rng.nextFloat(), rng.nextFloat(), rng.nextFloat(), 1.f ) ) ;
+  }
+}
+
+static void transformChunk( VertexPC* verts, int chunkVerts, const Matrix3f& m )
+{
+  for( int v = 0 ; v < chunkVerts ; v++ )
+    verts[v].pos = m * verts[v].pos ;
+}
+
+// Keeps the lines (vertex pairs) with both ends in the box, packed to the front.
+static int cullChunk( VertexPC* verts, int chunkVerts )
+{
+  int kept = 0 ;
+  for( int v = 0 ; v + 1 < chunkVerts ; v += 2 )
+  {
+    const Vector3f &a = verts[v].pos, &b = verts[v+1].pos ;
+    if( fabsf( a.x ) < 0.8f && fabsf( a.y ) < 0.8f && fabsf( b.x ) < 0.8f && fabsf( b.y ) < 0.8f ) {
+      verts[ kept++ ] = verts[v] ;
+      verts[ kept++ ] = verts[v+1] ;
+    }
+  }
+  return kept ;
+}
+
+// Some chunks are culled whole, to check a dropped chunk doesn't stall the in order filters.
+static inline bool culledWhole( int chunk ) { return chunk % 13 == 5 ; }
+
+int testPipeline( int numChunks, int chunkVerts, int maxTokens )
+{
+  int failures = 0 ;
+  printf( "testPipeline: %d chunks of %d vertices, %d tokens\n", numChunks, chunkVerts, maxTokens ) ;
+  Matrix3f m = Matrix3f::rotationYawPitchRoll( 0.3f, 0.2f, 0.1f ) ;
+
+  // STAGE BY STAGE: a sequence point after each, over everything.
+  vector<VertexPC> all( (size_t)numChunks * chunkVerts ), expected ;
+  vector<int> kept( numChunks ) ;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  forEachChunk( "generate", numChunks, 1, [&]( int s, int e ) {
+    for( int c = s ; c < e ; c++ )  generateChunk( &all[ (size_t)c * chunkVerts ], c, chunkVerts ) ;
+  } ) ;
+  forEachChunk( "transform", numChunks, 1, [&]( int s, int e ) {
+    for( int c = s ; c < e ; c++ )  transformChunk( &all[ (size_t)c * chunkVerts ], chunkVerts, m ) ;
+  } ) ;
+  forEachChunk( "cull", numChunks, 1, [&]( int s, int e ) {
+    for( int c = s ; c < e ; c++ )  kept[c] = culledWhole( c ) ? 0 : cullChunk( &all[ (size_t)c * chunkVerts ], chunkVerts ) ;
+  } ) ;
+  for( int c = 0 ; c < numChunks ; c++ )
+    expected.insert( expected.end(), all.begin() + (size_t)c * chunkVerts, all.begin() + (size_t)c * chunkVerts + kept[c] ) ;
+  double stagedTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  all.clear() ;
+  all.shrink_to_fit() ;
+
+  // PIPELINE: maxTokens chunk buffers, recycled.
+  vector<LineChunk> buffers( maxTokens ) ;
+  deque<LineChunk*> freeChunks ;
+  pthread_mutex_t mutexFree ;
+  pthread_mutex_init( &mutexFree, 0 ) ;
+  for( LineChunk& chunk : buffers ) {
+    chunk.verts.resize( chunkVerts ) ;
+    freeChunks.push_back( &chunk ) ;
+  }
+  auto recycle = [&]( LineChunk* chunk ) {
+    Lock lock( &mutexFree ) ;
+    freeChunks.push_back( chunk ) ;
+  } ;
+
+  vector<VertexPC> packed ;
+  packed.reserve( expected.size() ) ;
+  int nextChunk = 0, lastPacked = -1, outOfOrderChunks = 0, outOfOrderKept = 0 ;
+  atomic<int> inInput( 0 ), inPack( 0 ), inTally( 0 ), overlaps( 0 ), inFlight( 0 ), maxInFlight( 0 ) ;
+  bool noBuffer = 0, packedInOrder = 1 ;
+
+  Pipeline pipe( "lines", maxTokens ) ;
+  pipe.addFilter( "input", FilterSerialInOrder, [&]( void* ) -> void* {
+    if( inInput++ )  overlaps++ ;
+    LineChunk *chunk = 0 ;
+    if( nextChunk < numChunks ) {
+      Lock lock( &mutexFree ) ;
+      if( freeChunks.empty() )  noBuffer = 1 ; // more chunks out than tokens
+      else {
+        chunk = freeChunks.front() ;
+        freeChunks.pop_front() ;
+        chunk->index = nextChunk++ ;
+        int now = ++inFlight ;
+        if( now > maxInFlight )  maxInFlight = now ;
+      }
+    }
+    inInput-- ;
+    return chunk ;
+  } ) ;
+  pipe.addFilter( "generate", FilterParallel, [&]( void* item ) -> void* {
+    LineChunk *chunk = (LineChunk*)item ;
+    generateChunk( &chunk->verts[0], chunk->index, chunkVerts ) ;
+    return chunk ;
+  } ) ;
+  pipe.addFilter( "transform", FilterParallel, [&]( void* item ) -> void* {
+    LineChunk *chunk = (LineChunk*)item ;
+    transformChunk( &chunk->verts[0], chunkVerts, m ) ;
+    return chunk ;
+  } ) ;
+  pipe.addFilter( "cull", FilterParallel, [&]( void* item ) -> void* {
+    LineChunk *chunk = (LineChunk*)item ;
+    if( culledWhole( chunk->index ) ) {
+      inFlight-- ;
+      recycle( chunk ) ; // dropped: it's ours to put back
+      return 0 ;
+    }
+    chunk->kept = cullChunk( &chunk->verts[0], chunkVerts ) ;
+    return chunk ;
+  } ) ;
+  pipe.addFilter( "tally", FilterSerialOutOfOrder, [&]( void* item ) -> void* {
+    if( inTally++ )  overlaps++ ;
+    outOfOrderChunks++ ;
+    outOfOrderKept += ((LineChunk*)item)->kept ;
+    inTally-- ;
+    return item ;
+  } ) ;
+  pipe.addFilter( "pack", FilterSerialInOrder, [&]( void* item ) -> void* {
+    LineChunk *chunk = (LineChunk*)item ;
+    if( inPack++ )  overlaps++ ;
+    if( chunk->index <= lastPacked )  packedInOrder = 0 ;
+    lastPacked = chunk->index ;
+    packed.insert( packed.end(), chunk->verts.begin(), chunk->verts.begin() + chunk->kept ) ;
+    inPack-- ;
+    inFlight-- ;
+    recycle( chunk ) ;
+    return chunk ;
+  } ) ;
+
+  start = chrono::steady_clock::now() ;
+  long long made = pipe.run() ;
+  double pipelineTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  pipe.print() ;
+  pthread_mutex_destroy( &mutexFree ) ;
+
+  int expectedKept = (int)expected.size(), keptChunks = 0 ;
+  for( int c = 0 ; c < numChunks ; c++ )  keptChunks += !culledWhole( c ) ;
+  bool same = packed.size() == expected.size() &&
+    ( expected.empty() || !memcmp( &packed[0], &expected[0], expected.size() * sizeof( VertexPC ) ) ) ;
+
+  printf( "  staged (4 sequence points) %8.2f ms\n", stagedTime * 1e3 ) ;
+  printf( "  pipeline (%2d tokens)        %8.2f ms  (%.2fx)\n", maxTokens, pipelineTime * 1e3, stagedTime / pipelineTime ) ;
+  struct { const char* what ; bool ok ; } checks[] = {
+    { "every chunk made", made == numChunks && !noBuffer },
+    { "packed the same vertices in the same order", same && packedInOrder },
+    { "serial filters never overlapped", !overlaps },
+    { "out of order filter saw every kept chunk", outOfOrderChunks == keptChunks && outOfOrderKept == expectedKept },
+    { "never more chunks in flight than tokens", maxInFlight <= maxTokens && pipe.getMaxInFlight() <= maxTokens },
+  } ;
+  for( auto& check : checks ) {
+    printf( "  %-46s %s\n", check.what, check.ok ? "ok" : "FAIL" ) ;
+    failures += !check.ok ;
+  }
+
+  printf( "testPipeline: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
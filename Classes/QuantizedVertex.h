@@ -0,0 +1,219 @@
+#ifndef QUANTIZEDVERTEX_H
+#define QUANTIZEDVERTEX_H
+
+#include "Vectorf.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// VertexPC is 28 bytes: 12 of position and 16 of color, and the color is 4
+// floats for what ends up as 8 bits a channel on screen.  VertexPNC is 40.
+// Every processing pass drags all of that through the cache, and every draw
+// sends all of it to GL.
+//
+// The compact formats here are what GL ES 1 can draw STRAIGHT from, no decode:
+//
+//   VertexPC8    float xyz, RGBA8 color                 16 bytes  (1.75x smaller)
+//   VertexQPC    snorm16 xyz, RGBA8 color               12 bytes  (2.33x)
+//   VertexQPNC   snorm16 xyz, snorm8 normal, RGBA8      16 bytes  (2.5x vs VertexPNC)
+//
+// SNORM16 POSITIONS are pos/scale in [-1,1] as shorts (x 32767).  `scale` is
+// the radius of a sphere around the origin that holds every vertex
+// (positionScale() finds it).  A sphere, not a box, so rotating the vertices
+// never takes them out of range.  GL gets the shorts as-is (ES1 doesn't
+// normalize positions) and drawQPC puts the scale back with glScalef.
+//
+// For storage (files, the network) there's also:
+//   half floats     floatToHalf/halfToFloat.  ES1 can't take them as a vertex
+//                   attribute, so they're decoded before drawing.
+//   oct normals     a unit vector as 2 snorm16 (octEncode/octDecode): 4 bytes,
+//                   more accurate than 3 snorm8s, but again decoded to draw.
+//
+// Quantizing costs accuracy (testQuantizedVertices measures it).  DON'T
+// transform quantized vertices in place frame after frame: every transform
+// re-rounds them, so the error does a random walk with no bound and the
+// lines slowly distort.  Keep the quantized reference as it was loaded, keep
+// the rotation so far in a float Matrix3f (a TransformNode), and each frame
+// decode -> transform -> encode the reference into a separate buffer.  The
+// error is then one transform's, however long it runs.
+
+#define SNORM16_MAX 32767.f
+#define SNORM8_MAX 127.f
+
+struct VertexPC8
+{
+  Vector3f pos ;
+  uint8_t color[4] ; // r g b a
+} ;
+
+struct VertexQPC
+{
+  int16_t pos[4] ; // x y z, [3] is padding (keeps the color 4-aligned for GL)
+  uint8_t color[4] ;
+} ;
+
+struct VertexQPNC
+{
+  int16_t pos[4] ;   // x y z, padding
+  int8_t normal[4] ; // x y z, padding
+  uint8_t color[4] ;
+} ;
+
+// SCALARS //
+
+// Round to nearest (half away from zero).  Not lrintf, that's a library call
+// on some compilers, and copysignf not ?:, the sign of a vertex coordinate is
+// a coin toss so a branch on it mispredicts half the time.
+inline int16_t toSnorm16( float v ) {
+  v = v < 1.f ? v : 1.f ;  v = v > -1.f ? v : -1.f ; // minss/maxss, not fminf (a call)
+  return (int16_t)( v * SNORM16_MAX + copysignf( 0.5f, v ) ) ;
+}
+inline float fromSnorm16( int16_t q ) { return q * ( 1.f / SNORM16_MAX ) ; }
+
+inline int8_t toSnorm8( float v ) {
+  v = v < 1.f ? v : 1.f ;  v = v > -1.f ? v : -1.f ; // minss/maxss, not fminf (a call)
+  return (int8_t)( v * SNORM8_MAX + copysignf( 0.5f, v ) ) ;
+}
+inline float fromSnorm8( int8_t q ) { return q * ( 1.f / SNORM8_MAX ) ; }
+
+inline uint8_t toUnorm8( float v ) {
+  v = v < 1.f ? v : 1.f ;  v = v > 0.f ? v : 0.f ;
+  return (uint8_t)( v * 255.f + 0.5f ) ;
+}
+inline float fromUnorm8( uint8_t q ) { return q * ( 1.f / 255.f ) ; }
+
+inline void packColor( const Vector4f& c, uint8_t* out ) {
+  out[0] = toUnorm8( c.r ), out[1] = toUnorm8( c.g ), out[2] = toUnorm8( c.b ), out[3] = toUnorm8( c.a ) ;
+}
+inline Vector4f unpackColor( const uint8_t* c ) {
+  return Vector4f( fromUnorm8( c[0] ), fromUnorm8( c[1] ), fromUnorm8( c[2] ), fromUnorm8( c[3] ) ) ;
+}
+
+// pos/scale as snorm16 into out[0..2]
+inline void packPosition( const Vector3f& p, float invScale, int16_t* out ) {
+  out[0] = toSnorm16( p.x*invScale ), out[1] = toSnorm16( p.y*invScale ), out[2] = toSnorm16( p.z*invScale ), out[3] = 0 ;
+}
+inline Vector3f unpackPosition( const int16_t* q, float scale ) {
+  return Vector3f( fromSnorm16( q[0] ), fromSnorm16( q[1] ), fromSnorm16( q[2] ) ) * scale ;
+}
+
+inline void packNormal( const Vector3f& n, int8_t* out ) {
+  out[0] = toSnorm8( n.x ), out[1] = toSnorm8( n.y ), out[2] = toSnorm8( n.z ), out[3] = 0 ;
+}
+inline Vector3f unpackNormal( const int8_t* q ) {
+  return Vector3f( fromSnorm8( q[0] ), fromSnorm8( q[1] ), fromSnorm8( q[2] ) ) ;
+}
+
+// IEEE half, round to nearest even.  Overflow goes to inf, NaN stays NaN,
+// tiny values become half denormals (or 0).
+inline uint16_t floatToHalf( float f )
+{
+  uint32_t u ;
+  memcpy( &u, &f, 4 ) ;
+  uint32_t sign = ( u >> 16 ) & 0x8000u ;
+  uint32_t abs = u & 0x7FFFFFFFu ;
+  if( abs >= 0x7F800000u ) // inf or NaN
+    return (uint16_t)( sign | 0x7C00u | ( abs > 0x7F800000u ? 0x200u : 0 ) ) ;
+  if( abs >= 0x477FF000u ) // rounds to >= 65520, past the biggest half
+    return (uint16_t)( sign | 0x7C00u ) ;
+  if( abs < 0x38800000u ) // below the smallest normal half: a denormal
+  {
+    if( abs < 0x33000000u )  return (uint16_t)sign ; // under half of the smallest denormal
+    int shift = 126 - (int)( abs >> 23 ) ;  // 14..24
+    uint32_t mant = ( abs & 0x7FFFFFu ) | 0x800000u ;
+    uint32_t h = mant >> shift ;
+    uint32_t rest = mant & ( ( 1u << shift ) - 1 ), half = 1u << ( shift - 1 ) ;
+    if( rest > half || ( rest == half && ( h & 1 ) ) )  h++ ;
+    return (uint16_t)( sign | h ) ;
+  }
+  uint32_t h = ( abs - 0x38000000u ) >> 13 ; // rebias the exponent, drop 13 bits of mantissa
+  uint32_t rest = abs & 0x1FFFu ;
+  if( rest > 0x1000u || ( rest == 0x1000u && ( h & 1 ) ) )  h++ ; // may carry into the exponent, that's right
+  return (uint16_t)( sign | h ) ;
+}
+
+inline float halfToFloat( uint16_t h )
+{
+  uint32_t sign = ( h & 0x8000u ) << 16 ;
+  uint32_t exp = ( h >> 10 ) & 0x1F, mant = h & 0x3FFu ;
+  uint32_t u ;
+  if( exp == 0x1F )  u = sign | 0x7F800000u | ( mant << 13 ) ; // inf, NaN
+  else if( exp )  u = sign | ( ( exp + 112 ) << 23 ) | ( mant << 13 ) ;
+  else if( !mant )  u = sign ; // +-0
+  else
+  {
+    // denormal: normalize it
+    exp = 113 ;
+    while( !( mant & 0x400u ) )  mant <<= 1, exp-- ;
+    u = sign | ( exp << 23 ) | ( ( mant & 0x3FFu ) << 13 ) ;
+  }
+  float f ;
+  memcpy( &f, &u, 4 ) ;
+  return f ;
+}
+
+// Unit vector -> octahedron -> square, as 2 snorm16 (x in the low 16 bits).
+inline uint32_t octEncode( const Vector3f& n )
+{
+  float sum = fabsf( n.x ) + fabsf( n.y ) + fabsf( n.z ) ;
+  float x = sum > 0.f ? n.x / sum : 0.f, y = sum > 0.f ? n.y / sum : 0.f ;
+  if( n.z < 0.f ) {
+    // fold the bottom half out over the corners
+    float fx = ( 1.f - fabsf( y ) ) * ( x >= 0.f ? 1.f : -1.f ) ;
+    float fy = ( 1.f - fabsf( x ) ) * ( y >= 0.f ? 1.f : -1.f ) ;
+    x = fx, y = fy ;
+  }
+  return (uint16_t)toSnorm16( x ) | ( (uint32_t)(uint16_t)toSnorm16( y ) << 16 ) ;
+}
+
+inline Vector3f octDecode( uint32_t oct )
+{
+  float x = fromSnorm16( (int16_t)( oct & 0xFFFFu ) ), y = fromSnorm16( (int16_t)( oct >> 16 ) ) ;
+  float z = 1.f - fabsf( x ) - fabsf( y ) ;
+  if( z < 0.f ) {
+    float fx = ( 1.f - fabsf( y ) ) * ( x >= 0.f ? 1.f : -1.f ) ;
+    float fy = ( 1.f - fabsf( x ) ) * ( y >= 0.f ? 1.f : -1.f ) ;
+    x = fx, y = fy ;
+  }
+  Vector3f n( x, y, z ) ;
+  return n / n.len() ;
+}
+
+// CONVERSION //
+// All of these split into jobs on the pool (forEachChunk), and are fine without one.
+
+// The radius of a sphere around the origin holding every vertex, a hair bigger
+// so the biggest one isn't right on 1.0.  Never 0.
+float positionScale( const VertexPC* verts, int n ) ;
+float positionScale( const VertexPNC* verts, int n ) ;
+
+void quantize( const VertexPC* src, VertexPC8* dst, int n ) ;
+void quantize( const VertexPC* src, VertexQPC* dst, int n, float scale ) ;
+void quantize( const VertexPNC* src, VertexQPNC* dst, int n, float scale ) ;
+
+void dequantize( const VertexPC8* src, VertexPC* dst, int n ) ;
+void dequantize( const VertexQPC* src, VertexPC* dst, int n, float scale ) ;
+void dequantize( const VertexQPNC* src, VertexPNC* dst, int n, float scale ) ;
+
+void floatToHalf( const float* src, uint16_t* dst, int n ) ;
+void halfToFloat( const uint16_t* src, float* dst, int n ) ;
+
+// TRANSFORM //
+// decode -> m * -> encode, one pass, for verts [start,end).  No scale
+// needed: rotating pos/scale is the same as rotating pos then dividing.
+// m should be a rotation (anything that grows the vertices past the scale sphere gets clamped).
+// src -> dst (colors copied), so src can stay the pristine reference.
+void transformQuantized( const Matrix3f& m, const VertexQPC* src, VertexQPC* dst, int start, int end ) ;
+// In place.  Once: see above.
+void transformQuantized( const Matrix3f& m, VertexQPC* verts, int start, int end ) ;
+void transformQuantized( const Matrix3f& m, VertexQPNC* verts, int start, int end ) ; // normals too
+void transformQuantized( const Matrix3f& m, VertexPC8* verts, int start, int end ) ;
+
+// Round trip errors of every format and kernel against bounds, that 10
+// seconds of frames (reference + accumulated matrix) stay within one
+// transform's error, and ms + bytes a frame for the
+// transform in each format.  Prints it all, returns # failures.
+int testQuantizedVertices( int numVerts ) ;
+
+#endif
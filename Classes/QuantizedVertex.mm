@@ -0,0 +1,322 @@
+#import "QuantizedVertex.h"
+#import "ThreadPool.h"
+#import "ThreadSpecific.h"
+#import "Transform.h"
+
+#include <float.h>
+#include <chrono>
+#include <vector>
+using namespace std ;
+
+#define QUANTIZE_GRAIN 16384
+
+// CONVERSION //
+
+template <typename Vertex>
+static float positionScaleOf( const Vertex* verts, int n )
+{
+  Combinable<float> threadMax( 0.f ) ;
+  forEachChunk( "position scale", n, QUANTIZE_GRAIN, [&]( int start, int end ) {
+    float m = 0.f ;
+    for( int i = start ; i < end ; i++ )
+      m = max( m, verts[i].pos.dot( verts[i].pos ) ) ;
+    float& mine = threadMax.local() ;
+    mine = max( mine, m ) ;
+  } ) ;
+  float m = threadMax.combine( []( float a, float b ){ return max( a, b ) ; } ) ;
+  return m > 0.f ? sqrtf( m ) * 1.0001f : 1.f ;
+}
+
+float positionScale( const VertexPC* verts, int n ) { return positionScaleOf( verts, n ) ; }
+float positionScale( const VertexPNC* verts, int n ) { return positionScaleOf( verts, n ) ; }
+
+void quantize( const VertexPC* src, VertexPC8* dst, int n )
+{
+  forEachChunk( "quantize PC8", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      dst[i].pos = src[i].pos ;
+      packColor( src[i].color, dst[i].color ) ;
+    }
+  } ) ;
+}
+
+void quantize( const VertexPC* src, VertexQPC* dst, int n, float scale )
+{
+  float invScale = 1.f / scale ;
+  forEachChunk( "quantize QPC", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      packPosition( src[i].pos, invScale, dst[i].pos ) ;
+      packColor( src[i].color, dst[i].color ) ;
+    }
+  } ) ;
+}
+
+void quantize( const VertexPNC* src, VertexQPNC* dst, int n, float scale )
+{
+  float invScale = 1.f / scale ;
+  forEachChunk( "quantize QPNC", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      packPosition( src[i].pos, invScale, dst[i].pos ) ;
+      packNormal( src[i].normal, dst[i].normal ) ;
+      packColor( src[i].color, dst[i].color ) ;
+    }
+  } ) ;
+}
+
+void dequantize( const VertexPC8* src, VertexPC* dst, int n )
+{
+  forEachChunk( "dequantize PC8", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      dst[i] = VertexPC( src[i].pos, unpackColor( src[i].color ) ) ;
+  } ) ;
+}
+
+void dequantize( const VertexQPC* src, VertexPC* dst, int n, float scale )
+{
+  forEachChunk( "dequantize QPC", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      dst[i] = VertexPC( unpackPosition( src[i].pos, scale ), unpackColor( src[i].color ) ) ;
+  } ) ;
+}
+
+void dequantize( const VertexQPNC* src, VertexPNC* dst, int n, float scale )
+{
+  forEachChunk( "dequantize QPNC", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      dst[i] = VertexPNC( unpackPosition( src[i].pos, scale ), unpackNormal( src[i].normal ), unpackColor( src[i].color ) ) ;
+  } ) ;
+}
+
+void floatToHalf( const float* src, uint16_t* dst, int n )
+{
+  forEachChunk( "float to half", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      dst[i] = floatToHalf( src[i] ) ;
+  } ) ;
+}
+
+void halfToFloat( const uint16_t* src, float* dst, int n )
+{
+  forEachChunk( "half to float", n, QUANTIZE_GRAIN, [=]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      dst[i] = halfToFloat( src[i] ) ;
+  } ) ;
+}
+
+// TRANSFORM //
+
+void transformQuantized( const Matrix3f& m, const VertexQPC* src, VertexQPC* dst, int start, int end )
+{
+  for( int i = start ; i < end ; i++ )
+  {
+    const int16_t *q = src[i].pos ;
+    Vector3f p = m * Vector3f( fromSnorm16( q[0] ), fromSnorm16( q[1] ), fromSnorm16( q[2] ) ) ;
+    VertexQPC out ;
+    out.pos[0] = toSnorm16( p.x ), out.pos[1] = toSnorm16( p.y ), out.pos[2] = toSnorm16( p.z ), out.pos[3] = 0 ;
+    memcpy( out.color, src[i].color, 4 ) ;
+    dst[i] = out ;
+  }
+}
+
+void transformQuantized( const Matrix3f& m, VertexQPC* verts, int start, int end )
+{
+  transformQuantized( m, verts, verts, start, end ) ;
+}
+
+void transformQuantized( const Matrix3f& m, VertexQPNC* verts, int start, int end )
+{
+  for( int i = start ; i < end ; i++ )
+  {
+    int16_t *q = verts[i].pos ;
+    Vector3f p = m * Vector3f( fromSnorm16( q[0] ), fromSnorm16( q[1] ), fromSnorm16( q[2] ) ) ;
+    q[0] = toSnorm16( p.x ), q[1] = toSnorm16( p.y ), q[2] = toSnorm16( p.z ) ;
+
+    int8_t *qn = verts[i].normal ;
+    Vector3f n = m * unpackNormal( qn ) ;
+    // snorm8 is coarse, re-rounding it every frame would shrink/grow it.  Renormalize.
+    float len = n.len() ;
+    if( len > 0.f )  n /= len ;
+    packNormal( n, qn ) ;
+  }
+}
+
+void transformQuantized( const Matrix3f& m, VertexPC8* verts, int start, int end )
+{
+  for( int i = start ; i < end ; i++ )
+    verts[i].pos = m * verts[i].pos ;
+}
+
+// TEST & BENCHMARK //
+
+static float angleDegrees( const Vector3f& a, const Vector3f& b )
+{
+  float c = a.dot( b ) / ( a.len() * b.len() ) ;
+  c = c > 1.f ? 1.f : c < -1.f ? -1.f : c ;
+  return acosf( c ) * 57.29578f ;
+}
+
+static int check( const char* what, double error, double bound )
+{
+  bool ok = error <= bound ;
+  printf( "  %-44s max error %-12.4g (bound %.4g) %s\n", what, error, bound, ok ? "ok" : "FAIL" ) ;
+  return !ok ;
+}
+
+int testQuantizedVertices( int numVerts )
+{
+  printf( "testQuantizedVertices: %d verts\n", numVerts ) ;
+  printf( "  bytes/vertex: VertexPC %d, VertexPC8 %d, VertexQPC %d | VertexPNC %d, VertexQPNC %d\n",
+    (int)sizeof(VertexPC), (int)sizeof(VertexPC8), (int)sizeof(VertexQPC), (int)sizeof(VertexPNC), (int)sizeof(VertexQPNC) ) ;
+  int failures = 0 ;
+
+  vector<VertexPNC> pnc( numVerts ) ;
+  vector<VertexPC> pc( numVerts ) ;
+  for( int i = 0 ; i < numVerts ; i++ )
+  {
+    Rng rng = jobRng( i ) ;
+    Vector3f n = Vector3f::random( rng, -1.f, 1.f ) ;
+    if( n.len() < 1e-3f )  n = Vector3f( 0.f, 0.f, 1.f ) ;
+    pnc[i] = VertexPNC( Vector3f::random( rng, -3.f, 3.f ), n / n.len(), Vector4f::random( rng ) ) ;
+    pc[i] = VertexPC( pnc[i].pos, pnc[i].color ) ;
+  }
+  float scale = positionScale( &pc[0], numVerts ) ;
+  float step = scale / SNORM16_MAX ; // one snorm16 step, in position units
+
+  // ROUND TRIPS
+  vector<VertexQPNC> qpnc( numVerts ) ;
+  vector<VertexPNC> pncBack( numVerts ) ;
+  quantize( &pnc[0], &qpnc[0], numVerts, scale ) ;
+  dequantize( &qpnc[0], &pncBack[0], numVerts, scale ) ;
+  double posError = 0, colorError = 0, normalAngle = 0, octAngle = 0 ;
+  for( int i = 0 ; i < numVerts ; i++ )
+  {
+    Vector3f d = pncBack[i].pos - pnc[i].pos ;
+    posError = max( posError, (double)max( fabsf( d.x ), max( fabsf( d.y ), fabsf( d.z ) ) ) ) ;
+    Vector4f c = pncBack[i].color, c0 = pnc[i].color ;
+    colorError = max( colorError, (double)max( max( fabsf( c.r - c0.r ), fabsf( c.g - c0.g ) ), max( fabsf( c.b - c0.b ), fabsf( c.a - c0.a ) ) ) ) ;
+    normalAngle = max( normalAngle, (double)angleDegrees( pncBack[i].normal, pnc[i].normal ) ) ;
+    octAngle = max( octAngle, (double)angleDegrees( octDecode( octEncode( pnc[i].normal ) ), pnc[i].normal ) ) ;
+  }
+  failures += check( "snorm16 position (units)", posError, step*0.5 + 1e-6 ) ;
+  failures += check( "RGBA8 color", colorError, 0.5/255 + 1e-6 ) ;
+  failures += check( "snorm8 normal (degrees)", normalAngle, 1.0 ) ;
+  failures += check( "oct16 normal (degrees)", octAngle, 0.05 ) ;
+
+  // Colors that were 8 bit to begin with come back exactly.
+  int colorMismatches = 0 ;
+  for( int v = 0 ; v < 256 ; v++ ) {
+    uint8_t packed[4] ;
+    packColor( Vector4f( fromUnorm8( v ), 0.f, 0.f, 1.f ), packed ) ;
+    colorMismatches += packed[0] != v ;
+  }
+  failures += check( "RGBA8 color, 8 bit values (# wrong)", colorMismatches, 0 ) ;
+
+  // HALF.  Relative error of normal values, and the special cases exactly.
+  vector<float> floats( numVerts ), floatsBack( numVerts ) ;
+  vector<uint16_t> halfs( numVerts ) ;
+  for( int i = 0 ; i < numVerts ; i++ )
+    floats[i] = pc[i].pos.x * powf( 2.f, (float)( i % 28 - 14 ) ) ; // 2^-14 .. 2^13 times +-3
+  floatToHalf( &floats[0], &halfs[0], numVerts ) ;
+  halfToFloat( &halfs[0], &floatsBack[0], numVerts ) ;
+  double halfError = 0 ;
+  for( int i = 0 ; i < numVerts ; i++ )
+    if( fabsf( floats[i] ) >= 6.1035e-5f ) // normal halfs
+      halfError = max( halfError, (double)fabsf( ( floatsBack[i] - floats[i] ) / floats[i] ) ) ;
+  failures += check( "half (relative)", halfError, 1.0/2048 ) ;
+  float specials[] = { 0.f, -0.f, 1.f, -2.f, 65504.f, 65520.f, 1e10f, -1e10f, 5.9604645e-8f, 2.9802322e-8f, 6.1035156e-5f, 0.33333334f } ;
+  uint16_t expected[] = { 0x0000, 0x8000, 0x3C00, 0xC000, 0x7BFF, 0x7C00, 0x7C00, 0xFC00, 0x0001, 0x0000, 0x0400, 0x3555 } ;
+  int specialMismatches = 0 ;
+  for( int i = 0 ; i < (int)( sizeof( specials ) / sizeof( float ) ) ; i++ )
+    if( floatToHalf( specials[i] ) != expected[i] ) {
+      printf( "    floatToHalf( %g ) = 0x%04x, wanted 0x%04x\n", specials[i], floatToHalf( specials[i] ), expected[i] ) ;
+      specialMismatches++ ;
+    }
+  uint16_t nanHalf = floatToHalf( NAN ) ;
+  specialMismatches += !( ( nanHalf & 0x7C00 ) == 0x7C00 && ( nanHalf & 0x3FF ) && halfToFloat( nanHalf ) != halfToFloat( nanHalf ) ) ;
+  for( int h = 0 ; h < 0x7C00 ; h++ ) // every finite positive half goes through float and back
+    specialMismatches += floatToHalf( halfToFloat( (uint16_t)h ) ) != h ;
+  failures += check( "half special cases + all halfs (# wrong)", specialMismatches, 0 ) ;
+
+  // TRANSFORM.  One rotation, quantized vs float.
+  Matrix3f m = Matrix3f::rotationYawPitchRoll( 0.3f, -0.7f, 0.2f ) ;
+  vector<VertexQPC> qpc( numVerts ) ;
+  vector<VertexPC> pcBack( numVerts ) ;
+  quantize( &pc[0], &qpc[0], numVerts, scale ) ;
+  transformQuantized( m, &qpc[0], 0, numVerts ) ;
+  transformQuantized( m, &qpnc[0], 0, numVerts ) ;
+  dequantize( &qpc[0], &pcBack[0], numVerts, scale ) ;
+  dequantize( &qpnc[0], &pncBack[0], numVerts, scale ) ;
+  double transformError = 0, transformNormal = 0 ;
+  for( int i = 0 ; i < numVerts ; i++ ) {
+    Vector3f d = pcBack[i].pos - m * pc[i].pos ;
+    transformError = max( transformError, (double)max( fabsf( d.x ), max( fabsf( d.y ), fabsf( d.z ) ) ) ) ;
+    transformNormal = max( transformNormal, (double)angleDegrees( pncBack[i].normal, m * pnc[i].normal ) ) ;
+  }
+  // input error (half a step) carried through the rotation (up to sqrt(3) of it), then half a step of output rounding
+  failures += check( "transformQuantized position (units)", transformError, step*( 0.5*1.7321 + 0.5 ) + 1e-6 ) ;
+  failures += check( "transformQuantized normal (degrees)", transformNormal, 2.0 ) ;
+
+  // NO DRIFT.  10 seconds at 60fps, like the renderer: the reference stays
+  // as quantized, the rotation adds up in a TransformNode, and each frame is
+  // one transform of the reference.  Against the reference rotated in double.
+  const int frames = 600 ;
+  Matrix3f small = Matrix3f::rotationYawPitchRoll( 0.01f, 0.02f, 0.005f ) ;
+  int driftVerts = min( numVerts, 10000 ) ;
+  vector<VertexQPC> reference( driftVerts ), drawn( driftVerts ) ;
+  quantize( &pc[0], &reference[0], driftVerts, scale ) ;
+  TransformNode node ;
+  double exact[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, next[9] ;
+  double worstFrame = 0 ;
+  for( int f = 0 ; f < frames ; f++ ) {
+    node.compose( small ) ;
+    for( int c = 0 ; c < 3 ; c++ )  // column major, like Matrix3f
+      for( int r = 0 ; r < 3 ; r++ )
+        next[c*3+r] = small.elts[r]*exact[c*3] + small.elts[3+r]*exact[c*3+1] + small.elts[6+r]*exact[c*3+2] ;
+    memcpy( exact, next, sizeof( exact ) ) ;
+    transformQuantized( node.getWorld(), &reference[0], &drawn[0], 0, driftVerts ) ;
+    if( f % 100 != 99 )  continue ;
+    dequantize( &drawn[0], &pcBack[0], driftVerts, scale ) ;
+    for( int i = 0 ; i < driftVerts ; i++ ) {
+      const Vector3f& p = pc[i].pos ;
+      for( int r = 0 ; r < 3 ; r++ ) {
+        double want = exact[r]*p.x + exact[3+r]*p.y + exact[6+r]*p.z ;
+        worstFrame = max( worstFrame, fabs( pcBack[i].pos.elts[r] - want ) ) ;
+      }
+    }
+  }
+  printf( "    worst error over %d frames: %.4g units = %.2f steps\n", frames, worstFrame, worstFrame/step ) ;
+  // One transform's bound, plus a little for the float matrix (orthonormalized every 64 composes).
+  failures += check( "600 frames, no drift (units)", worstFrame, step*( 0.5*1.7321 + 0.5 ) + scale*2e-5 ) ;
+
+  // BANDWIDTH.  The same rotation over every vertex, in each format, from the pool.
+  const int reps = 20 ;
+  vector<VertexPC8> pc8( numVerts ) ;
+  quantize( &pc[0], &pc8[0], numVerts ) ;
+  quantize( &pc[0], &qpc[0], numVerts, scale ) ;
+  VertexPC *pcPtr = &pc[0] ;
+  VertexPC8 *pc8Ptr = &pc8[0] ;
+  VertexQPC *qpcPtr = &qpc[0] ;
+  VertexQPNC *qpncPtr = &qpnc[0] ;
+  VertexPNC *pncPtr = &pnc[0] ;
+  struct Format { const char* name ; int bytes ; function<void (int, int)> body ; } ;
+  Format formats[] = {
+    { "VertexPC", (int)sizeof(VertexPC), [&]( int s, int e ) { for( int i = s ; i < e ; i++ ) pcPtr[i].pos = small * pcPtr[i].pos ; } },
+    { "VertexPC8", (int)sizeof(VertexPC8), [&]( int s, int e ) { transformQuantized( small, pc8Ptr, s, e ) ; } },
+    { "VertexQPC", (int)sizeof(VertexQPC), [&]( int s, int e ) { transformQuantized( small, qpcPtr, s, e ) ; } },
+    { "VertexPNC", (int)sizeof(VertexPNC), [&]( int s, int e ) { for( int i = s ; i < e ; i++ ) {
+        pncPtr[i].pos = small * pncPtr[i].pos ;  pncPtr[i].normal = small * pncPtr[i].normal ; } } },
+    { "VertexQPNC", (int)sizeof(VertexQPNC), [&]( int s, int e ) { transformQuantized( small, qpncPtr, s, e ) ; } },
+  } ;
+  for( const Format& format : formats )
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+    for( int r = 0 ; r < reps ; r++ )
+      forEachChunk( "quantized transform", numVerts, QUANTIZE_GRAIN, format.body ) ;
+    double time = chrono::duration<double>( chrono::steady_clock::now() - start ).count() / reps ;
+    printf( "  %-10s %2d bytes, %7.2f MB/frame read+written, %8.3f ms/frame\n", format.name, format.bytes,
+      2.0*format.bytes*numVerts/1e6, time*1e3 ) ;
+  }
+
+  printf( "testQuantizedVertices: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
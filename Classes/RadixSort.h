@@ -0,0 +1,68 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Sorting draw batches by depth (for blending) or by material (fewer state
+// changes) every frame with std::sort is O(n log n) compares, serial.
+//
+// This is an LSD radix sort: 8 bits at a time, from the lowest byte up.
+// Each pass is
+//   1. HISTOGRAM (parallel) every block of the input counts its own bytes.
+//   2. SCAN      (serial, 256 x blocks) where each (byte, block) starts.
+//                Ordered byte-major, block-minor, so the sort is STABLE.
+//   3. SCATTER   (parallel) every block writes its keys to its own slots.
+// Passes where every key has the same byte are skipped (sorting 0..100000
+// as uint32 only does 3 passes, not 4).
+// The blocks are jobs on the pool, or run here if there's no pool (or for
+// small n, where waking the threads costs more than the sort).
+//
+// Key-value sorts move a uint32 along with each key, typically the index
+// of the thing the key came from, so you can sort keys and then gather.
+//
+// FLOAT KEYS.  IEEE floats sort right as integers if you flip the sign bit
+// of positives and all the bits of negatives (floatToKey).  -0 sorts before
+// +0, and NaNs go to the ends (-NaN first, +NaN last).
+
+inline uint32_t floatToKey( float f ) {
+  uint32_t u ;
+  memcpy( &u, &f, 4 ) ;
+  return u ^ ( (uint32_t)( (int32_t)u >> 31 ) | 0x80000000u ) ;
+}
+inline float keyToFloat( uint32_t k ) {
+  uint32_t u = k ^ ( ( ( k >> 31 ) - 1 ) | 0x80000000u ) ;
+  float f ;
+  memcpy( &f, &u, 4 ) ;
+  return f ;
+}
+inline uint64_t doubleToKey( double d ) {
+  uint64_t u ;
+  memcpy( &u, &d, 8 ) ;
+  return u ^ ( (uint64_t)( (int64_t)u >> 63 ) | 0x8000000000000000ULL ) ;
+}
+inline double keyToDouble( uint64_t k ) {
+  uint64_t u = k ^ ( ( ( k >> 63 ) - 1 ) | 0x8000000000000000ULL ) ;
+  double d ;
+  memcpy( &d, &u, 8 ) ;
+  return d ;
+}
+
+// Ascending, stable, in place (a scratch copy is allocated for the sort).
+void radixSort( uint32_t* keys, int n ) ;
+void radixSort( uint64_t* keys, int n ) ;
+void radixSort( float* keys, int n ) ;
+void radixSort( double* keys, int n ) ;
+
+// values[i] goes wherever keys[i] goes.
+void radixSort( uint32_t* keys, uint32_t* values, int n ) ;
+void radixSort( uint64_t* keys, uint32_t* values, int n ) ;
+void radixSort( float* keys, uint32_t* values, int n ) ;
+void radixSort( double* keys, uint32_t* values, int n ) ;
+
+// Radix sort vs std::sort on 10k, 100k and 10M random keys (sizes over
+// maxN are skipped, 10M key-value 64-bit needs ~300MB), for each key type,
+// key-only and key-value.  Checks the results too.
+void benchmarkRadixSort( int maxN ) ;
+
+#endif
@@ -0,0 +1,226 @@
+#import "RadixSort.h"
+#import "ThreadPool.h"
+#import "Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+using namespace std ;
+
+#define RADIX_BLOCK 65536    // at least this many keys per block (job)
+#define RADIX_MAX_BLOCKS 64
+
+// One block is the whole sort: just do it here, no jobs.
+static void runBlocks( const string& name, int numBlocks, const function<void (int, int)>& body )
+{
+  if( numBlocks == 1 )  body( 0, 1 ) ;
+  else  forEachChunk( name, numBlocks, 1, body ) ;
+}
+
+template <typename Key>
+static void radixSortKeys( Key* keys, uint32_t* values, int n )
+{
+  if( n < 2 )  return ;
+  const int DIGITS = sizeof(Key) ;
+
+  int numBlocks = min( max( n / RADIX_BLOCK, 1 ), RADIX_MAX_BLOCKS ) ;
+  int blockSize = ( n + numBlocks - 1 ) / numBlocks ;
+
+  // hist[ block ][ digit ][ byte ].  The first read counts every digit at
+  // once, which tells us which passes can be skipped, and is the block
+  // histogram for the first pass that isn't.
+  vector<uint32_t> hist( numBlocks * DIGITS * 256, 0 ) ;
+  runBlocks( "radix histogram", numBlocks, [&]( int bStart, int bEnd ) {
+    for( int b = bStart ; b < bEnd ; b++ )
+    {
+      uint32_t *h = &hist[ b*DIGITS*256 ] ;
+      int end = min( n, (b+1)*blockSize ) ;
+      for( int i = b*blockSize ; i < end ; i++ )
+      {
+        Key k = keys[i] ;
+        for( int d = 0 ; d < DIGITS ; d++ )
+          h[ d*256 + ( ( k >> 8*d ) & 255 ) ]++ ;
+      }
+    }
+  } ) ;
+
+  vector<Key> keyScratch( n ) ;
+  vector<uint32_t> valueScratch( values ? n : 0 ) ;
+  Key *src = keys, *dst = &keyScratch[0] ;
+  uint32_t *srcValues = values, *dstValues = values ? &valueScratch[0] : 0 ;
+  vector<uint32_t> offsets( numBlocks * 256 ) ;
+  bool countedThisLayout = true ; // hist matches how the keys are laid out in src right now
+
+  for( int d = 0 ; d < DIGITS ; d++ )
+  {
+    int shift = 8*d ;
+
+    // Every key has the same byte here?  Then this pass wouldn't move anything.
+    bool skip = false ;
+    for( int byte = 0 ; byte < 256 && !skip ; byte++ )
+    {
+      uint32_t total = 0 ;
+      for( int b = 0 ; b < numBlocks ; b++ )
+        total += hist[ ( b*DIGITS + d )*256 + byte ] ;
+      if( total == (uint32_t)n )  skip = true ;
+      else if( total )  break ;
+    }
+    if( skip )  continue ;
+
+    // 1. HISTOGRAM.  After a scatter the blocks hold different keys, so count again.
+    if( !countedThisLayout )
+    {
+      runBlocks( "radix histogram", numBlocks, [&]( int bStart, int bEnd ) {
+        for( int b = bStart ; b < bEnd ; b++ )
+        {
+          uint32_t *h = &hist[ ( b*DIGITS + d )*256 ] ;
+          memset( h, 0, 256*sizeof(uint32_t) ) ;
+          int end = min( n, (b+1)*blockSize ) ;
+          for( int i = b*blockSize ; i < end ; i++ )
+            h[ ( src[i] >> shift ) & 255 ]++ ;
+        }
+      } ) ;
+    }
+    countedThisLayout = false ;
+
+    // 2. SCAN.  All of byte 0 (block 0's, then block 1's, ..), then all of byte 1, ..
+    uint32_t sum = 0 ;
+    for( int byte = 0 ; byte < 256 ; byte++ )
+      for( int b = 0 ; b < numBlocks ; b++ )
+      {
+        offsets[ b*256 + byte ] = sum ;
+        sum += hist[ ( b*DIGITS + d )*256 + byte ] ;
+      }
+
+    // 3. SCATTER.  Each block owns its slots, no two blocks write the same place.
+    runBlocks( "radix scatter", numBlocks, [&]( int bStart, int bEnd ) {
+      for( int b = bStart ; b < bEnd ; b++ )
+      {
+        uint32_t *offset = &offsets[ b*256 ] ;
+        int end = min( n, (b+1)*blockSize ) ;
+        if( srcValues )
+          for( int i = b*blockSize ; i < end ; i++ ) {
+            uint32_t to = offset[ ( src[i] >> shift ) & 255 ]++ ;
+            dst[ to ] = src[i] ;
+            dstValues[ to ] = srcValues[i] ;
+          }
+        else
+          for( int i = b*blockSize ; i < end ; i++ )
+            dst[ offset[ ( src[i] >> shift ) & 255 ]++ ] = src[i] ;
+      }
+    } ) ;
+
+    swap( src, dst ) ;
+    swap( srcValues, dstValues ) ;
+  }
+
+  // An odd number of passes leaves the result in the scratch buffers.
+  if( src != keys )
+  {
+    runBlocks( "radix copy back", numBlocks, [&]( int bStart, int bEnd ) {
+      for( int b = bStart ; b < bEnd ; b++ )
+      {
+        int start = b*blockSize, end = min( n, (b+1)*blockSize ) ;
+        if( start >= end )  continue ;
+        memcpy( keys + start, src + start, sizeof(Key)*( end - start ) ) ;
+        if( values )  memcpy( values + start, srcValues + start, sizeof(uint32_t)*( end - start ) ) ;
+      }
+    } ) ;
+  }
+}
+
+// Floats are sorted as their keys, converted in place and back.
+template <typename Float, typename Key, Key (*toKey)( Float ), Float (*fromKey)( Key )>
+static void radixSortFloats( Float* keys, uint32_t* values, int n )
+{
+  Key *asKeys = (Key*)keys ;
+  forEachChunk( "radix float keys", n, RADIX_BLOCK, [asKeys]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      Float f ;
+      memcpy( &f, &asKeys[i], sizeof(Float) ) ;
+      asKeys[i] = toKey( f ) ;
+    }
+  } ) ;
+  radixSortKeys( asKeys, values, n ) ;
+  forEachChunk( "radix float keys", n, RADIX_BLOCK, [asKeys]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      Float f = fromKey( asKeys[i] ) ;
+      memcpy( &asKeys[i], &f, sizeof(Float) ) ;
+    }
+  } ) ;
+}
+
+void radixSort( uint32_t* keys, int n ) { radixSortKeys( keys, (uint32_t*)0, n ) ; }
+void radixSort( uint64_t* keys, int n ) { radixSortKeys( keys, (uint32_t*)0, n ) ; }
+void radixSort( float* keys, int n ) { radixSortFloats<float, uint32_t, floatToKey, keyToFloat>( keys, 0, n ) ; }
+void radixSort( double* keys, int n ) { radixSortFloats<double, uint64_t, doubleToKey, keyToDouble>( keys, 0, n ) ; }
+
+void radixSort( uint32_t* keys, uint32_t* values, int n ) { radixSortKeys( keys, values, n ) ; }
+void radixSort( uint64_t* keys, uint32_t* values, int n ) { radixSortKeys( keys, values, n ) ; }
+void radixSort( float* keys, uint32_t* values, int n ) { radixSortFloats<float, uint32_t, floatToKey, keyToFloat>( keys, values, n ) ; }
+void radixSort( double* keys, uint32_t* values, int n ) { radixSortFloats<double, uint64_t, doubleToKey, keyToDouble>( keys, values, n ) ; }
+
+// BENCHMARK //
+
+static double msToRun( const function<void ()>& setup, const function<void ()>& sort, int reps )
+{
+  double total = 0 ;
+  for( int r = 0 ; r < reps ; r++ )
+  {
+    setup() ; // not timed
+    chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+    sort() ;
+    total += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+  }
+  return total / reps * 1e3 ;
+}
+
+template <typename Key>
+static void benchmarkKeyType( const char* name, const vector<Key>& original, int reps )
+{
+  int n = (int)original.size() ;
+  vector<Key> keys, stdKeys ;
+  vector<uint32_t> values( n ) ;
+  vector< pair<Key, uint32_t> > stdPairs( n ) ;
+  bool ok = true ;
+
+  // KEY ONLY
+  double radixTime = msToRun( [&](){ keys = original ; }, [&](){ radixSort( &keys[0], n ) ; }, reps ) ;
+  double stdTime = msToRun( [&](){ stdKeys = original ; }, [&](){ sort( stdKeys.begin(), stdKeys.end() ) ; }, reps ) ;
+  ok = ok && keys == stdKeys ;
+  printf( "  %-7s keys       %9.3f ms  std::sort %9.3f ms  %5.2fx\n", name, radixTime, stdTime, stdTime/radixTime ) ;
+
+  // KEY-VALUE.  values are the original indices.  std::stable_sort, since the radix sort is stable too.
+  radixTime = msToRun( [&](){ keys = original ; for( int i = 0 ; i < n ; i++ ) values[i] = i ; },
+    [&](){ radixSort( &keys[0], &values[0], n ) ; }, reps ) ;
+  stdTime = msToRun( [&](){ for( int i = 0 ; i < n ; i++ ) stdPairs[i] = make_pair( original[i], (uint32_t)i ) ; },
+    [&](){ stable_sort( stdPairs.begin(), stdPairs.end(), []( const pair<Key, uint32_t>& a, const pair<Key, uint32_t>& b ) {
+      return a.first < b.first ; } ) ; }, reps ) ;
+  for( int i = 0 ; i < n && ok ; i++ )
+    ok = keys[i] == stdPairs[i].first && values[i] == stdPairs[i].second ;
+  printf( "  %-7s key+index  %9.3f ms  std::sort %9.3f ms  %5.2fx  %s\n", name, radixTime, stdTime, stdTime/radixTime, ok ? "ok" : "WRONG ORDER" ) ;
+}
+
+void benchmarkRadixSort( int maxN )
+{
+  int sizes[] = { 10000, 100000, 10000000 } ;
+  for( int n : sizes )
+  {
+    if( n > maxN )  continue ;
+    int reps = max( 1, 2000000 / n ) ;
+    printf( "benchmarkRadixSort: %d keys, %d blocks, avg of %d\n", n, min( max( n / RADIX_BLOCK, 1 ), RADIX_MAX_BLOCKS ), reps ) ;
+
+    Rng rng = jobRng( n ) ;
+    vector<uint32_t> u32( n ) ;
+    vector<uint64_t> u64( n ) ;
+    vector<float> f32( n ) ;
+    for( int i = 0 ; i < n ; i++ ) {
+      u32[i] = rng.next() ;
+      u64[i] = ( (uint64_t)rng.next() << 32 ) | rng.next() ;
+    }
+    randomFill( rng, &f32[0], n, -1000.f, 1000.f ) ; // negatives too, that's the hard part
+    benchmarkKeyType( "uint32", u32, reps ) ;
+    benchmarkKeyType( "uint64", u64, reps ) ;
+    benchmarkKeyType( "float", f32, reps ) ;
+  }
+}
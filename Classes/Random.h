@@ -0,0 +1,105 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// arc4random() takes a lock inside libc and reads from a shared pool, and
+// rand() has one global state.  Either way every thread generating random
+// numbers is fighting over the same cache line.
+//
+// Rng is COUNTER BASED (like Philox): the i'th number of a stream is just
+// hash( key, i ).  There's no state except the key and the counter, so
+//   - every thread has its own Rng (threadRng()), nothing shared, no locks.
+//   - a job can make its own Rng from (seed, jobIndex) and get the exact same
+//     numbers no matter which worker runs it, or in what order.
+//   - SIMD fills compute 4/8 numbers at once (counter, counter+1, ..)
+// The hash is 2 keyed rounds of a 32-bit integer mixer (lowbias32) instead of
+// Philox's 64-bit multiplies, so it vectorizes on SSE2 and armv7 NEON too.
+
+// All the thread and job streams derive from this.  Set it BEFORE
+// createWorkerThreads for reproducible worker streams.
+extern uint64_t randomSeed ;
+
+struct Rng
+{
+  // Stream numbers with this bit set are for threads, the rest are free for jobs.
+  static const uint64_t ThreadStream = 1ULL << 63 ;
+
+  uint32_t k0, k1 ; // the key: which stream this is
+  uint64_t counter ;  // which number of the stream is next
+
+  Rng( uint64_t seed=0, uint64_t stream=0 ) : counter( 0 ) {
+    uint64_t z = splitMix64( seed ^ splitMix64( stream ) ) ;
+    k0 = (uint32_t)z ;
+    k1 = (uint32_t)( z >> 32 ) ;
+  }
+
+  static inline uint64_t splitMix64( uint64_t z ) {
+    z += 0x9e3779b97f4a7c15ULL ;
+    z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL ;
+    z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL ;
+    return z ^ ( z >> 31 ) ;
+  }
+
+  static inline uint32_t hash( uint32_t x ) {
+    x ^= x >> 16 ;
+    x *= 0x7feb352dU ;
+    x ^= x >> 15 ;
+    x *= 0x846ca68bU ;
+    x ^= x >> 16 ;
+    return x ;
+  }
+
+  // 24 random bits -> [0,1).  Every float in there is exactly representable.
+  static inline float toFloat( uint32_t x ) {
+    return (float)( x >> 8 ) * ( 1.f / 16777216.f ) ;
+  }
+
+  // The i'th number of this stream.  Doesn't touch the counter.
+  inline uint32_t at( uint64_t i ) const {
+    return hash( hash( (uint32_t)i ^ k0 ) ^ (uint32_t)( i >> 32 ) ^ k1 ) ;
+  }
+
+  inline uint32_t next() { return at( counter++ ) ; }
+
+  // [0,1)
+  inline float nextFloat() { return toFloat( next() ) ; }
+
+  // [low,high)
+  inline float nextFloat( float low, float high ) { return low + (high-low)*nextFloat() ; }
+
+  // [0,n), n > 0.  Multiply-high instead of %, so no modulo bias toward small numbers.
+  inline int nextInt( int n ) { return (int)( ( (uint64_t)next() * (uint32_t)n ) >> 32 ) ; }
+} ;
+
+// The calling thread's generator.  Pool threads are seeded with
+// (randomSeed, thread num) in the fishTank.  Any other thread gets a
+// stream of its own the first time it asks.
+Rng& threadRng() ;
+
+// Reseeds the calling thread's generator to (randomSeed, ThreadStream | threadNum).
+void seedThreadRng( int threadNum ) ;
+
+// A job's own generator.  Give every job of a WorkOrder its index and the
+// output is the same for the same seed, whichever thread runs which job.
+inline Rng jobRng( uint64_t seed, uint64_t jobIndex ) { return Rng( seed, jobIndex & ~Rng::ThreadStream ) ; }
+inline Rng jobRng( uint64_t jobIndex ) { return jobRng( randomSeed, jobIndex ) ; }
+
+// BULK FILLS
+// Uniform in [min,max), SSE2/AVX2 on Intel and NEON on ARM (whichever
+// simdIsa() the batch kernels are using).  Consumes one number of rng's
+// stream per float (3 per Vector3f), so the result doesn't depend on the ISA
+// or on how you split the fill up.
+union Vector3f ;
+void randomFill( Rng& rng, float* dst, int n, float min, float max ) ;
+void randomFill( Rng& rng, Vector3f* dst, int n, float min, float max ) ;
+void randomFill( Rng& rng, Vector3f* dst, int n, const Vector3f& min, const Vector3f& max ) ;
+// Same, from threadRng()
+void randomFill( Vector3f* dst, int n, float min, float max ) ;
+
+// Checks the SIMD fills against Rng::at and the stream properties.  Prints, returns # failures.
+int testRandom() ;
+// Floats/s of arc4random, rand, randFloat and randomFill.
+void benchmarkRandom( int n, int reps ) ;
+
+#endif
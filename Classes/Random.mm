@@ -0,0 +1,363 @@
+#import "Random.h"
+#import "Vectorf.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+using namespace std ;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RANDOM_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define RANDOM_NEON 1
+#include <arm_neon.h>
+#endif
+
+uint64_t randomSeed = 0x746872656164656eULL ; // "threaden"
+
+// PER THREAD //
+
+static pthread_key_t rngKey ;
+static pthread_once_t rngKeyOnce = PTHREAD_ONCE_INIT ;
+static uint64_t nextAnonymousStream = 1ULL << 32 ; // way past any thread num
+
+static void deleteRng( void* rng ) { delete (Rng*)rng ; }
+static void makeRngKey() { pthread_key_create( &rngKey, deleteRng ) ; }
+
+static void setThreadRng( const Rng& rng )
+{
+  pthread_once( &rngKeyOnce, makeRngKey ) ;
+  Rng *mine = (Rng*)pthread_getspecific( rngKey ) ;
+  if( mine )  *mine = rng ;
+  else  pthread_setspecific( rngKey, new Rng( rng ) ) ;
+}
+
+Rng& threadRng()
+{
+  pthread_once( &rngKeyOnce, makeRngKey ) ;
+  Rng *mine = (Rng*)pthread_getspecific( rngKey ) ;
+  if( !mine ) {
+    // Not a pool thread (or the pool isn't up yet, eg static initializers).
+    mine = new Rng( randomSeed, Rng::ThreadStream | __sync_fetch_and_add( &nextAnonymousStream, 1 ) ) ;
+    pthread_setspecific( rngKey, mine ) ;
+  }
+  return *mine ;
+}
+
+void seedThreadRng( int threadNum )
+{
+  setThreadRng( Rng( randomSeed, Rng::ThreadStream | (uint32_t)threadNum ) ) ;
+}
+
+// FILL KERNELS //
+// Every kernel fills dst[i] = lo[i%3] + scale[i%3]*toFloat( rng.at( first+i ) ).
+// lo and scale are that period 3 pattern written out 24 floats long, so a
+// vector loop that does 12 (or 24) floats per pass can just load them.
+// The caller makes sure first .. first+n doesn't cross a 2^32 boundary,
+// so only the low word of the counter changes across the lanes.
+
+static void fillScalar( const Rng& rng, uint64_t first, float* dst, int n, const float* lo, const float* scale )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = lo[i%3] + scale[i%3]*Rng::toFloat( rng.at( first+i ) ) ;
+}
+
+#if RANDOM_X86
+
+// SSE2 has no 32-bit mullo (that's SSE4.1), so build it out of 2 32x32->64 multiplies.
+static inline __m128i mullo4( __m128i a, __m128i b )
+{
+  __m128i even = _mm_mul_epu32( a, b ) ;
+  __m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) ) ;
+  return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE(0,0,2,0) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE(0,0,2,0) ) ) ;
+}
+
+static inline __m128i hash4( __m128i x )
+{
+  x = _mm_xor_si128( x, _mm_srli_epi32( x, 16 ) ) ;
+  x = mullo4( x, _mm_set1_epi32( 0x7feb352d ) ) ;
+  x = _mm_xor_si128( x, _mm_srli_epi32( x, 15 ) ) ;
+  x = mullo4( x, _mm_set1_epi32( (int)0x846ca68b ) ) ;
+  return _mm_xor_si128( x, _mm_srli_epi32( x, 16 ) ) ;
+}
+
+static void fillSSE2( const Rng& rng, uint64_t first, float* dst, int n, const float* lo, const float* scale )
+{
+  __m128i k0 = _mm_set1_epi32( (int)rng.k0 ) ;
+  __m128i k1 = _mm_set1_epi32( (int)( rng.k1 ^ (uint32_t)( first >> 32 ) ) ) ;
+  __m128i ctr = _mm_add_epi32( _mm_set1_epi32( (int)(uint32_t)first ), _mm_setr_epi32( 0, 1, 2, 3 ) ) ;
+  __m128i four = _mm_set1_epi32( 4 ) ;
+  __m128 toUnit = _mm_set1_ps( 1.f / 16777216.f ) ;
+
+  int i = 0 ;
+  for( ; i + 12 <= n ; i += 12 )
+  for( int j = 0 ; j < 12 ; j += 4 )
+  {
+    __m128i x = hash4( _mm_xor_si128( hash4( _mm_xor_si128( ctr, k0 ) ), k1 ) ) ;
+    __m128 u = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( x, 8 ) ), toUnit ) ;
+    _mm_storeu_ps( dst + i + j, _mm_add_ps( _mm_loadu_ps( lo + j ), _mm_mul_ps( _mm_loadu_ps( scale + j ), u ) ) ) ;
+    ctr = _mm_add_epi32( ctr, four ) ;
+  }
+  // i is a multiple of 12, so the pattern is still in phase for the tail
+  fillScalar( rng, first + i, dst + i, n - i, lo, scale ) ;
+}
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i hash8( __m256i x )
+{
+  x = _mm256_xor_si256( x, _mm256_srli_epi32( x, 16 ) ) ;
+  x = _mm256_mullo_epi32( x, _mm256_set1_epi32( 0x7feb352d ) ) ;
+  x = _mm256_xor_si256( x, _mm256_srli_epi32( x, 15 ) ) ;
+  x = _mm256_mullo_epi32( x, _mm256_set1_epi32( (int)0x846ca68b ) ) ;
+  return _mm256_xor_si256( x, _mm256_srli_epi32( x, 16 ) ) ;
+}
+
+AVX2_TARGET static void fillAVX2( const Rng& rng, uint64_t first, float* dst, int n, const float* lo, const float* scale )
+{
+  __m256i k0 = _mm256_set1_epi32( (int)rng.k0 ) ;
+  __m256i k1 = _mm256_set1_epi32( (int)( rng.k1 ^ (uint32_t)( first >> 32 ) ) ) ;
+  __m256i ctr = _mm256_add_epi32( _mm256_set1_epi32( (int)(uint32_t)first ), _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) ) ;
+  __m256i eight = _mm256_set1_epi32( 8 ) ;
+  __m256 toUnit = _mm256_set1_ps( 1.f / 16777216.f ) ;
+
+  int i = 0 ;
+  for( ; i + 24 <= n ; i += 24 )
+  for( int j = 0 ; j < 24 ; j += 8 )
+  {
+    __m256i x = hash8( _mm256_xor_si256( hash8( _mm256_xor_si256( ctr, k0 ) ), k1 ) ) ;
+    __m256 u = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_srli_epi32( x, 8 ) ), toUnit ) ;
+    // mul + add, not fma, so it rounds the same as the scalar code
+    _mm256_storeu_ps( dst + i + j, _mm256_add_ps( _mm256_loadu_ps( lo + j ), _mm256_mul_ps( _mm256_loadu_ps( scale + j ), u ) ) ) ;
+    ctr = _mm256_add_epi32( ctr, eight ) ;
+  }
+  fillSSE2( rng, first + i, dst + i, n - i, lo, scale ) ;
+}
+
+#endif // RANDOM_X86
+
+#if RANDOM_NEON
+
+static inline uint32x4_t hashNEON4( uint32x4_t x )
+{
+  x = veorq_u32( x, vshrq_n_u32( x, 16 ) ) ;
+  x = vmulq_u32( x, vdupq_n_u32( 0x7feb352dU ) ) ;
+  x = veorq_u32( x, vshrq_n_u32( x, 15 ) ) ;
+  x = vmulq_u32( x, vdupq_n_u32( 0x846ca68bU ) ) ;
+  return veorq_u32( x, vshrq_n_u32( x, 16 ) ) ;
+}
+
+static void fillNEON( const Rng& rng, uint64_t first, float* dst, int n, const float* lo, const float* scale )
+{
+  static const uint32_t lanes[4] = { 0, 1, 2, 3 } ;
+  uint32x4_t k0 = vdupq_n_u32( rng.k0 ) ;
+  uint32x4_t k1 = vdupq_n_u32( rng.k1 ^ (uint32_t)( first >> 32 ) ) ;
+  uint32x4_t ctr = vaddq_u32( vdupq_n_u32( (uint32_t)first ), vld1q_u32( lanes ) ) ;
+  uint32x4_t four = vdupq_n_u32( 4 ) ;
+  float32x4_t toUnit = vdupq_n_f32( 1.f / 16777216.f ) ;
+
+  int i = 0 ;
+  for( ; i + 12 <= n ; i += 12 )
+  for( int j = 0 ; j < 12 ; j += 4 )
+  {
+    uint32x4_t x = hashNEON4( veorq_u32( hashNEON4( veorq_u32( ctr, k0 ) ), k1 ) ) ;
+    float32x4_t u = vmulq_f32( vcvtq_f32_u32( vshrq_n_u32( x, 8 ) ), toUnit ) ;
+    // vmul + vadd rather than vmla, so it rounds the same as the scalar code
+    vst1q_f32( dst + i + j, vaddq_f32( vld1q_f32( lo + j ), vmulq_f32( vld1q_f32( scale + j ), u ) ) ) ;
+    ctr = vaddq_u32( ctr, four ) ;
+  }
+  fillScalar( rng, first + i, dst + i, n - i, lo, scale ) ;
+}
+
+#endif // RANDOM_NEON
+
+typedef void (*FillKernel)( const Rng&, uint64_t, float*, int, const float*, const float* ) ;
+
+static FillKernel fillKernel()
+{
+  switch( simdIsa() )
+  {
+#if RANDOM_X86
+  case SimdSSE2:    return fillSSE2 ;
+  case SimdAVX2:
+  case SimdAVX512:  return fillAVX2 ; // integer multiplies are the bottleneck, 512 bit doesn't buy much
+#endif
+#if RANDOM_NEON
+  case SimdNEON:    return fillNEON ;
+#endif
+  default:          return fillScalar ;
+  }
+}
+
+// lo/scale are the 3 component bounds
+static void fill( Rng& rng, float* dst, int n, const float* lo3, const float* scale3 )
+{
+  // 2 extra, the chunks below start up to 2 floats into it
+  float lo[26], scale[26] ;
+  for( int i = 0 ; i < 26 ; i++ ) {
+    lo[i] = lo3[i%3] ;
+    scale[i] = scale3[i%3] ;
+  }
+
+  FillKernel kernel = fillKernel() ;
+  int done = 0 ;
+  while( done < n )
+  {
+    // Stop at the next 2^32 boundary of the counter, so the kernel's lanes all share the high word.
+    uint64_t untilWrap = ( 1ULL << 32 ) - (uint32_t)rng.counter ;
+    int chunk = n - done ;
+    if( (uint64_t)chunk > untilWrap )  chunk = (int)untilWrap ;
+
+    // Keep the period 3 pattern in phase across chunks.
+    int phase = done % 3 ;
+    kernel( rng, rng.counter, dst + done, chunk, lo + phase, scale + phase ) ;
+    rng.counter += chunk ;
+    done += chunk ;
+  }
+}
+
+void randomFill( Rng& rng, float* dst, int n, float min, float max )
+{
+  float lo[3] = { min, min, min } ;
+  float scale[3] = { max-min, max-min, max-min } ;
+  fill( rng, dst, n, lo, scale ) ;
+}
+
+void randomFill( Rng& rng, Vector3f* dst, int n, float min, float max )
+{
+  randomFill( rng, &dst->x, 3*n, min, max ) ;
+}
+
+void randomFill( Rng& rng, Vector3f* dst, int n, const Vector3f& min, const Vector3f& max )
+{
+  Vector3f scale = max - min ;
+  fill( rng, &dst->x, 3*n, min.elts, scale.elts ) ;
+}
+
+void randomFill( Vector3f* dst, int n, float min, float max )
+{
+  randomFill( threadRng(), dst, n, min, max ) ;
+}
+
+// TEST & BENCHMARK //
+
+int testRandom()
+{
+  SimdIsa was = simdIsa() ;
+  SimdIsa isas[] = { SimdScalar, SimdSSE2, SimdAVX2, SimdAVX512, SimdNEON } ;
+  int sizes[] = { 0, 1, 2, 5, 11, 12, 13, 23, 24, 25, 100, 1001 } ;
+  int failures = 0 ;
+  vector<Vector3f> got( 1001 ) ;
+  Vector3f lo( -1.f, 0.f, 10.f ), hi( 1.f, 0.5f, 20.f ) ;
+
+  for( SimdIsa isa : isas )
+  {
+    if( !simdIsaSupported( isa ) )  continue ;
+    setSimdIsa( isa ) ;
+    int before = failures ;
+
+    for( int n : sizes )
+    {
+      // start near a counter wrap, so the chunking gets exercised too
+      Rng rng = jobRng( 1234, n ) ;
+      rng.counter = ( 1ULL << 32 ) - 17 ;
+      Rng want = rng ;
+      randomFill( rng, &got[0], n, lo, hi ) ;
+      for( int i = 0 ; i < 3*n ; i++ )
+      {
+        int c = i%3 ;
+        float w = lo.elts[c] + ( hi.elts[c] - lo.elts[c] )*want.nextFloat() ;
+        float g = got[0].elts[i] ;
+        if( fabsf( g - w ) > 1e-5f * max( 1.f, fabsf( w ) ) || g < lo.elts[c] || g > hi.elts[c] ) {
+          printf( "  FAIL %s randomFill n=%d [%d]: got %f want %f\n", simdIsaName( isa ), n, i, g, w ) ;
+          failures++ ;
+          break ;
+        }
+      }
+      if( rng.counter != want.counter ) {
+        printf( "  FAIL %s randomFill n=%d consumed %d numbers, not %d\n", simdIsaName( isa ), n,
+          (int)( rng.counter - ( ( 1ULL << 32 ) - 17 ) ), 3*n ) ;
+        failures++ ;
+      }
+    }
+    printf( "testRandom: %s %s\n", simdIsaName( isa ), failures==before ? "PASS" : "FAIL" ) ;
+  }
+  setSimdIsa( was ) ;
+
+  // Same (seed, job) is the same stream.  Different jobs are different streams.
+  Rng a = jobRng( 99, 7 ), b = jobRng( 99, 7 ), c = jobRng( 99, 8 ) ;
+  int same = 0, sameAsOther = 0 ;
+  for( int i = 0 ; i < 1000 ; i++ ) {
+    uint32_t x = a.next() ;
+    same += x == b.next() ;
+    sameAsOther += x == c.next() ;
+  }
+  if( same != 1000 || sameAsOther > 1 ) {
+    printf( "  FAIL job streams: %d/1000 reproduced, %d/1000 collide with the next job\n", same, sameAsOther ) ;
+    failures++ ;
+  }
+
+  // Mean of [0,1) floats should be very close to 1/2, each bit set half the time.
+  Rng r = jobRng( 5 ) ;
+  double sum = 0 ;
+  int bits[32] = { 0 } ;
+  const int N = 1 << 20 ;
+  for( int i = 0 ; i < N ; i++ ) {
+    uint32_t x = r.next() ;
+    sum += Rng::toFloat( x ) ;
+    for( int bit = 0 ; bit < 32 ; bit++ )
+      bits[bit] += ( x >> bit ) & 1 ;
+  }
+  if( fabs( sum/N - 0.5 ) > 0.002 ) {
+    printf( "  FAIL mean %f\n", sum/N ) ;
+    failures++ ;
+  }
+  for( int bit = 0 ; bit < 32 ; bit++ )
+    if( fabs( (double)bits[bit]/N - 0.5 ) > 0.003 ) {
+      printf( "  FAIL bit %d set %f of the time\n", bit, (double)bits[bit]/N ) ;
+      failures++ ;
+    }
+
+  printf( "testRandom: %d failures\n", failures ) ;
+  return failures ;
+}
+
+static double secondsToRun( function<void ()> f, int reps )
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  for( int r = 0 ; r < reps ; r++ )
+    f() ;
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+void benchmarkRandom( int n, int reps )
+{
+  vector<float> dst( n ) ;
+  float *d = &dst[0] ;
+  double floats = (double)n * reps ;
+
+  printf( "benchmarkRandom: %d floats x %d reps, Mfloats/s\n", n, reps ) ;
+  double t = secondsToRun( [d,n](){ for( int i = 0 ; i < n ; i++ ) d[i] = (float)arc4random() / UINT_MAX ; }, reps ) ;
+  printf( "  arc4random        %10.1f\n", floats/t/1e6 ) ;
+  t = secondsToRun( [d,n](){ for( int i = 0 ; i < n ; i++ ) d[i] = (float)rand() / RAND_MAX ; }, reps ) ;
+  printf( "  rand              %10.1f\n", floats/t/1e6 ) ;
+  t = secondsToRun( [d,n](){ for( int i = 0 ; i < n ; i++ ) d[i] = randFloat() ; }, reps ) ;
+  printf( "  randFloat         %10.1f\n", floats/t/1e6 ) ;
+
+  SimdIsa was = simdIsa() ;
+  SimdIsa isas[] = { SimdScalar, SimdSSE2, SimdAVX2, SimdNEON } ;
+  for( SimdIsa isa : isas )
+  {
+    if( !simdIsaSupported( isa ) )  continue ;
+    setSimdIsa( isa ) ;
+    Rng rng = jobRng( 0 ) ;
+    t = secondsToRun( [&rng,d,n](){ randomFill( rng, d, n, 0.f, 1.f ) ; }, reps ) ;
+    printf( "  randomFill %-6s %10.1f\n", simdIsaName( isa ), floats/t/1e6 ) ;
+  }
+  setSimdIsa( was ) ;
+}
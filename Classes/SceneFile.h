@@ -0,0 +1,160 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include "Vectorf.h"
+#include "QuantizedVertex.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std ;
+
+// A binary scene: named vertex STREAMS (a VertexPC array, a VertexPNC array,
+// or one of the compact formats from QuantizedVertex.h), laid out so the file
+// can be mmap'd and the arrays used right where they sit.  No parsing, no copy:
+// loading is the page faults (and the disk reads behind them), nothing else.
+//
+//   [ SceneHeader          ]  64 bytes
+//   [ SceneStreamInfo x N  ]  64 bytes each
+//   [ block checksums      ]  uint64 per SCENE_BLOCK_BYTES of every stream
+//   [ pad to 4096 ] [ stream 0's vertices ] [ pad to 4096 ] [ stream 1 ] ...
+//
+// Every stream starts on a page boundary (so it's aligned for any vertex
+// type, and for mmap).  Each stream is checksummed in BLOCKS, so checking it
+// is a parallelFor over the blocks, and a bad block says where the damage is.
+// Little endian only (iOS and x86 both are); a big endian reader rejects it
+// by the magic number.
+//
+// Version history:
+//   1  first version
+
+#define SCENE_MAGIC   0x4E435344524854ULL // "THRDSCN" little endian
+#define SCENE_VERSION 1
+#define SCENE_ALIGN   4096
+#define SCENE_BLOCK_BYTES ( 1 << 20 )
+
+enum SceneStreamKind
+{
+  SceneVertexPC = 1,
+  SceneVertexPNC,
+  SceneVertexPC8,
+  SceneVertexQPC,  // `scale` is the one it was quantized with
+  SceneVertexQPNC
+} ;
+
+struct SceneHeader
+{
+  uint64_t magic ;
+  uint32_t version ;
+  uint32_t headerBytes ;   // sizeof( SceneHeader ), so a reader can skip fields added later
+  uint32_t streamInfoBytes ;
+  uint32_t numStreams ;
+  uint64_t fileBytes ;
+  uint64_t userTag ;       // whatever the writer wants to know the file by (the renderer: seed + size)
+  uint32_t numBlocks ;     // block checksums, all streams
+  uint32_t reserved[3] ;
+  uint64_t headerChecksum ; // of everything before it, and the stream table + block checksums
+} ;
+
+struct SceneStreamInfo
+{
+  char name[24] ;          // 0 terminated
+  uint32_t kind ;          // SceneStreamKind
+  uint32_t vertexBytes ;   // sizeof the vertex, checked against this build's
+  uint32_t count ;
+  float scale ;            // snorm16 position scale, 1 for the float formats
+  uint64_t offset ;        // from the start of the file, SCENE_ALIGN aligned
+  uint64_t bytes ;
+  uint32_t firstBlock, numBlocks ; // into the block checksums
+} ;
+
+// Fletcher style, over 32 bit words (2 running sums, so it catches swapped
+// words too, which a plain sum wouldn't).  Runs about as fast as memory.
+uint64_t sceneChecksum( const void* data, size_t bytes ) ;
+
+// Open with open(), which maps it and checks the header and stream table
+// (cheap).  validate() then checks every block's checksum, on the pool,
+// touching every page (so it's also the "load it all in now" step).
+struct SceneFile
+{
+  int fd ;
+  void *map ;
+  size_t mapBytes ;
+  const SceneHeader *header ;
+  const SceneStreamInfo *streams ;
+  const uint64_t *blockChecksums ;
+
+private:
+  // Copying forbidden: both would unmap the same memory.
+  SceneFile( const SceneFile& o ) {
+    puts( "ERROR: Copying SceneFile should not be done!" ) ;
+  }
+
+public:
+  SceneFile() : fd( -1 ), map( 0 ), mapBytes( 0 ), header( 0 ), streams( 0 ), blockChecksums( 0 ) {}
+  ~SceneFile() { close() ; }
+
+  // false (and why, printed) if it isn't a scene file this build can read.
+  bool open( const string& path ) ;
+  void close() ;
+  inline bool isOpen() const { return map != 0 ; }
+
+  int numStreams() const { return header ? (int)header->numStreams : 0 ; }
+  int findStream( const string& name ) const ; // -1 if there's none
+  const SceneStreamInfo& info( int stream ) const { return streams[ stream ] ; }
+
+  // # bad blocks in `stream` (-1 for all of them).  Parallel, on the pool.
+  int validate( int stream=-1 ) const ;
+
+  // ZERO COPY: the vertices, right in the mapping.  0 if the stream isn't that kind.
+  // Valid until close().  Read only (it's a private, read only mapping).
+  const VertexPC* vertexPC( int stream ) const { return (const VertexPC*)data( stream, SceneVertexPC ) ; }
+  const VertexPNC* vertexPNC( int stream ) const { return (const VertexPNC*)data( stream, SceneVertexPNC ) ; }
+  const VertexPC8* vertexPC8( int stream ) const { return (const VertexPC8*)data( stream, SceneVertexPC8 ) ; }
+  const VertexQPC* vertexQPC( int stream ) const { return (const VertexQPC*)data( stream, SceneVertexQPC ) ; }
+  const VertexQPNC* vertexQPNC( int stream ) const { return (const VertexQPNC*)data( stream, SceneVertexQPNC ) ; }
+
+  // Decodes any PC kind (PC, PC8, QPC) into floats, on the pool.  false if it's not one.
+  bool decode( int stream, vector<VertexPC>& out ) const ;
+  // Same for the PNC kinds (PNC, QPNC)
+  bool decode( int stream, vector<VertexPNC>& out ) const ;
+
+private:
+  const void* data( int stream, SceneStreamKind kind ) const ;
+} ;
+
+// Collects streams (doesn't copy them: they must stay put until write()), then
+// writes the file in one go, checksumming the blocks on the pool first.
+struct SceneWriter
+{
+  struct Pending
+  {
+    SceneStreamInfo info ;
+    const void *data ;
+  } ;
+  vector<Pending> pending ;
+  uint64_t userTag ;
+
+  SceneWriter() : userTag( 0 ) {}
+
+  void add( const string& name, const VertexPC* verts, int count ) ;
+  void add( const string& name, const VertexPNC* verts, int count ) ;
+  void add( const string& name, const VertexPC8* verts, int count ) ;
+  void add( const string& name, const VertexQPC* verts, int count, float scale ) ;
+  void add( const string& name, const VertexQPNC* verts, int count, float scale ) ;
+
+  // Writes to `path`.tmp and renames it over `path`, so a reader never sees half a file.
+  bool write( const string& path ) ;
+
+private:
+  void add( const string& name, SceneStreamKind kind, int vertexBytes, const void* data, int count, float scale ) ;
+} ;
+
+// Writes `numVerts` of VertexPC, VertexPNC and VertexQPC, reads them back
+// (mmap, validate, zero copy + decode) and checks them, times each step
+// against the bandwidth of a plain memcpy of the same bytes, and checks
+// that a flipped byte is caught in the right block and a bad header is
+// refused.  Uses $TMPDIR.  Returns # failures.
+int testSceneFile( int numVerts ) ;
+
+#endif
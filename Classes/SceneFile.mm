@@ -0,0 +1,478 @@
+#import "SceneFile.h"
+#import "ThreadPool.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <chrono>
+
+static_assert( sizeof( SceneHeader ) == 64, "SceneHeader is 64 bytes on disk" ) ;
+static_assert( sizeof( SceneStreamInfo ) == 64, "SceneStreamInfo is 64 bytes on disk" ) ;
+
+static inline uint64_t alignUp( uint64_t v, uint64_t a ) { return ( v + a - 1 ) / a * a ; }
+
+static int vertexBytesOf( uint32_t kind )
+{
+  switch( kind )
+  {
+  case SceneVertexPC:   return sizeof( VertexPC ) ;
+  case SceneVertexPNC:  return sizeof( VertexPNC ) ;
+  case SceneVertexPC8:  return sizeof( VertexPC8 ) ;
+  case SceneVertexQPC:  return sizeof( VertexQPC ) ;
+  case SceneVertexQPNC: return sizeof( VertexQPNC ) ;
+  default: return 0 ;
+  }
+}
+
+uint64_t sceneChecksum( const void* data, size_t bytes )
+{
+  const uint32_t *w = (const uint32_t*)data ;
+  size_t n = bytes / 4 ;
+  uint64_t a = 1, b = 0 ;
+  for( size_t i = 0 ; i < n ; i++ ) {
+    a += w[i] ;
+    b += a ;
+  }
+  if( bytes & 3 ) {
+    uint32_t tail = 0 ;
+    memcpy( &tail, w + n, bytes & 3 ) ;
+    a += tail ;
+    b += a ;
+  }
+  return a ^ ( b * 0x9E3779B97F4A7C15ULL ) ;
+}
+
+// The header (up to its checksum), then the stream table and block checksums right after it.
+static uint64_t headerChecksumOf( const char* file, const SceneHeader* h )
+{
+  size_t tableBytes = (size_t)h->numStreams * sizeof( SceneStreamInfo ) + (size_t)h->numBlocks * sizeof( uint64_t ) ;
+  return sceneChecksum( h, offsetof( SceneHeader, headerChecksum ) ) * 31 + sceneChecksum( file + sizeof( SceneHeader ), tableBytes ) ;
+}
+
+// SCENEFILE //
+
+bool SceneFile::open( const string& path )
+{
+  close() ;
+  fd = ::open( path.c_str(), O_RDONLY ) ;
+  if( fd < 0 ) {
+    printf( "ERROR: SceneFile: couldn't open %s\n", path.c_str() ) ;
+    return false ;
+  }
+  struct stat st ;
+  fstat( fd, &st ) ;
+  mapBytes = (size_t)st.st_size ;
+  if( mapBytes < sizeof( SceneHeader ) ) {
+    printf( "ERROR: SceneFile: %s is too short to be a scene\n", path.c_str() ) ;
+    close() ;
+    return false ;
+  }
+  map = mmap( 0, mapBytes, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+  if( map == MAP_FAILED ) {
+    map = 0 ;
+    printf( "ERROR: SceneFile: couldn't mmap %s\n", path.c_str() ) ;
+    close() ;
+    return false ;
+  }
+  
+  const char *file = (const char*)map ;
+  const SceneHeader *h = (const SceneHeader*)file ;
+  const char *why = 0 ;
+  uint64_t tableEnd = sizeof( SceneHeader ) + (uint64_t)h->numStreams * sizeof( SceneStreamInfo ) + (uint64_t)h->numBlocks * sizeof( uint64_t ) ;
+  if( h->magic != SCENE_MAGIC )  why = "not a scene file" ;
+  else if( h->version != SCENE_VERSION )  why = "a version this build doesn't read" ;
+  else if( h->headerBytes != sizeof( SceneHeader ) || h->streamInfoBytes != sizeof( SceneStreamInfo ) )  why = "a different header layout" ;
+  else if( h->fileBytes != mapBytes )  why = "truncated (or has junk on the end)" ;
+  else if( tableEnd > mapBytes )  why = "a stream table past the end of the file" ;
+  else if( headerChecksumOf( file, h ) != h->headerChecksum )  why = "a bad header checksum" ;
+  
+  const SceneStreamInfo *s = (const SceneStreamInfo*)( file + sizeof( SceneHeader ) ) ;
+  for( uint32_t i = 0 ; !why && i < h->numStreams ; i++ )
+  {
+    if( !memchr( s[i].name, 0, sizeof( s[i].name ) ) )  why = "a stream name that doesn't end" ;
+    else if( !vertexBytesOf( s[i].kind ) )  why = "a stream of a kind this build doesn't know" ;
+    else if( s[i].vertexBytes != (uint32_t)vertexBytesOf( s[i].kind ) )  why = "a vertex size that doesn't match this build's" ;
+    else if( s[i].bytes != (uint64_t)s[i].count * s[i].vertexBytes )  why = "a stream whose size doesn't match its count" ;
+    // (not offset + bytes > mapBytes: on a corrupt file that can wrap around)
+    else if( s[i].offset % SCENE_ALIGN || s[i].offset < tableEnd ||
+             s[i].offset > mapBytes || s[i].bytes > mapBytes - s[i].offset )  why = "a stream outside the file" ;
+    else if( s[i].numBlocks != ( s[i].bytes + SCENE_BLOCK_BYTES - 1 ) / SCENE_BLOCK_BYTES ||
+             (uint64_t)s[i].firstBlock + s[i].numBlocks > h->numBlocks )  why = "a stream with the wrong blocks" ;
+  }
+  if( why ) {
+    printf( "ERROR: SceneFile: %s has %s\n", path.c_str(), why ) ;
+    close() ;
+    return false ;
+  }
+  
+  header = h ;
+  streams = s ;
+  blockChecksums = (const uint64_t*)( file + sizeof( SceneHeader ) + h->numStreams * sizeof( SceneStreamInfo ) ) ;
+  return true ;
+}
+
+void SceneFile::close()
+{
+  if( map )  munmap( map, mapBytes ) ;
+  if( fd >= 0 )  ::close( fd ) ;
+  fd = -1, map = 0, mapBytes = 0 ;
+  header = 0, streams = 0, blockChecksums = 0 ;
+}
+
+int SceneFile::findStream( const string& name ) const
+{
+  for( int i = 0 ; i < numStreams() ; i++ )
+    if( name == streams[i].name )
+      return i ;
+  return -1 ;
+}
+
+int SceneFile::validate( int stream ) const
+{
+  if( !isOpen() )  return 0 ;
+  // Every block of the streams asked for, as one list, so small streams don't get a job each.
+  struct Block { const char* data ; size_t bytes ; uint32_t index ; } ;
+  vector<Block> blocks ;
+  for( int i = 0 ; i < numStreams() ; i++ )
+  {
+    if( stream >= 0 && i != stream )  continue ;
+    const SceneStreamInfo& s = streams[i] ;
+    const char *data = (const char*)map + s.offset ;
+    // Let the kernel start reading ahead of the jobs.
+    madvise( (void*)data, s.bytes, MADV_WILLNEED ) ;
+    for( uint32_t b = 0 ; b < s.numBlocks ; b++ ) {
+      uint64_t start = (uint64_t)b * SCENE_BLOCK_BYTES ;
+      Block block = { data + start, (size_t)min( (uint64_t)SCENE_BLOCK_BYTES, s.bytes - start ), s.firstBlock + b } ;
+      blocks.push_back( block ) ;
+    }
+  }
+  
+  vector<char> bad( blocks.size(), 0 ) ;
+  forEachChunk( "validate scene", (int)blocks.size(), 1, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ )
+      bad[i] = sceneChecksum( blocks[i].data, blocks[i].bytes ) != blockChecksums[ blocks[i].index ] ;
+  } ) ;
+  
+  int numBad = 0 ;
+  for( size_t i = 0 ; i < blocks.size() ; i++ )
+    if( bad[i] ) {
+      printf( "ERROR: SceneFile: block %u (file offset %lld) fails its checksum\n",
+        blocks[i].index, (long long)( blocks[i].data - (const char*)map ) ) ;
+      numBad++ ;
+    }
+  return numBad ;
+}
+
+const void* SceneFile::data( int stream, SceneStreamKind kind ) const
+{
+  if( stream < 0 || stream >= numStreams() || streams[stream].kind != (uint32_t)kind )
+    return 0 ;
+  return (const char*)map + streams[stream].offset ;
+}
+
+bool SceneFile::decode( int stream, vector<VertexPC>& out ) const
+{
+  if( stream < 0 || stream >= numStreams() )  return false ;
+  const SceneStreamInfo& s = streams[stream] ;
+  out.resize( s.count ) ;
+  if( !s.count )  return true ;
+  VertexPC *dst = &out[0] ;
+  switch( s.kind )
+  {
+  case SceneVertexPC: {
+      const VertexPC *src = vertexPC( stream ) ;
+      forEachChunk( "decode scene PC", s.count, 65536, [=]( int start, int end ) {
+        memcpy( dst + start, src + start, ( end - start )*sizeof( VertexPC ) ) ;
+      } ) ;
+    }
+    return true ;
+  case SceneVertexPC8:
+    dequantize( vertexPC8( stream ), dst, s.count ) ;
+    return true ;
+  case SceneVertexQPC:
+    dequantize( vertexQPC( stream ), dst, s.count, s.scale ) ;
+    return true ;
+  default:
+    out.clear() ;
+    return false ;
+  }
+}
+
+bool SceneFile::decode( int stream, vector<VertexPNC>& out ) const
+{
+  if( stream < 0 || stream >= numStreams() )  return false ;
+  const SceneStreamInfo& s = streams[stream] ;
+  out.resize( s.count ) ;
+  if( !s.count )  return true ;
+  VertexPNC *dst = &out[0] ;
+  switch( s.kind )
+  {
+  case SceneVertexPNC: {
+      const VertexPNC *src = vertexPNC( stream ) ;
+      forEachChunk( "decode scene PNC", s.count, 65536, [=]( int start, int end ) {
+        memcpy( dst + start, src + start, ( end - start )*sizeof( VertexPNC ) ) ;
+      } ) ;
+    }
+    return true ;
+  case SceneVertexQPNC:
+    dequantize( vertexQPNC( stream ), dst, s.count, s.scale ) ;
+    return true ;
+  default:
+    out.clear() ;
+    return false ;
+  }
+}
+
+// SCENEWRITER //
+
+void SceneWriter::add( const string& name, SceneStreamKind kind, int vertexBytes, const void* data, int count, float scale )
+{
+  Pending p ;
+  memset( &p.info, 0, sizeof( p.info ) ) ;
+  if( name.size() >= sizeof( p.info.name ) )
+    printf( "WARNING: SceneWriter: stream name `%s` cut to %d characters\n", name.c_str(), (int)sizeof( p.info.name ) - 1 ) ;
+  strncpy( p.info.name, name.c_str(), sizeof( p.info.name ) - 1 ) ;
+  p.info.kind = kind ;
+  p.info.vertexBytes = vertexBytes ;
+  p.info.count = count ;
+  p.info.scale = scale ;
+  p.info.bytes = (uint64_t)count * vertexBytes ;
+  p.data = data ;
+  pending.push_back( p ) ;
+}
+
+void SceneWriter::add( const string& name, const VertexPC* verts, int count ) { add( name, SceneVertexPC, sizeof( VertexPC ), verts, count, 1.f ) ; }
+void SceneWriter::add( const string& name, const VertexPNC* verts, int count ) { add( name, SceneVertexPNC, sizeof( VertexPNC ), verts, count, 1.f ) ; }
+void SceneWriter::add( const string& name, const VertexPC8* verts, int count ) { add( name, SceneVertexPC8, sizeof( VertexPC8 ), verts, count, 1.f ) ; }
+void SceneWriter::add( const string& name, const VertexQPC* verts, int count, float scale ) { add( name, SceneVertexQPC, sizeof( VertexQPC ), verts, count, scale ) ; }
+void SceneWriter::add( const string& name, const VertexQPNC* verts, int count, float scale ) { add( name, SceneVertexQPNC, sizeof( VertexQPNC ), verts, count, scale ) ; }
+
+bool SceneWriter::write( const string& path )
+{
+  // LAYOUT
+  SceneHeader h ;
+  memset( &h, 0, sizeof( h ) ) ;
+  h.magic = SCENE_MAGIC ;
+  h.version = SCENE_VERSION ;
+  h.headerBytes = sizeof( SceneHeader ) ;
+  h.streamInfoBytes = sizeof( SceneStreamInfo ) ;
+  h.numStreams = (uint32_t)pending.size() ;
+  h.userTag = userTag ;
+  for( Pending& p : pending ) {
+    p.info.firstBlock = h.numBlocks ;
+    p.info.numBlocks = (uint32_t)( ( p.info.bytes + SCENE_BLOCK_BYTES - 1 ) / SCENE_BLOCK_BYTES ) ;
+    h.numBlocks += p.info.numBlocks ;
+  }
+  uint64_t offset = sizeof( SceneHeader ) + h.numStreams * sizeof( SceneStreamInfo ) + h.numBlocks * sizeof( uint64_t ) ;
+  for( Pending& p : pending ) {
+    p.info.offset = alignUp( offset, SCENE_ALIGN ) ;
+    offset = p.info.offset + p.info.bytes ;
+  }
+  h.fileBytes = offset ;
+  
+  // CHECKSUMS, every block of every stream, in parallel
+  vector<char> table( h.numStreams * sizeof( SceneStreamInfo ) + h.numBlocks * sizeof( uint64_t ) ) ;
+  SceneStreamInfo *infos = (SceneStreamInfo*)&table[0] ;
+  uint64_t *sums = (uint64_t*)( &table[0] + h.numStreams * sizeof( SceneStreamInfo ) ) ;
+  vector<const char*> blockData( h.numBlocks ) ;
+  vector<size_t> blockBytes( h.numBlocks ) ;
+  for( uint32_t i = 0 ; i < h.numStreams ; i++ ) {
+    infos[i] = pending[i].info ;
+    for( uint32_t b = 0 ; b < infos[i].numBlocks ; b++ ) {
+      uint64_t start = (uint64_t)b * SCENE_BLOCK_BYTES ;
+      blockData[ infos[i].firstBlock + b ] = (const char*)pending[i].data + start ;
+      blockBytes[ infos[i].firstBlock + b ] = (size_t)min( (uint64_t)SCENE_BLOCK_BYTES, infos[i].bytes - start ) ;
+    }
+  }
+  forEachChunk( "checksum scene", (int)h.numBlocks, 1, [&]( int start, int end ) {
+    for( int b = start ; b < end ; b++ )
+      sums[b] = sceneChecksum( blockData[b], blockBytes[b] ) ;
+  } ) ;
+  
+  // The header checksum covers the table, which follows the header in the file.
+  vector<char> front( sizeof( SceneHeader ) + table.size() ) ;
+  memcpy( &front[0] + sizeof( SceneHeader ), &table[0], table.size() ) ;
+  memcpy( &front[0], &h, sizeof( h ) ) ;
+  h.headerChecksum = headerChecksumOf( &front[0], &h ) ;
+  memcpy( &front[0], &h, sizeof( h ) ) ;
+  
+  // WRITE
+  string tmpPath = path + ".tmp" ;
+  FILE *f = fopen( tmpPath.c_str(), "wb" ) ;
+  if( !f ) {
+    printf( "ERROR: SceneWriter: couldn't write %s\n", tmpPath.c_str() ) ;
+    return false ;
+  }
+  bool ok = fwrite( &front[0], 1, front.size(), f ) == front.size() ;
+  uint64_t at = front.size() ;
+  static const char zeros[ SCENE_ALIGN ] = { 0 } ;
+  for( uint32_t i = 0 ; ok && i < h.numStreams ; i++ ) {
+    uint64_t pad = infos[i].offset - at ;
+    ok = fwrite( zeros, 1, (size_t)pad, f ) == pad &&
+         fwrite( pending[i].data, 1, (size_t)infos[i].bytes, f ) == infos[i].bytes ;
+    at = infos[i].offset + infos[i].bytes ;
+  }
+  ok = fclose( f ) == 0 && ok ;
+  if( !ok || rename( tmpPath.c_str(), path.c_str() ) ) {
+    printf( "ERROR: SceneWriter: writing %s failed\n", path.c_str() ) ;
+    unlink( tmpPath.c_str() ) ;
+    return false ;
+  }
+  return true ;
+}
+
+// TEST & BENCHMARK //
+
+static double secondsSince( const chrono::steady_clock::time_point& start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+static void flipByte( const string& path, uint64_t offset )
+{
+  int fd = ::open( path.c_str(), O_RDWR ) ;
+  unsigned char c ;
+  pread( fd, &c, 1, offset ) ;
+  c ^= 0x10 ;
+  pwrite( fd, &c, 1, offset ) ;
+  ::close( fd ) ;
+}
+
+// Rewrites stream `i`'s offset, and the header checksum to go with it, so
+// only the bounds checks can catch it.
+static void setStreamOffset( const string& path, int i, uint64_t offset )
+{
+  int fd = ::open( path.c_str(), O_RDWR ) ;
+  SceneHeader h ;
+  pread( fd, &h, sizeof( h ), 0 ) ;
+  vector<char> front( sizeof( SceneHeader ) + h.numStreams*sizeof( SceneStreamInfo ) + h.numBlocks*sizeof( uint64_t ) ) ;
+  pread( fd, &front[0], front.size(), 0 ) ;
+  SceneStreamInfo *streams = (SceneStreamInfo*)( &front[0] + sizeof( SceneHeader ) ) ;
+  streams[i].offset = offset ;
+  h.headerChecksum = headerChecksumOf( &front[0], &h ) ;
+  memcpy( &front[0], &h, sizeof( h ) ) ;
+  pwrite( fd, &front[0], front.size(), 0 ) ;
+  ::close( fd ) ;
+}
+
+int testSceneFile( int numVerts )
+{
+  const char *tmp = getenv( "TMPDIR" ) ;
+  string path = string( tmp ? tmp : "/tmp" ) + "/threaden_test.scene" ;
+  printf( "testSceneFile: %d verts, %s\n", numVerts, path.c_str() ) ;
+  int failures = 0 ;
+  
+  vector<VertexPC> pc( numVerts ) ;
+  vector<VertexPNC> pnc( numVerts ) ;
+  forEachChunk( "scene test data", numVerts, 65536, [&]( int start, int end ) {
+    for( int i = start ; i < end ; i++ ) {
+      Rng rng = jobRng( i ) ;
+      Vector3f n = Vector3f::random( rng, -1.f, 1.f ) ;
+      pc[i] = VertexPC( Vector3f::random( rng, -2.f, 2.f ), Vector4f::random( rng ) ) ;
+      pnc[i] = VertexPNC( pc[i].pos, n / max( n.len(), 1e-6f ), pc[i].color ) ;
+    }
+  } ) ;
+  float scale = positionScale( &pc[0], numVerts ) ;
+  vector<VertexQPC> qpc( numVerts ) ;
+  quantize( &pc[0], &qpc[0], numVerts, scale ) ;
+  
+  // WRITE
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  SceneWriter writer ;
+  writer.userTag = 0x1234 ;
+  writer.add( "lines", &pc[0], numVerts ) ;
+  writer.add( "tris", &pnc[0], numVerts ) ;
+  writer.add( "lines packed", &qpc[0], numVerts, scale ) ;
+  bool wrote = writer.write( path ) ;
+  double writeTime = secondsSince( start ) ;
+  failures += !wrote ;
+  
+  // OPEN (map + header) and VALIDATE (every page, in parallel)
+  SceneFile scene ;
+  start = chrono::steady_clock::now() ;
+  bool opened = scene.open( path ) ;
+  double openTime = secondsSince( start ) ;
+  if( !opened ) {
+    puts( "testSceneFile: FAIL (couldn't open what it wrote)" ) ;
+    return failures + 1 ;
+  }
+  double fileMB = scene.mapBytes / 1e6 ;
+  start = chrono::steady_clock::now() ;
+  int bad = scene.validate() ;
+  double validateTime = secondsSince( start ) ;
+  failures += bad != 0 ;
+  
+  // ZERO COPY use, and decode
+  int lines = scene.findStream( "lines" ), tris = scene.findStream( "tris" ), packed = scene.findStream( "lines packed" ) ;
+  bool layoutOk = scene.header->userTag == 0x1234 && scene.numStreams() == 3 && lines == 0 && tris == 1 && packed == 2 &&
+    scene.vertexPC( lines ) && !scene.vertexPNC( lines ) && scene.vertexPNC( tris ) && scene.vertexQPC( packed ) &&
+    !( (size_t)scene.vertexPC( lines ) % SCENE_ALIGN ) && scene.findStream( "nope" ) == -1 ;
+  failures += !layoutOk ;
+  bool sameLines = !memcmp( scene.vertexPC( lines ), &pc[0], numVerts*sizeof( VertexPC ) ) ;
+  bool sameTris = !memcmp( scene.vertexPNC( tris ), &pnc[0], numVerts*sizeof( VertexPNC ) ) ;
+  failures += !sameLines + !sameTris ;
+  
+  vector<VertexPC> decoded ;
+  start = chrono::steady_clock::now() ;
+  bool decodedOk = scene.decode( packed, decoded ) ;
+  double decodeTime = secondsSince( start ) ;
+  double maxError = 0 ;
+  for( int i = 0 ; decodedOk && i < numVerts ; i++ ) {
+    Vector3f d = decoded[i].pos - pc[i].pos ;
+    maxError = max( maxError, (double)max( fabsf( d.x ), max( fabsf( d.y ), fabsf( d.z ) ) ) ) ;
+  }
+  bool decodeOk = decodedOk && (int)decoded.size() == numVerts && maxError <= scale / SNORM16_MAX ;
+  failures += !decodeOk ;
+  vector<VertexPNC> wrongKind ;
+  failures += scene.decode( lines, wrongKind ) ; // PC isn't a PNC kind
+  
+  // What parsing would have to beat: copying the bytes once.
+  vector<char> copy( scene.mapBytes ) ;
+  start = chrono::steady_clock::now() ;
+  memcpy( &copy[0], scene.map, scene.mapBytes ) ;
+  double memcpyTime = secondsSince( start ) ;
+  
+  printf( "  file %.1f MB.  write %.1f ms (%.0f MB/s), open %.3f ms, validate %.1f ms (%.0f MB/s), memcpy %.1f ms (%.0f MB/s)\n",
+    fileMB, writeTime*1e3, fileMB/writeTime, openTime*1e3, validateTime*1e3, fileMB/validateTime, memcpyTime*1e3, fileMB/memcpyTime ) ;
+  printf( "  decode QPC -> VertexPC %.1f ms (%.1f Mverts/s), max error %.3g (a step is %.3g)\n",
+    decodeTime*1e3, numVerts/decodeTime/1e6, maxError, scale / SNORM16_MAX ) ;
+  printf( "  %-52s %s\n", "written, opened, all blocks valid", wrote && !bad ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "streams, kinds, alignment, tag", layoutOk ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "zero copy streams are the bytes written", sameLines && sameTris ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "quantized stream decodes within a step", decodeOk ? "ok" : "FAIL" ) ;
+  scene.close() ;
+  
+  // DAMAGE.  A flipped byte in the 2nd stream's 3rd block (or its last) is caught there and nowhere else.
+  SceneFile check ;
+  check.open( path ) ;
+  SceneStreamInfo s = check.info( tris ) ; // a copy, it outlives the map
+  uint32_t block = min( 2u, s.numBlocks - 1 ) ;
+  uint64_t blockStart = (uint64_t)block*SCENE_BLOCK_BYTES ;
+  uint64_t at = s.offset + blockStart + min( (uint64_t)123, s.bytes - blockStart - 1 ) ;
+  uint64_t tableAt = sizeof( SceneHeader ) + offsetof( SceneStreamInfo, count ) ;
+  check.close() ;
+  flipByte( path, at ) ;
+  bool caught = check.open( path ) && check.validate( lines ) == 0 && check.validate( tris ) == 1 ;
+  check.close() ;
+  flipByte( path, at ) ;
+  flipByte( path, tableAt ) ;
+  bool refused = !check.open( path ) ;
+  flipByte( path, tableAt ) ;
+  // An aligned offset so near 2^64 that offset + bytes wraps back inside
+  // the file.  (A stream under SCENE_ALIGN bytes can't wrap: nothing to try.)
+  bool wrapRefused = true ;
+  if( s.bytes >= SCENE_ALIGN ) {
+    setStreamOffset( path, tris, 0 - s.bytes / SCENE_ALIGN * SCENE_ALIGN ) ;
+    wrapRefused = !check.open( path ) ;
+  }
+  printf( "  %-52s %s\n", "flipped byte caught in its block", caught ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "damaged stream table refused", refused ? "ok" : "FAIL" ) ;
+  printf( "  %-52s %s\n", "stream offset that wraps past 2^64 refused", wrapRefused ? "ok" : "FAIL" ) ;
+  failures += !caught + !refused + !wrapRefused ;
+  unlink( path.c_str() ) ;
+  
+  printf( "testSceneFile: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
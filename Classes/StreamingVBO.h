@@ -0,0 +1,108 @@
+#ifndef STREAMINGVBO_H
+#define STREAMINGVBO_H
+
+#import <OpenGLES/ES1/gl.h>
+#import <OpenGLES/ES1/glext.h>
+
+#include <vector>
+using namespace std ;
+
+// drawPC hands GL client-side arrays (glVertexPointer( &verts[0] )), so at
+// every glDrawArrays the driver has to copy the whole array into memory the
+// GPU can read.  That copy is serial, on the main thread, inside the draw call.
+//
+// StreamingVBO is a RING of N buffer objects that the vertices are written
+// straight into.  Each frame begin() hands out the next buffer in the ring,
+// MAPPED, the (worker) jobs write their transformed vertices into it, end()
+// unmaps it and it gets drawn from.  No copy anywhere but the one the jobs do.
+//
+// Why a ring, and not one buffer?  The GPU draws frame N while the CPU
+// writes frame N+1.  If N+1 went into the same buffer the map would have to
+// wait for the GPU to finish with it (a STALL).  So there are 3 ways to write:
+//
+//   StreamOrphan         glBufferData( NULL ) then glMapBufferOES.  "Orphaning":
+//                        the driver hands you fresh storage and frees the old
+//                        one when the GPU's done with it.  Needs GL_OES_mapbuffer.
+//   StreamUnsynchronized glMapBufferRangeEXT( UNSYNCHRONIZED ).  No driver
+//                        sync at all, so WE make sure the GPU's done: a fence
+//                        (GL_APPLE_sync) after the draw from each buffer, waited
+//                        on when the ring comes back round to it.  With 3
+//                        buffers that wait is almost always already over.
+//   StreamSubData        No map extension: the jobs write into a CPU copy and
+//                        end() glBufferSubData's it.  Still one copy, not one per draw.
+//
+// create() falls back down that list to what the context has.  All the GL
+// calls (create, begin, end, fence) are main thread only; only the WRITING
+// between begin() and end() is for the workers.
+
+#define STREAMVBO_MAX_RING 4
+
+enum StreamMode
+{
+  StreamOrphan,
+  StreamUnsynchronized,
+  StreamSubData
+} ;
+
+struct StreamingVBO
+{
+  GLuint buffers[ STREAMVBO_MAX_RING ] ;
+  GLsync fences[ STREAMVBO_MAX_RING ] ; // only used by StreamUnsynchronized
+  int ringSize, current ;
+  int capacity ; // bytes in each buffer
+  StreamMode mode ;
+  void *mapped ;   // between begin() and end()
+  vector<char> staging ; // StreamSubData writes here
+  int bytesWritten ;
+
+  // Stats
+  int frames, fenceWaits ; // times the fence wasn't done yet when we came round to it
+  double fenceWaitTime ;   // seconds spent waiting on those
+
+private:
+  // Copying forbidden: two objects would delete the same GL buffers.
+  StreamingVBO( const StreamingVBO& o ) {
+    puts( "ERROR: Copying StreamingVBO should not be done!" ) ;
+  }
+
+public:
+  StreamingVBO() : ringSize( 0 ), current( 0 ), capacity( 0 ), mode( StreamOrphan ), mapped( 0 ),
+    bytesWritten( 0 ), frames( 0 ), fenceWaits( 0 ), fenceWaitTime( 0 )
+  {
+    for( int i = 0 ; i < STREAMVBO_MAX_RING ; i++ )
+      buffers[i] = 0, fences[i] = 0 ;
+  }
+
+  // The GL objects have to go while the context's current, so no destructor, call destroy().
+
+  // Makes the ring, `bytes` each.  Uses `preferred` if the context has the
+  // extension for it, else the next one down.  Returns the mode it got.
+  StreamMode create( int bytes, int iRingSize, StreamMode preferred ) ;
+  void destroy() ;
+
+  // The next buffer in the ring, ready for `bytes` of writing (it grows if it has to).
+  // Returns 0 if it couldn't be mapped.
+  void* begin( int bytes ) ;
+
+  // Done writing (all the jobs have finished): unmaps it and returns it, to draw from.
+  // Nothing is left bound to GL_ARRAY_BUFFER (client array draws would break).
+  GLuint end() ;
+
+  // After the last draw from this frame's buffer.
+  void fence() ;
+
+  inline bool isCreated() const { return ringSize > 0 ; }
+  inline GLuint buffer() const { return buffers[ current ] ; }
+
+  static const char* modeName( StreamMode m ) ;
+} ;
+
+// Needs a current GL context (on Linux an EGL pbuffer over Mesa llvmpipe will do).
+// For each mode (and plain client arrays, to compare), fills `numVerts`
+// VertexPCs per frame from the pool straight into the buffer and draws them.
+// Every frame's buffer starts with a full screen quad of a different color,
+// and the pixel is read back, so a frame that drew a stale buffer is caught.
+// Prints ms/frame and the fence waits.  Returns # failures.
+int testStreamingVBO( int numVerts, int numFrames ) ;
+
+#endif
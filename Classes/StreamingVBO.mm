@@ -0,0 +1,267 @@
+#import "StreamingVBO.h"
+#import "ThreadPool.h"
+#import "Vectorf.h"
+
+#include <string.h>
+#include <chrono>
+
+static bool hasExtension( const char* name )
+{
+  const char* extensions = (const char*)glGetString( GL_EXTENSIONS ) ;
+  return extensions && strstr( extensions, name ) ;
+}
+
+const char* StreamingVBO::modeName( StreamMode m )
+{
+  switch( m )
+  {
+  case StreamOrphan:  return "orphan + map" ;
+  case StreamUnsynchronized:  return "unsynchronized map + fences" ;
+  case StreamSubData:  return "glBufferSubData" ;
+  default:  return "?" ;
+  }
+}
+
+StreamMode StreamingVBO::create( int bytes, int iRingSize, StreamMode preferred )
+{
+  if( ringSize )  destroy() ;
+
+  bool canMap = hasExtension( "GL_OES_mapbuffer" ) ;
+  mode = preferred ;
+  if( mode == StreamUnsynchronized && !( canMap && hasExtension( "GL_EXT_map_buffer_range" ) && hasExtension( "GL_APPLE_sync" ) ) )
+    mode = StreamOrphan ;
+  if( mode == StreamOrphan && !canMap )
+    mode = StreamSubData ;
+
+  ringSize = max( 1, min( iRingSize, STREAMVBO_MAX_RING ) ) ;
+  current = 0 ;
+  capacity = bytes ;
+  glGenBuffers( ringSize, buffers ) ;
+  for( int i = 0 ; i < ringSize ; i++ ) {
+    glBindBuffer( GL_ARRAY_BUFFER, buffers[i] ) ;
+    glBufferData( GL_ARRAY_BUFFER, capacity, 0, GL_DYNAMIC_DRAW ) ;
+    fences[i] = 0 ;
+  }
+  glBindBuffer( GL_ARRAY_BUFFER, 0 ) ;
+
+  printf( "StreamingVBO: %d buffers of %d bytes, %s\n", ringSize, capacity, modeName( mode ) ) ;
+  return mode ;
+}
+
+void StreamingVBO::destroy()
+{
+  if( !ringSize )  return ;
+  if( mapped )  end() ;
+  for( int i = 0 ; i < ringSize ; i++ )
+    if( fences[i] ) {
+      glDeleteSyncAPPLE( fences[i] ) ;
+      fences[i] = 0 ;
+    }
+  glDeleteBuffers( ringSize, buffers ) ;
+  for( int i = 0 ; i < ringSize ; i++ )
+    buffers[i] = 0 ;
+  ringSize = 0 ;
+  staging.clear() ;
+}
+
+void* StreamingVBO::begin( int bytes )
+{
+  if( !ringSize ) {
+    puts( "ERROR: StreamingVBO::begin() before create()" ) ;
+    return 0 ;
+  }
+  if( mapped ) {
+    puts( "ERROR: StreamingVBO::begin() twice without an end()" ) ;
+    return mapped ;
+  }
+
+  current = ( current + 1 ) % ringSize ;
+  frames++ ;
+  bytesWritten = bytes ;
+
+  // Too small, they all grow.  New storage, so nothing to wait for.
+  if( bytes > capacity )
+  {
+    capacity = bytes ;
+    for( int i = 0 ; i < ringSize ; i++ ) {
+      glBindBuffer( GL_ARRAY_BUFFER, buffers[i] ) ;
+      glBufferData( GL_ARRAY_BUFFER, capacity, 0, GL_DYNAMIC_DRAW ) ;
+    }
+  }
+
+  glBindBuffer( GL_ARRAY_BUFFER, buffers[ current ] ) ;
+  switch( mode )
+  {
+  case StreamOrphan:
+    glBufferData( GL_ARRAY_BUFFER, capacity, 0, GL_DYNAMIC_DRAW ) ; // ORPHAN. The GPU keeps the old storage.
+    mapped = glMapBufferOES( GL_ARRAY_BUFFER, GL_WRITE_ONLY_OES ) ;
+    break ;
+
+  case StreamUnsynchronized:
+    // The GPU may still be drawing from this one (ringSize frames ago).
+    if( GLsync fence = fences[ current ] )
+    {
+      GLenum result = glClientWaitSyncAPPLE( fence, GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, 0 ) ; // just look
+      if( result == GL_TIMEOUT_EXPIRED_APPLE )
+      {
+        // It isn't.  This is the stall the ring is there to avoid, so count it.
+        chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+        result = glClientWaitSyncAPPLE( fence, GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, GL_TIMEOUT_IGNORED_APPLE ) ;
+        fenceWaitTime += chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+        fenceWaits++ ;
+      }
+      if( result == GL_WAIT_FAILED_APPLE )
+        puts( "ERROR: StreamingVBO: glClientWaitSyncAPPLE failed" ) ;
+      glDeleteSyncAPPLE( fence ) ;
+      fences[ current ] = 0 ;
+    }
+    mapped = glMapBufferRangeEXT( GL_ARRAY_BUFFER, 0, bytes,
+      GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_RANGE_BIT_EXT | GL_MAP_UNSYNCHRONIZED_BIT_EXT ) ;
+    break ;
+
+  case StreamSubData:
+    if( (int)staging.size() < bytes )  staging.resize( bytes ) ;
+    mapped = &staging[0] ;
+    break ;
+  }
+  glBindBuffer( GL_ARRAY_BUFFER, 0 ) ;
+
+  if( !mapped )
+    printf( "ERROR: StreamingVBO: couldn't map buffer %d (%s)\n", current, modeName( mode ) ) ;
+  return mapped ;
+}
+
+GLuint StreamingVBO::end()
+{
+  if( !mapped ) {
+    puts( "ERROR: StreamingVBO::end() without a begin()" ) ;
+    return 0 ;
+  }
+
+  glBindBuffer( GL_ARRAY_BUFFER, buffers[ current ] ) ;
+  if( mode == StreamSubData )
+    glBufferSubData( GL_ARRAY_BUFFER, 0, bytesWritten, &staging[0] ) ;
+  else if( !glUnmapBufferOES( GL_ARRAY_BUFFER ) )
+    puts( "WARNING: StreamingVBO: the buffer's contents were lost while mapped, this frame draws garbage" ) ;
+  glBindBuffer( GL_ARRAY_BUFFER, 0 ) ;
+
+  mapped = 0 ;
+  return buffers[ current ] ;
+}
+
+void StreamingVBO::fence()
+{
+  if( mode != StreamUnsynchronized )  return ; // the driver syncs the others itself
+  if( fences[ current ] )  glDeleteSyncAPPLE( fences[ current ] ) ;
+  fences[ current ] = glFenceSyncAPPLE( GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0 ) ;
+}
+
+// TEST & BENCHMARK //
+
+// Verts 0-5 are a full screen quad in this frame's color, the rest are
+// degenerate (they're there for the size of the upload).
+static void fillFrame( VertexPC* out, int start, int end, const Vector4f& color )
+{
+  static const float quad[6][2] = { {-1,-1}, {1,-1}, {1,1}, {-1,-1}, {1,1}, {-1,1} } ;
+  for( int i = start ; i < end ; i++ )
+    if( i < 6 )  out[i] = VertexPC( Vector3f( quad[i][0], quad[i][1], 0.f ), color ) ;
+    else  out[i] = VertexPC( Vector3f( 0.f, 0.f, 0.f ), color ) ;
+}
+
+static void drawTriangles( const VertexPC* verts, int count )
+{
+  VertexPC v ;
+  int colorOffset = (int)( (char*)&v.color - (char*)&v ) ;
+  glEnableClientState( GL_VERTEX_ARRAY ) ;
+  glEnableClientState( GL_COLOR_ARRAY ) ;
+  glVertexPointer( 3, GL_FLOAT, sizeof( VertexPC ), verts ) ;
+  glColorPointer( 4, GL_FLOAT, sizeof( VertexPC ), (const char*)verts + colorOffset ) ;
+  glDrawArrays( GL_TRIANGLES, 0, count ) ;
+  glDisableClientState( GL_VERTEX_ARRAY ) ;
+  glDisableClientState( GL_COLOR_ARRAY ) ;
+}
+
+// One frame.  mode -1 is client arrays, the way drawPC does it.  Returns false if the pixel's wrong.
+static bool runFrame( int mode, StreamingVBO& vbo, vector<VertexPC>& clientVerts, int numVerts, int frame, bool check )
+{
+  // red, green, blue, white.  4 colors over a ring of 3, so a buffer left over
+  // from a lap ago is never the right color.
+  int c = frame % 4 ;
+  Vector4f color( c == 0 || c == 3, c == 1 || c == 3, c == 2 || c == 3, 1.f ) ;
+  glClear( GL_COLOR_BUFFER_BIT ) ;
+
+  VertexPC *out = mode < 0 ? &clientVerts[0] : (VertexPC*)vbo.begin( numVerts*sizeof(VertexPC) ) ;
+  if( !out )  return false ;
+  forEachChunk( "fill stream", numVerts, max( 1024, numVerts/8 ), [out, &color]( int start, int end ) {
+    fillFrame( out, start, end, color ) ;
+  } ) ;
+
+  if( mode < 0 )
+    drawTriangles( out, numVerts ) ;
+  else
+  {
+    GLuint buffer = vbo.end() ;
+    glBindBuffer( GL_ARRAY_BUFFER, buffer ) ;
+    drawTriangles( 0, numVerts ) ; // pointers are offsets into the buffer now
+    glBindBuffer( GL_ARRAY_BUFFER, 0 ) ;
+    vbo.fence() ;
+  }
+
+  if( !check )  return true ;
+  GLint viewport[4] ;
+  glGetIntegerv( GL_VIEWPORT, viewport ) ;
+  GLubyte pixel[4] = { 0, 0, 0, 0 } ;
+  glReadPixels( viewport[0] + viewport[2]/2, viewport[1] + viewport[3]/2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel ) ;
+  bool ok = pixel[0] == ( color.x ? 255 : 0 ) && pixel[1] == ( color.y ? 255 : 0 ) && pixel[2] == ( color.z ? 255 : 0 ) ;
+  if( !ok )
+    printf( "  FAIL frame %d: pixel %d %d %d, wanted %d %d %d\n", frame, pixel[0], pixel[1], pixel[2],
+      (int)color.x*255, (int)color.y*255, (int)color.z*255 ) ;
+  return ok ;
+}
+
+int testStreamingVBO( int numVerts, int numFrames )
+{
+  numVerts = max( 6, numVerts - numVerts % 3 ) ;
+  glMatrixMode( GL_PROJECTION ) ;
+  glLoadIdentity() ;
+  glMatrixMode( GL_MODELVIEW ) ;
+  glLoadIdentity() ;
+
+  printf( "testStreamingVBO: %d verts (%d KB) a frame, %d frames\n", numVerts, numVerts*(int)sizeof(VertexPC)/1024, numFrames ) ;
+  printf( "  %s\n", glGetString( GL_RENDERER ) ) ;
+  int failures = 0 ;
+  vector<VertexPC> clientVerts( numVerts ) ;
+
+  for( int mode = -1 ; mode <= StreamSubData ; mode++ )
+  {
+    StreamingVBO vbo ;
+    if( mode >= 0 && vbo.create( numVerts*sizeof(VertexPC), 3, (StreamMode)mode ) != mode ) {
+      printf( "  %-28s not supported here, skipped\n", StreamingVBO::modeName( (StreamMode)mode ) ) ;
+      vbo.destroy() ;
+      continue ;
+    }
+
+    // CHECK, every frame read back.  Enough frames to go round the ring twice.
+    for( int frame = 0 ; frame < 8 ; frame++ )
+      failures += !runFrame( mode, vbo, clientVerts, numVerts, frame, true ) ;
+
+    // TIME, no read backs (they'd sync every frame), one glFinish at the end.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+    for( int frame = 0 ; frame < numFrames ; frame++ )
+      runFrame( mode, vbo, clientVerts, numVerts, frame, false ) ;
+    glFinish() ;
+    double time = chrono::duration<double>( chrono::steady_clock::now() - start ).count() / numFrames ;
+
+    GLenum error = glGetError() ;
+    if( error != GL_NO_ERROR ) {
+      printf( "  FAIL GL error 0x%x\n", error ) ;
+      failures++ ;
+    }
+    printf( "  %-28s %8.3f ms/frame, %d fence waits (%.3f ms)\n", mode < 0 ? "client arrays" : StreamingVBO::modeName( (StreamMode)mode ),
+      time*1e3, vbo.fenceWaits, vbo.fenceWaitTime*1e3 ) ;
+    vbo.destroy() ;
+  }
+
+  printf( "testStreamingVBO: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
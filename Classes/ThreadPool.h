@@ -32,6 +32,7 @@
 
 #import <OpenGLES/EAGL.h>
 #import "Callback.h"
+#import "PhaseTimer.h"
 
 #include <mach/mach_host.h> // for counting cores
 #include <pthread.h>
@@ -39,6 +40,8 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <algorithm>
+#include <atomic>
 using namespace std ;
 
 struct Lock
@@ -97,11 +100,59 @@ public:
 
 int getNumberOfCores() ;
 
+// A small number for the calling thread, any thread (pool, I/O, the main
+// thread), so per thread data can be an array indexed by it (see
+// ThreadSpecific.h).  Handed out on a thread's first call, and handed back
+// when it exits, so they stay below the most threads alive at once.  More
+// than MAX_THREAD_INDEX alive at once aborts.
+// A pthread key lookup: cheap enough to call per job.
+#define MAX_THREAD_INDEX 256
+int threadIndex() ;
+
+void seedThreadRng( int threadNum ) ; // Random.h
+
+// C++20 coroutines (Coroutine.h) are only there when built as C++20, which
+// the Xcode project (C++0x, iOS 6.1) isn't.
+#if __cplusplus >= 202002L && defined( __cpp_impl_coroutine )
+#define THREADEN_COROUTINES 1
+struct ScheduleAwaiter ;
+struct MainThreadAwaiter ;
+#else
+#define THREADEN_COROUTINES 0
+#endif
+
+// What a worker binds before it runs its first job: its own GL context.
+// The EAGL one is made by newEAGLThreadContext (ThreadPool.mm); anything
+// else (a test's mock) can stand in for it.
+struct ThreadContext
+{
+  virtual ~ThreadContext() {}
+  // Called on the worker itself, before it looks for jobs.
+  virtual bool makeCurrent() = 0 ;
+} ;
+
+// A context that shares the main context's resources.  GL objects made or
+// filled on it are visible to the main context once it REBINDS them (see the
+// rules in Thread), and the worker should glFlush() after writing them.
+ThreadContext* newEAGLThreadContext( EAGLContext* glContext ) ;
+
+// Kinds of worker a job can ask for (see ThreadPool::addJobForThreadClass)
+enum ThreadClass
+{
+  ThreadClassGL,  // has its own context (a ThreadContext)
+  NumThreadClasses
+} ;
+
 // This is where newly spawned threads LIVE.
 // could call this fishTank or whatever.  Its where threads
 // spin around.
 void* fishTank( void* execData ) ;
 
+// Files `thread` as the calling thread's Thread, for getMe().  The fishTank
+// does it for the workers, ThreadPool for the main thread.
+struct Thread ;
+void fileThread( Thread* thread ) ;
+
 // A THREAD:  Something that runs code.
 struct Thread
 {
@@ -134,6 +185,7 @@ struct Thread
   //    The contents of the object are undefined if a context references it before binding it.
   EAGLContext *glContext ;
   GLuint defaultFramebuffer, colorRenderbuffer ;
+  ThreadContext *context ; // what the fishTank makes current, 0 for a thread that doesn't do GL
   
   static int NextThreadId ;
   
@@ -146,17 +198,28 @@ struct Thread
   pthread_mutex_t suspendMutex ;
   pthread_cond_t resumeCondition ;
   
-  volatile bool suspended, exiting ;
+  volatile bool suspended ;
+  atomic<bool> exiting ; // set by stop(), read by the fishTank between jobs
+  // A job was posted for this thread (inbox or class) while it was awake, so
+  // its next sleep() returns right away and it looks again.
+  volatile bool jobPosted ;
+  
+  // Jobs for THIS thread only (ThreadPool::addJobForThread).  It checks here
+  // before anywhere else.
+  deque<Callback*> inbox ;
+  pthread_mutex_t mutexInbox ;
 
 private:
   void init()
   {
-    suspended=exiting=0;
+    suspended=exiting=jobPosted=0;
     num = NextThreadId++ ;
     char b[255];  sprintf( b, "thread %d", num ) ;
     name = b ;
     glContext = nil ;
+    context = 0 ;
     pthread_mutex_init( &suspendMutex, 0 ) ;
+    pthread_mutex_init( &mutexInbox, 0 ) ;
     pthread_cond_init( &resumeCondition, 0 ) ;
   }
   
@@ -215,6 +278,7 @@ public:
     
     // Make a glContext for this thread that shares resources with the mainContext.
     glContext = [[EAGLContext alloc] initWithAPI:[mainContext API] sharegroup:[mainContext sharegroup]];
+    context = newEAGLThreadContext( glContext ) ;
     defaultFramebuffer = iDefaultFramebuffer ;
     colorRenderbuffer = iColorRenderbuffer ;
     
@@ -222,16 +286,53 @@ public:
     pthread_create( &threadId, NULL, fishTank, this ) ;  
   }
   
+  // thread with its own context, any kind (the thread owns it)
+  Thread( ThreadContext* iContext )
+  {
+    init() ;
+    char b[255];  sprintf( b, "context thread %d", num ) ;
+    name = b ;
+    context = iContext ;
+    pthread_create( &threadId, NULL, fishTank, this ) ;
+  }
+  
   ~Thread()
   {
     //pthread_exit( threadId ) ; // you could use this.  But I'm letting the thread exit fishTank itself.
     // THIS ONLY GETS INVOKED WHEN THE THREAD IS EXITING ITS fishTank.
     
     printf( "Thread %d is being destroyed\n", num ) ;
+    if( inbox.size() ) {
+      printf( "WARNING: Thread %d being destroyed while it still has %d jobs in its inbox\n", num, (int)inbox.size() ) ;
+      for( Callback* job : inbox )
+        delete job ;
+    }
+    delete context ;
+    pthread_mutex_destroy( &mutexInbox ) ;
     pthread_mutex_destroy( &suspendMutex ) ;
     pthread_cond_destroy( &resumeCondition ) ;
   }
   
+  bool isInClass( ThreadClass threadClass ) const {
+    switch( threadClass ) {
+      case ThreadClassGL: return context != 0 ;
+      default: return false ;
+    }
+  }
+  
+  void post( Callback* job ) {
+    Lock inboxLock( &mutexInbox ) ;
+    inbox.push_back( job ) ;
+  }
+  
+  Callback* takeInboxJob() {
+    Lock inboxLock( &mutexInbox ) ;
+    if( !inbox.size() )  return 0 ;
+    Callback* job = inbox.front() ;
+    inbox.pop_front() ;
+    return job ;
+  }
+  
   bool isSleeping() {
     Lock suspendLock( &suspendMutex ) ;
     return suspended ;
@@ -250,6 +351,12 @@ public:
       pthread_mutex_unlock( &suspendMutex ) ;
       return ;
     }
+    if( jobPosted ) {
+      // Something came for me after I last looked.  Go look again.
+      jobPosted = 0 ;
+      pthread_mutex_unlock( &suspendMutex ) ;
+      return ;
+    }
     suspended = 1 ;
     
     // The below loop is because `pthread_cond_wait` is like a loose chain
@@ -278,6 +385,195 @@ public:
     pthread_cond_signal( &resumeCondition ) ;  // send the wakeup signal
     pthread_mutex_unlock( &suspendMutex ) ;
   }
+  
+  // There's a job for me: wake me if I'm asleep, or stop me going to sleep
+  // if I'm about to (unlike wakeup(), nothing gets lost in between).
+  void jobWaiting()
+  {
+    Lock suspendLock( &suspendMutex ) ;
+    if( suspended ) {
+      suspended = 0 ;
+      pthread_cond_signal( &resumeCondition ) ;
+    }
+    else
+      jobPosted = 1 ;
+  }
+  
+  // Leave the fishTank once the job it's on (if any) is done.  It deletes
+  // itself on the way out, so don't touch it after this.
+  void stop()
+  {
+    Lock suspendLock( &suspendMutex ) ;
+    exiting = 1 ;
+    if( suspended ) {
+      suspended = 0 ;
+      pthread_cond_signal( &resumeCondition ) ;
+    }
+    else
+      jobPosted = 1 ;
+  }
+} ;
+
+struct WorkOrder ;
+
+// CANCELLING a WorkOrder that's already started, when what it's computing
+// has gone stale (the scene changed, a newer request replaced it):
+//
+//   WorkOrder *wo = new WorkOrder( "pathfind" ) ;
+//   ... addJob()s ...
+//   CancelToken *token = wo->cancelToken() ;  // before startWorkOrder.  Yours to release().
+//   threadPool->startWorkOrder( wo ) ;
+//   ...
+//   token->cancel() ;   // any thread, any time
+//   token->release() ;
+//
+// You can't keep using `wo` itself once it's started (the pool deletes it
+// when its last job is taken), which is why the token is separate.
+//
+// cancel() DROPS every job nobody has taken yet, right there: they're deleted
+// without running (Callback::drop()).  A job that was taken but hadn't started
+// is skipped too.  Jobs already running carry on, unless they look: a long job
+// checks every so often
+//
+//   if( jobCancelled() )  return ;  // was the WorkOrder this job came from cancelled?
+//
+// Anything waiting on the WorkOrder is let go the same as if it had finished:
+// a sequencePoint returns once the running jobs are out, and whenDone() still
+// runs exactly once, on whichever thread finishes or drops the last job (that
+// can be the one calling cancel()).  Check token->isCancelled() in it.
+//
+// The token keeps count, for measuring what cancelling costs: latency() is
+// from cancel() to the last running job returning.
+struct CancelToken
+{
+private:
+  pthread_mutex_t mutex ;
+  int refs ;
+  WorkOrder* wo ;  // 0 once the pool's done with it
+  atomic<bool> cancelled ; // read without the lock, it's polled
+  int running ;    // jobs started and not finished
+  double cancelledAt, stoppedAt ;
+  
+  // Copying CancelTokens forbidden
+  CancelToken( const CancelToken& o ) {
+    puts( "ERROR: Copying CancelTokens should not be done!" ) ;
+  }
+  // release() deletes it
+  ~CancelToken() {
+    pthread_mutex_destroy( &mutex ) ;
+  }
+  
+public:
+  // Counts, final once hasStopped()
+  int jobsRan ;      // started (some will have returned early)
+  int jobsSkipped ;  // taken by a thread after cancel(), never started
+  int jobsDropped ;  // still queued at cancel(), thrown away
+  
+  // Starts with 1 reference, the WorkOrder's.  Use WorkOrder::cancelToken().
+  CancelToken( WorkOrder* iWo ) ;
+  
+  void retain() ;
+  void release() ;
+  
+  // Idempotent.  Any thread.
+  void cancel() ;
+  inline bool isCancelled() const { return cancelled.load( memory_order_relaxed ) ; }
+  
+  // Cancelled, and none of its jobs are running any more.
+  bool hasStopped() ;
+  // Seconds from cancel() to the last of its running jobs returning. -1 until hasStopped().
+  double latency() ;
+  
+  // The token of the WorkOrder the calling thread's job came from (0 if it has none).
+  static CancelToken* current() ;
+  
+  // Internal (the pool's side)
+  bool jobStarting() ;  // false: it's cancelled, skip the job
+  void jobFinished() ;
+  void detach() ;       // the WorkOrder is being deleted
+} ;
+
+// Should the job running on this thread give up?
+inline bool jobCancelled()
+{
+  CancelToken* token = CancelToken::current() ;
+  return token && token->isCancelled() ;
+}
+
+// Wraps each job of a WorkOrder that has a CancelToken: skips it if it's
+// already cancelled, and makes the token current() while it runs.
+struct CancellableJob : public Callback
+{
+  Callback* job ;
+  CancelToken* token ;
+  
+  CancellableJob( Callback* iJob, CancelToken* iToken ) : job( iJob ), token( iToken ) {
+    token->retain() ;
+  }
+  ~CancellableJob() {
+    delete job ;
+    token->release() ;
+  }
+  void exec() ;
+  void drop() { job->drop() ; }
+} ;
+
+// A job queued by a link in itself rather than in a WorkOrder, so queueing
+// it allocates nothing, and a whole chain of them is queued in O(1) (see
+// ThreadPool::addLinkedJobs).  It's kept: the pool doesn't delete it after it
+// runs, its owner (a JobGraph) queues it again next frame.
+struct LinkedJob : public Callback
+{
+  LinkedJob* nextLinked ;
+  // Set on the first job of each chain as it's queued: the last job of
+  // its chain, and how many WorkOrders were queued before it.
+  LinkedJob* chainLast ;
+  long long queuedAfter ;
+  
+  LinkedJob() : nextLinked( 0 ), chainLast( 0 ), queuedAfter( 0 ) {}
+  bool isKept() const { return true ; }
+} ;
+
+// Counts down the jobs of a WorkOrder that has a whenDone().  It has to live
+// on its own: the WorkOrder gets deleted as soon as its last job is TAKEN,
+// which is before that job has FINISHED.
+struct WorkOrderCompletion
+{
+  LockCounter jobsLeft ;
+  Callback* whenDone ;
+  
+  WorkOrderCompletion( int numJobs, Callback* iWhenDone ) : whenDone( iWhenDone ) {
+    jobsLeft.write( numJobs ) ;
+  }
+  
+  // The last one out runs whenDone, and cleans up.
+  void jobFinished() {
+    if( !--jobsLeft ) {
+      Callback* cb = whenDone ;
+      delete this ;
+      cb->exec() ;
+      delete cb ;
+    }
+  }
+} ;
+
+// Wraps each job of a WorkOrder that has a whenDone()
+struct CountedJob : public Callback
+{
+  Callback* job ;
+  WorkOrderCompletion* completion ;
+  
+  CountedJob( Callback* iJob, WorkOrderCompletion* iCompletion ) : job( iJob ), completion( iCompletion ) {}
+  ~CountedJob() { delete job ; }
+  void exec() {
+    job->exec() ;
+    completion->jobFinished() ;
+  }
+  // A dropped job is finished as far as whenDone is concerned.
+  void drop() {
+    job->drop() ;
+    completion->jobFinished() ;
+  }
 } ;
 
 // A WorkOrder consists of a bunch of jobs that can be run in //l.
@@ -289,7 +585,12 @@ struct WorkOrder //ParallelizableBatch // I hate that name
   // A flag that stops this WorkOrder from being deleted, even if it becomes EMPTY of jobs.
   bool stillAdding ;
   pthread_mutex_t mutexJob, mutexStillAdding ;
-  static int NextWorkOrderId ;
+  static atomic<int> NextWorkOrderId ; // WorkOrders get made on any thread (I/O threads post completions)
+  
+  // Runs once every job has FINISHED (see whenDone())
+  Callback* whenDoneCallback ;
+  // 0 unless someone asked for one (see cancelToken())
+  CancelToken* token ;
   
 private:
   // Copying WorkOrders forbidden
@@ -303,11 +604,19 @@ public:
     name=iname ;
     workOrderId = NextWorkOrderId++ ;
     stillAdding = 1 ;
+    whenDoneCallback = 0 ;
+    token = 0 ;
     //printf( "WorkOrder `%s`, id=%d created\n", name.c_str(), workOrderId ) ;
   }
   
   ~WorkOrder()
   {
+    // Before taking mutexJob: cancel() holds the token's lock while it takes mutexJob.
+    if( token ) {
+      token->detach() ;
+      token->release() ;
+    }
+    
     pthread_mutex_lock( &mutexJob ) ;
     
     if( jobs.size() )
@@ -319,6 +628,8 @@ public:
         delete *iter ;
     }
     
+    delete whenDoneCallback ; // only still here if it was never started
+    
     pthread_mutex_unlock( &mutexJob ) ;
     pthread_mutex_destroy( &mutexJob ) ;
   }
@@ -369,6 +680,46 @@ public:
     //threadPool->wakeAll() ; // TELL EVERYBODY A WORKORDER HAS BEEN ADDED!
   }
   
+  // "Do X when done", without daisy-chaining it into every job: `cb` runs
+  // once ALL the jobs have finished running, on the thread that finished the
+  // last one (right away in startWorkOrder if there were no jobs).
+  // Set it before startWorkOrder.
+  void whenDone( Callback* cb )
+  {
+    if( !isStillAdding() ) {
+      puts( "ERROR: whenDone() on a WorkOrder that already started. Not doing it." ) ;
+      delete cb ;
+      return ;
+    }
+    delete whenDoneCallback ;
+    whenDoneCallback = cb ;
+  }
+  
+  // The token to cancel this WorkOrder with, once it's started (see CancelToken).
+  // Ask before startWorkOrder.  The caller gets a reference: release() it when done.
+  CancelToken* cancelToken()
+  {
+    if( !token ) {
+      if( !isStillAdding() ) {
+        puts( "ERROR: cancelToken() on a WorkOrder that already started. It can't be cancelled." ) ;
+        return 0 ;
+      }
+      token = new CancelToken( this ) ;
+    }
+    token->retain() ;
+    return token ;
+  }
+  
+  // Drops the jobs that haven't started (see CancelToken).  Only while `this`
+  // is still yours: before startWorkOrder, or stillAdding.  After that, use
+  // the token.
+  void cancel()
+  {
+    if( !token )
+      token = new CancelToken( this ) ;
+    token->cancel() ;
+  }
+  
   // I tell you if this list is marked for still adding (undeletable) or not
   bool isStillAdding()
   {
@@ -380,15 +731,19 @@ public:
   // an entire workorder to be processed by one thread.
   // used mainly for jobs that must be run by ONLY the mainthread in a special queue,
   // OR can be used for functional decomposition style programming.
+  // The jobs are taken out first and run unlocked, so a job can add more
+  // (they run next time).
   void runAll()
   {
+    deque<Callback*> running ;
     pthread_mutex_lock( &mutexJob ) ;
-    for( Callback* job : jobs ) {
+    running.swap( jobs ) ;
+    pthread_mutex_unlock( &mutexJob ) ;
+    
+    for( Callback* job : running ) {
       job->exec() ;
-      delete job ;
+      retire( job ) ;
     }
-    jobs.clear() ;
-    pthread_mutex_unlock( &mutexJob ) ;
   }
   
   void print() const {
@@ -396,6 +751,84 @@ public:
   }
 } ;
 
+// TASK ARENAS.  Long background work (the loops in testBackgroundWork, a
+// level being generated) goes in the same queue as the frame's vertex
+// WorkOrder: it takes every worker, the frame's jobs wait behind it, and the
+// frame's sequence point waits for all of it.
+//
+// A TaskArena is a named partition of the pool with its own queue:
+//
+//   TaskArena *background = threadPool->createArena( "background", 2, 0 ) ;
+//   threadPool->startWorkOrder( wo, background ) ;
+//
+//  - MAX CONCURRENCY: never more than that many workers in its jobs at once.
+//  - RESERVED: that many workers are kept for it while it has jobs waiting.
+//    The other arenas leave them be, and give them back (as their jobs
+//    finish) when it gets work.
+//  - BORROWING: while an arena has nothing waiting, the workers reserved for
+//    it are anyone's, up to each arena's max concurrency.
+//  - THE FRAME: the pool's own queue (startWorkOrder, parallelFor) isn't an
+//    arena.  Workers look there first, and reserveForFrame() workers are
+//    never let into an arena job, so the frame always has them.
+//  - A sequence point doesn't wait for arena jobs: a worker in one doesn't
+//    count as swimming.  Use whenDone(), or waitForArenas(), to know when
+//    they're done.
+//  - NO WORKERS TO SPARE: when every worker is kept for the frame (a 1
+//    worker pool), the main thread runs one arena job at each sequence
+//    point, after the frame's jobs, so the arenas still move.
+//
+// A job is never cut short: a worker goes back to whoever it's owed to when
+// its job finishes, so keep background jobs to a few ms each.
+struct TaskArena
+{
+  string name ;
+  int maxConcurrency ;  // the most workers in its jobs at once
+  int reserved ;        // workers kept for it while it has jobs waiting
+
+  // All under the pool's mutexArenas
+  deque<WorkOrder*> workOrders ;
+  int active ;          // workers in its jobs now
+  int peakActive ;      // the most there have been
+  long long jobsRun ;
+  long long jobsBorrowing ; // started on a worker reserved for another arena (an idle one)
+
+  TaskArena( const string& iName, int iMaxConcurrency, int iReserved ) : name( iName ),
+    maxConcurrency( iMaxConcurrency ), reserved( iReserved ), active( 0 ), peakActive( 0 ),
+    jobsRun( 0 ), jobsBorrowing( 0 ) {}
+  
+  ~TaskArena() {
+    if( workOrders.size() )
+      printf( "WARNING: TaskArena `%s` deleted with %d WorkOrders still being added to\n", name.c_str(), (int)workOrders.size() ) ;
+    for( WorkOrder* wo : workOrders )
+      delete wo ;
+  }
+
+  // Has it a job to start?  Throws out the WorkOrders that are done with (like ThreadPool::getNextJob).
+  bool hasJobs() ;
+  Callback* takeJob() ;
+  // Workers it's owed: kept for it and not in its jobs, while it has jobs waiting.
+  int owed() { return hasJobs() ? max( 0, reserved - active ) : 0 ; }
+
+private:
+  // Copying TaskArenas forbidden
+  TaskArena( const TaskArena& o ) {
+    puts( "ERROR: Copying TaskArenas should not be done!" ) ;
+  }
+} ;
+
+// An arena's job as a worker runs it: out of the swimmers, so it doesn't
+// hold up a sequence point, and its slot is given back after.  The main
+// thread isn't a swimmer, so it only gives the slot back.
+struct ArenaJob : public Callback
+{
+  Callback* job ;
+  TaskArena* arena ;
+  bool onWorker ;
+
+  ArenaJob( Callback* iJob, TaskArena* iArena, bool iOnWorker ) : job( iJob ), arena( iArena ), onWorker( iOnWorker ) {}
+  void exec() ;
+} ;
+
 // Used for making app multithreaded when it starts non-multi-threaded
 @interface EmptyObject : NSObject
 - ( void )empty;
@@ -408,7 +841,9 @@ private:
   int nCores ;
   
   Thread* mainThread ;
-  vector<Thread*> threads ;
+  vector<Thread*> threads ; // under mutexThreads: workers come and go while the others run
+  atomic<int> workerCount ; // threads.size(), for reading without the lock
+  pthread_mutex_t mutexThreads ;
 
 public:
   LockCounter numThreadsSwimming ;  // # threads that are currently swimming (not sleeping) in the fishTank.
@@ -439,6 +874,26 @@ private:
   
   WorkOrder* workOrderForMainThread ;
   
+  // LinkedJobs waiting to run, a chain from linkedFirst to linkedLast.  Under
+  // mutexWorkOrders, like them.  Each chain waits for the WorkOrders queued
+  // before it to run out, like a WorkOrder would: the front chain runs to
+  // linkedChainLast, and goes once workOrdersDone reaches linkedAfter.
+  LinkedJob *linkedFirst, *linkedLast, *linkedChainLast ;
+  long long linkedAfter ;
+  long long workOrdersQueued, workOrdersDone ; // ever pushed on, popped off workOrders
+  
+  // Jobs for any thread of a ThreadClass, checked by those threads after their
+  // own inbox and before workOrders.
+  WorkOrder* workOrdersForThreadClass[ NumThreadClasses ] ;
+  
+  // The TaskArenas, and how many workers are in their jobs, under mutexArenas.
+  // Only looked at once the jobs above have run out.
+  vector<TaskArena*> arenas ;
+  pthread_mutex_t mutexArenas ;
+  int arenasActive ;
+  int frameReserved ; // workers never let into an arena job
+  int nextArena ;     // where the next look starts, so one arena doesn't always go first
+  
   // The current workOrder being processed.
   //WorkOrder* currentWorkOrder ;
 
@@ -458,14 +913,15 @@ public:
     //for( Thread* thread : threads )
     //  delete thread ;
 
-    for( Thread* thread : threads ) {
-      thread->exiting = 1 ;
-      thread->wakeup() ; // make sure its awake, so it can exit.
-    }
+    pthread_mutex_lock( &mutexThreads ) ;
+    for( Thread* thread : threads )
+      thread->stop() ; // make sure its awake, so it can exit.
+    pthread_mutex_unlock( &mutexThreads ) ;
     
     free( mainThread ) ;
 
     pthread_mutex_destroy( &mutexWorkOrders ) ;
+    pthread_mutex_destroy( &mutexThreads ) ;
   }
   
   inline int getNumCores() const { return nCores ; }
@@ -475,16 +931,26 @@ private:
   void init()
   {
     pthread_mutex_init( &mutexWorkOrders, 0 ) ;
+    linkedFirst = linkedLast = linkedChainLast = 0 ;
+    linkedAfter = workOrdersQueued = workOrdersDone = 0 ;
+    pthread_mutex_init( &mutexThreads, 0 ) ;
+    workerCount = 0 ;
+    pthread_mutex_init( &mutexArenas, 0 ) ;
+    arenasActive = nextArena = 0 ;
+    frameReserved = 1 ;
     
     // create nCores-1 threads
     nCores = getNumberOfCores() ;
     
     // Create the work order for the main thread
     workOrderForMainThread = new WorkOrder( "WorkOrders for Main Thread" ) ;
+    workOrdersForThreadClass[ ThreadClassGL ] = new WorkOrder( "WorkOrders for GL Threads" ) ;
     
     // I need to circumvent the def ctor, becausee I don't want an actual thread to be created,
     // one already exists.
     mainThread = new Thread( pthread_self() ) ;
+    fileThread( mainThread ) ;
+    seedThreadRng( mainThread->num ) ; // the workers seed theirs in the fishTank
     
     // IF THE APP IS NOT ALREADY CONSIDERED MULTITHREADED, IT'S EXTREMELY IMPORTANT YOU MAKE IT SO
     // SINCE WE'RE USING POSIX THREADS HERE
@@ -508,7 +974,7 @@ public:
   void createWorkerThreads( int numThreads ) {
     printf( "ThreadPool: Creating %d threads\n", numThreads ) ;
     for( int i = 0 ; i < numThreads ; i++ )
-      threads.push_back( new Thread() ) ; // These will sleep as soon as they boot as they will find no jobs to do
+      addWorker( new Thread() ) ; // These will sleep as soon as they boot as they will find no jobs to do
   }
   
   // You want to create worker threads with their own OpenGL context.
@@ -516,24 +982,41 @@ public:
     mainThread->glContext = glContext ;
     printf( "ThreadPool: Creating %d threads with their own OpenGL contexts\n", numThreads ) ;
     for( int i = 0 ; i < numThreads ; i++ )
-      threads.push_back( new Thread( glContext, iDefaultFramebuffer, iColorRenderbuffer ) ) ;
+      addWorker( new Thread( glContext, iDefaultFramebuffer, iColorRenderbuffer ) ) ;
+  }
+  
+  // Workers with any kind of context, `makeContext()` makes each one's (on
+  // this thread).  For tests, with a mock context.
+  void createWorkerThreads( int numThreads, const function<ThreadContext* ()>& makeContext ) {
+    printf( "ThreadPool: Creating %d threads with their own contexts\n", numThreads ) ;
+    for( int i = 0 ; i < numThreads ; i++ )
+      addWorker( new Thread( makeContext() ) ) ;
+  }
+  
+private:
+  void addWorker( Thread* thread ) {
+    Lock threadsLock( &mutexThreads ) ;
+    threads.push_back( thread ) ;
+    workerCount = (int)threads.size() ;
   }
 
-  // A thread asks to retrieve a pointer to itself
-  Thread* getMe() {
-    pthread_t selfId = pthread_self() ;
-    
-    // ru main?
-    if( mainThread->threadId == selfId )
-      return mainThread ;
-    
-    for( Thread* t : threads )
-      if( t->threadId == selfId )
-        return t ;
-        
-    puts( "ERROR: I couldn't find your Thread object." ) ;
-    return 0 ;
+public:
+  
+  // Stops the last `numThreads` workers created, and returns once they've
+  // left the fishTank.  Their inbox jobs are dropped with them.
+  void removeWorkerThreads( int numThreads ) ;
+  
+  inline int getNumWorkers() const { return workerCount ; }
+  // Good until removeWorkerThreads() takes it out.  0 past the end.
+  Thread* getWorker( int i ) {
+    Lock threadsLock( &mutexThreads ) ;
+    return i >= 0 && i < (int)threads.size() ? threads[ i ] : 0 ;
   }
+  Thread* getMainThread() { return mainThread ; }
+
+  // A thread asks to retrieve a pointer to itself.  Each Thread is
+  // filed under a pthread key as it starts, so this doesn't search.
+  Thread* getMe() ;
 
 #if 0
   // This adds a job to the "current workorder" in other words THE BACK DEQUE.
@@ -605,6 +1088,31 @@ public:
   // Add an entire workorder to the q, mark it as `finishedSubmission` and
   // wake up any sleeping threads, so that they can begin working on it.
   WorkOrder* startWorkOrder( WorkOrder* wo ) ;
+  
+  // TASK ARENAS (see TaskArena).  The pool keeps them until removeArena().
+  TaskArena* createArena( const string& name, int maxConcurrency, int reserved ) ;
+  // Waits until `arena` has nothing waiting or running, then deletes it.
+  // Main thread only, once nobody's adding to it.
+  void removeArena( TaskArena* arena ) ;
+  // startWorkOrder, but into `arena`'s queue.
+  WorkOrder* startWorkOrder( WorkOrder* wo, TaskArena* arena ) ;
+  // Workers no arena job is ever given, so the frame always has them (1 to
+  // start with).  With none left over, the main thread runs the arena jobs,
+  // one per sequence point.
+  void reserveForFrame( int numWorkers ) ;
+  // Nothing waiting and nothing running
+  bool isIdle( TaskArena* arena ) ;
+  // A sequencePoint for the arenas: returns once every arena is idle (and the
+  // pool's own queue is done).  Main thread only.
+  void waitForArenas() ;
+  // ArenaJob: a worker's done one of `arena`'s jobs.
+  void arenaJobFinished( TaskArena* arena ) ;
+  
+  // Queues the chain of jobs first -> nextLinked -> ... -> last (last's
+  // nextLinked is overwritten) in one go, and wakes the workers.  O(1) however
+  // long the chain is.  The jobs are kept: nobody deletes them.  They run
+  // after the WorkOrders already queued, before any queued after.
+  void addLinkedJobs( LinkedJob* first, LinkedJob* last ) ;
     
   //
   void printAll()
@@ -614,12 +1122,16 @@ public:
     for( const WorkOrder* wo : workOrders )
       wo->print() ;
     UNLOCKQUEUES ;
+    printArenas() ;
   }
   
+  void printArenas() ;
+  
   void wakeAll() {
     // This triggers wakeup of all threads that are sleeping workorders.
     // This gets run EVERY TIME a job gets added.
     //puts( "Waking all" ) ;
+    Lock threadsLock( &mutexThreads ) ;
     for( Thread* t : threads )
       if( t->isSleeping() )
         t->wakeup() ;
@@ -630,7 +1142,7 @@ public:
   // are done.
   bool hasJobs() {
     Lock woLock( &mutexWorkOrders ) ;
-    return workOrders.size() ;
+    return linkedFirst || workOrders.size() ;
   }
   
   // This gets called when there are NO JOBS LEFT.
@@ -650,6 +1162,20 @@ public:
   Callback* getNextJob() {
   
     LOCKQUEUES ;
+    // ORDER OF ADDITION MATTERS: the front chain once the WorkOrders ahead of it are gone.
+    if( linkedFirst && workOrdersDone >= linkedAfter ) {
+      LinkedJob* job = linkedFirst ;
+      linkedFirst = job->nextLinked ;
+      if( !linkedFirst )  linkedLast = linkedChainLast = 0 ;
+      else if( job == linkedChainLast ) {
+        // on to the next chain
+        linkedChainLast = linkedFirst->chainLast ;
+        linkedAfter = linkedFirst->queuedAfter ;
+      }
+      UNLOCKQUEUES ;
+      return job ;
+    }
+    
     if( !workOrders.size() ) {
       UNLOCKQUEUES ;
       
@@ -679,6 +1205,7 @@ public:
       // This can deadlock processing if its on stillAddingMode
       // but the person completely forgot to push in new jobs or call finishedSubmission.
       workOrders.pop_front() ; // pop the front list, because its empty
+      workOrdersDone++ ;
     }
     //else puts( "WorkOrder stillAdding, not deleting" ) ;
     UNLOCKQUEUES ; // RELEASE THE LOCK
@@ -692,13 +1219,42 @@ public:
     return workOrderForMainThread->addJob( job ) ;
   }
   
+  // AFFINITY.  A job that has to run on one particular thread, or on any
+  // thread of a kind, typically because it makes GL calls and needs a context:
+  //
+  //   threadPool->addJobForThreadClass( ThreadClassGL, new Callback0( [=](){
+  //     glBindTexture( GL_TEXTURE_2D, tex ) ;
+  //     glTexImage2D( ... ) ;   // the upload, off the main thread
+  //     glFlush() ;
+  //     threadPool->addJobForMainThread( new Callback0( [=](){ textureReady( tex ) ; } ) ) ;
+  //   } ) ) ;
+  //
+  // A worker looks in its own inbox first, then at the jobs for its classes,
+  // and only then at the shared workOrders, so these jump the queue.  They
+  // aren't in any WorkOrder: sequencePoint doesn't wait for them, and they
+  // don't wait for it.  Post them from any thread.
+  
+  // The main thread's jobs go through addJobForMainThread (they run in mainThreadRunJobs).
+  void addJobForThread( Thread* thread, Callback* job ) ;
+  // With no thread of that class (no GL workers), it goes to the main thread, which has the GL context.
+  void addJobForThreadClass( ThreadClass threadClass, Callback* job ) ;
+  
+  // What a worker runs next: its inbox, then its classes' jobs, then the
+  // shared queue, then an arena's, if it's let in (see TaskArena).
+  Callback* getNextJob( Thread* thread ) ;
+  // `mainThread`: only let in when no worker may be, see TaskArena.
+  Callback* getNextArenaJob( bool mainThread ) ;
+  // One arena job, if the workers can't take them.  At sequence points.
+  void mainThreadRunArenaJob() ;
+  
   // A thread wants to continually run jobs as if it were in the fishTank,
   // but it is not in the fishTank.
   void runJobs() {
+    PhaseTimer timer( PhaseRunJobs ) ;
     while( Callback* job = getNextJob() )
     {
       job->exec() ;
-      delete job ;
+      retire( job ) ;
     }
     
     // When there are no more jobs, you drop out of the loop.
@@ -717,6 +1273,7 @@ public:
       return ;// no need to block if there are no swimming fish
     }
     
+    PhaseTimer timer( PhaseWait ) ;
     if( doBusyWait )
       while( numThreadsSwimming.read() ) ;  // busy wait until all the workers go to sleep
       // (that's how we know all the jobs have been done. all the workers will be sleeping)
@@ -729,8 +1286,23 @@ public:
   {
     runJobs() ;
     mainThreadBlockUntilAllJobsFinished( doBusyWait ) ;
+    mainThreadRunArenaJob() ;
   }
   
+  // Splits [0,n) into ranges of `grain` and runs body( start, end ) on each,
+  // as one WorkOrder.  The main thread helps, and it returns when every range
+  // is done (it's a sequencePoint, so anything else queued finishes too).
+  // The ranges are the same whoever runs them.  Called off the main thread,
+  // the ranges just run right here in order.
+  void parallelFor( const string& name, int n, int grain, const function<void (int, int)>& body ) ;
+  
+  #if THREADEN_COROUTINES
+  // Awaitables, see Coroutine.h.  `co_await threadPool->schedule()` carries on
+  // on a worker, `co_await threadPool->toMainThread()` in the next mainThreadRunJobs().
+  ScheduleAwaiter schedule() ;
+  MainThreadAwaiter toMainThread() ;
+  #endif
+  
   void mainThreadRunJobs()
   {
     if( ![NSThread isMainThread] ) {
@@ -739,6 +1311,7 @@ public:
     }
     
     // here, you are the main thread
+    PhaseTimer timer( PhaseRunJobs ) ;
     workOrderForMainThread->runAll() ;
   }
   
@@ -746,10 +1319,46 @@ public:
 
 extern ThreadPool* threadPool ;
 
+// threadPool->parallelFor, but also fine before the pool exists (then the
+// ranges just run here, in order).
+inline void forEachChunk( const string& name, int n, int grain, const function<void (int, int)>& body )
+{
+  if( grain < 1 )  grain = 1 ;
+  if( threadPool )
+    threadPool->parallelFor( name, n, grain, body ) ;
+  else
+    for( int start = 0 ; start < n ; start += grain )
+      body( start, min( n, start + grain ) ) ;
+}
+
 
 
 void testBackgroundWork() ;
 
+// Cancels WorkOrders of long jobs partway through: checks every job is run,
+// skipped or dropped exactly once, whenDone runs once, sequencePoint returns,
+// and jobs that poll stop. Prints the cancel latency for a few polling
+// intervals (and for jobs that never poll). Main thread, pool up.
+// Returns # failures.
+int testCancellation() ;
+
+// Adds 2 workers with MOCK contexts to the pool, then posts jobs
+// to the GL class and to each worker, with a shared WorkOrder keeping
+// everyone busy.  Checks every GL job ran on a thread whose mock context
+// was current, every targeted job on its thread, and that they jumped the
+// shared queue.  Removes the 2 workers again.  Main thread, pool up.
+// Returns # failures.
+int testThreadAffinity() ;
+
+// Frame latency (parallelFor frames of 2ms) with no background work, with a
+// saturating background load in the pool's own queue, and with the same load
+// in a TaskArena: checks the frames don't wait behind the arena and it stays
+// within its max concurrency.  Then two arenas with reservations, checking
+// one borrows the other's idle workers and gives them back.  With fewer than
+// 2 workers, only checks the main thread gets an arena's jobs done at
+// sequence points.  Removes its arenas again.  Main thread.  Returns # failures.
+int testTaskArenas() ;
+
 
 
 #endif
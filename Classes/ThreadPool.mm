@@ -1,10 +1,14 @@
 #import "ThreadPool.h"
+#import "Random.h"
 #import "ES1Renderer.h"
 
+#include <unistd.h>
+#include <chrono>
+
 ThreadPool *threadPool = 0 ;
 
 int Thread::NextThreadId=1 ;
-int WorkOrder::NextWorkOrderId = 1 ;
+atomic<int> WorkOrder::NextWorkOrderId( 1 ) ;
 
 int getNumberOfCores()
 {
@@ -17,6 +21,69 @@ int getNumberOfCores()
   return hostInfo.max_cpus ;
 }
 
+// THREAD INDEXES //
+
+static pthread_key_t threadIndexKey ;
+static pthread_once_t threadIndexKeyOnce = PTHREAD_ONCE_INIT ;
+static pthread_mutex_t mutexThreadIndexes = PTHREAD_MUTEX_INITIALIZER ;
+static vector<int> freeThreadIndexes ;
+static int nextThreadIndex = 0 ;
+
+// The key holds index+1 (0 is "none yet").  Runs as a thread exits.
+static void freeThreadIndex( void* index )
+{
+  Lock lock( &mutexThreadIndexes ) ;
+  freeThreadIndexes.push_back( (int)(intptr_t)index - 1 ) ;
+}
+static void makeThreadIndexKey() { pthread_key_create( &threadIndexKey, freeThreadIndex ) ; }
+
+int threadIndex()
+{
+  pthread_once( &threadIndexKeyOnce, makeThreadIndexKey ) ;
+  if( void* mine = pthread_getspecific( threadIndexKey ) )
+    return (int)(intptr_t)mine - 1 ;
+  
+  int index ;
+  pthread_mutex_lock( &mutexThreadIndexes ) ;
+  if( freeThreadIndexes.size() ) {
+    index = freeThreadIndexes.back() ;
+    freeThreadIndexes.pop_back() ;
+  }
+  else
+    index = nextThreadIndex++ ;
+  pthread_mutex_unlock( &mutexThreadIndexes ) ;
+  
+  // Everything indexed by it is MAX_THREAD_INDEX long: going on would write past the end.
+  if( index >= MAX_THREAD_INDEX ) {
+    printf( "ERROR: threadIndex: more than %d threads alive at once. Raise MAX_THREAD_INDEX.\n", MAX_THREAD_INDEX ) ;
+    fflush( stdout ) ;
+    abort() ;
+  }
+  pthread_setspecific( threadIndexKey, (void*)(intptr_t)( index + 1 ) ) ;
+  return index ;
+}
+
+// The Thread object of each pool thread (getMe)
+static pthread_key_t threadKey ;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT ;
+static void makeThreadKey() { pthread_key_create( &threadKey, 0 ) ; }
+
+void fileThread( Thread* thread )
+{
+  pthread_once( &threadKeyOnce, makeThreadKey ) ;
+  pthread_setspecific( threadKey, thread ) ;
+  threadIndex() ; // take one now, rather than in the middle of the first job
+}
+
+Thread* ThreadPool::getMe()
+{
+  pthread_once( &threadKeyOnce, makeThreadKey ) ;
+  if( Thread* me = (Thread*)pthread_getspecific( threadKey ) )
+    return me ;
+  puts( "ERROR: I couldn't find your Thread object." ) ;
+  return 0 ;
+}
+
 // The fishTank is where threads spin round and round
 // when there's nothing to do, they sleep.
 //
@@ -29,32 +96,29 @@ void* fishTank( void* execData )
   Thread *thread = (Thread*)execData ;  // I pick up the thread object THAT SPAWNED this execution thread.
   // The Thread object is actually created on the main thread (in the beginning the main thread is the only one in existence to be
   // able to actually create the worker threads!)
+  fileThread( thread ) ;
   
   // Bind my context to me
-  if( thread->glContext != nil )
-  {
-    if( ![EAGLContext setCurrentContext:thread->glContext] )
-      puts( "ERROR: Worker thread could not setCurrentContext." ) ;
-      
-    //glBindFramebufferOES( GL_FRAMEBUFFER_OES, thread->defaultFramebuffer ) ;
-		//glBindRenderbufferOES( GL_RENDERBUFFER_OES, thread->colorRenderbuffer ) ;
-		//glFramebufferRenderbufferOES( GL_FRAMEBUFFER_OES, GL_COLOR_ATTACHMENT0_OES, GL_RENDERBUFFER_OES, thread->colorRenderbuffer ) ;
-    
-  }
+  if( thread->context && !thread->context->makeCurrent() )
+    puts( "ERROR: Worker thread could not make its context current." ) ;
+  
+  // Every fish gets its own random number generator, seeded by its number,
+  // so worker 2 gets the same stream every run (for the same randomSeed).
+  seedThreadRng( thread->num ) ;
   
   ++threadPool->numThreadsSwimming ; // a fish is born. fishes++.
   
   while( !thread->exiting ) {
 
     // Try and find a job.
-    Callback* job = threadPool->getNextJob() ; // THIS LINE MEANS THE SUPERGLOBAL threadPool MUST BE
+    Callback* job = threadPool->getNextJob( thread ) ; // THIS LINE MEANS THE SUPERGLOBAL threadPool MUST BE
     // CREATED ALREADY BEFORE YOU SPAWN A THREAD.
     
     // If you got a job, execute it then delete it.
     if( job ) {
       //printf( "Thread %d is executing a job\n", thread->num ) ;
       job->exec() ;
-      delete job ;
+      retire( job ) ;
     }
     else {
       // NOJOBS.
@@ -92,23 +156,513 @@ void* fishTank( void* execData )
   return 0 ;
 }
 
+struct EAGLThreadContext : public ThreadContext
+{
+  EAGLContext *glContext ;
+  EAGLThreadContext( EAGLContext* iGlContext ) : glContext( iGlContext ) {}
+  bool makeCurrent()
+  {
+    if( ![EAGLContext setCurrentContext:glContext] )
+      return false ;
+    //glBindFramebufferOES( GL_FRAMEBUFFER_OES, thread->defaultFramebuffer ) ;
+		//glBindRenderbufferOES( GL_RENDERBUFFER_OES, thread->colorRenderbuffer ) ;
+		//glFramebufferRenderbufferOES( GL_FRAMEBUFFER_OES, GL_COLOR_ATTACHMENT0_OES, GL_RENDERBUFFER_OES, thread->colorRenderbuffer ) ;
+    return true ;
+  }
+} ;
+
+ThreadContext* newEAGLThreadContext( EAGLContext* glContext )
+{
+  return new EAGLThreadContext( glContext ) ;
+}
+
 @implementation EmptyObject
 - ( void )empty{}
 @end
 
-// Add an entire workorder to the q
-WorkOrder* ThreadPool::startWorkOrder( WorkOrder* wo ) {
+// What startWorkOrder does to a WorkOrder before it's queued, wherever it's queued.
+static void prepareWorkOrder( WorkOrder* wo )
+{
   wo->finishedSubmission() ; // I mark it as finished submission now, because we're going to start working on it.
   // You can't add tasks once we start working on the order.
   
+  // Nobody can take its jobs yet (it isn't in the queue), so wrapping them is safe.
+  // The CancellableJob goes inside the CountedJob, so a skipped job still counts down.
+  if( CancelToken* token = wo->token )
+    for( Callback*& job : wo->jobs )
+      job = new CancellableJob( job, token ) ;
+  
+  if( Callback* cb = wo->whenDoneCallback )
+  {
+    wo->whenDoneCallback = 0 ;
+    if( !wo->jobs.size() ) {
+      cb->exec() ;
+      delete cb ;
+    }
+    else {
+      WorkOrderCompletion *completion = new WorkOrderCompletion( (int)wo->jobs.size(), cb ) ;
+      for( Callback*& job : wo->jobs )
+        job = new CountedJob( job, completion ) ;
+    }
+  }
+}
+
+// Add an entire workorder to the q
+WorkOrder* ThreadPool::startWorkOrder( WorkOrder* wo ) {
+  PhaseTimer timer( PhaseSubmit ) ;
+  prepareWorkOrder( wo ) ;
+  
   LOCKQUEUES ;
   workOrders.push_back( wo ) ;
+  workOrdersQueued++ ;
   UNLOCKQUEUES ;
   
   threadPool->wakeAll() ; // TELL EVERYBODY A WORKORDER HAS BEEN ADDED!
   return wo ;
 }
 
+void ThreadPool::addLinkedJobs( LinkedJob* first, LinkedJob* last )
+{
+  LOCKQUEUES ;
+  last->nextLinked = 0 ;
+  if( linkedLast ) {
+    linkedLast->nextLinked = first ;
+    first->chainLast = last ;
+    first->queuedAfter = workOrdersQueued ;
+  }
+  else {
+    linkedFirst = first ;
+    linkedChainLast = last ;
+    linkedAfter = workOrdersQueued ;
+  }
+  linkedLast = last ;
+  UNLOCKQUEUES ;
+  wakeAll() ;
+}
+
+void ThreadPool::removeWorkerThreads( int numThreads )
+{
+  vector<pthread_t> stopped ;
+  pthread_mutex_lock( &mutexThreads ) ;
+  numThreads = max( 0, min( numThreads, (int)threads.size() ) ) ;
+  printf( "ThreadPool: Removing %d threads\n", numThreads ) ;
+  for( int i = 0 ; i < numThreads ; i++ ) {
+    Thread *thread = threads.back() ;
+    threads.pop_back() ;
+    stopped.push_back( thread->threadId ) ;
+    thread->stop() ;
+  }
+  workerCount = (int)threads.size() ;
+  pthread_mutex_unlock( &mutexThreads ) ;
+  
+  for( pthread_t t : stopped )
+    pthread_join( t, 0 ) ;
+}
+
+void ThreadPool::addJobForThread( Thread* thread, Callback* job )
+{
+  if( thread == mainThread ) {
+    addJobForMainThread( job ) ;
+    return ;
+  }
+  thread->post( job ) ;
+  thread->jobWaiting() ;
+}
+
+void ThreadPool::addJobForThreadClass( ThreadClass threadClass, Callback* job )
+{
+  bool anyone = 0 ;
+  pthread_mutex_lock( &mutexThreads ) ;
+  for( Thread* t : threads )
+    anyone |= t->isInClass( threadClass ) ;
+  pthread_mutex_unlock( &mutexThreads ) ;
+  if( !anyone ) {
+    addJobForMainThread( job ) ;
+    return ;
+  }
+  workOrdersForThreadClass[ threadClass ]->addJob( job ) ;
+  // All of them: whichever gets there first takes it, the rest find nothing and sleep again.
+  Lock threadsLock( &mutexThreads ) ;
+  for( Thread* t : threads )
+    if( t->isInClass( threadClass ) )
+      t->jobWaiting() ;
+}
+
+Callback* ThreadPool::getNextJob( Thread* thread )
+{
+  if( Callback* job = thread->takeInboxJob() )
+    return job ;
+  for( int c = 0 ; c < NumThreadClasses ; c++ )
+    if( thread->isInClass( (ThreadClass)c ) )
+      if( Callback* job = workOrdersForThreadClass[ c ]->getNextJob() )
+        return job ;
+  if( Callback* job = getNextJob() )
+    return job ;
+  return getNextArenaJob( false ) ;
+}
+
+// TASKARENA //
+
+bool TaskArena::hasJobs()
+{
+  while( workOrders.size() )
+  {
+    WorkOrder *wo = workOrders.front() ;
+    pthread_mutex_lock( &wo->mutexJob ) ;
+    bool empty = !wo->jobs.size() ;
+    pthread_mutex_unlock( &wo->mutexJob ) ;
+    if( !empty )
+      return true ;
+    if( wo->isStillAdding() )
+      return false ;
+    delete wo ;
+    workOrders.pop_front() ;
+  }
+  return false ;
+}
+
+Callback* TaskArena::takeJob()
+{
+  while( hasJobs() )
+    if( Callback* job = workOrders.front()->getNextJob() )
+      return job ;
+  return 0 ;
+}
+
+void ArenaJob::exec()
+{
+  // Not the frame's: out of the swimmers while it runs, so a sequence point
+  // doesn't wait for it.  The last fish out wakes the main thread, as if it had gone to sleep.
+  if( onWorker && ! --threadPool->numThreadsSwimming )
+    threadPool->noJobs() ;
+  job->exec() ;
+  retire( job ) ;
+  if( onWorker )
+    ++threadPool->numThreadsSwimming ;
+  threadPool->arenaJobFinished( arena ) ;
+}
+
+TaskArena* ThreadPool::createArena( const string& name, int maxConcurrency, int reserved )
+{
+  if( maxConcurrency < 1 ) {
+    printf( "WARNING: TaskArena `%s` with max concurrency %d, making it 1\n", name.c_str(), maxConcurrency ) ;
+    maxConcurrency = 1 ;
+  }
+  reserved = max( 0, min( reserved, maxConcurrency ) ) ;
+  TaskArena *arena = new TaskArena( name, maxConcurrency, reserved ) ;
+  
+  Lock lock( &mutexArenas ) ;
+  arenas.push_back( arena ) ;
+  int totalReserved = 0 ;
+  for( TaskArena* a : arenas )
+    totalReserved += a->reserved ;
+  if( totalReserved > max( 0, workerCount - frameReserved ) )
+    printf( "WARNING: The arenas reserve %d workers, but only %d of the %d aren't kept for the frame\n",
+      totalReserved, max( 0, workerCount - frameReserved ), (int)workerCount ) ;
+  return arena ;
+}
+
+void ThreadPool::removeArena( TaskArena* arena )
+{
+  if( ![NSThread isMainThread] ) {
+    puts( "ERROR: removeArena() intended for use by main thread only. Not removing it." ) ;
+    return ;
+  }
+  for( ;; )
+  {
+    pthread_mutex_lock( &mutexArenas ) ;
+    vector<TaskArena*>::iterator it = find( arenas.begin(), arenas.end(), arena ) ;
+    if( it == arenas.end() ) {
+      pthread_mutex_unlock( &mutexArenas ) ;
+      puts( "ERROR: removeArena(): that's not one of this pool's arenas." ) ;
+      return ;
+    }
+    if( !arena->active && !arena->hasJobs() ) {
+      arenas.erase( it ) ;
+      nextArena = 0 ;
+      pthread_mutex_unlock( &mutexArenas ) ;
+      delete arena ;
+      return ;
+    }
+    pthread_mutex_unlock( &mutexArenas ) ;
+    mainThreadRunArenaJob() ; // in case no worker may
+    usleep( 500 ) ;
+  }
+}
+
+WorkOrder* ThreadPool::startWorkOrder( WorkOrder* wo, TaskArena* arena )
+{
+  if( !arena )
+    return startWorkOrder( wo ) ;
+  prepareWorkOrder( wo ) ;
+  
+  pthread_mutex_lock( &mutexArenas ) ;
+  arena->workOrders.push_back( wo ) ;
+  pthread_mutex_unlock( &mutexArenas ) ;
+  
+  pthread_mutex_lock( &mutexThreads ) ;
+  for( Thread* t : threads )
+    t->jobWaiting() ;
+  pthread_mutex_unlock( &mutexThreads ) ;
+  return wo ;
+}
+
+void ThreadPool::reserveForFrame( int numWorkers )
+{
+  Lock lock( &mutexArenas ) ;
+  frameReserved = max( 0, numWorkers ) ;
+}
+
+bool ThreadPool::isIdle( TaskArena* arena )
+{
+  Lock lock( &mutexArenas ) ;
+  return !arena->active && !arena->hasJobs() ;
+}
+
+void ThreadPool::waitForArenas()
+{
+  for( ;; )
+  {
+    sequencePoint( 0 ) ; // and one arena job, if no worker may
+    pthread_mutex_lock( &mutexArenas ) ;
+    bool busy = arenasActive > 0 ;
+    for( TaskArena* a : arenas )
+      busy |= a->hasJobs() ;
+    pthread_mutex_unlock( &mutexArenas ) ;
+    if( !busy )
+      return ;
+    usleep( 500 ) ;
+  }
+}
+
+// A worker may start an arena's job if:
+//  - the arenas together are using fewer workers than aren't kept for the frame
+//  - the arena's below its max concurrency
+//  - that still leaves every OTHER arena with jobs waiting the workers it's owed
+// An arena with nothing waiting is owed nothing: that's the borrowing.
+// The main thread is only let in when there are no slots at all, by itself.
+Callback* ThreadPool::getNextArenaJob( bool mainThread )
+{
+  Lock lock( &mutexArenas ) ;
+  int numArenas = (int)arenas.size() ;
+  if( !numArenas )
+    return 0 ;
+  int slots = max( 0, workerCount - frameReserved ) ;
+  if( mainThread ) {
+    if( slots || arenasActive )
+      return 0 ;
+    slots = 1 ;
+  }
+  if( arenasActive >= slots )
+    return 0 ;
+  
+  int owed = 0, kept = 0 ;
+  for( TaskArena* a : arenas ) {
+    owed += a->owed() ;
+    kept += max( 0, a->reserved - a->active ) ;
+  }
+  for( int i = 0 ; i < numArenas ; i++ )
+  {
+    TaskArena *arena = arenas[ ( nextArena + i ) % numArenas ] ;
+    if( arena->active >= arena->maxConcurrency )  continue ;
+    int mine = max( 0, arena->reserved - arena->active ) ;
+    if( arenasActive + 1 + ( owed - arena->owed() ) > slots )  continue ;
+    Callback *job = arena->takeJob() ;
+    if( !job )  continue ;
+    
+    // Past what it'd get if every other arena had work: it's using a worker kept for one that hasn't.
+    if( arenasActive + 1 + ( kept - mine ) > slots )
+      arena->jobsBorrowing++ ;
+    arena->active++ ;
+    arena->peakActive = max( arena->peakActive, arena->active ) ;
+    arena->jobsRun++ ;
+    arenasActive++ ;
+    nextArena = ( nextArena + i + 1 ) % numArenas ;
+    return new ArenaJob( job, arena, !mainThread ) ;
+  }
+  return 0 ;
+}
+
+void ThreadPool::arenaJobFinished( TaskArena* arena )
+{
+  pthread_mutex_lock( &mutexArenas ) ;
+  arena->active-- ;
+  arenasActive-- ;
+  bool waiting = 0 ;
+  for( TaskArena* a : arenas )
+    waiting |= a->hasJobs() ;
+  pthread_mutex_unlock( &mutexArenas ) ;
+  
+  // A slot's free, or a reservation's been paid back: whoever's asleep might be let in now.
+  if( waiting ) {
+    Lock threadsLock( &mutexThreads ) ;
+    for( Thread* t : threads )
+      t->jobWaiting() ;
+  }
+}
+
+void ThreadPool::mainThreadRunArenaJob()
+{
+  if( ![NSThread isMainThread] )
+    return ;
+  if( Callback* job = getNextArenaJob( true ) ) {
+    PhaseTimer timer( PhaseRunJobs ) ;
+    job->exec() ;
+    retire( job ) ;
+  }
+}
+
+void ThreadPool::printArenas()
+{
+  Lock lock( &mutexArenas ) ;
+  for( TaskArena* a : arenas )
+    printf( "  - TaskArena `%s`: %d of max %d running (%d reserved), peak %d, %lld jobs run, %lld on borrowed workers, %s\n",
+      a->name.c_str(), a->active, a->maxConcurrency, a->reserved, a->peakActive, a->jobsRun, a->jobsBorrowing,
+      a->hasJobs() ? "jobs waiting" : "nothing waiting" ) ;
+}
+
+// CANCELTOKEN //
+
+static double secondsNow()
+{
+  return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count() ;
+}
+
+// The token of the job each thread is running
+static pthread_key_t currentTokenKey ;
+static pthread_once_t currentTokenKeyOnce = PTHREAD_ONCE_INIT ;
+static void makeCurrentTokenKey() { pthread_key_create( &currentTokenKey, 0 ) ; }
+
+CancelToken::CancelToken( WorkOrder* iWo ) : refs( 1 ), wo( iWo ), cancelled( 0 ), running( 0 ),
+  cancelledAt( 0 ), stoppedAt( 0 ), jobsRan( 0 ), jobsSkipped( 0 ), jobsDropped( 0 )
+{
+  pthread_mutex_init( &mutex, 0 ) ;
+}
+
+void CancelToken::retain()
+{
+  Lock lock( &mutex ) ;
+  refs++ ;
+}
+
+void CancelToken::release()
+{
+  pthread_mutex_lock( &mutex ) ;
+  bool last = !--refs ;
+  pthread_mutex_unlock( &mutex ) ;
+  if( last )
+    delete this ;
+}
+
+void CancelToken::cancel()
+{
+  deque<Callback*> dropped ;
+  pthread_mutex_lock( &mutex ) ;
+  if( cancelled ) {
+    pthread_mutex_unlock( &mutex ) ;
+    return ;
+  }
+  cancelled = 1 ;
+  cancelledAt = secondsNow() ;
+  if( !running )
+    stoppedAt = cancelledAt ;
+  // `wo` can't be deleted under us: its destructor detach()es first, which needs our lock.
+  if( wo ) {
+    pthread_mutex_lock( &wo->mutexJob ) ;
+    dropped.swap( wo->jobs ) ;
+    pthread_mutex_unlock( &wo->mutexJob ) ;
+  }
+  jobsDropped = (int)dropped.size() ;
+  pthread_mutex_unlock( &mutex ) ;
+  
+  // Unlocked: dropping a job can run whenDone, and deleting one releases us.
+  for( Callback* job : dropped ) {
+    job->drop() ;
+    delete job ;
+  }
+}
+
+bool CancelToken::hasStopped()
+{
+  Lock lock( &mutex ) ;
+  return cancelled && !running ;
+}
+
+double CancelToken::latency()
+{
+  Lock lock( &mutex ) ;
+  return cancelled && !running ? stoppedAt - cancelledAt : -1.0 ;
+}
+
+CancelToken* CancelToken::current()
+{
+  pthread_once( &currentTokenKeyOnce, makeCurrentTokenKey ) ;
+  return (CancelToken*)pthread_getspecific( currentTokenKey ) ;
+}
+
+bool CancelToken::jobStarting()
+{
+  Lock lock( &mutex ) ;
+  if( cancelled ) {
+    jobsSkipped++ ;
+    return false ;
+  }
+  running++ ;
+  jobsRan++ ;
+  return true ;
+}
+
+void CancelToken::jobFinished()
+{
+  Lock lock( &mutex ) ;
+  if( !--running && cancelled )
+    stoppedAt = secondsNow() ;
+}
+
+void CancelToken::detach()
+{
+  Lock lock( &mutex ) ;
+  wo = 0 ;
+}
+
+void CancellableJob::exec()
+{
+  if( !token->jobStarting() ) {
+    job->drop() ;
+    return ;
+  }
+  // The main thread can run a job from inside another one's parallelFor, so put the outer one back after.
+  CancelToken* outer = CancelToken::current() ;
+  pthread_setspecific( currentTokenKey, token ) ;
+  job->exec() ;
+  pthread_setspecific( currentTokenKey, outer ) ;
+  token->jobFinished() ;
+}
+
+void ThreadPool::parallelFor( const string& name, int n, int grain, const function<void (int, int)>& body )
+{
+  if( grain < 1 )  grain = 1 ;
+  
+  // Only the main thread can block on a sequence point.
+  if( ![NSThread isMainThread] ) {
+    for( int start = 0 ; start < n ; start += grain )
+      body( start, min( n, start + grain ) ) ;
+    return ;
+  }
+  
+  {
+    PhaseTimer timer( PhaseSubmit ) ;
+    WorkOrder *wo = new WorkOrder( name ) ;
+    for( int start = 0 ; start < n ; start += grain )
+    {
+      int end = min( n, start + grain ) ;
+      wo->addJob( new Callback0( [&body, start, end](){ body( start, end ) ; } ) ) ;
+    }
+    startWorkOrder( wo ) ;
+  }
+  sequencePoint( 0 ) ; // body is only referenced, so it must not return before the jobs are done
+}
+
 
 
 
@@ -125,16 +679,19 @@ void testBackgroundWork()
   {
     aiWo->addJob( new Callback0( [](){ 
       // This is the code of the job.
+      // rand() has one global state, so the threads would be fighting over it.
+      Rng& rng = threadRng() ;
       long long sum = 0 ;
       for( int j = 0 ; j < 100000000L ; j++ )
-        sum += rand() ;
+        sum += rng.next() ;
       printf( "AI: The sum was %lld\n", sum ) ;
     } ) ) ;
     
     graphicsWo->addJob( new Callback0( [](){
+      Rng& rng = threadRng() ;
       long long sum = 0 ;
       for( int j = 0 ; j < 200000000L ; j++ )
-        sum += rand() ;
+        sum += rng.next() ;
       printf( "Graphics job: got %lld\n", sum ) ; // this makes no sense, its just code that runs.
     } ) ) ;
   }
@@ -151,9 +708,330 @@ void testBackgroundWork()
 
 
 
+// Spins for `seconds` (a stand in for real work), checking jobCancelled()
+// every `pollEvery` seconds (never if it's 0).  true if it did all of it.
+static bool busyWork( double seconds, double pollEvery )
+{
+  double start = secondsNow(), nextPoll = start + pollEvery ;
+  for( double t = start ; t - start < seconds ; t = secondsNow() )
+    if( pollEvery && t >= nextPoll ) {
+      if( jobCancelled() )
+        return false ;
+      nextPoll = t + pollEvery ;
+    }
+  return true ;
+}
+
+int testCancellation()
+{
+  int failures = 0 ;
+  puts( "testCancellation" ) ;
+  
+  // CANCEL PARTWAY: 50 jobs of 20ms on the pool, called off after ~10ms.
+  // Every job is accounted for once, and the waiters are let go.
+  const int numJobs = 50 ;
+  double pollings[] = { 1e-5, 1e-4, 1e-3, 0 } ;
+  for( double pollEvery : pollings )
+  {
+    WorkOrder *wo = new WorkOrder( "cancel me" ) ;
+    LockCounter finished, bailed, whenDoneRuns ;
+    for( int i = 0 ; i < numJobs ; i++ )
+      wo->addJob( new Callback0( [&finished, &bailed, pollEvery](){
+        if( busyWork( 0.02, pollEvery ) )  ++finished ;
+        else  ++bailed ;
+      } ) ) ;
+    CancelToken *token = wo->cancelToken() ;
+    wo->whenDone( new Callback0( [&whenDoneRuns, token](){
+      ++whenDoneRuns ;
+      if( !token->isCancelled() )  puts( "ERROR: whenDone ran on a WorkOrder that wasn't cancelled" ) ;
+    } ) ) ;
+    threadPool->startWorkOrder( wo ) ;
+    usleep( 10000 ) ;
+    token->cancel() ;
+    token->cancel() ; // twice is fine
+    threadPool->sequencePoint( 0 ) ; // returns: nothing left to wait for
+    
+    bool stopped = token->hasStopped() ;
+    bool accounted = token->jobsRan + token->jobsSkipped + token->jobsDropped == numJobs &&
+                     finished.read() + bailed.read() == token->jobsRan ;
+    bool dropped = token->jobsDropped > 0 ;
+    bool once = whenDoneRuns.read() == 1 ;
+    // Jobs that poll give up, ones that don't can't.
+    bool polled = pollEvery ? bailed.read() > 0 : !bailed.read() ;
+    printf( "  poll every %-6s  ran %3d (finished %3d, gave up %d), skipped %d, dropped %3d.  latency %6.3f ms  %s\n",
+      pollEvery ? ( pollEvery < 1e-4 ? "10us" : pollEvery < 1e-3 ? "100us" : "1ms" ) : "never",
+      token->jobsRan, finished.read(), bailed.read(), token->jobsSkipped, token->jobsDropped, token->latency()*1e3,
+      stopped && accounted && dropped && once && polled ? "ok" : "FAIL" ) ;
+    failures += !( stopped && accounted && dropped && once && polled ) ;
+    token->release() ;
+  }
+  
+  // CANCELLED BEFORE IT STARTS: nothing runs, whenDone runs right away.
+  {
+    WorkOrder *wo = new WorkOrder( "never mind" ) ;
+    LockCounter ran, whenDoneRuns ;
+    for( int i = 0 ; i < 10 ; i++ )
+      wo->addJob( new Callback0( [&ran](){ ++ran ; } ) ) ;
+    wo->whenDone( new Callback0( [&whenDoneRuns](){ ++whenDoneRuns ; } ) ) ;
+    wo->cancel() ;
+    threadPool->startWorkOrder( wo ) ;
+    threadPool->sequencePoint( 0 ) ;
+    bool ok = !ran.read() && whenDoneRuns.read() == 1 ;
+    printf( "  %-40s %s\n", "cancelled before startWorkOrder", ok ? "ok" : "FAIL" ) ;
+    failures += !ok ;
+  }
+  
+  // SUPERSEDED: a new request every ~3ms cancels the last.  Only the last one finishes.
+  {
+    const int numRequests = 10 ;
+    LockCounter finishedRequests ;
+    CancelToken *previous = 0 ;
+    double maxLatency = 0 ;
+    for( int r = 0 ; r < numRequests ; r++ )
+    {
+      WorkOrder *wo = new WorkOrder( "request" ) ;
+      for( int i = 0 ; i < 40 ; i++ )
+        wo->addJob( new Callback0( [](){ busyWork( 0.005, 1e-4 ) ; } ) ) ;
+      CancelToken *token = wo->cancelToken() ;
+      wo->whenDone( new Callback0( [&finishedRequests, token](){
+        if( !token->isCancelled() )  ++finishedRequests ;
+      } ) ) ;
+      if( previous )  previous->cancel() ;
+      threadPool->startWorkOrder( wo ) ;
+      if( previous ) {
+        while( !previous->hasStopped() )  usleep( 100 ) ;
+        maxLatency = max( maxLatency, previous->latency() ) ;
+        previous->release() ;
+      }
+      previous = token ;
+      if( r < numRequests - 1 )  usleep( 3000 ) ;
+    }
+    threadPool->sequencePoint( 0 ) ;
+    previous->release() ;
+    bool ok = finishedRequests.read() == 1 ;
+    printf( "  %-40s %s (worst latency %.3f ms)\n", "superseded requests stop, last finishes", ok ? "ok" : "FAIL", maxLatency*1e3 ) ;
+    failures += !ok ;
+  }
+  
+  printf( "testCancellation: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
+
+
+
+// The mock context current on each thread
+static pthread_key_t currentMockKey ;
+static pthread_once_t currentMockKeyOnce = PTHREAD_ONCE_INIT ;
+static void makeCurrentMockKey() { pthread_key_create( &currentMockKey, 0 ) ; }
 
+// Stands in for an EAGL context: remembers which thread made it current.
+struct MockContext : public ThreadContext
+{
+  pthread_t owner ;
+  
+  bool makeCurrent()
+  {
+    owner = pthread_self() ;
+    pthread_once( &currentMockKeyOnce, makeCurrentMockKey ) ;
+    pthread_setspecific( currentMockKey, this ) ;
+    return true ;
+  }
+  // The mock current on the calling thread (0 for threads without one)
+  static MockContext* onThisThread() {
+    pthread_once( &currentMockKeyOnce, makeCurrentMockKey ) ;
+    return (MockContext*)pthread_getspecific( currentMockKey ) ;
+  }
+} ;
 
+int testThreadAffinity()
+{
+  int failures = 0 ;
+  puts( "testThreadAffinity" ) ;
+  
+  threadPool->createWorkerThreads( 2, [](){ return new MockContext() ; } ) ;
+  usleep( 10000 ) ; // for them to make their contexts current
+  
+  // Keep every worker busy with a shared WorkOrder of 2ms jobs.
+  const int numShared = 100 ;
+  LockCounter sharedDone ;
+  WorkOrder *shared = new WorkOrder( "shared" ) ;
+  for( int i = 0 ; i < numShared ; i++ )
+    shared->addJob( new Callback0( [&sharedDone](){
+      usleep( 2000 ) ;
+      ++sharedDone ;
+    } ) ) ;
+  threadPool->startWorkOrder( shared ) ;
+  
+  // GL CLASS: "uploads" that must land on a worker that has a context
+  const int numUploads = 40 ;
+  LockCounter uploadsDone, uploadsOnContext ;
+  for( int i = 0 ; i < numUploads ; i++ )
+    threadPool->addJobForThreadClass( ThreadClassGL, new Callback0( [&uploadsDone, &uploadsOnContext](){
+      MockContext* mock = MockContext::onThisThread() ;
+      if( mock && pthread_equal( mock->owner, pthread_self() ) )  ++uploadsOnContext ;
+      ++uploadsDone ;
+    } ) ) ;
+  
+  // ONE THREAD: 5 jobs for each worker, each checks it's on its target
+  int numWorkers = threadPool->getNumWorkers() ;
+  LockCounter targetedDone, wrongThread ;
+  for( int w = 0 ; w < numWorkers ; w++ )
+    for( int i = 0 ; i < 5 ; i++ ) {
+      Thread* target = threadPool->getWorker( w ) ;
+      threadPool->addJobForThread( target, new Callback0( [&targetedDone, &wrongThread, target](){
+        if( !pthread_equal( target->threadId, pthread_self() ) )  ++wrongThread ;
+        ++targetedDone ;
+      } ) ) ;
+    }
+  
+  while( uploadsDone.read() < numUploads || targetedDone.read() < numWorkers*5 )
+    usleep( 100 ) ;
+  int sharedWhenDone = sharedDone.read() ;
+  threadPool->sequencePoint( 0 ) ;
+  
+  bool glOk = uploadsOnContext.read() == numUploads ;
+  bool targetedOk = !wrongThread.read() ;
+  // They ran while the shared jobs were still going, not after.
+  bool jumped = sharedWhenDone < numShared ;
+  printf( "  %d of %d uploads on a thread with its mock context current, %d targeted jobs (%d on the wrong thread)\n",
+    uploadsOnContext.read(), numUploads, numWorkers*5, wrongThread.read() ) ;
+  printf( "  all done with %d of %d shared jobs finished\n", sharedWhenDone, numShared ) ;
+  printf( "  %-44s %s\n", "GL jobs ran where their context is current", glOk ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "targeted jobs ran on their thread", targetedOk ? "ok" : "FAIL" ) ;
+  printf( "  %-44s %s\n", "inboxes come before the shared queue", jumped ? "ok" : "FAIL" ) ;
+  failures += !glOk + !targetedOk + !jumped ;
+  
+  // Leave the pool as it was.
+  threadPool->removeWorkerThreads( 2 ) ;
+  bool removed = threadPool->getNumWorkers() == numWorkers - 2 ;
+  printf( "  %-44s %s\n", "the mock workers are gone again", removed ? "ok" : "FAIL" ) ;
+  failures += !removed ;
+  
+  printf( "testThreadAffinity: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
 
+// A frame: a parallelFor of 8 jobs that make up `seconds` in all.  Returns how long it took.
+static double timeFrame( double seconds )
+{
+  double start = secondsNow() ;
+  threadPool->parallelFor( "frame", 8, 1, [seconds]( int s, int e ) { busyWork( seconds/8, 0 ) ; } ) ;
+  return secondsNow() - start ;
+}
 
+// `numJobs` of `seconds` each, counted in `done`
+static WorkOrder* backgroundLoad( int numJobs, double seconds, LockCounter* done )
+{
+  WorkOrder *wo = new WorkOrder( "background" ) ;
+  for( int i = 0 ; i < numJobs ; i++ )
+    wo->addJob( new Callback0( [seconds, done](){
+      busyWork( seconds, 0 ) ;
+      ++*done ;
+    } ) ) ;
+  return wo ;
+}
 
+static bool waitUntilIdle( TaskArena* arena )
+{
+  for( double start = secondsNow() ; secondsNow() - start < 10.0 ; usleep( 1000 ) )
+    if( threadPool->isIdle( arena ) )
+      return true ;
+  return false ;
+}
 
+int testTaskArenas()
+{
+  int failures = 0 ;
+  puts( "testTaskArenas" ) ;
+  int numWorkers = threadPool->getNumWorkers() ;
+  if( numWorkers < 2 ) {
+    // Every worker is kept for the frame: the arena's jobs only get run by
+    // the main thread, one per sequence point.
+    puts( "  fewer than 2 workers: only the main thread's share" ) ;
+    TaskArena *arena = threadPool->createArena( "test main thread", 1, 0 ) ;
+    LockCounter done ;
+    const int numJobs = 10 ;
+    threadPool->startWorkOrder( backgroundLoad( numJobs, 0.001, &done ), arena ) ;
+    int points = 0 ;
+    for( ; points < numJobs*2 && !threadPool->isIdle( arena ) ; points++ )
+      threadPool->sequencePoint( 0 ) ;
+    bool ok = done.read() == numJobs ;
+    printf( "  %d of %d arena jobs done in %d sequence points\n", done.read(), numJobs, points ) ;
+    printf( "  %-52s %s\n", "the main thread runs arena jobs at sequence points", ok ? "ok" : "FAIL" ) ;
+    failures += !ok ;
+    threadPool->removeArena( arena ) ;
+    printf( "testTaskArenas: %s\n", failures ? "FAIL" : "PASS" ) ;
+    return failures ;
+  }
+  
+  // FRAME LATENCY: frames of 2ms of jobs, alone, then with a saturating
+  // background load (100ms per worker, in 5ms jobs) in the pool's own
+  // queue, then with the same load in an arena of all but one worker.
+  const int numFrames = 30, numBackground = numWorkers*20 ;
+  const double frameWork = 0.002, backgroundJob = 0.005 ;
+  double worst[ 3 ] = { 0, 0, 0 }, total[ 3 ] = { 0, 0, 0 } ;
+  LockCounter sharedDone, arenaDone ;
+  int arenaDoneAfterFrames = 0 ;
+  TaskArena *background = threadPool->createArena( "test background", numWorkers - 1, 0 ) ;
+  for( int run = 0 ; run < 3 ; run++ )
+  {
+    if( run == 1 )
+      threadPool->startWorkOrder( backgroundLoad( numBackground, backgroundJob, &sharedDone ) ) ;
+    else if( run == 2 )
+      threadPool->startWorkOrder( backgroundLoad( numBackground, backgroundJob, &arenaDone ), background ) ;
+    for( int f = 0 ; f < numFrames ; f++ ) {
+      double t = timeFrame( frameWork ) ;
+      worst[ run ] = max( worst[ run ], t ) ;
+      total[ run ] += t ;
+    }
+    if( run == 2 )
+      arenaDoneAfterFrames = arenaDone.read() ;
+  }
+  bool drained = waitUntilIdle( background ) && arenaDone.read() == numBackground && sharedDone.read() == numBackground ;
+  
+  const char* runNames[] = { "no background", "background in the pool's queue", "background in an arena" } ;
+  puts( "  frame ms                            average    worst" ) ;
+  for( int run = 0 ; run < 3 ; run++ )
+    printf( "  %-34s %8.2f %8.2f\n", runNames[ run ], total[ run ]/numFrames*1e3, worst[ run ]*1e3 ) ;
+  printf( "  %d of %d arena jobs done when the frames were\n", arenaDoneAfterFrames, numBackground ) ;
+  
+  bool ok = drained ;
+  printf( "  %-52s %s\n", "every background job ran", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  ok = background->peakActive <= numWorkers - 1 ;
+  printf( "  %-52s %s\n", "the arena never went over its max concurrency", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  // The frames didn't wait for the arena (it was still going), and came out
+  // far ahead of the ones queued behind the same load.
+  ok = arenaDoneAfterFrames < numBackground && worst[ 2 ] < worst[ 1 ]/2 ;
+  printf( "  %-52s %s\n", "frames don't wait behind an arena's jobs", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  
+  // BORROWING: every worker open to the arenas.  The lender has all but one
+  // reserved, the borrower one.  The borrower alone takes them all; once the
+  // lender has work, it gets its reservation back as the borrower's jobs finish.
+  threadPool->reserveForFrame( 0 ) ;
+  TaskArena *borrower = threadPool->createArena( "test borrower", numWorkers, 1 ) ;
+  TaskArena *lender = threadPool->createArena( "test lender", numWorkers, numWorkers - 1 ) ;
+  LockCounter borrowerDone, lenderDone ;
+  threadPool->startWorkOrder( backgroundLoad( numWorkers*6, 0.003, &borrowerDone ), borrower ) ;
+  usleep( 10000 ) ;
+  threadPool->startWorkOrder( backgroundLoad( numWorkers*4, 0.003, &lenderDone ), lender ) ;
+  drained = waitUntilIdle( borrower ) && waitUntilIdle( lender ) ;
+  threadPool->reserveForFrame( 1 ) ;
+  threadPool->printArenas() ;
+  
+  ok = drained && borrower->peakActive == numWorkers && borrower->jobsBorrowing > 0 ;
+  printf( "  %-52s %s\n", "an arena borrows the workers an idle one has reserved", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  ok = drained && lender->peakActive >= numWorkers - 1 ;
+  printf( "  %-52s %s\n", "and gives them back when it has work", ok ? "ok" : "FAIL" ) ;
+  failures += !ok ;
+  
+  threadPool->removeArena( background ) ;
+  threadPool->removeArena( borrower ) ;
+  threadPool->removeArena( lender ) ;
+  
+  printf( "testTaskArenas: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
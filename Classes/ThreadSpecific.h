@@ -0,0 +1,145 @@
+#ifndef THREADSPECIFIC_H
+#define THREADSPECIFIC_H
+
+#import "ThreadPool.h"
+
+#include <stdlib.h>
+#include <new>
+
+// A copy of a T for every thread that asks, for jobs that ACCUMULATE (a
+// histogram, a bounding box, a count, emitted vertices) without locking one
+// shared T and without sizing a partial-results array by chunk or thread by hand:
+//
+//   Combinable<Box> bounds( Box::empty() ) ;
+//   threadPool->parallelFor( "bounds", n, 4096, [&]( int start, int end ) {
+//     Box& b = bounds.local() ;    // this thread's, made on its first call
+//     for( int i = start ; i < end ; i++ )  b.add( verts[i].pos ) ;
+//   } ) ;
+//   Box all = bounds.combine( []( const Box& a, const Box& b ){ return a.unioned( b ) ; } ) ;
+//
+// local() is threadIndex() and an array lookup, no lock.  Each copy is on
+// cache lines of its own, so two threads adding into theirs don't false share.
+//
+// READ THEM (forEach, combine) only once the jobs that write them are done,
+// after the parallelFor or sequencePoint returns.  Not while they're adding.
+//
+// A thread's copy outlives the thread (it's still combined), and a thread
+// started later can get the same threadIndex and carry on adding to it.
+// Fine for accumulating; don't keep anything in one that's only valid for
+// the thread that made it.
+#define THREAD_SPECIFIC_ALIGN 64
+
+template <typename T>
+struct EnumerableThreadSpecific
+{
+private:
+  struct Slot
+  {
+    T value ;
+    Slot( const T& v ) : value( v ) {}
+  } ;
+  Slot* slots[ MAX_THREAD_INDEX ] ; // by threadIndex(), 0 until that thread asks
+  function<T ()> makeValue ;
+  
+  // Copying forbidden: both would free the same copies.
+  EnumerableThreadSpecific( const EnumerableThreadSpecific& o ) {
+    puts( "ERROR: Copying EnumerableThreadSpecifics should not be done!" ) ;
+  }
+  
+  // Rounded up to whole cache lines, so nothing else gets the end of its last one.
+  Slot* newSlot()
+  {
+    void *mem = 0 ;
+    size_t bytes = ( sizeof( Slot ) + THREAD_SPECIFIC_ALIGN - 1 ) / THREAD_SPECIFIC_ALIGN * THREAD_SPECIFIC_ALIGN ;
+    if( posix_memalign( &mem, THREAD_SPECIFIC_ALIGN, bytes ) ) {
+      puts( "ERROR: EnumerableThreadSpecific could not allocate" ) ;
+      return 0 ;
+    }
+    return new( mem ) Slot( makeValue() ) ;
+  }
+  
+public:
+  // Each thread's starts as T()
+  EnumerableThreadSpecific() : makeValue( [](){ return T() ; } ) {
+    memset( slots, 0, sizeof( slots ) ) ;
+  }
+  // ... as a copy of `exemplar`
+  explicit EnumerableThreadSpecific( const T& exemplar ) : makeValue( [exemplar](){ return exemplar ; } ) {
+    memset( slots, 0, sizeof( slots ) ) ;
+  }
+  ~EnumerableThreadSpecific() { clear() ; }
+  
+  // The calling thread's copy, made the first time it asks.  Aborts if it
+  // can't be allocated (there's no T& to give back).
+  T& local()
+  {
+    int i = threadIndex() ;
+    if( !slots[i] )
+    {
+      slots[i] = newSlot() ;
+      if( !slots[i] ) {
+        puts( "ERROR: EnumerableThreadSpecific::local() has no copy for this thread, aborting" ) ;
+        fflush( stdout ) ;
+        abort() ;
+      }
+    }
+    return slots[i]->value ;
+  }
+  
+  // How many threads have a copy
+  int size() const
+  {
+    int n = 0 ;
+    for( int i = 0 ; i < MAX_THREAD_INDEX ; i++ )
+      n += slots[i] != 0 ;
+    return n ;
+  }
+  
+  // f( T& ) on every copy
+  template <typename F>
+  void forEach( F f )
+  {
+    for( int i = 0 ; i < MAX_THREAD_INDEX ; i++ )
+      if( slots[i] )
+        f( slots[i]->value ) ;
+  }
+  
+  // All the copies folded together with `op( a, b )`.  A fresh T (as the
+  // constructor would make one) if no thread made one.
+  template <typename Op>
+  T combine( Op op )
+  {
+    T result = makeValue() ;
+    bool first = 1 ;
+    for( int i = 0 ; i < MAX_THREAD_INDEX ; i++ )
+      if( slots[i] ) {
+        result = first ? slots[i]->value : op( result, slots[i]->value ) ;
+        first = 0 ;
+      }
+    return result ;
+  }
+  
+  // Throws every copy away (the next local() starts a new one).
+  void clear()
+  {
+    for( int i = 0 ; i < MAX_THREAD_INDEX ; i++ )
+      if( slots[i] ) {
+        slots[i]->~Slot() ;
+        free( slots[i] ) ;
+        slots[i] = 0 ;
+      }
+  }
+} ;
+
+// Same thing, by the name you'd look for when all you want is the combine().
+template <typename T>
+using Combinable = EnumerableThreadSpecific<T> ;
+
+// A histogram of random numbers three ways on the pool: one shared histogram
+// behind a lock, a hand indexed array of partial histograms, and
+// Combinable.  Checks they agree and prints the times, then checks
+// threadIndex() is O(1) and unique per live thread, and getMe() finds every
+// worker.  Main thread, pool up.  Returns # failures.
+int testThreadSpecific( int n ) ;
+
+#endif
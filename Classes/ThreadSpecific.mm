@@ -0,0 +1,135 @@
+#import "ThreadSpecific.h"
+#import "Random.h"
+
+#include <chrono>
+
+// TEST & BENCHMARK //
+
+#define HISTOGRAM_BINS 64
+
+struct Histogram
+{
+  long long bins[ HISTOGRAM_BINS ] ;
+  Histogram() { memset( bins, 0, sizeof( bins ) ) ; }
+  Histogram operator+( const Histogram& o ) const {
+    Histogram sum ;
+    for( int b = 0 ; b < HISTOGRAM_BINS ; b++ )
+      sum.bins[b] = bins[b] + o.bins[b] ;
+    return sum ;
+  }
+  bool operator==( const Histogram& o ) const { return !memcmp( bins, o.bins, sizeof( bins ) ) ; }
+} ;
+
+static double secondsSince( const chrono::steady_clock::time_point& start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+// The same values every way (jobRng by chunk)
+#define HISTOGRAM_GRAIN 16384
+static inline int binOf( Rng& rng ) { return rng.nextInt( HISTOGRAM_BINS ) ; }
+
+int testThreadSpecific( int n )
+{
+  int failures = 0 ;
+  printf( "testThreadSpecific: %d values into %d bins\n", n, HISTOGRAM_BINS ) ;
+  
+  // SHARED, LOCKED: every add takes the lock.
+  Histogram locked ;
+  pthread_mutex_t mutex ;
+  pthread_mutex_init( &mutex, 0 ) ;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  threadPool->parallelFor( "histogram locked", n, HISTOGRAM_GRAIN, [&]( int s, int e ) {
+    Rng rng = jobRng( s ) ;
+    for( int i = s ; i < e ; i++ ) {
+      int b = binOf( rng ) ;
+      Lock lock( &mutex ) ;
+      locked.bins[b]++ ;
+    }
+  } ) ;
+  double lockedTime = secondsSince( start ) ;
+  pthread_mutex_destroy( &mutex ) ;
+  
+  // PARTIALS, by chunk: has to know the number of chunks up front, and the
+  // partials sit side by side (adjacent ones share cache lines).
+  int numChunks = ( n + HISTOGRAM_GRAIN - 1 ) / HISTOGRAM_GRAIN ;
+  vector<Histogram> partials( numChunks ) ;
+  start = chrono::steady_clock::now() ;
+  threadPool->parallelFor( "histogram partials", n, HISTOGRAM_GRAIN, [&]( int s, int e ) {
+    Rng rng = jobRng( s ) ;
+    Histogram& h = partials[ s / HISTOGRAM_GRAIN ] ;
+    for( int i = s ; i < e ; i++ )
+      h.bins[ binOf( rng ) ]++ ;
+  } ) ;
+  Histogram summed ;
+  for( const Histogram& h : partials )
+    summed = summed + h ;
+  double partialsTime = secondsSince( start ) ;
+  
+  // COMBINABLE: one per thread, whatever the chunking.
+  Combinable<Histogram> perThread ;
+  start = chrono::steady_clock::now() ;
+  threadPool->parallelFor( "histogram combinable", n, HISTOGRAM_GRAIN, [&]( int s, int e ) {
+    Rng rng = jobRng( s ) ;
+    Histogram& h = perThread.local() ;
+    for( int i = s ; i < e ; i++ )
+      h.bins[ binOf( rng ) ]++ ;
+  } ) ;
+  Histogram combined = perThread.combine( []( const Histogram& a, const Histogram& b ){ return a + b ; } ) ;
+  double combinableTime = secondsSince( start ) ;
+  
+  long long total = 0 ;
+  perThread.forEach( [&total]( Histogram& h ){
+    for( int b = 0 ; b < HISTOGRAM_BINS ; b++ )  total += h.bins[b] ;
+  } ) ;
+  bool agree = locked == summed && summed == combined && total == n ;
+  bool copies = perThread.size() >= 1 && perThread.size() <= threadPool->getNumWorkers() + 1 ;
+  printf( "  locked %.2f ms, partials %.2f ms, combinable %.2f ms (%d copies)\n",
+    lockedTime*1e3, partialsTime*1e3, combinableTime*1e3, perThread.size() ) ;
+  printf( "  %-46s %s\n", "all three histograms agree", agree ? "ok" : "FAIL" ) ;
+  printf( "  %-46s %s\n", "one copy per thread that ran a chunk", copies ? "ok" : "FAIL" ) ;
+  failures += !agree + !copies ;
+  
+  Combinable<int> none( 7 ) ;
+  bool empty = !none.size() && none.combine( []( int a, int b ){ return a + b ; } ) == 7 ;
+  printf( "  %-46s %s\n", "combine() of no copies is the exemplar", empty ? "ok" : "FAIL" ) ;
+  failures += !empty ;
+  
+  // THREAD INDEXES: distinct for the threads alive, and getMe() finds each worker.
+  int numWorkers = threadPool->getNumWorkers() ;
+  vector<int> indexes( numWorkers, -1 ) ;
+  LockCounter found, done ;
+  for( int w = 0 ; w < numWorkers ; w++ ) {
+    Thread* target = threadPool->getWorker( w ) ;
+    threadPool->addJobForThread( target, new Callback0( [&indexes, &found, &done, target, w](){
+      indexes[w] = threadIndex() ;
+      if( threadPool->getMe() == target )  ++found ;
+      ++done ;
+    } ) ) ;
+  }
+  while( done.read() < numWorkers )
+    usleep( 100 ) ;
+  indexes.push_back( threadIndex() ) ; // main
+  vector<int> sorted = indexes ;
+  sort( sorted.begin(), sorted.end() ) ;
+  bool distinct = unique( sorted.begin(), sorted.end() ) == sorted.end() && sorted.front() >= 0 && sorted.back() < MAX_THREAD_INDEX ;
+  bool gotMe = found.read() == numWorkers && threadPool->getMe() == threadPool->getMainThread() ;
+  
+  const int calls = 1000000 ;
+  int sink = 0 ;
+  start = chrono::steady_clock::now() ;
+  for( int i = 0 ; i < calls ; i++ )
+    sink += threadIndex() ;
+  double indexTime = secondsSince( start ) ;
+  start = chrono::steady_clock::now() ;
+  for( int i = 0 ; i < calls ; i++ )
+    sink += threadPool->getMe()->num ;
+  double getMeTime = secondsSince( start ) ;
+  printf( "  threadIndex() %.1f ns, getMe() %.1f ns  (%d)\n", indexTime/calls*1e9, getMeTime/calls*1e9, sink & 1 ) ;
+  printf( "  %-46s %s\n", "thread indexes distinct", distinct ? "ok" : "FAIL" ) ;
+  printf( "  %-46s %s\n", "getMe() finds every thread", gotMe ? "ok" : "FAIL" ) ;
+  failures += !distinct + !gotMe ;
+  
+  printf( "testThreadSpecific: %s\n", failures ? "FAIL" : "PASS" ) ;
+  return failures ;
+}
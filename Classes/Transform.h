@@ -0,0 +1,176 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "ThreadPool.h"
+#include "VertexStreams.h"
+
+// processVertices rewrites every vertex every frame with rot, rot2 and rot3:
+// 3 matrix-vector products per vertex, and the positions drift because each
+// frame's rounding error is baked into the next frame's input.
+//
+// Here instead:
+//   - each object has a TransformNode holding a Matrix3f.  Per frame you
+//     compose the frame's rotation into it ONCE (Matrix3f * Matrix3f).
+//   - the object's reference positions are never written to after load.
+//   - the transformed positions are only computed when somebody actually
+//     reads them (draw, cull, pick), and only if the matrix changed since
+//     the last time.  Objects that didn't move skip the pass entirely.
+// Nodes can have a parent, world = parent.world * local.
+
+struct TransformNode
+{
+  TransformNode *parent ;
+  Matrix3f local ;   // relative to the parent
+
+  // How many composes before we orthonormalize `local` again.
+  int orthonormalizeEvery ;
+
+private:
+  Matrix3f world ;   // cached parent.world * local
+  int localVersion ; // bumps whenever local is changed
+  int worldVersion ; // bumps whenever world is recomputed
+  int worldBuiltFromLocal, worldBuiltFromParent ; // versions world was computed from
+  int composesSinceOrthonormalize ;
+
+public:
+  TransformNode( TransformNode *iParent=0 ) :
+    parent( iParent ), orthonormalizeEvery( 64 ),
+    localVersion( 1 ), worldVersion( 0 ),
+    worldBuiltFromLocal( 0 ), worldBuiltFromParent( 0 ),
+    composesSinceOrthonormalize( 0 )
+  {
+  }
+
+  void setLocal( const Matrix3f& m ) {
+    local = m ;
+    composesSinceOrthonormalize = 0 ;
+    localVersion++ ;
+  }
+
+  // local = m * local.  This is the "rotate it a bit more this frame" call.
+  void compose( const Matrix3f& m ) {
+    local = m * local ;
+    if( ++composesSinceOrthonormalize >= orthonormalizeEvery ) {
+      local.orthonormalize() ;
+      composesSinceOrthonormalize = 0 ;
+    }
+    localVersion++ ;
+  }
+
+  // Recomputes world if local or any parent changed since the last call.
+  const Matrix3f& getWorld() {
+    int parentVersion = parent ? parent->getVersion() : 0 ;
+    if( worldBuiltFromLocal != localVersion || worldBuiltFromParent != parentVersion )
+    {
+      world = parent ? parent->getWorld() * local : local ;
+      worldBuiltFromLocal = localVersion ;
+      worldBuiltFromParent = parentVersion ;
+      worldVersion++ ;
+    }
+    return world ;
+  }
+
+  // Changes whenever getWorld() would return something different.
+  int getVersion() {
+    getWorld() ;
+    return worldVersion ;
+  }
+} ;
+
+// A set of lines with pristine reference positions and a lazily transformed copy.
+// The color stream is shared: draw reads transformed pos + reference color, no copy.
+struct TransformedStreamsPC
+{
+  TransformNode *node ;
+  VertexStreamsPC reference ; // never written after load()
+
+private:
+  Vector3f *pos ;     // reference.pos * world, valid when cachedVersion == node version
+  int capacity ;
+  int cachedVersion ;
+  int pendingVersion ;  // version the jobs in flight are computing
+
+  TransformedStreamsPC( const TransformedStreamsPC& o ) {
+    puts( "ERROR: Copying TransformedStreamsPC should not be done!" ) ;
+  }
+
+  static void transformRange( TransformedStreamsPC *obj, Matrix3f *world, int start, int end ) {
+    transformBatch( *world, obj->reference.pos + start, obj->pos + start, end - start ) ;
+  }
+
+  Matrix3f jobWorld ; // what the transform jobs read, stable while they run
+
+public:
+  TransformedStreamsPC( TransformNode *iNode ) :
+    node( iNode ), pos( 0 ), capacity( 0 ), cachedVersion( -1 ), pendingVersion( -1 )
+  {
+  }
+  ~TransformedStreamsPC() {
+    free( pos ) ;
+  }
+
+  void load( const vector<VertexPC>& verts )
+  {
+    reference.fromInterleaved( verts ) ;
+    if( capacity < reference.size() ) {
+      free( pos ) ;
+      pos = allocStream<Vector3f>( capacity = reference.size() ) ;
+    }
+    cachedVersion = pendingVersion = -1 ;
+  }
+
+  inline int size() const { return reference.size() ; }
+
+  bool isStale() {
+    return cachedVersion != node->getVersion() ;
+  }
+
+  // Queue the transform pass onto `wo`, in jobs of `jobSize` vertices.
+  // Returns false (adds nothing) if the positions are already current.
+  // You must reach a sequence point before reading the positions.
+  bool addTransformJobs( WorkOrder *wo, int jobSize )
+  {
+    int version = node->getVersion() ;
+    if( cachedVersion == version || pendingVersion == version )
+      return false ; // unchanged, skip the pass
+
+    jobWorld = node->getWorld() ;
+    pendingVersion = version ;
+    if( jobSize < 1 )  jobSize = size() ;
+    for( int i = 0 ; i < size() ; i += jobSize )
+    {
+      int end = i + jobSize ;
+      if( end > size() )  end = size() ;
+      wo->addJob( new Callback4<TransformedStreamsPC*, Matrix3f*, int, int>
+        ( transformRange, this, &jobWorld, i, end ) ) ;
+    }
+    return true ;
+  }
+
+  // Call after the sequence point that finished the jobs from addTransformJobs.
+  void jobsFinished() {
+    if( pendingVersion != -1 )
+      cachedVersion = pendingVersion ;
+    pendingVersion = -1 ;
+  }
+
+  // The consumer's entry point (draw, cull, pick all come through here).
+  // Jobs queued by addTransformJobs are taken as finished, so only call this
+  // after their sequence point.  If nobody queued them, transform right now on this thread.
+  const Vector3f* positions()
+  {
+    if( pendingVersion != -1 )
+      jobsFinished() ;
+    if( isStale() ) {
+      jobWorld = node->getWorld() ;
+      transformRange( this, &jobWorld, 0, size() ) ;
+      cachedVersion = node->getVersion() ;
+    }
+    return pos ;
+  }
+
+  inline VertexAttribView posView() { return VertexAttribView( positions(), sizeof(Vector3f) ) ; }
+  inline VertexAttribView colorView() const { return reference.colorView() ; }
+} ;
+
+#endif
@@ -0,0 +1,850 @@
+#import "Vectorf.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+using namespace std ;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VECTORF_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define VECTORF_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Every kernel has the same shape:
+//   - (non-temporal only) a few scalar iterations until dst is 16 byte aligned
+//   - the vector loop, W vectors at a time
+//   - a scalar tail for the last n % W
+// AoS Vector3f is deinterleaved into x,y,z registers 4 at a time on x86
+// (3 loads + shuffles) and by vld3q on NEON.  AVX2 / AVX-512 build their
+// wider registers out of 2 / 4 of those 4-vector groups.
+
+// SCALAR //
+
+static inline Vector3f normalizeQuiet( const Vector3f& v )
+{
+  float length = v.len() ;
+  return length ? v/length : v ;
+}
+
+static void transformScalar( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = m * src[i] ;
+}
+
+static void normalizeScalar( const Vector3f* src, Vector3f* dst, int n )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = normalizeQuiet( src[i] ) ;
+}
+
+static void dotScalar( const Vector3f* a, const Vector3f* b, float* dst, int n )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = a[i].dot( b[i] ) ;
+}
+
+static void crossScalar( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = a[i].cross( b[i] ) ;
+}
+
+static void triNormalScalar( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n )
+{
+  for( int i = 0 ; i < n ; i++ )
+    dst[i] = normalizeQuiet( ( b[i] - a[i] ).cross( c[i] - a[i] ) ) ;
+}
+
+// How many leading elements to do in scalar before &dst[i] is 16 byte aligned.
+// -1 if it never will be (dst isn't even float aligned), then we don't stream.
+static inline int alignPeel( const void* dst, int elementSize )
+{
+  for( int i = 0 ; i < 4 ; i++ )
+    if( !( ( (uintptr_t)dst + i*elementSize ) & 15 ) )
+      return i ;
+  return -1 ;
+}
+
+// SSE2 //
+
+#if VECTORF_X86
+
+// [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3]  ->  [x0 x1 x2 x3] [y0 y1 y2 y3] [z0 z1 z2 z3]
+static inline void load3x4( const Vector3f* p, __m128& x, __m128& y, __m128& z )
+{
+  const float *f = (const float*)p ;
+  __m128 a = _mm_loadu_ps( f ), b = _mm_loadu_ps( f+4 ), c = _mm_loadu_ps( f+8 ) ;
+  x = _mm_shuffle_ps( a, _mm_shuffle_ps( b, c, _MM_SHUFFLE(1,1,2,2) ), _MM_SHUFFLE(2,0,3,0) ) ;
+  y = _mm_shuffle_ps( _mm_shuffle_ps( a, b, _MM_SHUFFLE(0,0,1,1) ), _mm_shuffle_ps( b, c, _MM_SHUFFLE(2,2,3,3) ), _MM_SHUFFLE(2,0,2,0) ) ;
+  z = _mm_shuffle_ps( _mm_shuffle_ps( a, b, _MM_SHUFFLE(1,1,2,2) ), _mm_shuffle_ps( c, c, _MM_SHUFFLE(3,3,0,0) ), _MM_SHUFFLE(2,0,2,0) ) ;
+}
+
+// The reverse.  `stream` needs p 16 byte aligned.
+static inline void store3x4( Vector3f* p, __m128 x, __m128 y, __m128 z, bool stream )
+{
+  __m128 a = _mm_shuffle_ps( _mm_unpacklo_ps( x, y ), _mm_shuffle_ps( z, x, _MM_SHUFFLE(1,1,0,0) ), _MM_SHUFFLE(2,0,1,0) ) ;
+  __m128 b = _mm_shuffle_ps( _mm_shuffle_ps( y, z, _MM_SHUFFLE(1,1,1,1) ), _mm_shuffle_ps( x, y, _MM_SHUFFLE(2,2,2,2) ), _MM_SHUFFLE(2,0,2,0) ) ;
+  __m128 c = _mm_shuffle_ps( _mm_shuffle_ps( z, x, _MM_SHUFFLE(3,3,2,2) ), _mm_shuffle_ps( y, z, _MM_SHUFFLE(3,3,3,3) ), _MM_SHUFFLE(2,0,2,0) ) ;
+  float *f = (float*)p ;
+  if( stream ) {
+    _mm_stream_ps( f, a ) ;
+    _mm_stream_ps( f+4, b ) ;
+    _mm_stream_ps( f+8, c ) ;
+  }
+  else {
+    _mm_storeu_ps( f, a ) ;
+    _mm_storeu_ps( f+4, b ) ;
+    _mm_storeu_ps( f+8, c ) ;
+  }
+}
+
+// x/len, leaving len==0 lanes alone (like normalizeQuiet)
+static inline void normalize4( __m128& x, __m128& y, __m128& z )
+{
+  __m128 len = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y ) ), _mm_mul_ps( z, z ) ) ) ;
+  __m128 zero = _mm_cmpeq_ps( len, _mm_setzero_ps() ) ;
+  len = _mm_or_ps( _mm_andnot_ps( zero, len ), _mm_and_ps( zero, _mm_set1_ps( 1.f ) ) ) ; // divide by 1 instead
+  x = _mm_div_ps( x, len ) ;
+  y = _mm_div_ps( y, len ) ;
+  z = _mm_div_ps( z, len ) ;
+}
+
+static inline void cross4( __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz, __m128& x, __m128& y, __m128& z )
+{
+  x = _mm_sub_ps( _mm_mul_ps( ay, bz ), _mm_mul_ps( by, az ) ) ;
+  y = _mm_sub_ps( _mm_mul_ps( az, bx ), _mm_mul_ps( ax, bz ) ) ;
+  z = _mm_sub_ps( _mm_mul_ps( ax, by ), _mm_mul_ps( bx, ay ) ) ;
+}
+
+static void transformSSE2( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  transformScalar( m, src, dst, i = min( peel, n ) ) ;
+
+  __m128 m00 = _mm_set1_ps( m.m00 ), m01 = _mm_set1_ps( m.m01 ), m02 = _mm_set1_ps( m.m02 ),
+         m10 = _mm_set1_ps( m.m10 ), m11 = _mm_set1_ps( m.m11 ), m12 = _mm_set1_ps( m.m12 ),
+         m20 = _mm_set1_ps( m.m20 ), m21 = _mm_set1_ps( m.m21 ), m22 = _mm_set1_ps( m.m22 ) ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 x, y, z ;
+    load3x4( src+i, x, y, z ) ;
+    __m128 rx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m00 ), _mm_mul_ps( y, m10 ) ), _mm_mul_ps( z, m20 ) ) ;
+    __m128 ry = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m01 ), _mm_mul_ps( y, m11 ) ), _mm_mul_ps( z, m21 ) ) ;
+    __m128 rz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m02 ), _mm_mul_ps( y, m12 ) ), _mm_mul_ps( z, m22 ) ) ;
+    store3x4( dst+i, rx, ry, rz, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  transformScalar( m, src+i, dst+i, n-i ) ;
+}
+
+static void normalizeSSE2( const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  normalizeScalar( src, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 x, y, z ;
+    load3x4( src+i, x, y, z ) ;
+    normalize4( x, y, z ) ;
+    store3x4( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  normalizeScalar( src+i, dst+i, n-i ) ;
+}
+
+static void dotSSE2( const Vector3f* a, const Vector3f* b, float* dst, int n )
+{
+  int i = 0, peel = alignPeel( dst, sizeof(float) ) ;
+  bool stream = peel >= 0 ;
+  if( stream )  dotScalar( a, b, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 ax, ay, az, bx, by, bz ;
+    load3x4( a+i, ax, ay, az ) ;
+    load3x4( b+i, bx, by, bz ) ;
+    __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ), _mm_mul_ps( az, bz ) ) ;
+    if( stream )  _mm_stream_ps( dst+i, d ) ;
+    else  _mm_storeu_ps( dst+i, d ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  dotScalar( a+i, b+i, dst+i, n-i ) ;
+}
+
+static void crossSSE2( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  crossScalar( a, b, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 ax, ay, az, bx, by, bz, x, y, z ;
+    load3x4( a+i, ax, ay, az ) ;
+    load3x4( b+i, bx, by, bz ) ;
+    cross4( ax, ay, az, bx, by, bz, x, y, z ) ;
+    store3x4( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  crossScalar( a+i, b+i, dst+i, n-i ) ;
+}
+
+static void triNormalSSE2( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst && c != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  triNormalScalar( a, b, c, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    __m128 ax, ay, az, bx, by, bz, cx, cy, cz, x, y, z ;
+    load3x4( a+i, ax, ay, az ) ;
+    load3x4( b+i, bx, by, bz ) ;
+    load3x4( c+i, cx, cy, cz ) ;
+    cross4( _mm_sub_ps( bx, ax ), _mm_sub_ps( by, ay ), _mm_sub_ps( bz, az ),
+            _mm_sub_ps( cx, ax ), _mm_sub_ps( cy, ay ), _mm_sub_ps( cz, az ), x, y, z ) ;
+    normalize4( x, y, z ) ;
+    store3x4( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  triNormalScalar( a+i, b+i, c+i, dst+i, n-i ) ;
+}
+
+// AVX2 //
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+AVX2_TARGET static inline void load3x8( const Vector3f* p, __m256& x, __m256& y, __m256& z )
+{
+  __m128 x0, y0, z0, x1, y1, z1 ;
+  load3x4( p, x0, y0, z0 ) ;
+  load3x4( p+4, x1, y1, z1 ) ;
+  x = _mm256_insertf128_ps( _mm256_castps128_ps256( x0 ), x1, 1 ) ;
+  y = _mm256_insertf128_ps( _mm256_castps128_ps256( y0 ), y1, 1 ) ;
+  z = _mm256_insertf128_ps( _mm256_castps128_ps256( z0 ), z1, 1 ) ;
+}
+
+AVX2_TARGET static inline void store3x8( Vector3f* p, __m256 x, __m256 y, __m256 z, bool stream )
+{
+  store3x4( p, _mm256_castps256_ps128( x ), _mm256_castps256_ps128( y ), _mm256_castps256_ps128( z ), stream ) ;
+  store3x4( p+4, _mm256_extractf128_ps( x, 1 ), _mm256_extractf128_ps( y, 1 ), _mm256_extractf128_ps( z, 1 ), stream ) ;
+}
+
+AVX2_TARGET static inline void normalize8( __m256& x, __m256& y, __m256& z )
+{
+  __m256 len = _mm256_sqrt_ps( _mm256_fmadd_ps( z, z, _mm256_fmadd_ps( y, y, _mm256_mul_ps( x, x ) ) ) ) ;
+  __m256 zero = _mm256_cmp_ps( len, _mm256_setzero_ps(), _CMP_EQ_OQ ) ;
+  len = _mm256_blendv_ps( len, _mm256_set1_ps( 1.f ), zero ) ;
+  x = _mm256_div_ps( x, len ) ;
+  y = _mm256_div_ps( y, len ) ;
+  z = _mm256_div_ps( z, len ) ;
+}
+
+AVX2_TARGET static inline void cross8( __m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz, __m256& x, __m256& y, __m256& z )
+{
+  x = _mm256_fmsub_ps( ay, bz, _mm256_mul_ps( by, az ) ) ;
+  y = _mm256_fmsub_ps( az, bx, _mm256_mul_ps( ax, bz ) ) ;
+  z = _mm256_fmsub_ps( ax, by, _mm256_mul_ps( bx, ay ) ) ;
+}
+
+AVX2_TARGET static void transformAVX2( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  transformScalar( m, src, dst, i = min( peel, n ) ) ;
+
+  __m256 m00 = _mm256_set1_ps( m.m00 ), m01 = _mm256_set1_ps( m.m01 ), m02 = _mm256_set1_ps( m.m02 ),
+         m10 = _mm256_set1_ps( m.m10 ), m11 = _mm256_set1_ps( m.m11 ), m12 = _mm256_set1_ps( m.m12 ),
+         m20 = _mm256_set1_ps( m.m20 ), m21 = _mm256_set1_ps( m.m21 ), m22 = _mm256_set1_ps( m.m22 ) ;
+  for( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 x, y, z ;
+    load3x8( src+i, x, y, z ) ;
+    __m256 rx = _mm256_fmadd_ps( z, m20, _mm256_fmadd_ps( y, m10, _mm256_mul_ps( x, m00 ) ) ) ;
+    __m256 ry = _mm256_fmadd_ps( z, m21, _mm256_fmadd_ps( y, m11, _mm256_mul_ps( x, m01 ) ) ) ;
+    __m256 rz = _mm256_fmadd_ps( z, m22, _mm256_fmadd_ps( y, m12, _mm256_mul_ps( x, m02 ) ) ) ;
+    store3x8( dst+i, rx, ry, rz, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  transformSSE2( m, src+i, dst+i, n-i ) ;
+}
+
+AVX2_TARGET static void normalizeAVX2( const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  normalizeScalar( src, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 x, y, z ;
+    load3x8( src+i, x, y, z ) ;
+    normalize8( x, y, z ) ;
+    store3x8( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  normalizeSSE2( src+i, dst+i, n-i ) ;
+}
+
+AVX2_TARGET static void dotAVX2( const Vector3f* a, const Vector3f* b, float* dst, int n )
+{
+  int i = 0 ;
+  // stream needs 32 byte alignment here
+  while( i < n && ( (uintptr_t)(dst+i) & 31 ) && !( (uintptr_t)dst & 3 ) )
+    dst[i] = a[i].dot( b[i] ), i++ ;
+  bool stream = !( (uintptr_t)(dst+i) & 31 ) ;
+
+  for( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 ax, ay, az, bx, by, bz ;
+    load3x8( a+i, ax, ay, az ) ;
+    load3x8( b+i, bx, by, bz ) ;
+    __m256 d = _mm256_fmadd_ps( az, bz, _mm256_fmadd_ps( ay, by, _mm256_mul_ps( ax, bx ) ) ) ;
+    if( stream )  _mm256_stream_ps( dst+i, d ) ;
+    else  _mm256_storeu_ps( dst+i, d ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  dotSSE2( a+i, b+i, dst+i, n-i ) ;
+}
+
+AVX2_TARGET static void crossAVX2( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  crossScalar( a, b, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 ax, ay, az, bx, by, bz, x, y, z ;
+    load3x8( a+i, ax, ay, az ) ;
+    load3x8( b+i, bx, by, bz ) ;
+    cross8( ax, ay, az, bx, by, bz, x, y, z ) ;
+    store3x8( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  crossSSE2( a+i, b+i, dst+i, n-i ) ;
+}
+
+AVX2_TARGET static void triNormalAVX2( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst && c != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  triNormalScalar( a, b, c, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 8 <= n ; i += 8 )
+  {
+    __m256 ax, ay, az, bx, by, bz, cx, cy, cz, x, y, z ;
+    load3x8( a+i, ax, ay, az ) ;
+    load3x8( b+i, bx, by, bz ) ;
+    load3x8( c+i, cx, cy, cz ) ;
+    cross8( _mm256_sub_ps( bx, ax ), _mm256_sub_ps( by, ay ), _mm256_sub_ps( bz, az ),
+            _mm256_sub_ps( cx, ax ), _mm256_sub_ps( cy, ay ), _mm256_sub_ps( cz, az ), x, y, z ) ;
+    normalize8( x, y, z ) ;
+    store3x8( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  triNormalSSE2( a+i, b+i, c+i, dst+i, n-i ) ;
+}
+
+// AVX-512 //
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+AVX512_TARGET static inline void load3x16( const Vector3f* p, __m512& x, __m512& y, __m512& z )
+{
+  __m128 x0, y0, z0, x1, y1, z1, x2, y2, z2, x3, y3, z3 ;
+  load3x4( p, x0, y0, z0 ) ;
+  load3x4( p+4, x1, y1, z1 ) ;
+  load3x4( p+8, x2, y2, z2 ) ;
+  load3x4( p+12, x3, y3, z3 ) ;
+  x = _mm512_insertf32x4( _mm512_insertf32x4( _mm512_insertf32x4( _mm512_castps128_ps512( x0 ), x1, 1 ), x2, 2 ), x3, 3 ) ;
+  y = _mm512_insertf32x4( _mm512_insertf32x4( _mm512_insertf32x4( _mm512_castps128_ps512( y0 ), y1, 1 ), y2, 2 ), y3, 3 ) ;
+  z = _mm512_insertf32x4( _mm512_insertf32x4( _mm512_insertf32x4( _mm512_castps128_ps512( z0 ), z1, 1 ), z2, 2 ), z3, 3 ) ;
+}
+
+AVX512_TARGET static inline void store3x16( Vector3f* p, __m512 x, __m512 y, __m512 z, bool stream )
+{
+  store3x4( p, _mm512_castps512_ps128( x ), _mm512_castps512_ps128( y ), _mm512_castps512_ps128( z ), stream ) ;
+  store3x4( p+4, _mm512_extractf32x4_ps( x, 1 ), _mm512_extractf32x4_ps( y, 1 ), _mm512_extractf32x4_ps( z, 1 ), stream ) ;
+  store3x4( p+8, _mm512_extractf32x4_ps( x, 2 ), _mm512_extractf32x4_ps( y, 2 ), _mm512_extractf32x4_ps( z, 2 ), stream ) ;
+  store3x4( p+12, _mm512_extractf32x4_ps( x, 3 ), _mm512_extractf32x4_ps( y, 3 ), _mm512_extractf32x4_ps( z, 3 ), stream ) ;
+}
+
+AVX512_TARGET static inline void normalize16( __m512& x, __m512& y, __m512& z )
+{
+  __m512 len = _mm512_sqrt_ps( _mm512_fmadd_ps( z, z, _mm512_fmadd_ps( y, y, _mm512_mul_ps( x, x ) ) ) ) ;
+  __mmask16 zero = _mm512_cmp_ps_mask( len, _mm512_setzero_ps(), _CMP_EQ_OQ ) ;
+  len = _mm512_mask_blend_ps( zero, len, _mm512_set1_ps( 1.f ) ) ;
+  x = _mm512_div_ps( x, len ) ;
+  y = _mm512_div_ps( y, len ) ;
+  z = _mm512_div_ps( z, len ) ;
+}
+
+AVX512_TARGET static inline void cross16( __m512 ax, __m512 ay, __m512 az, __m512 bx, __m512 by, __m512 bz, __m512& x, __m512& y, __m512& z )
+{
+  x = _mm512_fmsub_ps( ay, bz, _mm512_mul_ps( by, az ) ) ;
+  y = _mm512_fmsub_ps( az, bx, _mm512_mul_ps( ax, bz ) ) ;
+  z = _mm512_fmsub_ps( ax, by, _mm512_mul_ps( bx, ay ) ) ;
+}
+
+AVX512_TARGET static void transformAVX512( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  transformScalar( m, src, dst, i = min( peel, n ) ) ;
+
+  __m512 m00 = _mm512_set1_ps( m.m00 ), m01 = _mm512_set1_ps( m.m01 ), m02 = _mm512_set1_ps( m.m02 ),
+         m10 = _mm512_set1_ps( m.m10 ), m11 = _mm512_set1_ps( m.m11 ), m12 = _mm512_set1_ps( m.m12 ),
+         m20 = _mm512_set1_ps( m.m20 ), m21 = _mm512_set1_ps( m.m21 ), m22 = _mm512_set1_ps( m.m22 ) ;
+  for( ; i + 16 <= n ; i += 16 )
+  {
+    __m512 x, y, z ;
+    load3x16( src+i, x, y, z ) ;
+    __m512 rx = _mm512_fmadd_ps( z, m20, _mm512_fmadd_ps( y, m10, _mm512_mul_ps( x, m00 ) ) ) ;
+    __m512 ry = _mm512_fmadd_ps( z, m21, _mm512_fmadd_ps( y, m11, _mm512_mul_ps( x, m01 ) ) ) ;
+    __m512 rz = _mm512_fmadd_ps( z, m22, _mm512_fmadd_ps( y, m12, _mm512_mul_ps( x, m02 ) ) ) ;
+    store3x16( dst+i, rx, ry, rz, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  transformSSE2( m, src+i, dst+i, n-i ) ;
+}
+
+AVX512_TARGET static void normalizeAVX512( const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0, peel = src != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  normalizeScalar( src, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 16 <= n ; i += 16 )
+  {
+    __m512 x, y, z ;
+    load3x16( src+i, x, y, z ) ;
+    normalize16( x, y, z ) ;
+    store3x16( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  normalizeSSE2( src+i, dst+i, n-i ) ;
+}
+
+AVX512_TARGET static void dotAVX512( const Vector3f* a, const Vector3f* b, float* dst, int n )
+{
+  int i = 0 ;
+  // stream needs 64 byte alignment here
+  while( i < n && ( (uintptr_t)(dst+i) & 63 ) && !( (uintptr_t)dst & 3 ) )
+    dst[i] = a[i].dot( b[i] ), i++ ;
+  bool stream = !( (uintptr_t)(dst+i) & 63 ) ;
+
+  for( ; i + 16 <= n ; i += 16 )
+  {
+    __m512 ax, ay, az, bx, by, bz ;
+    load3x16( a+i, ax, ay, az ) ;
+    load3x16( b+i, bx, by, bz ) ;
+    __m512 d = _mm512_fmadd_ps( az, bz, _mm512_fmadd_ps( ay, by, _mm512_mul_ps( ax, bx ) ) ) ;
+    if( stream )  _mm512_stream_ps( dst+i, d ) ;
+    else  _mm512_storeu_ps( dst+i, d ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  dotSSE2( a+i, b+i, dst+i, n-i ) ;
+}
+
+AVX512_TARGET static void crossAVX512( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  crossScalar( a, b, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 16 <= n ; i += 16 )
+  {
+    __m512 ax, ay, az, bx, by, bz, x, y, z ;
+    load3x16( a+i, ax, ay, az ) ;
+    load3x16( b+i, bx, by, bz ) ;
+    cross16( ax, ay, az, bx, by, bz, x, y, z ) ;
+    store3x16( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  crossSSE2( a+i, b+i, dst+i, n-i ) ;
+}
+
+AVX512_TARGET static void triNormalAVX512( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n )
+{
+  int i = 0, peel = a != dst && b != dst && c != dst ? alignPeel( dst, sizeof(Vector3f) ) : -1 ;
+  bool stream = peel >= 0 ;
+  if( stream )  triNormalScalar( a, b, c, dst, i = min( peel, n ) ) ;
+
+  for( ; i + 16 <= n ; i += 16 )
+  {
+    __m512 ax, ay, az, bx, by, bz, cx, cy, cz, x, y, z ;
+    load3x16( a+i, ax, ay, az ) ;
+    load3x16( b+i, bx, by, bz ) ;
+    load3x16( c+i, cx, cy, cz ) ;
+    cross16( _mm512_sub_ps( bx, ax ), _mm512_sub_ps( by, ay ), _mm512_sub_ps( bz, az ),
+             _mm512_sub_ps( cx, ax ), _mm512_sub_ps( cy, ay ), _mm512_sub_ps( cz, az ), x, y, z ) ;
+    normalize16( x, y, z ) ;
+    store3x16( dst+i, x, y, z, stream ) ;
+  }
+  if( stream )  _mm_sfence() ;
+  triNormalSSE2( a+i, b+i, c+i, dst+i, n-i ) ;
+}
+
+#endif // VECTORF_X86
+
+// NEON //
+
+#if VECTORF_NEON
+
+// No non-temporal store intrinsic on NEON, vst3q writes through the cache.
+
+static inline void normalizeNEON4( float32x4x3_t& v )
+{
+  float32x4_t len2 = vmlaq_f32( vmlaq_f32( vmulq_f32( v.val[0], v.val[0] ), v.val[1], v.val[1] ), v.val[2], v.val[2] ) ;
+  uint32x4_t zero = vceqq_f32( len2, vdupq_n_f32( 0.f ) ) ;
+#if defined(__aarch64__)
+  float32x4_t len = vbslq_f32( zero, vdupq_n_f32( 1.f ), vsqrtq_f32( len2 ) ) ;
+  v.val[0] = vdivq_f32( v.val[0], len ) ;
+  v.val[1] = vdivq_f32( v.val[1], len ) ;
+  v.val[2] = vdivq_f32( v.val[2], len ) ;
+#else
+  // armv7 has no vector sqrt or divide: reciprocal sqrt estimate + 2 Newton steps (~23 bits)
+  len2 = vbslq_f32( zero, vdupq_n_f32( 1.f ), len2 ) ;
+  float32x4_t e = vrsqrteq_f32( len2 ) ;
+  e = vmulq_f32( e, vrsqrtsq_f32( vmulq_f32( len2, e ), e ) ) ;
+  e = vmulq_f32( e, vrsqrtsq_f32( vmulq_f32( len2, e ), e ) ) ;
+  v.val[0] = vmulq_f32( v.val[0], e ) ;
+  v.val[1] = vmulq_f32( v.val[1], e ) ;
+  v.val[2] = vmulq_f32( v.val[2], e ) ;
+#endif
+}
+
+static inline float32x4x3_t crossNEON4( const float32x4x3_t& a, const float32x4x3_t& b )
+{
+  float32x4x3_t r ;
+  r.val[0] = vmlsq_f32( vmulq_f32( a.val[1], b.val[2] ), b.val[1], a.val[2] ) ;
+  r.val[1] = vmlsq_f32( vmulq_f32( a.val[2], b.val[0] ), a.val[0], b.val[2] ) ;
+  r.val[2] = vmlsq_f32( vmulq_f32( a.val[0], b.val[1] ), b.val[0], a.val[1] ) ;
+  return r ;
+}
+
+static void transformNEON( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0 ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    float32x4x3_t v = vld3q_f32( (const float*)(src+i) ), r ;
+    r.val[0] = vmlaq_n_f32( vmlaq_n_f32( vmulq_n_f32( v.val[0], m.m00 ), v.val[1], m.m10 ), v.val[2], m.m20 ) ;
+    r.val[1] = vmlaq_n_f32( vmlaq_n_f32( vmulq_n_f32( v.val[0], m.m01 ), v.val[1], m.m11 ), v.val[2], m.m21 ) ;
+    r.val[2] = vmlaq_n_f32( vmlaq_n_f32( vmulq_n_f32( v.val[0], m.m02 ), v.val[1], m.m12 ), v.val[2], m.m22 ) ;
+    vst3q_f32( (float*)(dst+i), r ) ;
+  }
+  transformScalar( m, src+i, dst+i, n-i ) ;
+}
+
+static void normalizeNEON( const Vector3f* src, Vector3f* dst, int n )
+{
+  int i = 0 ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    float32x4x3_t v = vld3q_f32( (const float*)(src+i) ) ;
+    normalizeNEON4( v ) ;
+    vst3q_f32( (float*)(dst+i), v ) ;
+  }
+  normalizeScalar( src+i, dst+i, n-i ) ;
+}
+
+static void dotNEON( const Vector3f* a, const Vector3f* b, float* dst, int n )
+{
+  int i = 0 ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    float32x4x3_t va = vld3q_f32( (const float*)(a+i) ), vb = vld3q_f32( (const float*)(b+i) ) ;
+    vst1q_f32( dst+i, vmlaq_f32( vmlaq_f32( vmulq_f32( va.val[0], vb.val[0] ), va.val[1], vb.val[1] ), va.val[2], vb.val[2] ) ) ;
+  }
+  dotScalar( a+i, b+i, dst+i, n-i ) ;
+}
+
+static void crossNEON( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n )
+{
+  int i = 0 ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    float32x4x3_t va = vld3q_f32( (const float*)(a+i) ), vb = vld3q_f32( (const float*)(b+i) ) ;
+    vst3q_f32( (float*)(dst+i), crossNEON4( va, vb ) ) ;
+  }
+  crossScalar( a+i, b+i, dst+i, n-i ) ;
+}
+
+static void triNormalNEON( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n )
+{
+  int i = 0 ;
+  for( ; i + 4 <= n ; i += 4 )
+  {
+    float32x4x3_t va = vld3q_f32( (const float*)(a+i) ), vb = vld3q_f32( (const float*)(b+i) ), vc = vld3q_f32( (const float*)(c+i) ) ;
+    for( int k = 0 ; k < 3 ; k++ ) {
+      vb.val[k] = vsubq_f32( vb.val[k], va.val[k] ) ;
+      vc.val[k] = vsubq_f32( vc.val[k], va.val[k] ) ;
+    }
+    float32x4x3_t r = crossNEON4( vb, vc ) ;
+    normalizeNEON4( r ) ;
+    vst3q_f32( (float*)(dst+i), r ) ;
+  }
+  triNormalScalar( a+i, b+i, c+i, dst+i, n-i ) ;
+}
+
+#endif // VECTORF_NEON
+
+// DISPATCH //
+
+struct BatchKernels
+{
+  SimdIsa isa ;
+  void (*transform)( const Matrix3f&, const Vector3f*, Vector3f*, int ) ;
+  void (*normalize)( const Vector3f*, Vector3f*, int ) ;
+  void (*dot)( const Vector3f*, const Vector3f*, float*, int ) ;
+  void (*cross)( const Vector3f*, const Vector3f*, Vector3f*, int ) ;
+  void (*triNormal)( const Vector3f*, const Vector3f*, const Vector3f*, Vector3f*, int ) ;
+} ;
+
+bool simdIsaSupported( SimdIsa isa )
+{
+  SimdIsa best = simdIsaDetected() ;
+  switch( isa )
+  {
+  case SimdScalar:  return true ;
+  case SimdSSE2:    return best == SimdSSE2 || best == SimdAVX2 || best == SimdAVX512 ;
+  case SimdAVX2:    return best == SimdAVX2 || best == SimdAVX512 ;
+  case SimdAVX512:  return best == SimdAVX512 ;
+  case SimdNEON:    return best == SimdNEON ;
+  }
+  return false ;
+}
+
+static BatchKernels kernelsFor( SimdIsa isa )
+{
+  BatchKernels k = { SimdScalar, transformScalar, normalizeScalar, dotScalar, crossScalar, triNormalScalar } ;
+  if( !simdIsaSupported( isa ) )  return k ;
+  switch( isa )
+  {
+#if VECTORF_X86
+  case SimdSSE2:   { BatchKernels sse2 = { isa, transformSSE2, normalizeSSE2, dotSSE2, crossSSE2, triNormalSSE2 } ; return sse2 ; }
+  case SimdAVX2:   { BatchKernels avx2 = { isa, transformAVX2, normalizeAVX2, dotAVX2, crossAVX2, triNormalAVX2 } ; return avx2 ; }
+  case SimdAVX512: { BatchKernels avx512 = { isa, transformAVX512, normalizeAVX512, dotAVX512, crossAVX512, triNormalAVX512 } ; return avx512 ; }
+#endif
+#if VECTORF_NEON
+  case SimdNEON:   { BatchKernels neon = { isa, transformNEON, normalizeNEON, dotNEON, crossNEON, triNormalNEON } ; return neon ; }
+#endif
+  default:  return k ;
+  }
+}
+
+#if VECTORF_X86
+static SimdIsa detectedIsa = SimdSSE2 ;
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT ;
+
+static void detectIsa()
+{
+  __builtin_cpu_init() ;
+  if( __builtin_cpu_supports( "avx512f" ) )  detectedIsa = SimdAVX512 ;
+  else if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )  detectedIsa = SimdAVX2 ;
+}
+#endif
+
+// Any thread: the first one in detects, the others wait for it.
+SimdIsa simdIsaDetected()
+{
+#if VECTORF_X86
+  pthread_once( &detectOnce, detectIsa ) ;
+  return detectedIsa ;
+#elif VECTORF_NEON
+  return SimdNEON ; // every armv7/arm64 iOS device has it
+#else
+  return SimdScalar ;
+#endif
+}
+
+SimdIsa simdIsaDefault()
+{
+  SimdIsa detected = simdIsaDetected() ;
+  if( detected == SimdAVX512 && !VECTORF_PREFER_AVX512 )
+    return SimdAVX2 ;
+  return detected ;
+}
+
+// Picked the first time anybody calls a batch function.
+static BatchKernels& kernels()
+{
+  static BatchKernels k = kernelsFor( simdIsaDefault() ) ;
+  return k ;
+}
+
+SimdIsa simdIsa() { return kernels().isa ; }
+
+SimdIsa setSimdIsa( SimdIsa isa )
+{
+  if( !simdIsaSupported( isa ) ) {
+    printf( "setSimdIsa: %s not supported on this CPU, using %s\n", simdIsaName( isa ), simdIsaName( simdIsaDefault() ) ) ;
+    isa = simdIsaDefault() ;
+  }
+  kernels() = kernelsFor( isa ) ;
+  return isa ;
+}
+
+const char* simdIsaName( SimdIsa isa )
+{
+  switch( isa )
+  {
+  case SimdScalar: return "scalar" ;
+  case SimdSSE2:   return "SSE2" ;
+  case SimdAVX2:   return "AVX2" ;
+  case SimdAVX512: return "AVX-512" ;
+  case SimdNEON:   return "NEON" ;
+  }
+  return "?" ;
+}
+
+void transformBatch( const Matrix3f& m, const Vector3f* src, Vector3f* dst, int n ) { kernels().transform( m, src, dst, n ) ; }
+void normalizeBatch( const Vector3f* src, Vector3f* dst, int n ) { kernels().normalize( src, dst, n ) ; }
+void dotBatch( const Vector3f* a, const Vector3f* b, float* dst, int n ) { kernels().dot( a, b, dst, n ) ; }
+void crossBatch( const Vector3f* a, const Vector3f* b, Vector3f* dst, int n ) { kernels().cross( a, b, dst, n ) ; }
+void triNormalBatch( const Vector3f* a, const Vector3f* b, const Vector3f* c, Vector3f* dst, int n ) { kernels().triNormal( a, b, c, dst, n ) ; }
+
+// TEST & BENCHMARK //
+
+static bool nearlyEqual( float a, float b )
+{
+  return fabsf( a - b ) <= 1e-5f * max( 1.f, fabsf( b ) ) ;
+}
+static bool nearlyEqual( const Vector3f& a, const Vector3f& b )
+{
+  return nearlyEqual( a.x, b.x ) && nearlyEqual( a.y, b.y ) && nearlyEqual( a.z, b.z ) ;
+}
+
+static int checkVectors( const char* what, SimdIsa isa, int n, int offset, const Vector3f* got, const Vector3f* want )
+{
+  for( int i = 0 ; i < n ; i++ )
+    if( !nearlyEqual( got[i], want[i] ) ) {
+      printf( "  FAIL %s %s n=%d offset=%d [%d]: got (%f %f %f) want (%f %f %f)\n", simdIsaName( isa ), what, n, offset, i,
+        got[i].x, got[i].y, got[i].z, want[i].x, want[i].y, want[i].z ) ;
+      return 1 ;
+    }
+  return 0 ;
+}
+
+int testBatchKernels()
+{
+  SimdIsa was = simdIsa() ;
+  SimdIsa isas[] = { SimdSSE2, SimdAVX2, SimdAVX512, SimdNEON } ;
+  int sizes[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 100, 1027 } ;
+  int failures = 0 ;
+
+  const int MAXN = 1027 + 4 ;
+  vector<Vector3f> a( MAXN ), b( MAXN ), c( MAXN ), want( MAXN ), got( MAXN ), inPlace( MAXN ) ;
+  vector<float> dotWant( MAXN ), dotGot( MAXN ) ;
+  for( int i = 0 ; i < MAXN ; i++ ) {
+    a[i] = Vector3f::random( -10.f, 10.f ) ;
+    b[i] = Vector3f::random( -10.f, 10.f ) ;
+    c[i] = Vector3f::random( -10.f, 10.f ) ;
+  }
+  a[5] = Vector3f( 0.f ) ;        // normalize of zero
+  b[9] = c[9] = a[9] ;            // degenerate triangle
+  Matrix3f m = Matrix3f::rotationYawPitchRoll( 0.3f, -1.1f, 2.f ) ;
+
+  for( SimdIsa isa : isas )
+  {
+    if( !simdIsaSupported( isa ) )  continue ;
+    setSimdIsa( isa ) ;
+    int before = failures ;
+
+    for( int n : sizes )
+    for( int offset = 0 ; offset < 4 ; offset++ ) // shifts dst alignment, so the streaming peel is exercised
+    {
+      const Vector3f *A = &a[offset], *B = &b[offset], *C = &c[offset] ;
+      Vector3f *G = &got[offset], *W = &want[offset] ;
+
+      transformScalar( m, A, W, n ) ;
+      transformBatch( m, A, G, n ) ;
+      failures += checkVectors( "transform", isa, n, offset, G, W ) ;
+      inPlace = a ;
+      transformBatch( m, &inPlace[offset], &inPlace[offset], n ) ;
+      failures += checkVectors( "transform in place", isa, n, offset, &inPlace[offset], W ) ;
+
+      normalizeScalar( A, W, n ) ;
+      normalizeBatch( A, G, n ) ;
+      failures += checkVectors( "normalize", isa, n, offset, G, W ) ;
+      inPlace = a ;
+      normalizeBatch( &inPlace[offset], &inPlace[offset], n ) ;
+      failures += checkVectors( "normalize in place", isa, n, offset, &inPlace[offset], W ) ;
+
+      crossScalar( A, B, W, n ) ;
+      crossBatch( A, B, G, n ) ;
+      failures += checkVectors( "cross", isa, n, offset, G, W ) ;
+
+      triNormalScalar( A, B, C, W, n ) ;
+      triNormalBatch( A, B, C, G, n ) ;
+      failures += checkVectors( "triNormal", isa, n, offset, G, W ) ;
+
+      dotScalar( A, B, &dotWant[offset], n ) ;
+      dotBatch( A, B, &dotGot[offset], n ) ;
+      for( int i = 0 ; i < n ; i++ )
+        if( !nearlyEqual( dotGot[offset+i], dotWant[offset+i] ) ) {
+          printf( "  FAIL %s dot n=%d offset=%d [%d]: got %f want %f\n", simdIsaName( isa ), n, offset, i, dotGot[offset+i], dotWant[offset+i] ) ;
+          failures++ ;
+          break ;
+        }
+    }
+    printf( "testBatchKernels: %s %s\n", simdIsaName( isa ), failures==before ? "PASS" : "FAIL" ) ;
+  }
+
+  setSimdIsa( was ) ;
+  return failures ;
+}
+
+static double timeIt( function<void ()> f, int reps )
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  for( int r = 0 ; r < reps ; r++ )
+    f() ;
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+void benchmarkBatchKernels( int n, int reps )
+{
+  SimdIsa was = simdIsa() ;
+  SimdIsa isas[] = { SimdScalar, SimdSSE2, SimdAVX2, SimdAVX512, SimdNEON } ;
+
+  vector<Vector3f> a( n ), b( n ), c( n ), out( n ) ;
+  vector<float> dots( n ) ;
+  for( int i = 0 ; i < n ; i++ ) {
+    a[i] = Vector3f::random( -1.f, 1.f ) ;
+    b[i] = Vector3f::random( -1.f, 1.f ) ;
+    c[i] = Vector3f::random( -1.f, 1.f ) ;
+  }
+  Matrix3f m = Matrix3f::rotation( Vector3f( 0.f, 1.f, 0.f ), 0.01f ) ;
+
+  // flops per element, counting sqrt and divide as 1
+  printf( "benchmarkBatchKernels: %d vectors x %d reps, GFLOP/s\n", n, reps ) ;
+  printf( "  %-8s %10s %10s %10s %10s %10s\n", "isa", "transform", "normalize", "dot", "cross", "triNormal" ) ;
+  for( SimdIsa isa : isas )
+  {
+    if( !simdIsaSupported( isa ) )  continue ;
+    setSimdIsa( isa ) ;
+    double flops = (double)n * reps / 1e9 ;
+    double tT = timeIt( [&](){ transformBatch( m, &a[0], &out[0], n ) ; }, reps ) ;
+    double tN = timeIt( [&](){ normalizeBatch( &a[0], &out[0], n ) ; }, reps ) ;
+    double tD = timeIt( [&](){ dotBatch( &a[0], &b[0], &dots[0], n ) ; }, reps ) ;
+    double tC = timeIt( [&](){ crossBatch( &a[0], &b[0], &out[0], n ) ; }, reps ) ;
+    double tTri = timeIt( [&](){ triNormalBatch( &a[0], &b[0], &c[0], &out[0], n ) ; }, reps ) ;
+    printf( "  %-8s %10.2f %10.2f %10.2f %10.2f %10.2f%s\n", simdIsaName( isa ),
+      15*flops/tT, 9*flops/tN, 5*flops/tD, 9*flops/tC, 24*flops/tTri, isa == simdIsaDefault() ? "  (default)" : "" ) ;
+  }
+  setSimdIsa( was ) ;
+}
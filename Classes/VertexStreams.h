@@ -0,0 +1,165 @@
+#ifndef VERTEXSTREAMS_H
+#define VERTEXSTREAMS_H
+
+#include "Vectorf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+using namespace std ;
+
+// VertexPC is AoS: 12 bytes of pos then 16 bytes of color, 28 bytes a vertex.
+// processVertices only ever touches pos, but the color rides along in the
+// same cache lines, so 57% of the memory traffic is dead weight.
+//
+// VertexStreamsPC keeps each ATTRIBUTE in its own cache-line aligned array
+// ("stream"):
+//   pos   [ xyz xyz xyz ... ]  12 bytes/vertex
+//   color [ rgba rgba ... ]    16 bytes/vertex
+// The transform kernels only pull the pos stream through cache.
+//
+// Why not go further and split x,y,z into 3 planar arrays?  Because GL
+// (glVertexPointer) needs the 3 components of ONE vertex next to each other.
+// Planar xyz would force a gather into a temp buffer every draw.  Packed xyz
+// lets drawPC point GL straight at the streams, no copy at all.
+
+#define VERTEX_STREAM_ALIGN 64
+
+// A pointer + byte stride.  This is exactly what glVertexPointer/glColorPointer
+// want, so a view can describe either an AoS vector<VertexPC> or a stream.
+struct VertexAttribView
+{
+  const void *ptr ;
+  int stride ; // bytes between consecutive elements
+
+  VertexAttribView() : ptr(0), stride(0) { }
+  VertexAttribView( const void *iPtr, int iStride ) : ptr(iPtr), stride(iStride) { }
+
+  template <typename T>
+  inline const T& at( int i ) const {
+    return *(const T*)( (const char*)ptr + (size_t)i*stride ) ;
+  }
+} ;
+
+template <typename T>
+inline T* allocStream( int count )
+{
+  void *mem = 0 ;
+  if( posix_memalign( &mem, VERTEX_STREAM_ALIGN, sizeof(T)*(count?count:1) ) ) {
+    printf( "ERROR: allocStream could not allocate %d elements\n", count ) ;
+    return 0 ;
+  }
+  return (T*)mem ;
+}
+
+struct VertexStreamsPC
+{
+  Vector3f *pos ;
+  Vector4f *color ;
+  int count, capacity ;
+
+private:
+  // Copying streams forbidden, it would be the full copy we're trying to avoid.
+  // (and the implicit ones would share pos/color, and free them twice)
+  VertexStreamsPC( const VertexStreamsPC& o ) {
+    puts( "ERROR: Copying VertexStreamsPC should not be done!" ) ;
+  }
+  VertexStreamsPC& operator=( const VertexStreamsPC& o ) {
+    puts( "ERROR: Copying VertexStreamsPC should not be done!" ) ;
+    return *this ;
+  }
+
+public:
+  VertexStreamsPC() : pos(0), color(0), count(0), capacity(0) { }
+  VertexStreamsPC( int n ) : pos(0), color(0), count(0), capacity(0) {
+    resize( n ) ;
+  }
+  ~VertexStreamsPC() {
+    free( pos ) ;
+    free( color ) ;
+  }
+
+  inline int size() const { return count ; }
+
+  // Keeps what fits.  New vertices are uninitialized.  false if it couldn't
+  // allocate: the streams are left as they were.
+  bool reserve( int n )
+  {
+    if( n <= capacity )  return true ;
+    Vector3f *newPos = allocStream<Vector3f>( n ) ;
+    Vector4f *newColor = allocStream<Vector4f>( n ) ;
+    if( !newPos || !newColor ) {
+      free( newPos ) ;
+      free( newColor ) ;
+      return false ;
+    }
+    if( count ) {
+      memcpy( newPos, pos, sizeof(Vector3f)*count ) ;
+      memcpy( newColor, color, sizeof(Vector4f)*count ) ;
+    }
+    free( pos ) ;
+    free( color ) ;
+    pos = newPos, color = newColor, capacity = n ;
+    return true ;
+  }
+
+  // The size stays put if the memory isn't there.
+  void resize( int n ) {
+    if( reserve( n ) )
+      count = n ;
+  }
+
+  inline void push_back( const VertexPC& v ) {
+    if( count == capacity && !reserve( capacity ? 2*capacity : 64 ) )
+      return ;
+    pos[ count ] = v.pos ;
+    color[ count ] = v.color ;
+    count++ ;
+  }
+
+  inline VertexPC get( int i ) const {
+    return VertexPC( pos[i], color[i] ) ;
+  }
+  inline void set( int i, const VertexPC& v ) {
+    pos[i] = v.pos ;
+    color[i] = v.color ;
+  }
+
+  // Scatter an AoS buffer into the streams (once, at load time).
+  void fromInterleaved( const vector<VertexPC>& verts )
+  {
+    resize( (int)verts.size() ) ;
+    for( int i = 0 ; i < count ; i++ ) {
+      pos[i] = verts[i].pos ;
+      color[i] = verts[i].color ;
+    }
+  }
+
+  // Gather [start,end) back into AoS.  Only for consumers that really
+  // can't take strided pointers, drawPC doesn't need this.
+  void toInterleaved( vector<VertexPC>& verts, int start, int end ) const
+  {
+    if( (int)verts.size() < end )  verts.resize( end ) ;
+    for( int i = start ; i < end ; i++ ) {
+      verts[i].pos = pos[i] ;
+      verts[i].color = color[i] ;
+    }
+  }
+
+  inline VertexAttribView posView() const { return VertexAttribView( pos, sizeof(Vector3f) ) ; }
+  inline VertexAttribView colorView() const { return VertexAttribView( color, sizeof(Vector4f) ) ; }
+} ;
+
+// Same attribute views, but over the existing AoS layout.
+inline VertexAttribView posView( const vector<VertexPC>& verts ) {
+  return VertexAttribView( &verts[0].pos, sizeof(VertexPC) ) ;
+}
+inline VertexAttribView colorView( const vector<VertexPC>& verts ) {
+  return VertexAttribView( &verts[0].color, sizeof(VertexPC) ) ;
+}
+
+// Times the vertex transform pass over a vector<VertexPC> vs. the pos stream
+// of a VertexStreamsPC, and prints the effective memory bandwidth of each.
+void benchmarkVertexLayouts( int numVerts, int reps ) ;
+
+#endif
@@ -0,0 +1,45 @@
+#import "VertexStreams.h"
+
+#include <chrono>
+
+static double secondsSince( const chrono::steady_clock::time_point& start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+void benchmarkVertexLayouts( int numVerts, int reps )
+{
+  Matrix3f m = Matrix3f::rotation( Vector3f( 0.f, 0.f, 1.f ), 0.01f ) ;
+
+  vector<VertexPC> aos( numVerts ) ;
+  for( int i = 0 ; i < numVerts ; i++ )
+    aos[i] = VertexPC( Vector3f::random(-1.f,1.f), Vector4f::random() ) ;
+
+  VertexStreamsPC soa ;
+  soa.fromInterleaved( aos ) ;
+
+  // AoS: every cache line pulled in is 28 bytes/vertex, read AND written back.
+  chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+  for( int r = 0 ; r < reps ; r++ )
+    for( int i = 0 ; i < numVerts ; i++ )
+      aos[i].pos = m * aos[i].pos ;
+  double aosTime = secondsSince( start ) ;
+
+  // SoA: only the 12 byte pos stream moves.
+  start = chrono::steady_clock::now() ;
+  for( int r = 0 ; r < reps ; r++ )
+    for( int i = 0 ; i < numVerts ; i++ )
+      soa.pos[i] = m * soa.pos[i] ;
+  double soaTime = secondsSince( start ) ;
+
+  // Don't let the optimizer throw the loops away
+  float check = aos[ numVerts/2 ].pos.x + soa.pos[ numVerts/2 ].x ;
+
+  double aosBytes = 2.0 * sizeof(VertexPC) * numVerts * reps ;
+  double soaBytes = 2.0 * sizeof(Vector3f) * numVerts * reps ;
+  printf( "benchmarkVertexLayouts: %d verts x %d reps (check %f)\n", numVerts, reps, check ) ;
+  printf( "  vector<VertexPC>  %8.3f ms  %6.2f GB/s  (%d bytes/vertex)\n",
+    aosTime*1e3, aosBytes/aosTime/1e9, (int)sizeof(VertexPC) ) ;
+  printf( "  VertexStreamsPC   %8.3f ms  %6.2f GB/s  (%d bytes/vertex)  %.2fx\n",
+    soaTime*1e3, soaBytes/soaTime/1e9, (int)sizeof(Vector3f), aosTime/soaTime ) ;
+}